@@ -4,223 +4,3119 @@
 
 #include <iostream>
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <stdexcept>
 #include <string>
-
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if __cplusplus > 201703L && defined(__has_include)
+#if __has_include(<compare>)
+#include <compare>
+#endif
+#endif
+
 //Definition of the value that will
 //be held in the in the Map
 template<class Key_T, class Mapped_T>
 using ValueType = std::pair <const Key_T, Mapped_T>;
 
+//***** KEY COMPARISON *******//
+
+//overload ranks for KeyCompare, a higher rank is tried first
+template <int N>
+struct CompareRank : CompareRank<N - 1>
+{
+};
+template <>
+struct CompareRank<0>
+{
+};
+
+//Three-way comparison of two keys: negative, zero or positive. A descent
+//picks its child from a single call instead of two operator< calls.
+//Scalars compare directly, then a compare() member such as the one of
+//std::string is used, then <=>, and operator< twice as the last resort.
+//Specialize it to supply a faster comparison, it has to agree with <.
+template <class Key_T>
+struct KeyCompare
+{
+    static int compare(const Key_T & a, const Key_T & b)
+    {
+        return compare(a, b, CompareRank<3>());
+    }
+
+    private:
+        template <class K>
+        static typename std::enable_if<std::is_scalar<K>::value, int>::type
+        compare(const K & a, const K & b, CompareRank<3>)
+        {
+            return (b < a) - (a < b);
+        }
+
+        template <class K>
+        static auto compare(const K & a, const K & b, CompareRank<2>)
+            -> decltype(int(a.compare(b)))
+        {
+            int result = a.compare(b);
+            return (result > 0) - (result < 0);
+        }
+
+#if defined(__cpp_impl_three_way_comparison) && defined(__cpp_lib_three_way_comparison)
+        template <class K>
+        static auto compare(const K & a, const K & b, CompareRank<1>)
+            -> decltype((a <=> b) < 0, int())
+        {
+            auto result = a <=> b;
+            return (result > 0) - (result < 0);
+        }
+#endif
+
+        template <class K>
+        static int compare(const K & a, const K & b, CompareRank<0>)
+        {
+            return a < b ? -1 : (b < a ? 1 : 0);
+        }
+};
+
+//Integer prefix of a key that orders like the key: when two prefixes
+//differ they decide the comparison, when they are equal the keys have to
+//be compared. Nodes cache it when the policy asks for key_prefix, so most
+//levels of a descent never touch the key itself. Specialize it with
+//enabled = true for other key types.
+template <class Key_T>
+struct KeyPrefix
+{
+    static constexpr bool enabled = false;
+
+    static std::uint64_t prefix(const Key_T &)
+    {
+        return 0;
+    }
+};
+
+//the first 8 bytes, big-endian and zero padded, so unsigned integer
+//order is the byte order std::string compares by
+template <>
+struct KeyPrefix<std::string>
+{
+    static constexpr bool enabled = true;
+
+    static std::uint64_t prefix(const std::string & key)
+    {
+        std::size_t length = std::min<std::size_t>(key.size(), 8);
+        std::uint64_t result = 0;
+        for (std::size_t i = 0; i < length; ++i)
+        {
+            result |= std::uint64_t(static_cast<unsigned char>(key[i])) << (56 - 8 * i);
+        }
+        return result;
+    }
+};
+
+//***** NODE STORAGE POLICIES *******//
+
+//Every node is allocated on its own and nodes link to each other
+//with pointers. clear() and the destructor hand the nodes back to the
+//allocator one by one, there is no bulk free.
+struct PointerStorage
+{
+    template <class Base>
+    using link = Base *;
+
+    template <class Node_T, class Alloc>
+    class store;
+};
+
+//Nodes live in one growable array and link to each other with 32-bit
+//indices. Slot 0 holds the header, so index 0 doubles as the null link.
+//Nodes are relocatable, a map of trivially copyable keys and values is
+//copied with a single memcpy, and about four billion entries fit.
+//clear() and the destructor drop every node in one sweep over the array
+//and skip the destructors of trivially destructible keys and values.
+struct IndexStorage
+{
+    template <class Base>
+    using link = std::uint32_t;
+
+    template <class Node_T, class Alloc>
+    class store;
+};
+
+//***** BALANCING POLICIES *******//
+
+template <class Context> struct AvlAlgorithms;
+template <class Context> struct RedBlackAlgorithms;
+template <class Context> struct WavlAlgorithms;
+template <class Context> struct TreapAlgorithms;
+
+//How a tree keeps its height logarithmic, each names the algorithms that
+//rebalance after a change. All of them keep their data in the height and
+//balanceFactor of NodeBase, so nodes are the same size under every one.
+
+//sibling heights differ by one at most, the shallowest of them and so the
+//fewest comparisons per lookup. An erase can rotate at every level.
+struct AvlBalance
+{
+    template <class Context>
+    using algorithms = AvlAlgorithms<Context>;
+};
+
+//up to twice as deep as AVL, at most three rotations per erase
+struct RedBlackBalance
+{
+    template <class Context>
+    using algorithms = RedBlackAlgorithms<Context>;
+};
+
+//rank balanced: as deep as AVL while only inserting, as deep as
+//red-black at worst, and at most two rotations per erase
+struct WavlBalance
+{
+    template <class Context>
+    using algorithms = WavlAlgorithms<Context>;
+};
+
+//randomized, about 40% deeper than AVL on average and nothing to update
+//on the way back up
+struct TreapBalance
+{
+    template <class Context>
+    using algorithms = TreapAlgorithms<Context>;
+};
+
+//***** INSTRUMENTATION POLICIES *******//
+
+//Counters a tree can keep about the work it does
+struct TreeStats
+{
+    //key comparisons made while descending
+    std::uint64_t comparisons;
+
+    //nodes looked at while descending
+    std::uint64_t nodesVisited;
+
+    //rebalancing rotations, a double rotation counts once
+    std::uint64_t singleRotations;
+    std::uint64_t doubleRotations;
+
+    //rebalancing passes after an insert or remove and the nodes they walked
+    std::uint64_t retraces;
+    std::uint64_t retraceSteps;
+
+    //nodes created and destroyed
+    std::uint64_t allocations;
+    std::uint64_t frees;
+};
+
+//No counting at all, every hook is empty and the tree keeps no state
+struct NoStats
+{
+    void compare() const {}
+    void visit() const {}
+    void single_rotation() const {}
+    void double_rotation() const {}
+    void retrace() const {}
+    void retrace_step() const {}
+    void allocation() const {}
+    void free() const {}
+    void free(std::size_t) const {}
+
+    TreeStats snapshot() const
+    {
+        return TreeStats();
+    }
+    void reset() const {}
+};
+
+//Counts everything in TreeStats, const lookups count too
+class CountingStats
+{
+    public:
+        CountingStats()
+            : counters()
+        {
+            //Empty
+        }
+
+        void compare() const { ++counters.comparisons; }
+        void visit() const { ++counters.nodesVisited; }
+        void single_rotation() const { ++counters.singleRotations; }
+        void double_rotation() const { ++counters.doubleRotations; }
+        void retrace() const { ++counters.retraces; }
+        void retrace_step() const { ++counters.retraceSteps; }
+        void allocation() const { ++counters.allocations; }
+        void free() const { ++counters.frees; }
+        void free(std::size_t count) const { counters.frees += count; }
+
+        TreeStats snapshot() const
+        {
+            return counters;
+        }
+        void reset() const
+        {
+            counters = TreeStats();
+        }
+
+    private:
+        mutable TreeStats counters;
+};
+
+//Default configuration of a Tree, derive from it and override
+//members to change one aspect of the tree
+struct DefaultTreePolicy
+{
+    //how nodes are stored and linked to each other
+    using storage = PointerStorage;
+
+    //how the tree is kept balanced
+    using balance = AvlBalance;
+
+    //keep the listPrevious/listNext thread, without it iteration
+    //follows parent links and each node is two links smaller
+    static constexpr bool threaded = true;
+
+    //instrumentation, CountingStats turns the counters on
+    using stats = NoStats;
+
+    //up to this many entries live in a sorted array inside the tree
+    //before the first node is allocated, 0 turns the array off.
+    //Needs PointerStorage, links have to be able to point into the tree.
+    //Entries keep their place when the array fills up and joins the
+    //tree. Swap, move and compact() move the ones still in the array,
+    //extract() hands out a copy of one.
+    static constexpr std::size_t inline_capacity = 0;
+
+    //cache KeyPrefix of the key in every node, for key types that have
+    //one. Costs 8 bytes per node.
+    static constexpr bool key_prefix = false;
+
+    //erase only marks a node dead, it stays linked and iteration and
+    //lookups skip it. Once dead nodes are more than this share of the
+    //tree it is rebuilt without them in O(n). 0 unlinks right away.
+    static constexpr double lazy_erase_ratio = 0;
+
+    //remember nodes found by searches in this many sets of two, picked
+    //by std::hash of the key, so a repeated search skips the descent.
+    //A power of two, 0 turns the cache off. Costs 32 bytes per set.
+    //Only searches through a non-const tree fill it and count hits and
+    //misses. A const search reads it and writes nothing, so const lookups
+    //from several threads at once are safe.
+    static constexpr std::size_t lookup_cache_sets = 0;
+
+    //also keep an open addressing table from std::hash of the key to its
+    //node, so find and at skip the descent. Inserts still descend to
+    //link the node. A slot is 16 bytes and past its first 16 slots the
+    //table is between 1/4 and 3/4 full, 21 to 64 bytes per entry.
+    static constexpr bool hash_index = false;
+};
+
 //***** DECLARATION OF NODE *******//
-template <class Key_T, class Mapped_T>
-class Node
+
+//Links to be used for iteration, only threaded trees have them
+template <class LinkPtr, bool Threaded>
+class NodeThread
 {
     public:
-        //Parent of the current node
-        Node * parent;
+        LinkPtr listPrevious;
+        LinkPtr listNext;
 
-        //ValueType
-        ValueType<Key_T, Mapped_T> pair;
+        NodeThread()
+            : listPrevious(0), listNext(0)
+        {
+            //Empty
+        }
+
+        //replace every link with f(link)
+        template <class F>
+        void relink_thread(F f)
+        {
+            listPrevious = f(listPrevious);
+            listNext = f(listNext);
+        }
+};
+
+template <class LinkPtr>
+class NodeThread<LinkPtr, false>
+{
+    public:
+        template <class F>
+        void relink_thread(F)
+        {
+            //Empty
+        }
+};
 
-        //Key and the Data for dictionary
-        Mapped_T & data;
-        const Key_T & key;
+//Links of a node, the tree header is a NodeBase with no payload
+template <class Policy>
+class NodeBase
+    : public NodeThread<typename Policy::storage::template link<NodeBase<Policy>>, Policy::threaded>
+{
+    public:
+        //how a node refers to another node, a pointer or an index
+        using LinkPtr = typename Policy::storage::template link<NodeBase>;
 
-        //Left and right children
-        Node * left;
-        Node * right;
+        //Parent of the current node
+        LinkPtr parent;
 
-        //Pointer to be used for iteration
-        Node * listPrevious;
-        Node * listNext;
+        //Left and right children
+        LinkPtr left;
+        LinkPtr right;
 
+        //what the balancing policy keeps per node, the AVL height and
+        //balance factor, the red-black colour, the WAVL rank or the
+        //treap priority
         unsigned char height;
+
+        //erased but still linked, see DefaultTreePolicy::lazy_erase_ratio.
+        //It sits in padding, the node does not grow.
+        bool dead;
         short int balanceFactor;
-
+
         //empty constructor
-        Node()
-            :height(0), left(0), right(0), parent(0), key(pair.first), data(pair.second)
-        {
-            //Empty
+        NodeBase()
+            : parent(0), left(0), right(0), height(0), dead(false), balanceFactor(0)
+        {
+            //Empty
         }
-
+
+        //replace every link with f(link), used when nodes move
+        template <class F>
+        void relink(F f)
+        {
+            parent = f(parent);
+            left = f(left);
+            right = f(right);
+            this->relink_thread(f);
+        }
+};
+
+//KeyPrefix of the node's key, only there when the policy caches it
+template <class Key_T, class Policy,
+    bool Cached = Policy::key_prefix && KeyPrefix<Key_T>::enabled>
+class NodeKeyPrefix : public NodeBase<Policy>
+{
+    public:
+        std::uint64_t keyPrefix;
+
+        explicit NodeKeyPrefix(const Key_T & key)
+            : keyPrefix(KeyPrefix<Key_T>::prefix(key))
+        {
+            //Empty
+        }
+};
+
+template <class Key_T, class Policy>
+class NodeKeyPrefix<Key_T, Policy, false> : public NodeBase<Policy>
+{
+    public:
+        explicit NodeKeyPrefix(const Key_T &)
+        {
+            //Empty
+        }
+};
+
+template <class Key_T, class Mapped_T, class Policy>
+class Node : public NodeKeyPrefix<Key_T, Policy>
+{
+    public:
+        using Base = NodeBase<Policy>;
+        using Key = Key_T;
+        using Mapped = Mapped_T;
+
+        //ValueType, holds the key and the data for dictionary
+        ValueType<Key_T, Mapped_T> pair;
+
         //constructor with key and value template type
-        Node(Key_T key, Mapped_T item)
-            : parent(0), pair(key, item), data(pair.second), key(pair.first),
-            left(0), right(0), listPrevious(0), listNext(0), height(0), balanceFactor(0)
+        Node(const Key_T & key, const Mapped_T & item)
+            : NodeKeyPrefix<Key_T, Policy>(key), pair(key, item)
         {
 
         }
 
         //constructor with pair data type
-        Node(ValueType <Key_T, Mapped_T> x)
-            :parent(0), pair(x), data(pair.second), key(pair.first),
-            left(0), right(0), listPrevious(0), listNext(0), height(0), balanceFactor(0)
+        Node(const ValueType <Key_T, Mapped_T> & x)
+            : NodeKeyPrefix<Key_T, Policy>(x.first), pair(x)
         {
 
         }
 };
 
 //Pointer to the node
-template<class Key_T, class Mapped_T>
-using NodePtr = Node <Key_T, Mapped_T> *;
+template<class Key_T, class Mapped_T, class Policy = DefaultTreePolicy>
+using NodePtr = Node <Key_T, Mapped_T, Policy> *;
 
 //****** END OF NODE DECLARATION ******//
 
-//forward declaration of the Tree
-template<class Key_T, class Mapped_T>
-class Tree;
-
-//Tree pointer
-template<class Key_T, class Mapped_T>
-using TreePtr = Tree<Key_T, Mapped_T> *;
-
-//****** DECLARATION OF THE TREE BEGINS HERE *****//
-template<class Key_T, class Mapped_T>
-class Tree
-{
-    public:
-
-        //forward declaration for the iterators
-        struct Iterator;
-        struct ConstIterator;
-        struct ReverseIterator;
-
-        //*** Beginning of Iterator definition ***//
-        struct Iterator
-        {
-            NodePtr<Key_T, Mapped_T> inode;
-            TreePtr<Key_T, Mapped_T> ptr;    //This is newly added.
-
-            //no argument constructor
-            Iterator()
-            {
-                inode = NULL;
-            }
-
-            //Iterator: that takes a node pointer and tree pointer
-            Iterator(NodePtr<Key_T, Mapped_T> node, const TreePtr<Key_T, Mapped_T> tree)
-                : ptr(tree)
-            {
-                inode = NULL;
-                if (node != NULL)
-                {
-                    inode = node;
-                }
-            }
-
-            //copy constructor for the iterator
-            Iterator(const Iterator & copy)
-            {
-                inode = copy.inode;
-                ptr = copy.ptr;
-            }
-
-            //overloaded operator equality
-            bool operator==(const Iterator & itTwo)
-            {
-                return inode == itTwo.inode;
-            }
-            bool operator==(const ConstIterator & itTwo)
-            {
-                return inode == itTwo.inode;
-            }
-
-            //overloaded operator inequality
-            bool operator!=(const Iterator & itTwo)
-            {
-                return !(inode == itTwo.inode);
-            }
-            bool operator!=(const ConstIterator & itTwo)
-            {
-                return !(inode == itTwo.inode);
-            }
-
-            //overloaded operator increment
-            Iterator& operator++()
-            {
-                increment();
-                return *this;
-            }
-            Iterator operator++(int)
-            {
-                Iterator temp(*this);
-                increment();
-                return temp;
-            }
-
-            //overloaded operator decrement
-            Iterator& operator--()
-            {
-                decrement();
-                return *this;
-            }
-            Iterator operator--(int)
-            {
-                Iterator temp(*this);
-                decrement();
-                return temp;
-            }
-
-            //overloaded operator: pointer de-referencing
-            ValueType<const Key_T, Mapped_T> & operator *() const
-            {
-                return inode->pair;
-            }
-            ValueType<const Key_T, Mapped_T> * operator->() const
-            {
-                return &(inode->pair);
-            }
-
-            void decrement();
-            void increment();
-        };
-
-        //*** Beginning of CONST Iterator ***//
-        struct ConstIterator
-        {
-            NodePtr <Key_T, Mapped_T> inode;
-            const Tree<Key_T, Mapped_T> *ptr;
-
-            //empty constructor
-            ConstIterator()
-            {
-                inode = NULL;
-            }
-
-            //constructor that takes tree pointer and a node pointer
-            ConstIterator(const NodePtr<Key_T, Mapped_T> & node, const Tree<Key_T, Mapped_T> *tree)
-                : ptr(tree)
-            {
-                inode = NULL;
-                if (node != NULL)
-                    inode = node;
-            }
-
-            ConstIterator(const ConstIterator & iter)
-            {
-                inode = iter.inode;
-                ptr = iter.ptr;
-            }
-
-            //operator overloading equality
-            bool operator==(const Iterator & itTwo)
-            {
-                return inode == itTwo.inode;
-            }
-            bool operator==(const ConstIterator & itTwo)
-            {
-                return inode == itTwo.inode;
-            }
-
+//****** POINTER STORAGE ******//
+template <class Node_T, class Alloc>
+class PointerStorage::store
+    : private std::allocator_traits<Alloc>::template rebind_alloc<Node_T>
+{
+    public:
+        using Base = typename Node_T::Base;
+        using LinkPtr = Base *;
+        using NodeAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Node_T>;
+
+        explicit store(const Alloc & alloc = Alloc())
+            : NodeAlloc(alloc)
+        {
+            //Empty
+        }
+
+        //the header belongs to one tree, a copy starts with its own
+        store(const store & original)
+            : NodeAlloc(Traits::select_on_container_copy_construction(original.allocator()))
+        {
+            //Empty
+        }
+
+        store & operator=(const store &) = delete;
+
+        NodeAlloc get_allocator() const
+        {
+            return allocator();
+        }
+
+        bool same_allocator(const store & other) const
+        {
+            return allocator() == other.allocator();
+        }
+
+        //take over the allocator of another store, both have no nodes
+        void copy_allocator(const store & other, std::true_type)
+        {
+            allocator() = other.allocator();
+        }
+        void copy_allocator(const store &, std::false_type)
+        {
+            //Empty
+        }
+
+        //exchange headers, the tree points the end nodes at their new
+        //header afterwards
+        template <class Propagate>
+        void swap(store & other, Propagate propagate)
+        {
+            std::swap(header, other.header);
+            swap_allocator(other, propagate);
+        }
+
+        //the header is the end() position and closes the iteration list
+        LinkPtr header_link() const
+        {
+            return const_cast<LinkPtr>(&header);
+        }
+
+        Base & links(LinkPtr node) const
+        {
+            return *node;
+        }
+
+        Node_T & node(LinkPtr node) const
+        {
+            return *static_cast<Node_T *>(node);
+        }
+
+        //link that refers to a node
+        LinkPtr link_of(Node_T & node) const
+        {
+            return &node;
+        }
+
+        //allocate a node and construct its payload
+        template <class... Args>
+        LinkPtr create(Args &&... args)
+        {
+            typename Traits::pointer memory = Traits::allocate(allocator(), 1);
+            Node_T * node = std::addressof(*memory);
+            try
+            {
+                Traits::construct(allocator(), node, std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                Traits::deallocate(allocator(), memory, 1);
+                throw;
+            }
+            return node;
+        }
+
+        void destroy(LinkPtr node)
+        {
+            Node_T * payload = static_cast<Node_T *>(node);
+            Traits::destroy(allocator(), payload);
+            Traits::deallocate(allocator(), std::pointer_traits<typename Traits::pointer>::pointer_to(*payload), 1);
+        }
+
+        //bytes allocated for the given number of live nodes, the header
+        //lives inside the store
+        std::size_t allocated_bytes(std::size_t live) const
+        {
+            return live * sizeof(Node_T);
+        }
+
+        //move one node to a freshly allocated one, its links come along
+        LinkPtr relocate(LinkPtr node)
+        {
+            LinkPtr moved = create(std::move_if_noexcept(this->node(node)));
+            destroy(node);
+            return moved;
+        }
+
+        //move every node, in the given order, into freshly allocated nodes
+        void relayout(const std::vector<LinkPtr> & order, LinkPtr & root);
+
+        //every node has been destroyed, nothing is left to release
+        void reset()
+        {
+            //Empty
+        }
+
+        //nodes are allocated one by one, the tree destroys each of them.
+        //Each one needs its own deallocate, so there is no bulk path.
+        bool destroy_all()
+        {
+            return false;
+        }
+
+        //nodes cannot be copied without walking the tree
+        bool clone(const store &)
+        {
+            return false;
+        }
+
+    private:
+        using Traits = std::allocator_traits<NodeAlloc>;
+
+        Base header;
+
+        NodeAlloc & allocator()
+        {
+            return *this;
+        }
+        const NodeAlloc & allocator() const
+        {
+            return *this;
+        }
+
+        void swap_allocator(store & other, std::true_type)
+        {
+            using std::swap;
+            swap(allocator(), other.allocator());
+        }
+        void swap_allocator(store &, std::false_type)
+        {
+            //Empty
+        }
+};
+
+template <class Node_T, class Alloc>
+void PointerStorage::store<Node_T, Alloc>::relayout(const std::vector<LinkPtr> & order, LinkPtr & root)
+{
+    std::vector<LinkPtr> moved(order.size());
+    std::size_t i = 0;
+    try
+    {
+        for (; i < order.size(); ++i)
+        {
+            moved[i] = create(std::move_if_noexcept(node(order[i])));
+        }
+    }
+    catch (...)
+    {
+        while (i > 0)
+        {
+            destroy(moved[--i]);
+        }
+        throw;
+    }
+
+    //the new nodes hold copies of the old links, so the old nodes can
+    //forward to their new place through their parent link
+    for (i = 0; i < order.size(); ++i)
+    {
+        order[i]->parent = moved[i];
+    }
+    LinkPtr head = header_link();
+    auto forward = [head](LinkPtr x) { return (x == 0 || x == head) ? x : x->parent; };
+    for (i = 0; i < order.size(); ++i)
+    {
+        moved[i]->relink(forward);
+    }
+    header.relink(forward);
+    root = forward(root);
+
+    for (i = 0; i < order.size(); ++i)
+    {
+        destroy(order[i]);
+    }
+}
+
+//****** INDEX STORAGE ******//
+template <class Node_T, class Alloc>
+class IndexStorage::store
+    : private std::allocator_traits<Alloc>::template rebind_alloc<
+        typename std::aligned_storage<sizeof(Node_T), alignof(Node_T)>::type>
+{
+    typedef typename std::aligned_storage<sizeof(Node_T), alignof(Node_T)>::type Slot;
+
+    public:
+        using Base = typename Node_T::Base;
+        using LinkPtr = std::uint32_t;
+        using SlotAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Slot>;
+
+        explicit store(const Alloc & alloc = Alloc())
+            : SlotAlloc(alloc), slots(0), capacity(0), used(0), freeList(0)
+        {
+            start();
+        }
+
+        //the copy is filled by clone() or by the tree
+        store(const store & original)
+            : SlotAlloc(Traits::select_on_container_copy_construction(original.allocator())),
+              slots(0), capacity(0), used(0), freeList(0)
+        {
+            start();
+        }
+
+        store & operator=(const store &) = delete;
+
+        //the tree destroys every node before the storage goes away
+        ~store()
+        {
+            deallocate(slots, capacity);
+        }
+
+        SlotAlloc get_allocator() const
+        {
+            return allocator();
+        }
+
+        bool same_allocator(const store & other) const
+        {
+            return allocator() == other.allocator();
+        }
+
+        //take over the allocator of another store, both have no nodes.
+        //The header slot moves to memory of the new allocator.
+        void copy_allocator(const store & other, std::true_type)
+        {
+            if (!same_allocator(other))
+            {
+                deallocate(slots, capacity);
+                slots = 0;
+                capacity = 0;
+                allocator() = other.allocator();
+                start();
+            }
+        }
+        void copy_allocator(const store &, std::false_type)
+        {
+            //Empty
+        }
+
+        //exchange the arrays, links are indices so nothing else changes
+        template <class Propagate>
+        void swap(store & other, Propagate propagate)
+        {
+            std::swap(slots, other.slots);
+            std::swap(capacity, other.capacity);
+            std::swap(used, other.used);
+            std::swap(freeList, other.freeList);
+            swap_allocator(other, propagate);
+        }
+
+        LinkPtr header_link() const
+        {
+            return 0;
+        }
+
+        Base & links(LinkPtr node) const
+        {
+            return *reinterpret_cast<Base *>(slots + node);
+        }
+
+        Node_T & node(LinkPtr node) const
+        {
+            return *reinterpret_cast<Node_T *>(slots + node);
+        }
+
+        //link that refers to a node
+        LinkPtr link_of(Node_T & node) const
+        {
+            return static_cast<LinkPtr>(reinterpret_cast<Slot *>(&node) - slots);
+        }
+
+        //take a free slot, or grow the array, and construct the payload
+        template <class... Args>
+        LinkPtr create(Args &&... args)
+        {
+            if (freeList != 0)
+            {
+                LinkPtr node = freeList;
+                LinkPtr next = links(node).parent;
+                new (slots + node) Node_T(std::forward<Args>(args)...);
+                freeList = next;
+                return node;
+            }
+            return append(std::forward<Args>(args)...);
+        }
+
+        //destroy the payload and put the slot on the free list
+        void destroy(LinkPtr node)
+        {
+            reinterpret_cast<Node_T *>(slots + node)->~Node_T();
+            new (slots + node) Base();
+            links(node).height = freeMark;
+            links(node).parent = freeList;
+            freeList = node;
+        }
+
+        //move one node to the end of the array, so nodes relocated one
+        //after the other end up next to each other
+        LinkPtr relocate(LinkPtr node)
+        {
+            LinkPtr moved = append(std::move_if_noexcept(this->node(node)));
+            destroy(node);
+            return moved;
+        }
+
+        //move every node, in the given order, into a new array that
+        //holds nothing else
+        void relayout(const std::vector<LinkPtr> & order, LinkPtr & root);
+
+        //bytes of the whole array, free and spare slots included
+        std::size_t allocated_bytes(std::size_t) const
+        {
+            return capacity * sizeof(Slot);
+        }
+
+        //every node has been destroyed, hand all slots back
+        void reset()
+        {
+            used = 1;
+            freeList = 0;
+        }
+
+        //destroy every node in one sweep over the array, without calling
+        //destructors the payload does not need. The array is kept.
+        bool destroy_all()
+        {
+            if (!std::is_trivially_destructible<Node_T>::value)
+            {
+                for (std::size_t i = 1; i < used; ++i)
+                {
+                    if (reinterpret_cast<Base *>(slots + i)->height != freeMark)
+                    {
+                        reinterpret_cast<Node_T *>(slots + i)->~Node_T();
+                    }
+                }
+            }
+            reset();
+            return true;
+        }
+
+        //copy the whole array in one go when the payload allows it
+        bool clone(const store & original);
+
+    private:
+        using Traits = std::allocator_traits<SlotAlloc>;
+
+        //raw array, slot 0 is the header
+        Slot * slots;
+        std::size_t capacity;
+
+        //slots handed out so far and the head of the list of freed ones
+        std::size_t used;
+        LinkPtr freeList;
+
+        static constexpr bool trivial = std::is_trivially_copyable<typename Node_T::Key>::value
+            && std::is_trivially_copyable<typename Node_T::Mapped>::value;
+
+        //height of a free slot, no tree gets this tall
+        static constexpr unsigned char freeMark = std::numeric_limits<unsigned char>::max();
+
+        //construct a node past the last used slot, growing the array
+        template <class... Args>
+        LinkPtr append(Args &&... args);
+
+        SlotAlloc & allocator()
+        {
+            return *this;
+        }
+        const SlotAlloc & allocator() const
+        {
+            return *this;
+        }
+
+        void swap_allocator(store & other, std::true_type)
+        {
+            using std::swap;
+            swap(allocator(), other.allocator());
+        }
+        void swap_allocator(store &, std::false_type)
+        {
+            //Empty
+        }
+
+        //raw slots from the allocator
+        Slot * allocate(std::size_t slotCount)
+        {
+            return std::addressof(*Traits::allocate(allocator(), slotCount));
+        }
+        void deallocate(Slot * array, std::size_t slotCount)
+        {
+            if (array != 0)
+            {
+                Traits::deallocate(allocator(), std::pointer_traits<typename Traits::pointer>::pointer_to(*array), slotCount);
+            }
+        }
+
+        //a single slot holding an empty header
+        void start()
+        {
+            slots = allocate(1);
+            capacity = 1;
+            new (slots) Base();
+            used = 1;
+        }
+
+        //move the nodes of the old array into a new one
+        void relocate(Slot * to, Slot * from, std::size_t count);
+};
+
+template <class Node_T, class Alloc>
+template <class... Args>
+typename IndexStorage::store<Node_T, Alloc>::LinkPtr IndexStorage::store<Node_T, Alloc>::append(Args &&... args)
+{
+    if (used < capacity)
+    {
+        new (slots + used) Node_T(std::forward<Args>(args)...);
+        return static_cast<LinkPtr>(used++);
+    }
+
+    //the array is full, every 32-bit index is in use
+    const std::size_t maxSlots = std::numeric_limits<LinkPtr>::max();
+    if (capacity >= maxSlots)
+    {
+        throw std::length_error("map holds the maximum number of entries");
+    }
+    std::size_t newCapacity = std::min(capacity * 2, maxSlots);
+    Slot * newSlots = allocate(newCapacity);
+
+    //construct the new node first, its arguments may live in the old array
+    try
+    {
+        new (newSlots + used) Node_T(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        deallocate(newSlots, newCapacity);
+        throw;
+    }
+    try
+    {
+        relocate(newSlots, slots, used);
+    }
+    catch (...)
+    {
+        reinterpret_cast<Node_T *>(newSlots + used)->~Node_T();
+        deallocate(newSlots, newCapacity);
+        throw;
+    }
+
+    deallocate(slots, capacity);
+    slots = newSlots;
+    capacity = newCapacity;
+    return static_cast<LinkPtr>(used++);
+}
+
+template <class Node_T, class Alloc>
+void IndexStorage::store<Node_T, Alloc>::relocate(Slot * to, Slot * from, std::size_t count)
+{
+    if (trivial)
+    {
+        std::memcpy(static_cast<void *>(to), static_cast<const void *>(from), count * sizeof(Slot));
+        return;
+    }
+
+    //the header and free slots only hold links
+    new (to) Base(*reinterpret_cast<Base *>(from));
+    std::size_t i = 1;
+    try
+    {
+        for (; i < count; ++i)
+        {
+            if (reinterpret_cast<Base *>(from + i)->height == freeMark)
+            {
+                new (to + i) Base(*reinterpret_cast<Base *>(from + i));
+            }
+            else
+            {
+                new (to + i) Node_T(std::move_if_noexcept(*reinterpret_cast<Node_T *>(from + i)));
+            }
+        }
+    }
+    catch (...)
+    {
+        while (--i > 0)
+        {
+            if (reinterpret_cast<Base *>(to + i)->height != freeMark)
+            {
+                reinterpret_cast<Node_T *>(to + i)->~Node_T();
+            }
+        }
+        throw;
+    }
+    for (i = 1; i < count; ++i)
+    {
+        if (reinterpret_cast<Base *>(from + i)->height != freeMark)
+        {
+            reinterpret_cast<Node_T *>(from + i)->~Node_T();
+        }
+    }
+}
+
+template <class Node_T, class Alloc>
+void IndexStorage::store<Node_T, Alloc>::relayout(const std::vector<LinkPtr> & order, LinkPtr & root)
+{
+    std::size_t count = order.size() + 1;
+    Slot * fresh = allocate(count);
+
+    //where each old index went, the header and null link stay at 0
+    std::vector<LinkPtr> remap(used, 0);
+
+    new (fresh) Base(links(0));
+    std::size_t i = 0;
+    try
+    {
+        for (; i < order.size(); ++i)
+        {
+            new (fresh + i + 1) Node_T(std::move_if_noexcept(node(order[i])));
+            remap[order[i]] = static_cast<LinkPtr>(i + 1);
+        }
+    }
+    catch (...)
+    {
+        for (; i > 0; --i)
+        {
+            reinterpret_cast<Node_T *>(fresh + i)->~Node_T();
+        }
+        deallocate(fresh, count);
+        throw;
+    }
+
+    auto forward = [&remap](LinkPtr x) { return remap[x]; };
+    for (i = 0; i < count; ++i)
+    {
+        reinterpret_cast<Base *>(fresh + i)->relink(forward);
+    }
+    root = forward(root);
+
+    for (i = 0; i < order.size(); ++i)
+    {
+        node(order[i]).~Node_T();
+    }
+    deallocate(slots, capacity);
+    slots = fresh;
+    capacity = count;
+    used = count;
+    freeList = 0;
+}
+
+template <class Node_T, class Alloc>
+bool IndexStorage::store<Node_T, Alloc>::clone(const store & original)
+{
+    if (!trivial)
+    {
+        return false;
+    }
+
+    if (capacity < original.used)
+    {
+        Slot * newSlots = allocate(original.used);
+        deallocate(slots, capacity);
+        slots = newSlots;
+        capacity = original.used;
+    }
+    std::memcpy(static_cast<void *>(slots), static_cast<const void *>(original.slots), original.used * sizeof(Slot));
+    used = original.used;
+    freeList = original.freeList;
+    return true;
+}
+
+//Memory held by a tree. Memory owned by the keys and values themselves,
+//like string buffers, and the allocator's own bookkeeping are not counted.
+struct MemoryUsage
+{
+    //live nodes, links and payload together
+    std::size_t nodeBytes;
+
+    //key and value pairs stored in the nodes
+    std::size_t payloadBytes;
+
+    //everything that is not payload: links, padding, unused storage
+    //and the tree object
+    std::size_t overheadBytes;
+
+    std::size_t totalBytes;
+};
+
+//Shape of a tree, a height of 0 is an empty tree
+struct TreeShape
+{
+    //levels of the tree and the most an AVL tree of this size can have
+    std::size_t height;
+    std::size_t avlBound;
+
+    //nodes looked at by a successful search, averaged over every key
+    double averagePathLength;
+
+    //depthHistogram[d] is the number of nodes d links below the root
+    std::vector<std::size_t> depthHistogram;
+};
+
+//order in which compact() lays the nodes out
+enum class CompactOrder
+{
+    //level by level from the root
+    breadth_first,
+
+    //recursively split by half the height, good at every cache level
+    van_emde_boas
+};
+
+//what Tree::merge_sorted does with the key of a MergeEntry: put adds it
+//or overwrites the value, insert only adds a missing key
+enum class MergeOp
+{
+    put,
+    insert,
+    erase
+};
+
+//one change of a batch for Tree::merge_sorted, the value of an erase is
+//not used
+template <class Key_T, class Mapped_T>
+struct MergeEntry
+{
+    Key_T first;
+    Mapped_T second;
+    MergeOp op;
+};
+
+//****** BINARY TREE ALGORITHMS ******//
+
+//Linking, rotations and walks every balancing policy shares. Context
+//provides LinkPtr, links(LinkPtr) giving the parent/left/right/height/
+//balanceFactor of a node, a treeRoot member and counters() for the
+//instrumentation hooks. A balancing policy derives from it and adds
+//  rebalance_insert(tree, node)  after attach() hung node as a new leaf
+//  detach(tree, node, successor) take a node out and rebalance
+//  built(tree, node, depth, bottom) set the data of a node that a bulk
+//                                build linked, children first, into a
+//                                tree whose deepest level is bottom
+//  check(tree, node)             whether the node's own data is valid
+template <class Context>
+struct BinaryTreeAlgorithms
+{
+    typedef typename Context::LinkPtr LinkPtr;
+
+    //hang a new leaf below parent, or make it the root, without
+    //rebalancing. Call rebalance_insert() on it afterwards.
+    static void attach(Context & tree, LinkPtr parent, LinkPtr node, bool left);
+
+    //move the right child up into the place of node and the left child
+    //up into it, nothing else is updated
+    static void rotate_left(Context & tree, LinkPtr node);
+    static void rotate_right(Context & tree, LinkPtr node);
+
+    //unlink a node, one with two children is replaced by its in-order
+    //successor, which also swaps height and balanceFactor with it. Returns
+    //the parent of the position that lost a node, child is what hangs
+    //there now.
+    static LinkPtr splice(Context & tree, LinkPtr node, LinkPtr successor, LinkPtr & child);
+
+    static LinkPtr min_val(const Context & tree, const LinkPtr &);
+    static LinkPtr max_val(const Context & tree, const LinkPtr &);
+
+    static LinkPtr get_successor(const Context & tree, LinkPtr);
+    static LinkPtr get_predecessor(const Context & tree, LinkPtr);
+};
+
+//HELPER FUNCTION: link a new leaf to its parent
+template <class Context>
+void BinaryTreeAlgorithms<Context>::attach(Context & tree, LinkPtr parent, LinkPtr node, bool left)
+{
+    //empty tree
+	if (parent == 0)
+	{
+		tree.treeRoot = node;
+    }
+	else if (left)
+    {
+        tree.links(parent).left = node;
+    }
+	else
+    {
+        tree.links(parent).right = node;
+    }
+	tree.links(node).parent = parent;
+}
+
+//HELPER FUNCTION: left rotation, links only
+template <class Context>
+void BinaryTreeAlgorithms<Context>::rotate_left(Context & tree, LinkPtr node)
+{
+	LinkPtr tempNode = tree.links(node).right;
+	tree.links(tempNode).parent = tree.links(node).parent;
+	if (tree.links(node).parent != 0) {
+		if (node == tree.links(tree.links(node).parent).left)
+			tree.links(tree.links(node).parent).left = tempNode;
+		else if (node == tree.links(tree.links(node).parent).right)
+			tree.links(tree.links(node).parent).right = tempNode;
+	}
+
+	tree.links(node).parent = tempNode;
+	tree.links(node).right = tree.links(tempNode).left;
+
+	if (tree.links(tempNode).left != 0)
+    {
+        tree.links(tree.links(tempNode).left).parent = node;
+    }
+
+	tree.links(tempNode).left = node;
+
+	if (tree.links(tempNode).parent == 0)
+    {
+        tree.treeRoot = tempNode;
+    }
+}
+
+//HELPER FUNCTION: right rotation, links only
+template <class Context>
+void BinaryTreeAlgorithms<Context>::rotate_right(Context & tree, LinkPtr node)
+{
+	LinkPtr tempNode = tree.links(node).left;
+	tree.links(tempNode).parent = tree.links(node).parent;
+	if (tree.links(node).parent != 0)
+    {
+		if (node == tree.links(tree.links(node).parent).left)
+		{
+		    tree.links(tree.links(node).parent).left = tempNode;
+		}
+		else if (node == tree.links(tree.links(node).parent).right)
+        {
+            tree.links(tree.links(node).parent).right = tempNode;
+        }
+	}
+
+	tree.links(node).parent = tempNode;
+	tree.links(node).left = tree.links(tempNode).right;
+
+	if (tree.links(tempNode).right != 0)
+    {
+        tree.links(tree.links(tempNode).right).parent = node;
+    }
+	tree.links(tempNode).right = node;
+
+	if (tree.links(tempNode).parent == 0)
+    {
+        tree.treeRoot = tempNode;
+    }
+}
+
+//HELPER FUNCTION: unlink a node, the balancing policy fixes up from the
+//returned parent
+template <class Context>
+typename BinaryTreeAlgorithms<Context>::LinkPtr BinaryTreeAlgorithms<Context>::splice(Context & tree, LinkPtr node, LinkPtr successor, LinkPtr & child)
+{
+	//parent of the position that loses a node
+	LinkPtr parent = tree.links(node).parent;
+
+	//node that takes the place of the removed one
+	LinkPtr replacement = 0;
+
+	if (tree.links(node).left != 0 && tree.links(node).right != 0)
+    {
+		//the successor is the minimum of the right sub tree, move it
+		//into the position of the removed node instead of copying it
+		replacement = successor;
+		child = tree.links(replacement).right;
+		if (tree.links(replacement).parent != node)
+        {
+			parent = tree.links(replacement).parent;
+
+			//detach the successor, it has no left child
+			tree.links(parent).left = child;
+			if (child != 0)
+            {
+                tree.links(child).parent = parent;
+            }
+
+			tree.links(replacement).right = tree.links(node).right;
+			tree.links(tree.links(node).right).parent = replacement;
+		}
+		else
+        {
+            parent = replacement;
+        }
+
+		tree.links(replacement).left = tree.links(node).left;
+		tree.links(tree.links(node).left).parent = replacement;
+
+		//the successor takes over the shape of the removed node, which
+		//keeps the data of the position that is gone
+		std::swap(tree.links(replacement).height, tree.links(node).height);
+		std::swap(tree.links(replacement).balanceFactor, tree.links(node).balanceFactor);
+	}
+	else
+    {
+		//reassign children based on whether or not it has 1 or 0 children
+		replacement = tree.links(node).left;
+		if (replacement == 0)
+        {
+			replacement = tree.links(node).right;
+		}
+		child = replacement;
+	}
+
+	//is the node to be deleted is root?
+	if (tree.links(node).parent == 0)
+    {
+		tree.treeRoot = replacement;
+	}
+
+	//The node to be deleted, which child is it?
+	else if (tree.links(tree.links(node).parent).left == node)
+    {
+		tree.links(tree.links(node).parent).left = replacement;
+	}
+	else
+	{
+		tree.links(tree.links(node).parent).right = replacement;
+	}
+
+	//Set the parent to the node's parent pointer
+	if (replacement != 0)
+    {
+		tree.links(replacement).parent = tree.links(node).parent;
+	}
+	return parent;
+}
+
+//HELPER FUNCTION: get the minimum value
+template <class Context>
+typename BinaryTreeAlgorithms<Context>::LinkPtr BinaryTreeAlgorithms<Context>::min_val(const Context & tree, const LinkPtr & subTreeRoot)
+{
+	if (subTreeRoot == 0)
+    {
+        return 0;
+    }
+
+	LinkPtr current = subTreeRoot;
+	while (tree.links(current).left != 0)
+    {
+		current = tree.links(current).left;
+	}
+
+	return current;
+}
+
+//HELPER FUNCTION: get the maximum value
+template <class Context>
+typename BinaryTreeAlgorithms<Context>::LinkPtr BinaryTreeAlgorithms<Context>::max_val(const Context & tree, const LinkPtr & subTreeRoot)
+{
+	if (subTreeRoot == 0)
+    {
+        return 0;
+    }
+
+	LinkPtr current = subTreeRoot;
+	while (tree.links(current).right != 0)
+    {
+		current = tree.links(current).right;
+	}
+
+	return current;
+}
+
+//HELPER FUNCTION: in-order Successor
+template <class Context>
+typename BinaryTreeAlgorithms<Context>::LinkPtr BinaryTreeAlgorithms<Context>::get_successor(const Context & tree, LinkPtr node)
+{
+    //if it has a right child
+    if (tree.links(node).right != 0)
+    {
+        return min_val(tree, tree.links(node).right);
+    }
+
+	LinkPtr p = tree.links(node).parent;
+	while (p != 0 && node == tree.links(p).right)
+    {
+		node = p;
+		p = tree.links(node).parent;
+	}
+
+	return p;
+}
+
+//HELPER FUNCTION: in-order predecessor
+template <class Context>
+typename BinaryTreeAlgorithms<Context>::LinkPtr BinaryTreeAlgorithms<Context>::get_predecessor(const Context & tree, LinkPtr node)
+{
+    //if it has a left child
+	if (tree.links(node).left != 0)
+    {
+        return max_val(tree, tree.links(node).left);
+    }
+
+
+	LinkPtr p = tree.links(node).parent;
+	while (p != 0 && node == tree.links(p).left)
+    {
+		node = p;
+		p = tree.links(node).parent;
+	}
+
+	return p;
+}
+
+//****** AVL ALGORITHMS ******//
+
+//Rebalancing of an AVL tree, shared by Tree and cs540::IntrusiveTree.
+//height is the height of the subtree, balanceFactor the height of the
+//left subtree minus the right one.
+template <class Context>
+struct AvlAlgorithms : BinaryTreeAlgorithms<Context>
+{
+    typedef BinaryTreeAlgorithms<Context> Base;
+    typedef typename Context::LinkPtr LinkPtr;
+
+    //take a node out of the tree and rebalance. A node with two children
+    //is replaced by its in-order successor, which the caller passes in.
+    static void detach(Context & tree, LinkPtr node, LinkPtr successor);
+
+    static void rebalance_insert(Context & tree, LinkPtr node)
+    {
+        adjust_height_insert(tree, node);
+    }
+
+    static void built(Context & tree, LinkPtr node, std::size_t, std::size_t)
+    {
+        get_height(tree, node);
+        get_balance_factor(tree, node);
+    }
+
+    //stored height and balance factor match the children, which differ
+    //in height by one at most
+    static bool check(const Context & tree, LinkPtr node);
+
+    //update height after insert and remove
+    static void adjust_height_insert(Context & tree, LinkPtr &);
+    static void adjust_height_remove(Context & tree, LinkPtr &);
+
+    //balance factor
+    static short int balance_factor(const Context & tree, const LinkPtr &);
+
+    static short int height(const Context & tree, const LinkPtr &);
+
+    static void get_balance_factor(Context & tree, LinkPtr &);
+
+    //what is the height of the current node
+    static void get_height(const Context & tree, const LinkPtr &);
+
+    //left rotation
+    static void left_rotation(Context & tree, LinkPtr);
+
+    //right rotation
+    static void right_rotation(Context & tree, LinkPtr);
+
+    //left-right rotation
+    static void left_right_rotation(Context & tree, LinkPtr &);
+
+    //right-left rotation
+    static void right_left_rotation(Context & tree, LinkPtr &);
+
+    static void preform_rotation(Context & tree, LinkPtr &);
+    static void preform_remove(Context & tree, LinkPtr &);
+};
+
+//HELPER FUNCTION: unlink a node and rebalance from where the shape changed
+template <class Context>
+void AvlAlgorithms<Context>::detach(Context & tree, LinkPtr node, LinkPtr successor)
+{
+	//lowest node whose height may have changed
+	LinkPtr child;
+	LinkPtr retrace = Base::splice(tree, node, successor, child);
+
+	//re-adjust the height after a node is removed
+	adjust_height_remove(tree, retrace);
+}
+
+//HELPER FUNCTION: the invariant at a single node
+template <class Context>
+bool AvlAlgorithms<Context>::check(const Context & tree, LinkPtr node)
+{
+	LinkPtr left = tree.links(node).left;
+	LinkPtr right = tree.links(node).right;
+	if (tree.links(node).height != std::max(height(tree, left), height(tree, right)) + 1)
+    {
+        return false;
+    }
+	short int balance = balance_factor(tree, node);
+	return balance >= -1 && balance <= 1 && tree.links(node).balanceFactor == balance;
+}
+
+//HELPER FUNCTION: update height of the tree after insertion
+template <class Context>
+void AvlAlgorithms<Context>::adjust_height_insert(Context & tree, LinkPtr & insertedPtr)
+{
+	LinkPtr child = insertedPtr;
+	tree.counters().retrace();
+	while (tree.links(child).parent != 0)
+    {
+		tree.counters().retrace_step();
+		get_height(tree, child);
+		get_balance_factor(tree, child);
+		preform_rotation(tree, child);
+		child = tree.links(child).parent;
+	}
+	if (tree.links(child).parent == 0)
+    {
+		tree.counters().retrace_step();
+		get_height(tree, child);
+		get_balance_factor(tree, child);
+		preform_rotation(tree, child);
+	}
+}
+
+//HELPER FUNCTION: re-adjust height of the tree after a remove
+template <class Context>
+void AvlAlgorithms<Context>::adjust_height_remove(Context & tree, LinkPtr & insertedPtr)
+{
+	LinkPtr child = insertedPtr;
+	if (child != 0)
+    {
+		tree.counters().retrace();
+		while (tree.links(child).parent != 0)
+		{
+			tree.counters().retrace_step();
+			get_height(tree, child);
+			get_balance_factor(tree, child);
+			preform_remove(tree, child);
+			child = tree.links(child).parent;
+		}
+		if (tree.links(child).parent == 0)
+        {
+			tree.counters().retrace_step();
+			get_height(tree, child);
+			get_balance_factor(tree, child);
+			preform_remove(tree, child);
+		}
+	}
+}
+
+//HELPER FUNCTION: what is the balance factor, needed to readjust the height of the
+//tree
+template <class Context>
+void AvlAlgorithms<Context>::get_balance_factor(Context & tree, LinkPtr & node)
+{
+	tree.links(node).balanceFactor = balance_factor(tree, node);
+}
+template <class Context>
+short int AvlAlgorithms<Context>::balance_factor(const Context & tree, const LinkPtr & p)
+{
+	return height(tree, tree.links(p).left) - height(tree, tree.links(p).right);
+}
+
+//HELPER FUNCTION: calculate the hight of a sub_tree
+template <class Context>
+short int AvlAlgorithms<Context>::height(const Context & tree, const LinkPtr & p)
+{
+	return p ? tree.links(p).height : -1;
+}
+
+//HELPER FUNCTION: calculate the height of the tree
+template <class Context>
+void AvlAlgorithms<Context>::get_height(const Context & tree, const LinkPtr & node)
+{
+	tree.links(node).height = std::max(height(tree, tree.links(node).right), height(tree, tree.links(node).left)) + 1;
+}
+
+//HELPER FUNCTION: left rotation
+template <class Context>
+void AvlAlgorithms<Context>::left_rotation(Context & tree, LinkPtr node)
+{
+	LinkPtr tempNode = tree.links(node).right;
+	Base::rotate_left(tree, node);
+
+	get_height(tree, node);
+	get_balance_factor(tree, node);
+
+	get_height(tree, tempNode);
+	get_balance_factor(tree, tempNode);
+}
+
+//HELPER FUNCTION: right rotation
+template <class Context>
+void AvlAlgorithms<Context>::right_rotation(Context & tree, LinkPtr node)
+{
+	LinkPtr tempNode = tree.links(node).left;
+	Base::rotate_right(tree, node);
+
+	get_height(tree, node);
+	get_balance_factor(tree, node);
+
+	get_height(tree, tempNode);
+	get_balance_factor(tree, tempNode);
+}
+
+//HELPER FUNCTION: left_right rotation
+template <class Context>
+void AvlAlgorithms<Context>::left_right_rotation(Context & tree, LinkPtr & node)
+{
+	left_rotation(tree, tree.links(node).left);
+	right_rotation(tree, node);
+}
+
+//HELPER FUNCTION: right_left rotation
+template <class Context>
+void AvlAlgorithms<Context>::right_left_rotation(Context & tree, LinkPtr & node)
+{
+	right_rotation(tree, tree.links(node).right);
+	left_rotation(tree, node);
+}
+
+//HELPER FUNCTION: decides which type of rotation is needed
+template <class Context>
+void AvlAlgorithms<Context>::preform_rotation(Context & tree, LinkPtr & node)
+{
+	LinkPtr temp = 0;
+	if (tree.links(node).balanceFactor == 2)
+    {
+		temp = tree.links(node).left;
+		if (tree.links(temp).balanceFactor == 1)
+		{
+			right_rotation(tree, node);
+			tree.counters().single_rotation();
+		}
+		else if (tree.links(temp).balanceFactor == -1)
+		{
+			left_right_rotation(tree, node);
+			tree.counters().double_rotation();
+		}
+	}
+	if (tree.links(node).balanceFactor == -2)
+	{
+		temp = tree.links(node).right;
+		if (tree.links(temp).balanceFactor == 1)
+		{
+			right_left_rotation(tree, node);
+			tree.counters().double_rotation();
+		}
+		else if (tree.links(temp).balanceFactor == -1)
+		{
+			left_rotation(tree, node);
+			tree.counters().single_rotation();
+		}
+	}
+}
+
+//HELPER FUNCTION: re-adjust the tree after removing a node
+template <class Context>
+void AvlAlgorithms<Context>::preform_remove(Context & tree, LinkPtr & node)
+{
+	LinkPtr temp = 0;
+
+	if (tree.links(node).balanceFactor == 2)
+    {
+		temp = tree.links(node).left;
+
+		if (tree.links(temp).balanceFactor == 1 || tree.links(temp).balanceFactor == 0)
+        {
+			right_rotation(tree, node);
+			tree.counters().single_rotation();
+		}
+
+		else if (tree.links(temp).balanceFactor == -1)
+        {
+			left_right_rotation(tree, node);
+			tree.counters().double_rotation();
+		}
+	}
+
+	if (tree.links(node).balanceFactor == -2)
+    {
+		temp = tree.links(node).right;
+		if (tree.links(temp).balanceFactor == 1)
+		{
+			right_left_rotation(tree, node);
+			tree.counters().double_rotation();
+		}
+
+		else if (tree.links(temp).balanceFactor == -1 || tree.links(temp).balanceFactor == 0)
+        {
+			left_rotation(tree, node);
+			tree.counters().single_rotation();
+		}
+	}
+}
+
+//****** RED-BLACK ALGORITHMS ******//
+
+//Rebalancing of a red-black tree: no red node has a red child and every
+//path down to a null link passes the same number of black nodes. The
+//colour is kept in balanceFactor, height is not used. An insert rotates
+//twice at most and an erase three times, the rest is recolouring.
+template <class Context>
+struct RedBlackAlgorithms : BinaryTreeAlgorithms<Context>
+{
+    typedef BinaryTreeAlgorithms<Context> Base;
+    typedef typename Context::LinkPtr LinkPtr;
+
+    enum Colour { black = 0, red = 1 };
+
+    static void rebalance_insert(Context & tree, LinkPtr node);
+    static void detach(Context & tree, LinkPtr node, LinkPtr successor);
+
+    //the deepest level of a balanced build is red, the rest black, so
+    //every path has the same number of black nodes
+    static void built(Context & tree, LinkPtr node, std::size_t depth, std::size_t bottom)
+    {
+        tree.links(node).balanceFactor = depth == bottom && depth != 0 ? red : black;
+    }
+
+    //no red-red link, a black root and as many black nodes down the
+    //left child as down the right one
+    static bool check(const Context & tree, LinkPtr node);
+
+    private:
+        static bool is_red(const Context & tree, LinkPtr node)
+        {
+            return node != 0 && tree.links(node).balanceFactor == red;
+        }
+        static void paint(Context & tree, LinkPtr node, Colour colour)
+        {
+            tree.links(node).balanceFactor = colour;
+        }
+
+        //black nodes on the leftmost path below and including node
+        static std::size_t black_height(const Context & tree, LinkPtr node);
+
+        //node is one black short on its paths, parent is its parent since
+        //node may be a null link
+        static void erase_fixup(Context & tree, LinkPtr node, LinkPtr parent);
+};
+
+//HELPER FUNCTION: the new leaf starts red, red parents are fixed by
+//recolouring while the uncle is red and by rotating once it is black
+template <class Context>
+void RedBlackAlgorithms<Context>::rebalance_insert(Context & tree, LinkPtr node)
+{
+	paint(tree, node, red);
+	tree.counters().retrace();
+	LinkPtr parent;
+	while ((parent = tree.links(node).parent) != 0 && is_red(tree, parent))
+    {
+		tree.counters().retrace_step();
+
+		//a red parent is never the root, so the grandparent is there
+		LinkPtr grandparent = tree.links(parent).parent;
+		bool left = parent == tree.links(grandparent).left;
+		LinkPtr uncle = left ? tree.links(grandparent).right : tree.links(grandparent).left;
+		if (is_red(tree, uncle))
+        {
+			paint(tree, parent, black);
+			paint(tree, uncle, black);
+			paint(tree, grandparent, red);
+			node = grandparent;
+			continue;
+		}
+
+		//an inner grandchild is rotated to the outside first
+		bool inner = left ? node == tree.links(parent).right : node == tree.links(parent).left;
+		if (inner)
+        {
+			if (left)
+            {
+                Base::rotate_left(tree, parent);
+            }
+			else
+            {
+                Base::rotate_right(tree, parent);
+            }
+			node = parent;
+			parent = tree.links(node).parent;
+		}
+		paint(tree, parent, black);
+		paint(tree, grandparent, red);
+		if (left)
+        {
+            Base::rotate_right(tree, grandparent);
+        }
+		else
+        {
+            Base::rotate_left(tree, grandparent);
+        }
+		if (inner)
+        {
+            tree.counters().double_rotation();
+        }
+		else
+        {
+            tree.counters().single_rotation();
+        }
+		break;
+	}
+	paint(tree, tree.treeRoot, black);
+}
+
+//HELPER FUNCTION: a red position can go without changes, a black one
+//leaves its paths a black node short
+template <class Context>
+void RedBlackAlgorithms<Context>::detach(Context & tree, LinkPtr node, LinkPtr successor)
+{
+	LinkPtr child;
+	LinkPtr parent = Base::splice(tree, node, successor, child);
+
+	//after splice() node has the colour of the position that is gone
+	if (!is_red(tree, node))
+    {
+        erase_fixup(tree, child, parent);
+    }
+}
+
+//HELPER FUNCTION: push the missing black up, or make it up with a
+//rotation once the sibling has a red child
+template <class Context>
+void RedBlackAlgorithms<Context>::erase_fixup(Context & tree, LinkPtr node, LinkPtr parent)
+{
+	tree.counters().retrace();
+	while (parent != 0 && !is_red(tree, node))
+    {
+		tree.counters().retrace_step();
+
+		//the sibling has a black node more on its paths, so it exists
+		bool left = node == tree.links(parent).left;
+		LinkPtr sibling = left ? tree.links(parent).right : tree.links(parent).left;
+		if (is_red(tree, sibling))
+        {
+			paint(tree, sibling, black);
+			paint(tree, parent, red);
+			if (left)
+            {
+                Base::rotate_left(tree, parent);
+            }
+			else
+            {
+                Base::rotate_right(tree, parent);
+            }
+			tree.counters().single_rotation();
+			sibling = left ? tree.links(parent).right : tree.links(parent).left;
+		}
+
+		LinkPtr outer = left ? tree.links(sibling).right : tree.links(sibling).left;
+		LinkPtr inner = left ? tree.links(sibling).left : tree.links(sibling).right;
+		if (!is_red(tree, outer) && !is_red(tree, inner))
+        {
+			paint(tree, sibling, red);
+			node = parent;
+			parent = tree.links(node).parent;
+			continue;
+		}
+
+		//a red inner nephew is rotated to the outside first
+		bool twice = !is_red(tree, outer);
+		if (twice)
+        {
+			paint(tree, inner, black);
+			paint(tree, sibling, red);
+			if (left)
+            {
+                Base::rotate_right(tree, sibling);
+            }
+			else
+            {
+                Base::rotate_left(tree, sibling);
+            }
+			outer = sibling;
+			sibling = inner;
+		}
+		tree.links(sibling).balanceFactor = tree.links(parent).balanceFactor;
+		paint(tree, parent, black);
+		paint(tree, outer, black);
+		if (left)
+        {
+            Base::rotate_left(tree, parent);
+        }
+		else
+        {
+            Base::rotate_right(tree, parent);
+        }
+		if (twice)
+        {
+            tree.counters().double_rotation();
+        }
+		else
+        {
+            tree.counters().single_rotation();
+        }
+		return;
+	}
+	if (node != 0)
+    {
+        paint(tree, node, black);
+    }
+}
+
+//HELPER FUNCTION: checking each node's children against each other
+//covers every path, one leftmost path per child is enough
+template <class Context>
+bool RedBlackAlgorithms<Context>::check(const Context & tree, LinkPtr node)
+{
+	const auto & link = tree.links(node);
+	if (link.balanceFactor != red && link.balanceFactor != black)
+    {
+        return false;
+    }
+	if (link.parent == 0 && is_red(tree, node))
+    {
+        return false;
+    }
+	if (is_red(tree, node) && (is_red(tree, link.left) || is_red(tree, link.right)))
+    {
+        return false;
+    }
+	return black_height(tree, link.left) == black_height(tree, link.right);
+}
+
+//HELPER FUNCTION: count the black nodes down the left side
+template <class Context>
+std::size_t RedBlackAlgorithms<Context>::black_height(const Context & tree, LinkPtr node)
+{
+	std::size_t count = 0;
+	for (; node != 0; node = tree.links(node).left)
+    {
+        count += !is_red(tree, node);
+    }
+	return count;
+}
+
+//****** WEAK AVL ALGORITHMS ******//
+
+//Rebalancing of a weak AVL tree. Every node has a rank, kept in height,
+//a null link has rank -1. A child's rank is one or two below its
+//parent's and a leaf has rank 0. Built by inserts only it is an AVL tree,
+//erases only demote, so a long erase sequence costs O(1) amortized
+//rotations and at most two per erase, against O(log n) for AVL.
+template <class Context>
+struct WavlAlgorithms : BinaryTreeAlgorithms<Context>
+{
+    typedef BinaryTreeAlgorithms<Context> Base;
+    typedef typename Context::LinkPtr LinkPtr;
+
+    static void rebalance_insert(Context & tree, LinkPtr node);
+    static void detach(Context & tree, LinkPtr node, LinkPtr successor);
+
+    //AVL heights are valid ranks
+    static void built(Context & tree, LinkPtr node, std::size_t, std::size_t)
+    {
+        tree.links(node).height = std::max(rank(tree, tree.links(node).left), rank(tree, tree.links(node).right)) + 1;
+    }
+
+    //rank differences of 1 or 2 and leaves of rank 0
+    static bool check(const Context & tree, LinkPtr node);
+
+    private:
+        static int rank(const Context & tree, LinkPtr node)
+        {
+            return node != 0 ? tree.links(node).height : -1;
+        }
+        static void promote(Context & tree, LinkPtr node, int by = 1)
+        {
+            tree.links(node).height += by;
+        }
+        static void demote(Context & tree, LinkPtr node, int by = 1)
+        {
+            tree.links(node).height -= by;
+        }
+        static bool leaf(const Context & tree, LinkPtr node)
+        {
+            return tree.links(node).left == 0 && tree.links(node).right == 0;
+        }
+};
+
+//HELPER FUNCTION: promote while the new rank equals the parent's and the
+//sibling is one below, then one single or double rotation ends it
+template <class Context>
+void WavlAlgorithms<Context>::rebalance_insert(Context & tree, LinkPtr node)
+{
+	tree.links(node).height = 0;
+	tree.counters().retrace();
+	LinkPtr parent;
+	while ((parent = tree.links(node).parent) != 0 && rank(tree, parent) == rank(tree, node))
+    {
+		tree.counters().retrace_step();
+		bool left = node == tree.links(parent).left;
+		LinkPtr sibling = left ? tree.links(parent).right : tree.links(parent).left;
+		if (rank(tree, parent) - rank(tree, sibling) == 1)
+        {
+			promote(tree, parent);
+			node = parent;
+			continue;
+		}
+
+		//the sibling is two below, rotate the taller side up
+		LinkPtr inner = left ? tree.links(node).right : tree.links(node).left;
+		if (rank(tree, node) - rank(tree, inner) == 2)
+        {
+			if (left)
+            {
+                Base::rotate_right(tree, parent);
+            }
+			else
+            {
+                Base::rotate_left(tree, parent);
+            }
+			demote(tree, parent);
+			tree.counters().single_rotation();
+		}
+		else
+        {
+			if (left)
+            {
+				Base::rotate_left(tree, node);
+				Base::rotate_right(tree, parent);
+			}
+			else
+            {
+				Base::rotate_right(tree, node);
+				Base::rotate_left(tree, parent);
+			}
+			promote(tree, inner);
+			demote(tree, node);
+			demote(tree, parent);
+			tree.counters().double_rotation();
+		}
+		break;
+	}
+}
+
+//HELPER FUNCTION: demote while a child ends up three below its parent,
+//then one single or double rotation ends it
+template <class Context>
+void WavlAlgorithms<Context>::detach(Context & tree, LinkPtr node, LinkPtr successor)
+{
+	LinkPtr child;
+	LinkPtr parent = Base::splice(tree, node, successor, child);
+	if (parent == 0)
+    {
+        return;
+    }
+
+	tree.counters().retrace();
+
+	//a parent left without children is a leaf of rank 1, it drops to 0
+	if (child == 0 && leaf(tree, parent))
+    {
+		tree.counters().retrace_step();
+		if (rank(tree, parent) == 1)
+        {
+            demote(tree, parent);
+        }
+		child = parent;
+		parent = tree.links(child).parent;
+	}
+
+	while (parent != 0 && rank(tree, parent) - rank(tree, child) == 3)
+    {
+		tree.counters().retrace_step();
+
+		//the sibling is ranked at least 0, it exists
+		bool left = child == tree.links(parent).left;
+		LinkPtr sibling = left ? tree.links(parent).right : tree.links(parent).left;
+		if (rank(tree, parent) - rank(tree, sibling) == 2)
+        {
+			demote(tree, parent);
+			child = parent;
+			parent = tree.links(child).parent;
+			continue;
+		}
+
+		LinkPtr outer = left ? tree.links(sibling).right : tree.links(sibling).left;
+		LinkPtr inner = left ? tree.links(sibling).left : tree.links(sibling).right;
+		if (rank(tree, sibling) - rank(tree, outer) == 2 && rank(tree, sibling) - rank(tree, inner) == 2)
+        {
+			demote(tree, sibling);
+			demote(tree, parent);
+			child = parent;
+			parent = tree.links(child).parent;
+			continue;
+		}
+
+		if (rank(tree, sibling) - rank(tree, outer) == 1)
+        {
+			if (left)
+            {
+                Base::rotate_left(tree, parent);
+            }
+			else
+            {
+                Base::rotate_right(tree, parent);
+            }
+			promote(tree, sibling);
+			demote(tree, parent, leaf(tree, parent) ? 2 : 1);
+			tree.counters().single_rotation();
+		}
+		else
+        {
+			if (left)
+            {
+				Base::rotate_right(tree, sibling);
+				Base::rotate_left(tree, parent);
+			}
+			else
+            {
+				Base::rotate_left(tree, sibling);
+				Base::rotate_right(tree, parent);
+			}
+			promote(tree, inner, 2);
+			demote(tree, sibling);
+			demote(tree, parent, 2);
+			tree.counters().double_rotation();
+		}
+		break;
+	}
+}
+
+//HELPER FUNCTION: the rank rule at a single node
+template <class Context>
+bool WavlAlgorithms<Context>::check(const Context & tree, LinkPtr node)
+{
+	int left = rank(tree, node) - rank(tree, tree.links(node).left);
+	int right = rank(tree, node) - rank(tree, tree.links(node).right);
+	if (left < 1 || left > 2 || right < 1 || right > 2)
+    {
+        return false;
+    }
+	return !leaf(tree, node) || rank(tree, node) == 0;
+}
+
+//****** TREAP ALGORITHMS ******//
+
+//Rebalancing of a treap: every node has a priority and no child has a
+//higher one than its parent. The priority is the top 16 bits of a hash of
+//the node's link, kept in balanceFactor, with the full 64-bit hash to
+//break ties, so the shape is that of a random tree, about 1.4 log n deep
+//on average, however many nodes share the 16 bits. An insert rotates the
+//node up and an erase rotates it down, no data is kept on the way.
+template <class Context>
+struct TreapAlgorithms : BinaryTreeAlgorithms<Context>
+{
+    typedef BinaryTreeAlgorithms<Context> Base;
+    typedef typename Context::LinkPtr LinkPtr;
+
+    static void rebalance_insert(Context & tree, LinkPtr node);
+
+    //rotate the node down below its higher child until it has one child
+    //at most, the successor is not needed
+    static void detach(Context & tree, LinkPtr node, LinkPtr);
+
+    //priorities grow with the height of the subtree, in the range a
+    //random treap has at that height: [1 - 2^(1-h), 1 - 2^-h) of the scale.
+    //height keeps the subtree height while the build runs.
+    static void built(Context & tree, LinkPtr node, std::size_t, std::size_t);
+
+    //heap order against both children, ties may go either way once
+    //nodes are relocated and their hashes change
+    static bool check(const Context & tree, LinkPtr node)
+    {
+        return priority(tree, tree.links(node).left) <= priority(tree, node)
+            && priority(tree, tree.links(node).right) <= priority(tree, node);
+    }
+
+    private:
+        static int priority(const Context & tree, LinkPtr node)
+        {
+            return node != 0 ? static_cast<unsigned short>(tree.links(node).balanceFactor) : -1;
+        }
+        static void set_priority(Context & tree, LinkPtr node, std::uint64_t value)
+        {
+            tree.links(node).balanceFactor = static_cast<short int>(static_cast<unsigned short>(value));
+        }
+
+        //does a come before b in heap order, the hash settles equal priorities
+        static bool higher(const Context & tree, LinkPtr a, LinkPtr b)
+        {
+            int pa = priority(tree, a), pb = priority(tree, b);
+            return pa != pb ? pa > pb : hash(a) > hash(b);
+        }
+
+        //a well mixed 64-bit hash of a link, the splitmix64 finalizer
+        template <class T>
+        static std::uint64_t hash(T * node)
+        {
+            return hash(std::uint64_t(reinterpret_cast<std::uintptr_t>(node)));
+        }
+        static std::uint64_t hash(std::uint64_t bits)
+        {
+            bits = (bits ^ (bits >> 30)) * 0xbf58476d1ce4e5b9ull;
+            bits = (bits ^ (bits >> 27)) * 0x94d049bb133111ebull;
+            return bits ^ (bits >> 31);
+        }
+};
+
+//HELPER FUNCTION: rotate up past every parent of lower priority
+template <class Context>
+void TreapAlgorithms<Context>::rebalance_insert(Context & tree, LinkPtr node)
+{
+	set_priority(tree, node, hash(node) >> 48);
+	tree.counters().retrace();
+	LinkPtr parent;
+	while ((parent = tree.links(node).parent) != 0 && higher(tree, node, parent))
+    {
+		tree.counters().retrace_step();
+		if (node == tree.links(parent).left)
+        {
+            Base::rotate_right(tree, parent);
+        }
+		else
+        {
+            Base::rotate_left(tree, parent);
+        }
+		tree.counters().single_rotation();
+	}
+}
+
+//HELPER FUNCTION: the child of higher priority moves up each time
+template <class Context>
+void TreapAlgorithms<Context>::detach(Context & tree, LinkPtr node, LinkPtr)
+{
+	tree.counters().retrace();
+	LinkPtr left, right;
+	while ((left = tree.links(node).left) != 0 && (right = tree.links(node).right) != 0)
+    {
+		tree.counters().retrace_step();
+		if (higher(tree, left, right))
+        {
+            Base::rotate_right(tree, node);
+        }
+		else
+        {
+            Base::rotate_left(tree, node);
+        }
+		tree.counters().single_rotation();
+	}
+	LinkPtr child;
+	Base::splice(tree, node, 0, child);
+}
+
+//HELPER FUNCTION: a random priority within the band of the subtree height,
+//the bands run out at 16 levels and the hash orders the ones above
+template <class Context>
+void TreapAlgorithms<Context>::built(Context & tree, LinkPtr node, std::size_t, std::size_t)
+{
+	LinkPtr left = tree.links(node).left;
+	LinkPtr right = tree.links(node).right;
+	unsigned levels = std::max(left != 0 ? tree.links(left).height : 0, right != 0 ? tree.links(right).height : 0) + 1u;
+	tree.links(node).height = static_cast<unsigned char>(levels);
+
+	std::uint64_t band = levels <= 16 ? 65536u >> levels : 0;
+	std::uint64_t low = levels <= 16 ? 65536u - (65536u >> (levels - 1)) : 65535u;
+	set_priority(tree, node, band != 0 ? low + hash(node) % band : low);
+}
+
+//****** INLINE NODES ******//
+
+//Entries of a small tree, kept in an array inside the tree object. Nodes
+//stay in their slot, a byte per entry keeps the slots in key order.
+//They are ordinary nodes, so iterators work unchanged. When the array
+//is full its nodes are linked into the tree where they are and stay in
+//their slots until erased, the tree tells them apart by address.
+template <class Node_T, std::size_t N>
+class InlineNodes
+{
+    static_assert(N < 256, "inline_capacity has to fit in a byte");
+
+    public:
+        InlineNodes()
+            : inlineCount(0), inlineMode(true)
+        {
+            for (std::size_t i = 0; i < N; ++i)
+            {
+                order[i] = static_cast<unsigned char>(i);
+                rank[i] = static_cast<unsigned char>(i);
+            }
+        }
+
+        InlineNodes(const InlineNodes &) = delete;
+        InlineNodes & operator=(const InlineNodes &) = delete;
+
+        //the entries are in the array rather than in the tree
+        bool inline_mode() const
+        {
+            return inlineMode;
+        }
+        void set_inline_mode(bool on)
+        {
+            inlineMode = on;
+        }
+
+        std::size_t inline_count() const
+        {
+            return inlineCount;
+        }
+
+        //entry at a position in key order and the position of an entry
+        Node_T * inline_node(std::size_t position) const
+        {
+            return slot(order[position]);
+        }
+        std::size_t inline_position(const Node_T * node) const
+        {
+            return rank[node - slot(0)];
+        }
+
+        //does the node live in one of the slots
+        bool inline_holds(const Node_T * node) const
+        {
+            std::less<const Node_T *> before;
+            return !before(node, slot(0)) && before(node, slot(N));
+        }
+
+        //construct an entry at a position, there has to be room left
+        template <class... Args>
+        Node_T * inline_emplace(std::size_t position, Args &&... args);
+
+        //destroy the entry at a position
+        void inline_erase(std::size_t position);
+
+        //destroy every entry
+        void inline_clear()
+        {
+            while (inlineCount > 0)
+            {
+                inline_erase(inlineCount - 1);
+            }
+        }
+
+        //exchange entries with another array, they are moved one by one
+        void swap_inline(InlineNodes & other)
+        {
+            InlineNodes temp;
+            temp.take(*this);
+            take(other);
+            other.take(temp);
+            std::swap(inlineMode, other.inlineMode);
+        }
+
+    private:
+        typename std::aligned_storage<sizeof(Node_T), alignof(Node_T)>::type buffer[N];
+        unsigned char order[N];
+        unsigned char rank[N];
+        std::size_t inlineCount;
+        bool inlineMode;
+
+        Node_T * slot(std::size_t i) const
+        {
+            return const_cast<Node_T *>(reinterpret_cast<const Node_T *>(buffer + i));
+        }
+
+        //move every entry of another array into this empty one
+        void take(InlineNodes & from);
+};
+
+template <class Node_T, std::size_t N>
+template <class... Args>
+Node_T * InlineNodes<Node_T, N>::inline_emplace(std::size_t position, Args &&... args)
+{
+    //the first free slot is the one after the last entry in order
+    unsigned char free = order[inlineCount];
+    Node_T * node = new (slot(free)) Node_T(std::forward<Args>(args)...);
+    for (std::size_t i = inlineCount; i > position; --i)
+    {
+        order[i] = order[i - 1];
+        rank[order[i]] = static_cast<unsigned char>(i);
+    }
+    order[position] = free;
+    rank[free] = static_cast<unsigned char>(position);
+    ++inlineCount;
+    return node;
+}
+
+template <class Node_T, std::size_t N>
+void InlineNodes<Node_T, N>::inline_erase(std::size_t position)
+{
+    unsigned char freed = order[position];
+    slot(freed)->~Node_T();
+    --inlineCount;
+    for (std::size_t i = position; i < inlineCount; ++i)
+    {
+        order[i] = order[i + 1];
+        rank[order[i]] = static_cast<unsigned char>(i);
+    }
+    order[inlineCount] = freed;
+    rank[freed] = static_cast<unsigned char>(inlineCount);
+}
+
+template <class Node_T, std::size_t N>
+void InlineNodes<Node_T, N>::take(InlineNodes & from)
+{
+    for (std::size_t i = 0; i < from.inlineCount; ++i)
+    {
+        inline_emplace(i, std::move_if_noexcept(*from.inline_node(i)));
+    }
+    from.inline_clear();
+}
+
+//Without an inline array the tree is always in tree mode and keeps no state
+template <class Node_T>
+class InlineNodes<Node_T, 0>
+{
+    public:
+        bool inline_mode() const
+        {
+            return false;
+        }
+        void set_inline_mode(bool)
+        {
+            //Empty
+        }
+        std::size_t inline_count() const
+        {
+            return 0;
+        }
+        Node_T * inline_node(std::size_t) const
+        {
+            return 0;
+        }
+        std::size_t inline_position(const Node_T *) const
+        {
+            return 0;
+        }
+        bool inline_holds(const Node_T *) const
+        {
+            return false;
+        }
+        template <class... Args>
+        Node_T * inline_emplace(std::size_t, Args &&...)
+        {
+            return 0;
+        }
+        void inline_erase(std::size_t)
+        {
+            //Empty
+        }
+        void inline_clear()
+        {
+            //Empty
+        }
+        void swap_inline(InlineNodes &)
+        {
+            //Empty
+        }
+};
+
+//searches answered by the lookup cache and the ones that descended, see
+//DefaultTreePolicy::lookup_cache_sets
+struct LookupCacheStats
+{
+    std::uint64_t hits;
+    std::uint64_t misses;
+};
+
+//Nodes found by recent searches, in sets of two picked by the hash of the
+//key, the one found last first. A hit costs the set and the node instead
+//of a descent. Rotations leave nodes where they are, only a node that is
+//unlinked, destroyed or moved has to be forgotten.
+template <class Key_T, class LinkPtr, std::size_t Sets>
+class LookupCache
+{
+    static_assert((Sets & (Sets - 1)) == 0, "lookup_cache_sets has to be a power of two");
+
+    public:
+        LookupCache()
+            : lookups()
+        {
+            //Empty
+        }
+
+        //a copy starts empty, the links would be those of the other tree
+        LookupCache(const LookupCache &)
+            : lookups()
+        {
+            //Empty
+        }
+        LookupCache & operator=(const LookupCache &) = delete;
+
+        //the cached node with the key, same(node) confirms it since
+        //different keys can share a hash. hash is kept for cache_remember.
+        template <class Same>
+        LinkPtr cache_lookup(const Key_T & key, std::size_t & hash, Same same);
+
+        //the same without moving the way found to the front or counting,
+        //for const searches
+        template <class Same>
+        LinkPtr cache_peek(const Key_T & key, Same same) const;
+
+        //a node just found with the key of the given hash
+        void cache_remember(std::size_t hash, LinkPtr node);
+
+        //drop a node, or every node
+        void cache_forget(const Key_T & key, LinkPtr node);
+        void cache_forget_all()
+        {
+            std::fill(ways.begin(), ways.end(), Way());
+        }
+
+        //the cached nodes follow the nodes they point at
+        void swap_cache(LookupCache & other)
+        {
+            ways.swap(other.ways);
+            std::swap(lookups, other.lookups);
+        }
+
+        LookupCacheStats cache_stats() const
+        {
+            return lookups;
+        }
+        std::size_t cache_bytes() const
+        {
+            return ways.capacity() * sizeof(Way);
+        }
+        void reset_cache_stats()
+        {
+            lookups = LookupCacheStats();
+        }
+
+    private:
+        struct Way
+        {
+            std::size_t hash;
+            LinkPtr node;
+
+            Way()
+                : hash(0), node(0)
+            {
+                //Empty
+            }
+        };
+
+        //two ways per set, allocated by the first node remembered
+        std::vector<Way> ways;
+        LookupCacheStats lookups;
+
+        //std::hash of an integer is often the integer, mix the bits so
+        //keys with a common stride spread over the sets
+        static std::size_t first_way(std::size_t hash)
+        {
+            return 2 * (std::size_t((std::uint64_t(hash) * 0x9e3779b97f4a7c15ULL) >> 32) & (Sets - 1));
+        }
+};
+
+template <class Key_T, class LinkPtr, std::size_t Sets>
+template <class Same>
+LinkPtr LookupCache<Key_T, LinkPtr, Sets>::cache_lookup(const Key_T & key, std::size_t & hash, Same same)
+{
+    hash = std::hash<Key_T>()(key);
+    if (!ways.empty())
+    {
+        Way * set = &ways[first_way(hash)];
+        for (std::size_t i = 0; i < 2; ++i)
+        {
+            if (set[i].node != 0 && set[i].hash == hash && same(set[i].node))
+            {
+                if (i != 0)
+                {
+                    std::swap(set[0], set[1]);
+                }
+                ++lookups.hits;
+                return set[0].node;
+            }
+        }
+    }
+    ++lookups.misses;
+    return 0;
+}
+
+template <class Key_T, class LinkPtr, std::size_t Sets>
+template <class Same>
+LinkPtr LookupCache<Key_T, LinkPtr, Sets>::cache_peek(const Key_T & key, Same same) const
+{
+    if (ways.empty())
+    {
+        return 0;
+    }
+    std::size_t hash = std::hash<Key_T>()(key);
+    const Way * set = &ways[first_way(hash)];
+    for (std::size_t i = 0; i < 2; ++i)
+    {
+        if (set[i].node != 0 && set[i].hash == hash && same(set[i].node))
+        {
+            return set[i].node;
+        }
+    }
+    return 0;
+}
+
+//the older way makes room, a cache that cannot be allocated stays empty
+template <class Key_T, class LinkPtr, std::size_t Sets>
+void LookupCache<Key_T, LinkPtr, Sets>::cache_remember(std::size_t hash, LinkPtr node)
+{
+    if (ways.empty())
+    {
+        try
+        {
+            ways.resize(2 * Sets);
+        }
+        catch (const std::bad_alloc &)
+        {
+            return;
+        }
+    }
+    Way * set = &ways[first_way(hash)];
+    set[1] = set[0];
+    set[0].hash = hash;
+    set[0].node = node;
+}
+
+template <class Key_T, class LinkPtr, std::size_t Sets>
+void LookupCache<Key_T, LinkPtr, Sets>::cache_forget(const Key_T & key, LinkPtr node)
+{
+    if (ways.empty())
+    {
+        return;
+    }
+    Way * set = &ways[first_way(std::hash<Key_T>()(key))];
+    for (std::size_t i = 0; i < 2; ++i)
+    {
+        if (set[i].node == node)
+        {
+            set[i] = Way();
+        }
+    }
+}
+
+//Without a cache every search descends and nothing is kept
+template <class Key_T, class LinkPtr>
+class LookupCache<Key_T, LinkPtr, 0>
+{
+    public:
+        template <class Same>
+        LinkPtr cache_lookup(const Key_T &, std::size_t &, Same)
+        {
+            return 0;
+        }
+        template <class Same>
+        LinkPtr cache_peek(const Key_T &, Same) const
+        {
+            return 0;
+        }
+        void cache_remember(std::size_t, LinkPtr)
+        {
+            //Empty
+        }
+        void cache_forget(const Key_T &, LinkPtr)
+        {
+            //Empty
+        }
+        void cache_forget_all()
+        {
+            //Empty
+        }
+        void swap_cache(LookupCache &)
+        {
+            //Empty
+        }
+        LookupCacheStats cache_stats() const
+        {
+            return LookupCacheStats();
+        }
+        std::size_t cache_bytes() const
+        {
+            return 0;
+        }
+        void reset_cache_stats()
+        {
+            //Empty
+        }
+};
+
+//Open addressing table from the hash of a key to the node with it, next
+//to the tree. Linear probing, a slot holds the full hash so probes
+//compare keys only when the hashes match, and erase shifts the entries
+//after it back instead of leaving tombstones.
+//Growing can throw, callers reserve before they change the tree and the
+//other changes never throw. Erase halves a table that is a quarter full,
+//unless there is no memory for the smaller one.
+template <class Key_T, class LinkPtr, bool Enabled>
+class HashIndex
+{
+    public:
+        HashIndex()
+            : count(0), shift(64)
+        {
+            //Empty
+        }
+
+        //a copy starts empty, the links would be those of the other tree
+        HashIndex(const HashIndex &)
+            : count(0), shift(64)
+        {
+            //Empty
+        }
+        HashIndex & operator=(const HashIndex &) = delete;
+
+        //room for total entries without growing
+        void index_reserve(std::size_t total);
+
+        //a node that is not in the table yet, there has to be room
+        void index_add(const Key_T & key, LinkPtr node);
+        void index_remove(const Key_T & key, LinkPtr node);
+
+        //the node with the key, same(node) confirms it
+        template <class Same>
+        LinkPtr index_find(const Key_T & key, Same same) const;
+
+        //empty the table and keep its memory for as many entries again,
+        //or give it back
+        void index_clear()
+        {
+            std::fill(slots.begin(), slots.end(), Slot());
+            count = 0;
+        }
+        void index_release()
+        {
+            std::vector<Slot>().swap(slots);
+            count = 0;
+            shift = 64;
+        }
+
+        void swap_index(HashIndex & other)
+        {
+            slots.swap(other.slots);
+            std::swap(count, other.count);
+            std::swap(shift, other.shift);
+        }
+
+        std::size_t index_size() const
+        {
+            return count;
+        }
+        std::size_t index_bytes() const
+        {
+            return slots.capacity() * sizeof(Slot);
+        }
+
+    private:
+        struct Slot
+        {
+            std::size_t hash;
+            LinkPtr node;
+
+            Slot()
+                : hash(0), node(0)
+            {
+                //Empty
+            }
+        };
+
+        std::vector<Slot> slots;
+        std::size_t count;
+        unsigned shift;
+
+        //the top bits of the mixed hash, std::hash of an integer is often
+        //the integer itself
+        std::size_t home(std::size_t hash) const
+        {
+            return std::size_t((std::uint64_t(hash) * 0x9e3779b97f4a7c15ULL) >> shift);
+        }
+        std::size_t next(std::size_t slot) const
+        {
+            return (slot + 1) & (slots.size() - 1);
+        }
+
+        void place(std::size_t hash, LinkPtr node);
+        void resize(std::size_t size);
+};
+
+//at most three quarters full, the size stays a power of two
+template <class Key_T, class LinkPtr, bool Enabled>
+void HashIndex<Key_T, LinkPtr, Enabled>::index_reserve(std::size_t total)
+{
+    std::size_t size = slots.empty() ? 16 : slots.size();
+    while (total > size / 4 * 3)
+    {
+        size *= 2;
+    }
+    if (size != slots.size())
+    {
+        resize(size);
+    }
+}
+
+//HELPER FUNCTION: move every entry into a table of size slots, a power
+//of two. Only allocating the new table can throw.
+template <class Key_T, class LinkPtr, bool Enabled>
+void HashIndex<Key_T, LinkPtr, Enabled>::resize(std::size_t size)
+{
+    std::vector<Slot> old(size);
+    old.swap(slots);
+    shift = 64;
+    for (std::size_t s = size; s > 1; s /= 2)
+    {
+        --shift;
+    }
+    for (std::size_t i = 0; i < old.size(); ++i)
+    {
+        if (old[i].node != 0)
+        {
+            place(old[i].hash, old[i].node);
+        }
+    }
+}
+
+template <class Key_T, class LinkPtr, bool Enabled>
+void HashIndex<Key_T, LinkPtr, Enabled>::index_add(const Key_T & key, LinkPtr node)
+{
+    place(std::hash<Key_T>()(key), node);
+    ++count;
+}
+
+template <class Key_T, class LinkPtr, bool Enabled>
+void HashIndex<Key_T, LinkPtr, Enabled>::place(std::size_t hash, LinkPtr node)
+{
+    std::size_t slot = home(hash);
+    while (slots[slot].node != 0)
+    {
+        slot = next(slot);
+    }
+    slots[slot].hash = hash;
+    slots[slot].node = node;
+}
+
+//an entry after the hole moves into it unless its home lies cyclically
+//between the hole and the entry, where it would no longer be found
+template <class Key_T, class LinkPtr, bool Enabled>
+void HashIndex<Key_T, LinkPtr, Enabled>::index_remove(const Key_T & key, LinkPtr node)
+{
+    if (slots.empty())
+    {
+        return;
+    }
+    std::size_t hole = home(std::hash<Key_T>()(key));
+    while (slots[hole].node != node)
+    {
+        if (slots[hole].node == 0)
+        {
+            return;
+        }
+        hole = next(hole);
+    }
+
+    for (std::size_t slot = next(hole); slots[slot].node != 0; slot = next(slot))
+    {
+        std::size_t wanted = home(slots[slot].hash);
+        bool between = hole <= slot ? (hole < wanted && wanted <= slot) : (hole < wanted || wanted <= slot);
+        if (!between)
+        {
+            slots[hole] = slots[slot];
+            hole = slot;
+        }
+    }
+    slots[hole] = Slot();
+    --count;
+
+    //half full again, so erasing and inserting around the threshold
+    //does not resize every time
+    if (slots.size() > 16 && count < slots.size() / 4)
+    {
+        try
+        {
+            resize(slots.size() / 2);
+        }
+        catch (const std::bad_alloc &)
+        {
+            //the larger table still works
+        }
+    }
+}
+
+template <class Key_T, class LinkPtr, bool Enabled>
+template <class Same>
+LinkPtr HashIndex<Key_T, LinkPtr, Enabled>::index_find(const Key_T & key, Same same) const
+{
+    if (slots.empty())
+    {
+        return 0;
+    }
+    std::size_t hash = std::hash<Key_T>()(key);
+    for (std::size_t slot = home(hash); slots[slot].node != 0; slot = next(slot))
+    {
+        if (slots[slot].hash == hash && same(slots[slot].node))
+        {
+            return slots[slot].node;
+        }
+    }
+    return 0;
+}
+
+//Without the index the tree is the only way to a key
+template <class Key_T, class LinkPtr>
+class HashIndex<Key_T, LinkPtr, false>
+{
+    public:
+        void index_reserve(std::size_t)
+        {
+            //Empty
+        }
+        void index_add(const Key_T &, LinkPtr)
+        {
+            //Empty
+        }
+        void index_remove(const Key_T &, LinkPtr)
+        {
+            //Empty
+        }
+        template <class Same>
+        LinkPtr index_find(const Key_T &, Same) const
+        {
+            return 0;
+        }
+        void index_clear()
+        {
+            //Empty
+        }
+        void index_release()
+        {
+            //Empty
+        }
+        void swap_index(HashIndex &)
+        {
+            //Empty
+        }
+        std::size_t index_size() const
+        {
+            return 0;
+        }
+        std::size_t index_bytes() const
+        {
+            return 0;
+        }
+};
+
+//forward declaration of the Tree
+template<class Key_T, class Mapped_T, class Policy = DefaultTreePolicy,
+    class Alloc = std::allocator<ValueType<Key_T, Mapped_T>>>
+class Tree;
+
+//Tree pointer
+template<class Key_T, class Mapped_T, class Policy = DefaultTreePolicy,
+    class Alloc = std::allocator<ValueType<Key_T, Mapped_T>>>
+using TreePtr = Tree<Key_T, Mapped_T, Policy, Alloc> *;
+
+//****** DECLARATION OF THE TREE BEGINS HERE *****//
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+class Tree
+    : private Policy::stats,
+      private InlineNodes<Node<Key_T, Mapped_T, Policy>, Policy::inline_capacity>,
+      private LookupCache<Key_T, typename NodeBase<Policy>::LinkPtr, Policy::lookup_cache_sets>,
+      private HashIndex<Key_T, typename NodeBase<Policy>::LinkPtr, Policy::hash_index>
+{
+    static_assert(Policy::inline_capacity == 0 || std::is_same<typename Policy::storage, PointerStorage>::value,
+        "inline_capacity needs PointerStorage");
+
+    //entries of a small tree, see DefaultTreePolicy::inline_capacity
+    typedef InlineNodes<Node<Key_T, Mapped_T, Policy>, Policy::inline_capacity> Inline;
+
+    //nodes of recent searches, see DefaultTreePolicy::lookup_cache_sets
+    typedef LookupCache<Key_T, typename NodeBase<Policy>::LinkPtr, Policy::lookup_cache_sets> Cache;
+
+    //hash table of the nodes, see DefaultTreePolicy::hash_index
+    typedef HashIndex<Key_T, typename NodeBase<Policy>::LinkPtr, Policy::hash_index> Index;
+
+    public:
+
+        //node type and how nodes refer to each other
+        using NodeType = Node<Key_T, Mapped_T, Policy>;
+        using LinkPtr = typename NodeBase<Policy>::LinkPtr;
+
+        //forward declaration for the iterators
+        struct Iterator;
+        struct ConstIterator;
+        struct ReverseIterator;
+
+        //*** Beginning of Iterator definition ***//
+        struct Iterator
+        {
+            //standard iterator traits
+            using iterator_category = std::bidirectional_iterator_tag;
+            using value_type = ValueType<const Key_T, Mapped_T>;
+            using difference_type = std::ptrdiff_t;
+            using pointer = value_type *;
+            using reference = value_type &;
+
+            LinkPtr inode;
+            TreePtr<Key_T, Mapped_T, Policy, Alloc> ptr;
+
+            //no argument constructor
+            Iterator()
+                : inode(0), ptr(0)
+            {
+
+            }
+
+            //Iterator: that takes a node pointer and tree pointer
+            Iterator(LinkPtr node, const TreePtr<Key_T, Mapped_T, Policy, Alloc> tree)
+                : inode(node), ptr(tree)
+            {
+
+            }
+
+            //copy constructor for the iterator
+            Iterator(const Iterator & copy)
+                : inode(copy.inode), ptr(copy.ptr)
+            {
+
+            }
+
+            Iterator & operator=(const Iterator &) = default;
+
+            //overloaded operator equality
+            bool operator==(const Iterator & itTwo) const
+            {
+                return inode == itTwo.inode;
+            }
+            bool operator==(const ConstIterator & itTwo) const
+            {
+                return inode == itTwo.inode;
+            }
+
+            //overloaded operator inequality
+            bool operator!=(const Iterator & itTwo) const
+            {
+                return !(inode == itTwo.inode);
+            }
+            bool operator!=(const ConstIterator & itTwo) const
+            {
+                return !(inode == itTwo.inode);
+            }
+
+            //overloaded operator increment
+            Iterator& operator++()
+            {
+                increment();
+                return *this;
+            }
+            Iterator operator++(int)
+            {
+                Iterator temp(*this);
+                increment();
+                return temp;
+            }
+
+            //overloaded operator decrement
+            Iterator& operator--()
+            {
+                decrement();
+                return *this;
+            }
+            Iterator operator--(int)
+            {
+                Iterator temp(*this);
+                decrement();
+                return temp;
+            }
+
+            //overloaded operator: pointer de-referencing
+            reference operator *() const
+            {
+                return ptr->pair_of(inode);
+            }
+            pointer operator->() const
+            {
+                return &(ptr->pair_of(inode));
+            }
+
+            void decrement();
+            void increment();
+        };
+
+        //*** Beginning of CONST Iterator ***//
+        struct ConstIterator
+        {
+            //standard iterator traits
+            using iterator_category = std::bidirectional_iterator_tag;
+            using value_type = ValueType<const Key_T, Mapped_T>;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const value_type *;
+            using reference = const value_type &;
+
+            LinkPtr inode;
+            const Tree<Key_T, Mapped_T, Policy, Alloc> *ptr;
+
+            //empty constructor
+            ConstIterator()
+                : inode(0), ptr(0)
+            {
+
+            }
+
+            //constructor that takes tree pointer and a node pointer
+            ConstIterator(LinkPtr node, const Tree<Key_T, Mapped_T, Policy, Alloc> *tree)
+                : inode(node), ptr(tree)
+            {
+
+            }
+
+            ConstIterator(const ConstIterator & iter)
+                : inode(iter.inode), ptr(iter.ptr)
+            {
+
+            }
+
+            //a mutable iterator can always be used as a const one
+            ConstIterator(const Iterator & iter)
+                : inode(iter.inode), ptr(iter.ptr)
+            {
+
+            }
+
+            ConstIterator & operator=(const ConstIterator &) = default;
+
+            //operator overloading equality
+            bool operator==(const Iterator & itTwo) const
+            {
+                return inode == itTwo.inode;
+            }
+            bool operator==(const ConstIterator & itTwo) const
+            {
+                return inode == itTwo.inode;
+            }
+
             //operator overloading inequality
-            bool operator!=(const Iterator & itTwo)
+            bool operator!=(const Iterator & itTwo) const
             {
                 return !(inode == itTwo.inode);
             }
 
-            bool operator!=(const ConstIterator & itTwo)
+            bool operator!=(const ConstIterator & itTwo) const
             {
                 return !(inode == itTwo.inode);
             }
@@ -250,13 +3146,13 @@ class Tree
                 decrement();
                 return temp;
             }
-            const ValueType<const Key_T, Mapped_T> & operator *() const
+            reference operator *() const
             {
-                return inode->pair;
+                return ptr->pair_of(inode);
             }
-            const ValueType<const Key_T, Mapped_T> * operator-> () const
+            pointer operator-> () const
             {
-                return &(inode->pair);
+                return &(ptr->pair_of(inode));
             }
 
             void increment();
@@ -266,40 +3162,46 @@ class Tree
 
         struct ReverseIterator
         {
-            NodePtr <Key_T, Mapped_T> inode;
-            TreePtr<Key_T, Mapped_T> ptr;
+            //standard iterator traits
+            using iterator_category = std::bidirectional_iterator_tag;
+            using value_type = ValueType<const Key_T, Mapped_T>;
+            using difference_type = std::ptrdiff_t;
+            using pointer = value_type *;
+            using reference = value_type &;
+
+            LinkPtr inode;
+            TreePtr<Key_T, Mapped_T, Policy, Alloc> ptr;
 
             //empty constructor
             ReverseIterator()
+                : inode(0), ptr(0)
             {
-                inode = NULL;
+
             }
 
             //constructor that takes a node and tree
-            ReverseIterator(NodePtr<Key_T, Mapped_T> node, const TreePtr<Key_T, Mapped_T> tree)
-                : ptr(tree)
+            ReverseIterator(LinkPtr node, const TreePtr<Key_T, Mapped_T, Policy, Alloc> tree)
+                : inode(node), ptr(tree)
             {
-                inode = NULL;
-                if (node != NULL)
-                {
-                    inode = node;
-                }
+
             }
             //copy constructor
             ReverseIterator(const ReverseIterator & copy)
+                : inode(copy.inode), ptr(copy.ptr)
             {
-                inode = copy.inode;
-                ptr = copy.ptr;
+
             }
 
+            ReverseIterator & operator=(const ReverseIterator &) = default;
+
             //overloaded operator equality
-            bool operator==(const ReverseIterator & itTwo)
+            bool operator==(const ReverseIterator & itTwo) const
             {
                 return inode == itTwo.inode;
             }
 
             //overloaded operator inequality
-            bool operator!=(const ReverseIterator & itTwo)
+            bool operator!=(const ReverseIterator & itTwo) const
             {
                 return !(inode == itTwo.inode);
             }
@@ -314,7 +3216,7 @@ class Tree
             {
                 ReverseIterator temp(*this);
                 increment();
-                return *this;
+                return temp;
             }
 
             //overloaded operator decrement
@@ -331,13 +3233,13 @@ class Tree
             }
 
             //overloaded pointer de-referencing
-            ValueType<const Key_T, Mapped_T> & operator *() const
+            reference operator *() const
             {
-                return inode->pair;
+                return ptr->pair_of(inode);
             }
-            ValueType<const Key_T, Mapped_T> * operator->() const
+            pointer operator->() const
             {
-                return &(inode->pair);
+                return &(ptr->pair_of(inode));
             }
 
             void increment();
@@ -357,14 +3259,18 @@ class Tree
         const Mapped_T & at(const Key_T &) const;
 
         //forward declaration for the tree constructor
-        Tree<Key_T, Mapped_T>();
+        Tree();
+        explicit Tree(const Alloc &);
+
+        //move constructor, takes the nodes and a copy of the allocator
+        Tree(Tree<Key_T, Mapped_T, Policy, Alloc> && original);
 
         //copy constructor
-        Tree<Key_T, Mapped_T>(const Tree<Key_T, Mapped_T> & otherTree);
+        Tree(const Tree<Key_T, Mapped_T, Policy, Alloc> & otherTree);
 
         bool empty() const
         {
-            return treeRoot == NULL;
+            return size == 0;
         }
 
         size_t sizeR() const
@@ -372,1128 +3278,6264 @@ class Tree
             return size;
         }
 
+        //erased nodes that are still linked, see lazy_erase_ratio
+        size_t dead_count() const
+        {
+            return deadCount;
+        }
+
+        //*** Node handle ***//
+        //owns a node taken out of a tree, see extract() and insert()
+        class NodeHandle
+        {
+            public:
+                using key_type = Key_T;
+                using mapped_type = Mapped_T;
+                using allocator_type = Alloc;
+
+                NodeHandle()
+                    : node(0)
+                {
+                    //Empty
+                }
+
+                NodeHandle(NodeHandle && other)
+                    : node(other.node), alloc(other.alloc)
+                {
+                    other.node = 0;
+                }
+
+                NodeHandle & operator=(NodeHandle && other)
+                {
+                    if (this != &other)
+                    {
+                        reset();
+                        node = other.node;
+                        alloc = other.alloc;
+                        other.node = 0;
+                    }
+                    return *this;
+                }
+
+                NodeHandle(const NodeHandle &) = delete;
+                NodeHandle & operator=(const NodeHandle &) = delete;
+
+                ~NodeHandle()
+                {
+                    reset();
+                }
+
+                bool empty() const
+                {
+                    return node == 0;
+                }
+                explicit operator bool() const
+                {
+                    return node != 0;
+                }
+
+                //the key can be changed while the node is out of any tree
+                Key_T & key() const
+                {
+                    return const_cast<Key_T &>(node->pair.first);
+                }
+                Mapped_T & mapped() const
+                {
+                    return node->pair.second;
+                }
+
+                allocator_type get_allocator() const
+                {
+                    return alloc;
+                }
+
+                void swap(NodeHandle & other)
+                {
+                    std::swap(node, other.node);
+                    std::swap(alloc, other.alloc);
+                }
+
+            private:
+                friend class Tree;
+                using NodeAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<NodeType>;
+                using NodeTraits = std::allocator_traits<NodeAlloc>;
+
+                NodeType * node;
+                Alloc alloc;
+
+                //handle that owns a node of a tree with the given allocator
+                static NodeHandle own(NodeType * taken, const Alloc & from)
+                {
+                    NodeHandle handle;
+                    handle.node = taken;
+                    handle.alloc = from;
+                    return handle;
+                }
+
+                //give the node up, the caller owns it
+                NodeType * release()
+                {
+                    NodeType * taken = node;
+                    node = 0;
+                    return taken;
+                }
+
+                //destroy and free the node like the storage would
+                void reset()
+                {
+                    if (node != 0)
+                    {
+                        NodeAlloc nodeAlloc(alloc);
+                        NodeTraits::destroy(nodeAlloc, node);
+                        NodeTraits::deallocate(nodeAlloc, std::pointer_traits<typename NodeTraits::pointer>::pointer_to(*node), 1);
+                        node = 0;
+                    }
+                }
+        };
+
+        //take the node out of the tree without freeing it. Needs
+        //PointerStorage, an inline entry is moved to a node of its own.
+        NodeHandle extract(LinkPtr node);
+
+        //link the node of a handle, taken from a tree with an equal
+        //allocator, unless its key is already there. Then the handle keeps
+        //it and the node with that key is returned.
+        LinkPtr insert(NodeHandle && handle, bool & inserted);
+
         //search function declaration along with helper functions
         bool search(const Key_T & key) const;
-        NodePtr<Key_T, Mapped_T> helper_search(const Key_T & key)
+        LinkPtr helper_search(const Key_T & key)
         {
             return hSearch(key);
         }
-        NodePtr<Key_T, Mapped_T> helper_search(const Key_T & key) const
+        LinkPtr helper_search(const Key_T & key) const
         {
             return hSearch(key);
         }
 
-        NodePtr <Key_T, Mapped_T> insert(const Key_T &, const Mapped_T &);
+        //the first live entry whose key is not less than key, or greater
+        //than key when upper, the header when there is none
+        LinkPtr bound(const Key_T & key, bool upper) const;
+
+        LinkPtr insert(const Key_T &, const Mapped_T &);
+
+        //insert unless the key is already there, inserted says which
+        LinkPtr insert_unique(const Key_T &, const Mapped_T &, bool & inserted);
+
+        //the key and data stored in the node behind a link
+        ValueType<Key_T, Mapped_T> & pair_of(LinkPtr node) const
+        {
+            return nodes.node(node).pair;
+        }
         void remove(const Key_T & key)
         {
             remove_node(key);
         }
 
+        //remove the node the iterator points at, returns the next position
+        Iterator remove(Iterator pos)
+        {
+            return Iterator(remove_node(pos.inode), this);
+        }
+
         void display_min_max()
         {
-            std::cout << min_val(treeRoot)->data << std::endl;
-            std::cout << max_val(treeRoot)->data << std::endl;
+            std::cout << pair_of(next_live(header_link())).second << std::endl;
+            std::cout << pair_of(previous_live(header_link())).second << std::endl;
         }
 
         void clear()
         {
             helper_dest();
-            treeRoot = NULL;
+            treeRoot = 0;
             size = 0;
+            deadCount = 0;
+            reset_header();
+            stop_compaction();
         }
 
-        Tree<Key_T, Mapped_T> & operator=(const Tree &);
-        ~Tree<Key_T, Mapped_T>();
+        //replace the contents with count entries from next(), which have
+        //to come in increasing key order. Builds a balanced tree in O(n).
+        template <class Next>
+        void assign_sorted(std::size_t count, Next next);
+
+        //apply a batch sorted by key with one entry per key, values are
+        //moved out of it. A batch that is large against the tree is merged
+        //with it in one in-order pass that relinks every node, a smaller
+        //one is applied entry by entry, in key order so that consecutive
+        //descents share their upper levels.
+        void merge_sorted(std::vector<MergeEntry<Key_T, Mapped_T>> & batch);
+
+        //empty the tree now and destroy the old nodes on the returned
+        //thread, which the caller joins or detaches. The allocator has to
+        //stay usable from that thread until it is done.
+        std::thread clear_background();
+
+        //memory held by the tree, see MemoryUsage for what is counted
+        MemoryUsage memory_usage() const;
+
+        //depth histogram, height and average search path, O(n)
+        TreeShape shape() const;
+
+        //check heights, balance factors, parent links, key order, the
+        //threads or cached ends and the size, O(n)
+        bool validate() const;
+
+        //counters of the instrumentation policy, all zero without one
+        TreeStats stats() const
+        {
+            return counters().snapshot();
+        }
+        void reset_stats()
+        {
+            counters().reset();
+            Cache::reset_cache_stats();
+        }
+
+        //hits and misses of the lookup cache, all zero without one
+        LookupCacheStats lookup_cache_stats() const
+        {
+            return Cache::cache_stats();
+        }
+
+        //move every node into fresh storage laid out in the given order.
+        //Breadth first is O(n), van Emde Boas O(n log log n). Invalidates
+        //iterators, the tree stays fully usable afterwards.
+        void compact(CompactOrder order = CompactOrder::breadth_first);
+
+        //relocate up to budget nodes in breadth first order, returns true
+        //once a whole pass is done. Inserts between calls are fine, a
+        //remove starts the pass over. Invalidates iterators.
+        bool compact_step(std::size_t budget);
+
+        Tree<Key_T, Mapped_T, Policy, Alloc> & operator=(const Tree &);
+        Tree<Key_T, Mapped_T, Policy, Alloc> & operator=(Tree &&);
+        ~Tree();
+
+        //exchange the contents, the allocators are exchanged only when they
+        //propagate on swap, otherwise they have to compare equal
+        void swap(Tree &);
+
+        using allocator_type = Alloc;
+        allocator_type get_allocator() const
+        {
+            return allocator_type(nodes.get_allocator());
+        }
 
     private:
         //root of the tree
-        NodePtr<Key_T, Mapped_T> treeRoot;
+        LinkPtr treeRoot;
         size_t size;
 
+        //dead nodes still in the tree, size does not count them
+        size_t deadCount;
+
+        //nodes still to be moved by compact_step() and where it is at
+        std::vector<LinkPtr> compactQueue;
+        std::size_t compactNext;
+
+        void stop_compaction()
+        {
+            compactQueue.clear();
+            compactNext = 0;
+        }
+
+        //move a single node and point its neighbours at the new place
+        LinkPtr relocate_node(LinkPtr node);
+        void relink_order(LinkPtr from, LinkPtr to, std::true_type);
+        void relink_order(LinkPtr from, LinkPtr to, std::false_type);
+
+        //node orders for compact()
+        void breadth_first_order(std::vector<LinkPtr> &) const;
+        void van_emde_boas_order(LinkPtr, int, std::vector<LinkPtr> &) const;
+        void collect_level(LinkPtr, int, std::vector<LinkPtr> &) const;
+
+        //where the nodes live, it also owns the header
+        typename Policy::storage::template store<NodeType, Alloc> nodes;
+
+        using AllocTraits = std::allocator_traits<Alloc>;
+
+        //exchange every node with another tree, the allocators only when
+        //they propagate
+        template <class Propagate>
+        void swap_contents(Tree & other, Propagate);
+
+        //point the end nodes at this tree's header after a swap
+        void adopt_header()
+        {
+            if (treeRoot == 0)
+            {
+                reset_header();
+            }
+            else
+            {
+                adopt_header(Threaded());
+            }
+        }
+        void adopt_header(std::true_type)
+        {
+            links(links(header_link()).listNext).listPrevious = header_link();
+            links(links(header_link()).listPrevious).listNext = header_link();
+        }
+        void adopt_header(std::false_type)
+        {
+            //Empty
+        }
+
+        //sentinel that closes the iteration order, it is the end() position.
+        //A threaded header's listNext is the leftmost node and its
+        //listPrevious the rightmost, otherwise left and right cache them.
+        LinkPtr header_link() const
+        {
+            return nodes.header_link();
+        }
+
+        //does the tree keep the listPrevious/listNext thread
+        typedef std::integral_constant<bool, Policy::threaded> Threaded;
+
+        //point the header back at itself, the state of an empty tree
+        void reset_header()
+        {
+            reset_header(Threaded());
+        }
+        void reset_header(std::true_type)
+        {
+            links(header_link()).listNext = header_link();
+            links(header_link()).listPrevious = header_link();
+        }
+        void reset_header(std::false_type)
+        {
+            links(header_link()).left = header_link();
+            links(header_link()).right = header_link();
+        }
+
+        //in-order neighbours, the header comes before the leftmost
+        //node and after the rightmost one
+        LinkPtr next_link(LinkPtr node) const
+        {
+            if (inline_mode())
+            {
+                return inline_next(node);
+            }
+            return next_link(node, Threaded());
+        }
+        LinkPtr previous_link(LinkPtr node) const
+        {
+            if (inline_mode())
+            {
+                return inline_previous(node);
+            }
+            return previous_link(node, Threaded());
+        }
+        LinkPtr next_link(LinkPtr node, std::true_type) const
+        {
+            return links(node).listNext;
+        }
+        LinkPtr previous_link(LinkPtr node, std::true_type) const
+        {
+            return links(node).listPrevious;
+        }
+        LinkPtr next_link(LinkPtr node, std::false_type) const;
+        LinkPtr previous_link(LinkPtr node, std::false_type) const;
+
+        //does erase leave dead nodes behind
+        typedef std::integral_constant<bool, (Policy::lazy_erase_ratio > 0)> LazyErase;
+
+        //in-order neighbours that are not dead, the iterators step with these
+        LinkPtr next_live(LinkPtr node) const
+        {
+            do
+            {
+                node = next_link(node);
+            } while (LazyErase::value && node != header_link() && links(node).dead);
+            return node;
+        }
+        LinkPtr previous_live(LinkPtr node) const
+        {
+            do
+            {
+                node = previous_link(node);
+            } while (LazyErase::value && node != header_link() && links(node).dead);
+            return node;
+        }
+
+        //mark a node dead or alive again, size only counts live ones
+        LinkPtr bury(LinkPtr node);
+        void revive(LinkPtr node)
+        {
+            links(node).dead = false;
+            ++size;
+            --deadCount;
+            Index::index_add(key_of(node), node);
+        }
+
+        //rebuild the tree without its dead nodes
+        void purge_dead();
+
+        //are the nodes in a hash table too, see DefaultTreePolicy::hash_index
+        typedef std::integral_constant<bool, Policy::hash_index> Hashed;
+
+        //fill the hash index again from the live nodes, it has to have
+        //room for them
+        void index_rebuild();
+
+        //while the tree is small its entries sit in the inline array in key
+        //order, the root stays empty and size counts the entries
+        using Inline::inline_mode;
+        using Inline::inline_count;
+
+        //link of the entry at a position of the inline array and back
+        LinkPtr inline_link(std::size_t position) const
+        {
+            return nodes.link_of(*Inline::inline_node(position));
+        }
+        std::size_t inline_position(LinkPtr node) const
+        {
+            return Inline::inline_position(&nodes.node(node));
+        }
+
+        //neighbours in the inline array, the header closes both ends
+        LinkPtr inline_next(LinkPtr node) const;
+        LinkPtr inline_previous(LinkPtr node) const;
+
+        //linear search, the position of the first entry not less than key
+        //and the key compared to it
+        std::size_t inline_lower_bound(const Key_T & key, int & cmp) const;
+        LinkPtr inline_search(const Key_T & key) const;
+
+        LinkPtr inline_remove(LinkPtr node);
+
+        //link the entries into the tree where they are once the array is
+        //full. Until they are erased the nodes stay in the array.
+        void spill_inline();
+
+        //is a tree node one that stayed in the inline array
+        bool in_inline_array(LinkPtr node) const
+        {
+            return Inline::inline_holds(&nodes.node(node));
+        }
+
+        //destroy a node that is out of the tree, wherever it lives
+        void free_node(LinkPtr node);
+
+        //move a node to a new place, one in the inline array goes to the
+        //heap. The caller fixes the links to it.
+        LinkPtr move_node(LinkPtr node);
+
+        //move the tree nodes still in the inline array to the heap, for
+        //when the tree hands its nodes to another one
+        void evict_inline();
+
+        //link nodes in key order into a balanced subtree, returns its root.
+        //Threaded nodes get their thread in the same visit, thread_sorted()
+        //then only links the ends to the header.
+        LinkPtr link_sorted(const std::vector<LinkPtr> & order);
+        LinkPtr link_sorted(const std::vector<LinkPtr> & order, std::size_t first, std::size_t last, LinkPtr parent,
+            std::size_t depth, std::size_t bottom);
+        void merge_relink(std::vector<MergeEntry<Key_T, Mapped_T>> & batch);
+        void thread_sorted(const std::vector<LinkPtr> & order, std::true_type);
+        void thread_sorted(const std::vector<LinkPtr> & order, std::false_type);
+        void thread_node(const std::vector<LinkPtr> & order, std::size_t i, std::true_type)
+        {
+            NodeBase<Policy> & link = links(order[i]);
+            link.listPrevious = i == 0 ? header_link() : order[i - 1];
+            link.listNext = i + 1 == order.size() ? header_link() : order[i + 1];
+        }
+        void thread_node(const std::vector<LinkPtr> &, std::size_t, std::false_type)
+        {
+            //Empty
+        }
+
+        //add a new node to, or take a node out of, the iteration order
+        void link_order(LinkPtr node, std::true_type);
+        void link_order(LinkPtr node, std::false_type);
+        void unlink_order(LinkPtr node, std::true_type);
+        void unlink_order(LinkPtr node, std::false_type);
+
+        //links of the node behind a link
+        NodeBase<Policy> & links(LinkPtr node) const
+        {
+            return nodes.links(node);
+        }
+
+        //key stored in the node behind a link
+        const Key_T & key_of(LinkPtr node) const
+        {
+            return nodes.node(node).pair.first;
+        }
+
+        //the instrumentation policy, a base so that NoStats takes no room
+        const typename Policy::stats & counters() const
+        {
+            return *this;
+        }
+
+        //three-way key comparison that the instrumentation can count
+        int three_way(const Key_T & a, const Key_T & b) const
+        {
+            counters().compare();
+            return KeyCompare<Key_T>::compare(a, b);
+        }
+
+        //whether nodes cache KeyPrefix of their key
+        typedef std::integral_constant<bool, Policy::key_prefix && KeyPrefix<Key_T>::enabled> PrefixCached;
+
+        //compare a key, with its prefix, to the key of a node. Cached
+        //prefixes settle it when they differ.
+        int compare_node(const Key_T & key, std::uint64_t prefix, LinkPtr node) const
+        {
+            return compare_node(key, prefix, node, PrefixCached());
+        }
+        int compare_node(const Key_T & key, std::uint64_t prefix, LinkPtr node, std::true_type) const
+        {
+            const NodeType & other = nodes.node(node);
+            if (prefix != other.keyPrefix)
+            {
+                return prefix < other.keyPrefix ? -1 : 1;
+            }
+            return three_way(key, other.pair.first);
+        }
+        int compare_node(const Key_T & key, std::uint64_t, LinkPtr node, std::false_type) const
+        {
+            return three_way(key, key_of(node));
+        }
+
+        //compute the cached prefix again after the key has changed
+        void refresh_prefix(NodeType & node, std::true_type)
+        {
+            node.keyPrefix = KeyPrefix<Key_T>::prefix(node.pair.first);
+        }
+        void refresh_prefix(NodeType &, std::false_type)
+        {
+            //Empty
+        }
+
+        //child a descent continues with after comparing the key to a
+        //node, a select rather than a branch
+        LinkPtr child(LinkPtr node, int cmp) const
+        {
+            const NodeBase<Policy> & link = links(node);
+            return cmp < 0 ? link.left : link.right;
+        }
+
+        //walk down to the node holding the key. Without one, parent is
+        //the node a new key hangs off and cmp says on which side.
+        LinkPtr descend(const Key_T & key, LinkPtr & parent, int & cmp) const;
+
         //*** HELPER FUNCTIONS *****
-        //update height after insert and remove
-        void adjust_height_insert(NodePtr<Key_T, Mapped_T> &);
-        void adjust_height_remove(NodePtr<Key_T, Mapped_T> &);
+        //rotations and rebalancing
+        typedef typename Policy::balance::template algorithms<Tree> Balance;
+        friend Balance;
+        friend struct BinaryTreeAlgorithms<Tree>;
 
         //helper function copy
-        void helper_copy_const(const Tree<Key_T, Mapped_T> &);
+        void helper_copy_const(const Tree<Key_T, Mapped_T, Policy, Alloc> &);
 
         //helper function when the tree is destroyed
         void helper_dest();
 
-        //post order traversal
-        void post_order_traversal(NodePtr<Key_T, Mapped_T>);
-
-        //balance factor
-        short int balance_factor(const NodePtr<Key_T, Mapped_T> &) const;
-
-        short int height(const NodePtr<Key_T, Mapped_T> &) const;
-
-        void get_balance_factor(NodePtr<Key_T, Mapped_T> &);
-
-        //what is the height of the current node
-        void get_height(const NodePtr<Key_T, Mapped_T> &) const;
-
-        //left rotation
-        void left_rotation(NodePtr<Key_T, Mapped_T>);
-
-        //right rotation
-        void right_rotation(NodePtr<Key_T, Mapped_T>);
-
-        //left-right rotation
-        void left_right_rotation(NodePtr<Key_T, Mapped_T> &);
-
-        //right-left rotation
-        void right_left_rotation(NodePtr<Key_T, Mapped_T> &);
-
-        void preform_rotation(NodePtr<Key_T, Mapped_T> &);
-        void preform_remove(NodePtr<Key_T, Mapped_T> &);
-
-        NodePtr<Key_T, Mapped_T> min_val(const NodePtr<Key_T, Mapped_T> &) const;
-        NodePtr<Key_T, Mapped_T> max_val(const NodePtr<Key_T, Mapped_T> &) const;
-
-
-        NodePtr<Key_T, Mapped_T> get_successor(NodePtr<Key_T, Mapped_T>);
-        NodePtr<Key_T, Mapped_T> get_predecessor(NodePtr<Key_T, Mapped_T>);
+        //destroy every node of the tree without recursion
+        void destroy_nodes();
+        void destroy_subtree(LinkPtr);
 
         //helper search functions
-        NodePtr<Key_T, Mapped_T> hSearch(const Key_T &) const;
-        NodePtr<Key_T, Mapped_T> hSearch(const Key_T &);
+        LinkPtr hSearch(const Key_T &) const;
+        LinkPtr hSearch(const Key_T &);
 
         void remove_node(const Key_T &);
+        LinkPtr remove_node(LinkPtr);
+        LinkPtr unlink_node(LinkPtr);
 };
 
 //**** END OF TREE DECLARATIONS *****//
 
 //**** IMPLEMENT OF FUNCTIONS STARTS HERE ****//
 //implementation for the default constructor
-template<class Key_T, class Mapped_T>
-Tree<Key_T, Mapped_T>::Tree()
-    : treeRoot(0), size(0)
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+Tree<Key_T, Mapped_T, Policy, Alloc>::Tree()
+    : treeRoot(0), size(0), deadCount(0), compactNext(0)
 {
-    //empty constructor
+    reset_header();
 }
 
+//constructor with the allocator the nodes come from
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+Tree<Key_T, Mapped_T, Policy, Alloc>::Tree(const Alloc & alloc)
+    : treeRoot(0), size(0), deadCount(0), compactNext(0), nodes(alloc)
+{
+    reset_header();
+}
+
+//MOVE CONSTRUCTOR
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+Tree<Key_T, Mapped_T, Policy, Alloc>::Tree(Tree<Key_T, Mapped_T, Policy, Alloc> && original)
+    : Policy::stats(), Inline(), Cache(), Index(), treeRoot(0), size(0), deadCount(0), compactNext(0), nodes(original.get_allocator())
+{
+    reset_header();
+    swap_contents(original, std::false_type());
+}
+
 //COPY CONSTRUCTOR
-template<class Key_T, class Mapped_T>
-Tree<Key_T, Mapped_T>::Tree(const Tree<Key_T, Mapped_T> & original)
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+Tree<Key_T, Mapped_T, Policy, Alloc>::Tree(const Tree<Key_T, Mapped_T, Policy, Alloc> & original)
+    : Policy::stats(), Inline(), Cache(), Index(), treeRoot(0), size(0), deadCount(0), compactNext(0), nodes(original.nodes)
 {
+    reset_header();
 	helper_copy_const(original);
 }
 
 //DESTRUCTOR
-template<class Key_T, class Mapped_T>
-Tree<Key_T, Mapped_T>::~Tree()
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+Tree<Key_T, Mapped_T, Policy, Alloc>::~Tree()
 {
 	helper_dest();
 }
 
 //OPERATOR OVERLOADED: equality
-template<class Key_T, class Mapped_T>
-Tree<Key_T, Mapped_T> & Tree<Key_T, Mapped_T>::operator = (const Tree<Key_T, Mapped_T> & original)
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+Tree<Key_T, Mapped_T, Policy, Alloc> & Tree<Key_T, Mapped_T, Policy, Alloc>::operator = (const Tree<Key_T, Mapped_T, Policy, Alloc> & original)
 {
-    //helper destructor
-	helper_dest();
-	helper_copy_const(original);
+    if (this != &original)
+    {
+        clear();
+        nodes.copy_allocator(original.nodes, typename AllocTraits::propagate_on_container_copy_assignment());
+        helper_copy_const(original);
+    }
 	return *this;
 }
 
+//OPERATOR OVERLOADED: move assignment, the nodes are taken over when the
+//allocator propagates or both allocators are equal, copied otherwise
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+Tree<Key_T, Mapped_T, Policy, Alloc> & Tree<Key_T, Mapped_T, Policy, Alloc>::operator = (Tree<Key_T, Mapped_T, Policy, Alloc> && original)
+{
+    typedef typename AllocTraits::propagate_on_container_move_assignment Propagate;
+    if (this != &original)
+    {
+        clear();
+        if (Propagate::value || nodes.same_allocator(original.nodes))
+        {
+            nodes.copy_allocator(original.nodes, Propagate());
+            swap_contents(original, std::false_type());
+        }
+        else
+        {
+            helper_copy_const(original);
+            original.clear();
+        }
+    }
+	return *this;
+}
+
+//SWAP
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::swap(Tree<Key_T, Mapped_T, Policy, Alloc> & other)
+{
+    if (this != &other)
+    {
+        swap_contents(other, typename AllocTraits::propagate_on_container_swap());
+    }
+}
+
+//HELPER FUNCTION: exchange nodes, bookkeeping and headers
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+template<class Propagate>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::swap_contents(Tree<Key_T, Mapped_T, Policy, Alloc> & other, Propagate propagate)
+{
+    //nodes still in an inline array would stay behind
+    evict_inline();
+    other.evict_inline();
+    nodes.swap(other.nodes, propagate);
+    std::swap(treeRoot, other.treeRoot);
+    std::swap(size, other.size);
+    std::swap(deadCount, other.deadCount);
+    compactQueue.swap(other.compactQueue);
+    std::swap(compactNext, other.compactNext);
+    Inline::swap_inline(other);
+    Cache::swap_cache(other);
+    Index::swap_index(other);
+    adopt_header();
+    other.adopt_header();
+}
+
 //HELPER FUNCTION: Copy Constructor
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::helper_copy_const(const Tree<Key_T, Mapped_T> & original)
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::helper_copy_const(const Tree<Key_T, Mapped_T, Policy, Alloc> & original)
 {
-	Tree<Key_T, Mapped_T>::ConstIterator x = original.begin();
+    //storage that can copy its nodes wholesale keeps the same shape
+    Index::index_reserve(original.size);
+    if (nodes.clone(original.nodes))
+    {
+        treeRoot = original.treeRoot;
+        size = original.size;
+        deadCount = original.deadCount;
+        index_rebuild();
+        return;
+    }
+
+	typename Tree<Key_T, Mapped_T, Policy, Alloc>::ConstIterator x = original.begin();
 	for (; x != original.end(); ++x)
     {
         insert(x->first, x->second);
     }
 }
 
-//HELPER FUNCTION: Destructor
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::helper_dest()
+//HELPER FUNCTION: Destructor, storage that can drop every node at once
+//does, otherwise the nodes are destroyed one by one
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::helper_dest()
 {
-	post_order_traversal(treeRoot);
+	if (nodes.destroy_all())
+    {
+		counters().free(size + deadCount);
+	}
+	else if (treeRoot != 0)
+    {
+        destroy_nodes();
+    }
+	Inline::inline_clear();
+	Inline::set_inline_mode(true);
+	Cache::cache_forget_all();
+	Index::index_release();
+	nodes.reset();
 }
 
-//HELPER FUNCTION: Post Order Traversal
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::post_order_traversal(NodePtr<Key_T, Mapped_T> root)
+//BULK BUILD: nodes are created in key order, then linked with the middle
+//one of every range as its root, so no rotation is needed
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+template<class Next>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::assign_sorted(std::size_t count, Next next)
+{
+	clear();
+	const char * unordered = "entries are not in increasing key order";
+
+	//a small tree stays in the inline array
+	if (inline_mode() && count <= Policy::inline_capacity)
+    {
+		try
+        {
+			for (std::size_t i = 0; i < count; ++i)
+            {
+				ValueType<Key_T, Mapped_T> entry = next();
+				if (i > 0 && three_way(key_of(inline_link(i - 1)), entry.first) >= 0)
+                {
+                    throw std::invalid_argument(unordered);
+                }
+				Inline::inline_emplace(i, entry.first, entry.second);
+				++size;
+			}
+		}
+		catch (...)
+        {
+			clear();
+			throw;
+		}
+		return;
+	}
+
+	std::vector<LinkPtr> order;
+	order.reserve(count);
+	Index::index_reserve(count);
+	try
+    {
+		for (std::size_t i = 0; i < count; ++i)
+        {
+			ValueType<Key_T, Mapped_T> entry = next();
+			if (i > 0 && three_way(key_of(order.back()), entry.first) >= 0)
+            {
+                throw std::invalid_argument(unordered);
+            }
+			order.push_back(nodes.create(entry));
+			counters().allocation();
+		}
+	}
+	catch (...)
+    {
+		for (std::size_t i = 0; i < order.size(); ++i)
+        {
+			nodes.destroy(order[i]);
+			counters().free();
+		}
+		throw;
+	}
+
+	Inline::set_inline_mode(false);
+	treeRoot = link_sorted(order);
+	thread_sorted(order, Threaded());
+	size = order.size();
+	index_rebuild();
+}
+
+//BULK MERGE: relinking walks all n nodes once, applying the entries one
+//by one costs a descent each. Relink when the batch is an eighth of the
+//tree or more.
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::merge_sorted(std::vector<MergeEntry<Key_T, Mapped_T>> & batch)
+{
+	if (!inline_mode() && batch.size() * 8 >= size)
+    {
+		merge_relink(batch);
+		return;
+	}
+
+	for (std::size_t i = 0; i < batch.size(); ++i)
+    {
+		MergeEntry<Key_T, Mapped_T> & entry = batch[i];
+		if (entry.op == MergeOp::erase)
+        {
+			remove_node(entry.first);
+			continue;
+		}
+		bool inserted;
+		LinkPtr node = insert_unique(entry.first, entry.second, inserted);
+		if (!inserted && entry.op == MergeOp::put)
+        {
+            pair_of(node).second = std::move(entry.second);
+        }
+	}
+}
+
+//HELPER FUNCTION: merge the batch with the nodes in key order. New nodes
+//are created before any existing one is touched, so running out of memory
+//leaves the tree as it was. Then every node is linked again like
+//assign_sorted() does, and the erased ones are destroyed.
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::merge_relink(std::vector<MergeEntry<Key_T, Mapped_T>> & batch)
+{
+	std::vector<LinkPtr> order, created, doomed;
+	std::vector<std::pair<LinkPtr, std::size_t>> updates;
+	order.reserve(size + batch.size());
+	Index::index_reserve(size + batch.size());
+
+	LinkPtr node = next_link(header_link());
+	try
+    {
+		for (std::size_t i = 0; i < batch.size(); ++i)
+        {
+			MergeEntry<Key_T, Mapped_T> & entry = batch[i];
+			int cmp = -1;
+			while (node != header_link() && (cmp = three_way(key_of(node), entry.first)) < 0)
+            {
+				(links(node).dead ? doomed : order).push_back(node);
+				node = next_link(node);
+			}
+			if (node != header_link() && cmp == 0)
+            {
+				if (entry.op == MergeOp::erase)
+                {
+                    doomed.push_back(node);
+                }
+				else
+                {
+					//a dead node takes the value like a new one would
+					if (entry.op == MergeOp::put || links(node).dead)
+                    {
+                        updates.push_back(std::make_pair(node, i));
+                    }
+					order.push_back(node);
+				}
+				node = next_link(node);
+			}
+			else if (entry.op != MergeOp::erase)
+            {
+				created.push_back(nodes.create(entry.first, entry.second));
+				counters().allocation();
+				order.push_back(created.back());
+			}
+		}
+	}
+	catch (...)
+    {
+		for (std::size_t i = 0; i < created.size(); ++i)
+        {
+			nodes.destroy(created[i]);
+			counters().free();
+		}
+		throw;
+	}
+	for (; node != header_link(); node = next_link(node))
+    {
+        (links(node).dead ? doomed : order).push_back(node);
+    }
+
+	//erased keys leave their nodes, which are destroyed below
+	Cache::cache_forget_all();
+	stop_compaction();
+	treeRoot = link_sorted(order);
+	reset_header();
+	thread_sorted(order, Threaded());
+	size = order.size();
+	deadCount = 0;
+	for (std::size_t i = 0; i < doomed.size(); ++i)
+    {
+		free_node(doomed[i]);
+	}
+	if (size == 0 && Policy::inline_capacity != 0)
+    {
+        Inline::set_inline_mode(true);
+    }
+
+	for (std::size_t i = 0; i < updates.size(); ++i)
+    {
+		links(updates[i].first).dead = false;
+        pair_of(updates[i].first).second = std::move(batch[updates[i].second].second);
+    }
+	index_rebuild();
+}
+
+//HELPER FUNCTION: the halves of a range differ by at most one node, so
+//every subtree is balanced and the deepest level is floor(log2(n))
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::link_sorted(const std::vector<LinkPtr> & order)
+{
+	std::size_t bottom = 0;
+	while ((order.size() >> bottom) > 1)
+    {
+        ++bottom;
+    }
+	return link_sorted(order, 0, order.size(), 0, 0, bottom);
+}
+
+//HELPER FUNCTION: children first, so the balancing data of a node can
+//be derived from theirs
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::link_sorted(const std::vector<LinkPtr> & order, std::size_t first, std::size_t last, LinkPtr parent,
+    std::size_t depth, std::size_t bottom)
+{
+	if (first == last)
+    {
+        return 0;
+    }
+	std::size_t middle = first + (last - first) / 2;
+	LinkPtr node = order[middle];
+	links(node).parent = parent;
+	thread_node(order, middle, Threaded());
+	links(node).left = link_sorted(order, first, middle, node, depth + 1, bottom);
+	links(node).right = link_sorted(order, middle + 1, last, node, depth + 1, bottom);
+	Balance::built(*this, node, depth, bottom);
+	return node;
+}
+
+//HELPER FUNCTION: the header closes the thread link_sorted() made
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::thread_sorted(const std::vector<LinkPtr> & order, std::true_type)
+{
+	if (!order.empty())
+    {
+		links(header_link()).listNext = order.front();
+		links(header_link()).listPrevious = order.back();
+	}
+}
+
+//HELPER FUNCTION: only the cached ends
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::thread_sorted(const std::vector<LinkPtr> & order, std::false_type)
+{
+	if (!order.empty())
+    {
+		links(header_link()).left = order.front();
+		links(header_link()).right = order.back();
+	}
+}
+
+//CLEAR: hand the nodes to a tree of their own, it is destroyed on a new
+//thread
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+std::thread Tree<Key_T, Mapped_T, Policy, Alloc>::clear_background()
 {
-	if (root == NULL)
+	std::unique_ptr<Tree> old(new Tree(get_allocator()));
+	old->swap_contents(*this, std::false_type());
+	stop_compaction();
+
+	Tree * doomed = old.get();
+	std::thread worker([doomed]() { delete doomed; });
+	old.release();
+	return worker;
+}
+
+//HELPER FUNCTION: destroy the nodes parent first, with the children still
+//to go on a small stack. Each pending node is the sibling of a node on the
+//path from the root, so the stack never outgrows the height of the tree,
+//and an AVL tree of 2^64 nodes is under 93 levels. A subtree that finds
+//the stack full, in a deeper tree, goes to destroy_subtree().
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::destroy_nodes()
+{
+	LinkPtr pending[2 * std::numeric_limits<std::size_t>::digits];
+	const std::size_t capacity = sizeof(pending) / sizeof(pending[0]);
+	std::size_t top = 0;
+	pending[top++] = treeRoot;
+	while (top != 0)
     {
-		return;
-	}
-	else
-	{
-		post_order_traversal(root->left);
-		post_order_traversal(root->right);
-		delete root;
+		LinkPtr node = pending[--top];
+		const NodeBase<Policy> & link = links(node);
+		LinkPtr children[2] = { link.right, link.left };
+		free_node(node);
+		for (LinkPtr child : children)
+        {
+			if (child == 0)
+            {
+                continue;
+            }
+			if (top < capacity)
+            {
+                pending[top++] = child;
+            }
+			else
+            {
+                destroy_subtree(child);
+            }
+		}
+	}
+}
+
+//HELPER FUNCTION: destroy a subtree without a stack. A node with a left
+//child is rotated right until it has none, then it goes and its right
+//child is next. Every rotation moves a node to the right spine for good,
+//so this is O(n), allocates nothing and works at any height.
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::destroy_subtree(LinkPtr node)
+{
+	while (node != 0)
+    {
+		NodeBase<Policy> & link = links(node);
+		if (link.left != 0)
+        {
+			LinkPtr left = link.left;
+			link.left = links(left).right;
+			links(left).right = node;
+			node = left;
+			continue;
+		}
+
+		LinkPtr right = link.right;
+		free_node(node);
+		node = right;
 	}
 }
 
 //*** SEARCH FUNCTION ****//
-template<class Key_T, class Mapped_T>
-bool Tree<Key_T, Mapped_T>::search(const Key_T & key) const
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+bool Tree<Key_T, Mapped_T, Policy, Alloc>::search(const Key_T & key) const
 {
-	NodePtr<Key_T, Mapped_T> nodePtr = treeRoot;
-	bool found = false;
-	while (!found && nodePtr != 0)
+	return hSearch(key) != 0;
+}
+
+//HELPER FUNCTION: descent with one three-way comparison per level
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::descend(const Key_T & key, LinkPtr & parent, int & cmp) const
+{
+	LinkPtr nodePtr = treeRoot;
+	std::uint64_t prefix = PrefixCached::value ? KeyPrefix<Key_T>::prefix(key) : 0;
+	parent = 0;
+	cmp = 0;
+	while (nodePtr != 0)
     {
-		if (key < nodePtr->key)
-		{
-		    nodePtr = nodePtr->left;
-		}
-		else if (nodePtr->key < key)
+		counters().visit();
+		cmp = compare_node(key, prefix, nodePtr);
+		if (cmp == 0)
         {
-            nodePtr = nodePtr->right;
-        }
-		else
-        {
-            found = true;
+            return nodePtr;
         }
+		parent = nodePtr;
+		nodePtr = child(nodePtr, cmp);
 	}
-	return found;
+	return 0;
 }
 
 //*** AT FUNCTION ***//
-template<class Key_T, class Mapped_T>
-Mapped_T & Tree<Key_T, Mapped_T>::at(const Key_T & key)
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+Mapped_T & Tree<Key_T, Mapped_T, Policy, Alloc>::at(const Key_T & key)
 {
-	NodePtr<Key_T, Mapped_T> temp = hSearch(key);
-	if (temp == NULL)
+	LinkPtr temp = hSearch(key);
+	if (temp == 0)
     {
         throw std::out_of_range("not in range");
     }
-	return temp->data;
+	return pair_of(temp).second;
 }
-template<class Key_T, class Mapped_T>
-const Mapped_T & Tree<Key_T, Mapped_T>::at(const Key_T & key) const
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+const Mapped_T & Tree<Key_T, Mapped_T, Policy, Alloc>::at(const Key_T & key) const
 {
-	NodePtr<Key_T, Mapped_T> temp = hSearch(key);
-	if (temp == NULL)
+	LinkPtr temp = hSearch(key);
+	if (temp == 0)
     {
         throw std::out_of_range("not in range");
     }
-	return temp->data;
+	return pair_of(temp).second;
 }
 
 //*** INSERT FUNCTION ***//
-template<class Key_T, class Mapped_T>
-NodePtr<Key_T, Mapped_T> Tree<Key_T, Mapped_T>::insert(const Key_T & key, const Mapped_T & item)
-{
-	NodePtr<Key_T, Mapped_T> locationPtr = treeRoot, parent = 0;
-	bool found = false;
-
-	while (!found && locationPtr != 0)
-    {
-		parent = locationPtr;
-		if (key < locationPtr->key)
-		{
-		    locationPtr = locationPtr->left;
-		}
-		else if (locationPtr->key < key)
-        {
-            locationPtr = locationPtr->right;
-        }
-		else
-        {
-            found = true;
-        }
-	}
-	if (found)
-    {
-		remove_node(locationPtr->key);
-		insert(key, item);
-	}
-
-	if (!found)
-    {
-		locationPtr = new Node<Key_T, Mapped_T>(key, item);
-        //empty tree
-		if (parent == 0)
-		{
-			treeRoot = locationPtr;
-        }
-		else if (key < parent->key)
-        {
-            parent->left = locationPtr;
-        }
-		else
-        {
-            parent->right = locationPtr;
-        }
-
-		locationPtr->parent = parent;
-		adjust_height_insert(locationPtr);
-
-		if (NodePtr<Key_T, Mapped_T> successor = get_successor(locationPtr))
-        {
-			locationPtr->listNext = successor;
-			successor->listPrevious = locationPtr;
-		}
-		if (NodePtr<Key_T, Mapped_T> predecessor = get_predecessor(locationPtr))
-		{
-			locationPtr->listPrevious = predecessor;
-			predecessor->listNext = locationPtr;
-		}
-
-		++size;
-		return locationPtr;
-	}
-	return NULL;
-}
-
-//HELPER FUNCTION: update height of the tree after insertion
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::adjust_height_insert(NodePtr<Key_T, Mapped_T> & insertedPtr)
-{
-	NodePtr<Key_T, Mapped_T> child = insertedPtr;
-	while (child->parent != 0)
-    {
-
-		get_height(child);
-		get_balance_factor(child);
-		this->preform_rotation(child);
-		child = child->parent;
-	}
-	if (child->parent == 0)
-    {
-		get_height(child);
-		get_balance_factor(child);
-		preform_rotation(child);
-	}
-}
-
-//HELPER FUNCTION: re-adjust height of the tree after a remove
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::adjust_height_remove(NodePtr<Key_T, Mapped_T> & insertedPtr)
-{
-	NodePtr<Key_T, Mapped_T> child = insertedPtr;
-	if (child != NULL)
-    {
-		while (child->parent != 0)
-		{
-			get_height(child);
-			get_balance_factor(child);
-			preform_remove(child);
-			child = child->parent;
-		}
-		if (child->parent == 0)
-        {
-			get_height(child);
-			get_balance_factor(child);
-			preform_remove(child);
-		}
-	}
-}
-
-//HELPER FUNCTION: what is the balance factor, needed to readjust the height of the
-//tree
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::get_balance_factor(NodePtr<Key_T, Mapped_T> & node)
-{
-	node->balanceFactor = balance_factor(node);
-}
-template<class Key_T, class Mapped_T>
-short int Tree<Key_T, Mapped_T>::balance_factor(const NodePtr<Key_T, Mapped_T> & p) const
-{
-	return height(p->left) - height(p->right);
-}
-
-//HELPER FUNCTION: calculate the hight of a sub_tree
-template<class Key_T, class Mapped_T>
-short int Tree<Key_T, Mapped_T>::height(const NodePtr<Key_T, Mapped_T> & p) const
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::insert(const Key_T & key, const Mapped_T & item)
 {
-	return p ? p->height : -1;
-}
-
-//HELPER FUNCTION: calculate the height of the tree
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::get_height(const NodePtr<Key_T, Mapped_T> & node) const
-{
-	node->height = std::max(height(node->right), height(node->left)) + 1;
-}
-
-//HELPER FUNCTION: left rotation
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::left_rotation(NodePtr<Key_T, Mapped_T> node)
-{
-	NodePtr<Key_T, Mapped_T> tempNode = node->right;
-	tempNode->parent = node->parent;
-	if (node->parent != NULL) {
-		if (node == node->parent->left)
-			node->parent->left = tempNode;
-		else if (node == node->parent->right)
-			node->parent->right = tempNode;
-	}
-
-	node->parent = tempNode;
-	node->right = tempNode->left;
-
-	if (tempNode->left != NULL)
+	bool inserted;
+	LinkPtr node = insert_unique(key, item, inserted);
+	if (!inserted)
+    {
+		remove_node(node);
+		node = insert_unique(key, item, inserted);
+	}
+	return node;
+}
+
+//INSERT: only when the key is missing, in a single descent
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::insert_unique(const Key_T & key, const Mapped_T & item, bool & inserted)
+{
+	int cmp;
+	inserted = false;
+	if (inline_mode())
+    {
+		std::size_t position = inline_lower_bound(key, cmp);
+		if (cmp == 0)
+        {
+            return inline_link(position);
+        }
+		if (inline_count() < Policy::inline_capacity)
+        {
+			Inline::inline_emplace(position, key, item);
+			++size;
+			inserted = true;
+			return inline_link(position);
+		}
+		spill_inline();
+	}
+
+	Index::index_reserve(size + 1);
+	LinkPtr parent;
+	LinkPtr locationPtr = descend(key, parent, cmp);
+	if (locationPtr != 0)
     {
-        tempNode->left->parent = node;
-    }
-
-	tempNode->left = node;
+		//an erased key comes back in its old node
+		if (links(locationPtr).dead)
+        {
+			pair_of(locationPtr).second = item;
+			revive(locationPtr);
+			inserted = true;
+		}
+        return locationPtr;
+    }
 
-	get_height(node);
-	get_balance_factor(node);
+	LinkPtr newNode = nodes.create(key, item);
+	counters().allocation();
+	locationPtr = newNode;
+
+	Balance::attach(*this, parent, locationPtr, cmp < 0);
+	link_order(locationPtr, Threaded());
 
-	get_height(tempNode);
-	get_balance_factor(tempNode);
+	Balance::rebalance_insert(*this, locationPtr);
+	Index::index_add(key, newNode);
 
-	if (tempNode->parent == NULL)
-    {
-        this->treeRoot = tempNode;
-    }
+	++size;
+	inserted = true;
+	return newNode;
 }
 
-//HELPER FUNCTION: right rotation
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::right_rotation(NodePtr<Key_T, Mapped_T> node)
+//HELPER FUNCTION: search function
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::hSearch(const Key_T & key)
 {
-	NodePtr<Key_T, Mapped_T> tempNode = node->left;
-	tempNode->parent = node->parent;
-	if (node->parent != NULL)
-    {
-		if (node == node->parent->left)
-		{
-		    node->parent->left = tempNode;
-		}
-		else if (node == node->parent->right)
-        {
-            node->parent->right = tempNode;
-        }
-	}
-
-	node->parent = tempNode;
-	node->left = tempNode->right;
-
-	if (tempNode->right != NULL)
-    {
-        tempNode->right->parent = node;
-    }
-	tempNode->right = node;
-	get_height(node);
-	get_balance_factor(node);
-
-	get_height(tempNode);
-	get_balance_factor(tempNode);
-
-	if (tempNode->parent == NULL)
-    {
-        this->treeRoot = tempNode;
-    }
-}
+	if (inline_mode())
+    {
+        return inline_search(key);
+    }
 
-//HELPER FUNCTION: left_right rotation
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::left_right_rotation(NodePtr<Key_T, Mapped_T> & node)
-{
-	left_rotation(node->left);
-	right_rotation(node);
+	if (Hashed::value)
+    {
+        return Index::index_find(key, [this, &key](LinkPtr node) { return three_way(key, key_of(node)) == 0; });
+    }
+
+	std::size_t hash;
+	if (LinkPtr cached = Cache::cache_lookup(key, hash, [this, &key](LinkPtr node) { return three_way(key, key_of(node)) == 0; }))
+    {
+        return cached;
+    }
+
+	LinkPtr parent;
+	int cmp;
+	LinkPtr node = descend(key, parent, cmp);
+	if (node == 0 || links(node).dead)
+    {
+        return 0;
+    }
+	Cache::cache_remember(hash, node);
+	return node;
 }
 
-//HELPER FUNCTION: right_left rotation
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::right_left_rotation(NodePtr<Key_T, Mapped_T> & node)
+//HELPER FUNCTION: search function doesn't modify the tree, nor the
+//lookup cache, so const searches can run side by side
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::hSearch(const Key_T & key) const
 {
-	right_rotation(node->right);
-	left_rotation(node);
-}
+	if (inline_mode())
+    {
+        return inline_search(key);
+    }
 
-//HELPER FUNCTION: decides which type of rotation is needed
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::preform_rotation(NodePtr<Key_T, Mapped_T> & node)
-{
-	NodePtr<Key_T, Mapped_T> temp = NULL;
-	if (node->balanceFactor == 2)
-    {
-		temp = node->left;
-		if (temp->balanceFactor == 1)
-		{
-			right_rotation(node);
-		}
-		if (temp->balanceFactor == -1)
-		{
-			left_right_rotation(node);
-		}
-	}
-	if (node->balanceFactor == -2)
-	{
-		temp = node->right;
-		if (temp->balanceFactor == 1)
-		{
-			right_left_rotation(node);
-		}
-
-		if (temp->balanceFactor == -1)
-		{
-			left_rotation(node);
-		}
-	}
+	if (Hashed::value)
+    {
+        return Index::index_find(key, [this, &key](LinkPtr node) { return three_way(key, key_of(node)) == 0; });
+    }
+
+	if (LinkPtr cached = Cache::cache_peek(key, [this, &key](LinkPtr node) { return three_way(key, key_of(node)) == 0; }))
+    {
+        return cached;
+    }
+
+	LinkPtr parent;
+	int cmp;
+	LinkPtr node = descend(key, parent, cmp);
+	if (node == 0 || links(node).dead)
+    {
+        return 0;
+    }
+	return node;
 }
 
-//HELPER FUNCTION: re-adjust the tree after removing a node
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::preform_remove(NodePtr<Key_T, Mapped_T> & node)
+//REMOVE: the node with the given key
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::remove_node(const Key_T & key)
 {
-	NodePtr<Key_T, Mapped_T> temp = NULL;
-
-	if (node->balanceFactor == 2)
-    {
-		temp = node->left;
-
-		if (temp->balanceFactor == 1 || temp->balanceFactor == 0)
-        {
-			right_rotation(node);
-		}
-
-		else if (temp->balanceFactor == -1)
-        {
-			left_right_rotation(node);
-		}
-	}
-
-	if (node->balanceFactor == -2)
+	if (LinkPtr node = hSearch(key))
     {
-		temp = node->right;
-		if (temp->balanceFactor == 1)
-		{
-			right_left_rotation(node);
-		}
-
-		else if (temp->balanceFactor == -1 || temp->balanceFactor == 0)
-        {
-			left_rotation(node);
-		}
-	}
+		remove_node(node);
+	}
+}
+
+//REMOVE: unlink the given node, returns the node that followed it
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::remove_node(LinkPtr node)
+{
+	if (inline_mode())
+    {
+        return inline_remove(node);
+    }
+	if (LazyErase::value)
+    {
+        return bury(node);
+    }
+
+	LinkPtr next = unlink_node(node);
+	free_node(node);
+	return next;
+}
+
+//HELPER FUNCTION: lazy erase, the node stays where it is and only its
+//flag changes. Returns the live node that followed it.
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::bury(LinkPtr node)
+{
+	LinkPtr next = next_live(node);
+	Cache::cache_forget(key_of(node), node);
+	Index::index_remove(key_of(node), node);
+	links(node).dead = true;
+	--size;
+	++deadCount;
+	if (deadCount > Policy::lazy_erase_ratio * (size + deadCount))
+    {
+		//the erase is done either way, without memory for the rebuild
+		//the next erase tries again
+		try
+        {
+            purge_dead();
+        }
+		catch (const std::bad_alloc &)
+        {
+            //Empty
+        }
+	}
+	return next;
+}
+
+//HELPER FUNCTION: collect the live nodes in key order and link them like
+//assign_sorted() does, then destroy the dead ones. Live nodes stay where
+//they are, so links to them are still good. The nodes are collected
+//walking down the tree rather than along the thread: a right child's
+//address is known as soon as its parent is, so the cache misses of a
+//large tree overlap instead of coming one after another.
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::purge_dead()
+{
+	std::vector<LinkPtr> order, doomed;
+	order.reserve(size);
+	doomed.reserve(deadCount);
+
+	//the stack holds the path from the root, as long as the tree is high
+	std::vector<LinkPtr> pending;
+	LinkPtr node = treeRoot;
+	while (node != 0 || !pending.empty())
+    {
+		for (; node != 0; node = links(node).left)
+        {
+            pending.push_back(node);
+        }
+		node = pending.back();
+		pending.pop_back();
+		(links(node).dead ? doomed : order).push_back(node);
+		node = links(node).right;
+	}
+
+	stop_compaction();
+	treeRoot = link_sorted(order);
+	reset_header();
+	thread_sorted(order, Threaded());
+	for (std::size_t i = 0; i < doomed.size(); ++i)
+    {
+		free_node(doomed[i]);
+	}
+	deadCount = 0;
+	if (size == 0 && Policy::inline_capacity != 0)
+    {
+        Inline::set_inline_mode(true);
+    }
+}
+
+//HELPER FUNCTION: after a bulk change, the nodes were relinked or moved
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::index_rebuild()
+{
+	if (!Hashed::value)
+    {
+        return;
+    }
+	Index::index_clear();
+	if (inline_mode())
+    {
+        return;
+    }
+	for (LinkPtr node = next_live(header_link()); node != header_link(); node = next_live(node))
+    {
+        Index::index_add(key_of(node), node);
+    }
+}
+
+//HELPER FUNCTION: take a node out of the tree and the iteration order
+//without destroying it, returns the node that followed it
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::unlink_node(LinkPtr node)
+{
+	//in order successor, it is what the caller will continue with
+	LinkPtr next = next_link(node);
+	Cache::cache_forget(key_of(node), node);
+	Index::index_remove(key_of(node), node);
+	unlink_order(node, Threaded());
+	stop_compaction();
+
+	//put the successor, or the only child, in its place and rebalance
+	Balance::detach(*this, node, next);
+	--size;
+
+	//an empty tree starts over in the inline array
+	if (size == 0 && deadCount == 0 && Policy::inline_capacity != 0)
+    {
+        Inline::set_inline_mode(true);
+    }
+	return next;
 }
 
-//HELPER FUNCTION: get the minimum value
-template<class Key_T, class Mapped_T>
-NodePtr<Key_T, Mapped_T> Tree<Key_T, Mapped_T>::min_val(const NodePtr<Key_T, Mapped_T> & subTreeRoot) const
-{
-	if (subTreeRoot == NULL)
-    {
-        return NULL;
-    }
-
-	NodePtr<Key_T, Mapped_T> current = subTreeRoot;
-	while (current->left != NULL)
-    {
-		current = current->left;
-	}
+//EXTRACT: hand the node over to a node handle
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::NodeHandle Tree<Key_T, Mapped_T, Policy, Alloc>::extract(LinkPtr node)
+{
+	static_assert(std::is_same<typename Policy::storage, PointerStorage>::value,
+        "node handles need PointerStorage");
+
+	if (inline_mode())
+    {
+		LinkPtr moved = nodes.create(std::move_if_noexcept(nodes.node(node)));
+		counters().allocation();
+		inline_remove(node);
+		return NodeHandle::own(&nodes.node(moved), get_allocator());
+	}
+
+	//a node in the inline array leaves a copy, its slot stays here
+	if (in_inline_array(node))
+    {
+		LinkPtr moved = nodes.create(std::move_if_noexcept(nodes.node(node)));
+		counters().allocation();
+		unlink_node(node);
+		Inline::inline_erase(inline_position(node));
+		return NodeHandle::own(&nodes.node(moved), get_allocator());
+	}
+
+	unlink_node(node);
+	return NodeHandle::own(&nodes.node(node), get_allocator());
+}
+
+//INSERT: link the node of a handle, no allocation and no copy in tree mode
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::insert(NodeHandle && handle, bool & inserted)
+{
+	static_assert(std::is_same<typename Policy::storage, PointerStorage>::value,
+        "node handles need PointerStorage");
+
+	//the key may have changed while the node was out
+	NodeType & taken = *handle.node;
+	refresh_prefix(taken, PrefixCached());
+	const Key_T & key = taken.pair.first;
+
+	int cmp;
+	inserted = false;
+	if (inline_mode())
+    {
+		std::size_t position = inline_lower_bound(key, cmp);
+		if (cmp == 0)
+        {
+            return inline_link(position);
+        }
+		if (inline_count() < Policy::inline_capacity)
+        {
+			Inline::inline_emplace(position, std::move_if_noexcept(taken));
+			++size;
+			inserted = true;
+			handle.reset();
+			counters().free();
+			return inline_link(position);
+		}
+		spill_inline();
+	}
+
+	Index::index_reserve(size + 1);
+	LinkPtr parent;
+	LinkPtr found = descend(key, parent, cmp);
+	if (found != 0)
+    {
+		//a dead node takes the entry, like the inline array does
+		if (links(found).dead)
+        {
+			pair_of(found).second = std::move_if_noexcept(taken.pair.second);
+			revive(found);
+			inserted = true;
+			handle.reset();
+			counters().free();
+		}
+        return found;
+    }
+
+	LinkPtr node = handle.release();
+	links(node) = NodeBase<Policy>();
+	Balance::attach(*this, parent, node, cmp < 0);
+	link_order(node, Threaded());
+	Balance::rebalance_insert(*this, node);
+	Index::index_add(key, node);
+
+	++size;
+	inserted = true;
+	return node;
+}
+
+//HELPER FUNCTION: next entry of the inline array
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::inline_next(LinkPtr node) const
+{
+	std::size_t next = node == header_link() ? 0 : inline_position(node) + 1;
+	return next < inline_count() ? inline_link(next) : header_link();
+}
+
+//HELPER FUNCTION: previous entry of the inline array
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::inline_previous(LinkPtr node) const
+{
+	std::size_t position = node == header_link() ? inline_count() : inline_position(node);
+	return position > 0 ? inline_link(position - 1) : header_link();
+}
+
+//HELPER FUNCTION: linear search of the inline array, a handful of keys
+//next to each other beats chasing pointers
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+std::size_t Tree<Key_T, Mapped_T, Policy, Alloc>::inline_lower_bound(const Key_T & key, int & cmp) const
+{
+	std::size_t position = 0;
+	std::uint64_t prefix = PrefixCached::value ? KeyPrefix<Key_T>::prefix(key) : 0;
+	cmp = 1;
+	while (position < inline_count())
+    {
+		counters().visit();
+		cmp = compare_node(key, prefix, inline_link(position));
+		if (cmp <= 0)
+        {
+            break;
+        }
+		++position;
+	}
+	return position;
+}
+
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::inline_search(const Key_T & key) const
+{
+	int cmp;
+	std::size_t position = inline_lower_bound(key, cmp);
+	if (cmp == 0)
+    {
+        return inline_link(position);
+    }
+	return 0;
+}
+
+//BOUND: keep the last node the key went left of on the way down
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::bound(const Key_T & key, bool upper) const
+{
+	if (inline_mode())
+    {
+		int cmp;
+		std::size_t position = inline_lower_bound(key, cmp);
+		if (cmp == 0 && upper)
+        {
+            ++position;
+        }
+		return position < inline_count() ? inline_link(position) : header_link();
+	}
+
+	LinkPtr bound = header_link();
+	LinkPtr nodePtr = treeRoot;
+	std::uint64_t prefix = PrefixCached::value ? KeyPrefix<Key_T>::prefix(key) : 0;
+	while (nodePtr != 0)
+    {
+		counters().visit();
+		int cmp = compare_node(key, prefix, nodePtr);
+		if (cmp < 0 || (cmp == 0 && !upper))
+        {
+			bound = nodePtr;
+			nodePtr = links(nodePtr).left;
+		}
+		else
+        {
+            nodePtr = links(nodePtr).right;
+        }
+	}
+	//dead nodes are still in order, the next live one is the bound
+	if (bound != header_link() && links(bound).dead)
+    {
+        bound = next_live(bound);
+    }
+	return bound;
+}
+
+//HELPER FUNCTION: take an entry out of the inline array, returns the
+//entry that followed it
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::inline_remove(LinkPtr node)
+{
+	std::size_t position = inline_position(node);
+	Inline::inline_erase(position);
+	--size;
+	return position < inline_count() ? inline_link(position) : header_link();
+}
+
+//HELPER FUNCTION: link the full inline array into the tree. The entries
+//are in key order, so every node goes right of the one before it. They
+//stay in their slots, so references and iterators to them stay valid.
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::spill_inline()
+{
+	const std::size_t count = inline_count();
+	Index::index_reserve(count + 1);
+	Inline::set_inline_mode(false);
+
+	treeRoot = 0;
+	reset_header();
+	LinkPtr previous = 0;
+	for (std::size_t i = 0; i < count; ++i)
+    {
+		LinkPtr node = inline_link(i);
+		Balance::attach(*this, previous, node, false);
+		link_order(node, Threaded());
+		Balance::rebalance_insert(*this, node);
+		Index::index_add(key_of(node), node);
+		previous = node;
+	}
+}
+
+//HELPER FUNCTION: a node from the inline array gives its slot back, only
+//heap nodes were counted as allocations
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::free_node(LinkPtr node)
+{
+	if (in_inline_array(node))
+    {
+		Inline::inline_erase(inline_position(node));
+		return;
+	}
+	nodes.destroy(node);
+	counters().free();
+}
+
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::move_node(LinkPtr node)
+{
+	if (!in_inline_array(node))
+    {
+        return nodes.relocate(node);
+    }
+	LinkPtr moved = nodes.create(std::move_if_noexcept(nodes.node(node)));
+	counters().allocation();
+	Inline::inline_erase(inline_position(node));
+	return moved;
+}
+
+//HELPER FUNCTION: relocate_node() takes the nodes out of the array one by
+//one, an allocation that throws leaves the rest where they are
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::evict_inline()
+{
+	if (inline_mode())
+    {
+        return;
+    }
+	stop_compaction();
+	while (inline_count() != 0)
+    {
+        relocate_node(inline_link(0));
+    }
+}
+
+//HELPER FUNCTION: thread a new node between its in-order neighbours
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::link_order(LinkPtr node, std::true_type)
+{
+	LinkPtr parent = links(node).parent;
+
+	//neighbours in the iteration list, the header closes the list at both ends
+	LinkPtr predecessor = header_link();
+	LinkPtr successor = header_link();
+
+	if (parent != 0)
+    {
+		if (node == links(parent).left)
+        {
+            //a left child comes right before its parent
+            successor = parent;
+            predecessor = links(parent).listPrevious;
+        }
+		else
+        {
+            //a right child comes right after its parent
+            predecessor = parent;
+            successor = links(parent).listNext;
+        }
+	}
+
+	links(node).listPrevious = predecessor;
+	links(node).listNext = successor;
+	links(predecessor).listNext = node;
+	links(successor).listPrevious = node;
+}
+
+//HELPER FUNCTION: without a thread only the cached ends can change
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::link_order(LinkPtr node, std::false_type)
+{
+	LinkPtr parent = links(node).parent;
+	NodeBase<Policy> & header = links(header_link());
+
+	if (parent == 0)
+    {
+		header.left = node;
+		header.right = node;
+	}
+	else if (node == links(parent).left)
+    {
+		if (parent == header.left)
+        {
+            header.left = node;
+        }
+	}
+	else if (parent == header.right)
+    {
+        header.right = node;
+    }
+}
+
+//HELPER FUNCTION: take a node out of the thread
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::unlink_order(LinkPtr node, std::true_type)
+{
+	//the header keeps both neighbours valid even at the ends of the list
+	links(links(node).listPrevious).listNext = links(node).listNext;
+	links(links(node).listNext).listPrevious = links(node).listPrevious;
+}
+
+//HELPER FUNCTION: move the cached ends past a node that is going away
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::unlink_order(LinkPtr node, std::false_type)
+{
+	NodeBase<Policy> & header = links(header_link());
+	if (node == header.left)
+    {
+        header.left = next_link(node);
+    }
+	if (node == header.right)
+    {
+        header.right = previous_link(node);
+    }
+}
+
+//HELPER FUNCTION: next node by walking parent links, amortized O(1)
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::next_link(LinkPtr node, std::false_type) const
+{
+	if (node == header_link())
+    {
+        return links(node).left;
+    }
+	LinkPtr next = Balance::get_successor(*this, node);
+	return next != 0 ? next : header_link();
+}
+
+//HELPER FUNCTION: previous node by walking parent links, amortized O(1)
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::previous_link(LinkPtr node, std::false_type) const
+{
+	if (node == header_link())
+    {
+        return links(node).right;
+    }
+	LinkPtr previous = Balance::get_predecessor(*this, node);
+	return previous != 0 ? previous : header_link();
+}
+
+//MEMORY USAGE: storage of the nodes plus the tree object
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+MemoryUsage Tree<Key_T, Mapped_T, Policy, Alloc>::memory_usage() const
+{
+	MemoryUsage usage;
+	usage.nodeBytes = (size + deadCount) * sizeof(NodeType);
+	usage.payloadBytes = size * sizeof(ValueType<Key_T, Mapped_T>);
+	usage.totalBytes = sizeof(*this) + nodes.allocated_bytes(inline_mode() ? 0 : size + deadCount - inline_count()) + Cache::cache_bytes() + Index::index_bytes();
+	usage.overheadBytes = usage.totalBytes - usage.payloadBytes;
+	return usage;
+}
+
+//SHAPE: walk every node once, keeping the depth next to it
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+TreeShape Tree<Key_T, Mapped_T, Policy, Alloc>::shape() const
+{
+	TreeShape result;
+	result.height = 0;
+	result.averagePathLength = 0;
+
+	//dead nodes are part of the shape until they are purged
+	const std::size_t count = size + deadCount;
+
+	//the most levels an AVL tree of count nodes can have: the sparsest
+	//tree of h levels holds sparse(h) = sparse(h-1) + sparse(h-2) + 1
+	std::size_t shorter = 0, sparse = 1;
+	result.avlBound = 0;
+	while (count != 0 && sparse <= count)
+    {
+		++result.avlBound;
+		std::size_t next = sparse + shorter + 1;
+		shorter = sparse;
+		sparse = next;
+	}
+
+	//the inline array is searched from the front
+	if (inline_mode())
+    {
+		result.averagePathLength = size == 0 ? 0 : (size + 1) / 2.0;
+		return result;
+	}
+	if (treeRoot == 0)
+    {
+        return result;
+    }
+
+	std::vector<std::pair<LinkPtr, std::size_t> > pending;
+	pending.push_back(std::make_pair(treeRoot, std::size_t(0)));
+	std::size_t pathTotal = 0;
+	while (!pending.empty())
+    {
+		LinkPtr node = pending.back().first;
+		std::size_t depth = pending.back().second;
+		pending.pop_back();
+
+		if (result.depthHistogram.size() <= depth)
+        {
+            result.depthHistogram.resize(depth + 1);
+        }
+		++result.depthHistogram[depth];
+		pathTotal += depth + 1;
+
+		if (links(node).left != 0)
+        {
+            pending.push_back(std::make_pair(links(node).left, depth + 1));
+        }
+		if (links(node).right != 0)
+        {
+            pending.push_back(std::make_pair(links(node).right, depth + 1));
+        }
+	}
+
+	result.height = result.depthHistogram.size();
+	result.averagePathLength = double(pathTotal) / count;
+	return result;
+}
+
+//VALIDATE: every node is checked against its children and the key range
+//its ancestors allow, then the iteration order is walked once
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+bool Tree<Key_T, Mapped_T, Policy, Alloc>::validate() const
+{
+	//inline entries only have to be in key order
+	if (inline_mode())
+    {
+		if (treeRoot != 0 || deadCount != 0 || inline_count() != size || inline_count() > Policy::inline_capacity
+			|| Index::index_size() != 0)
+        {
+            return false;
+        }
+		for (std::size_t i = 1; i < inline_count(); ++i)
+        {
+			if (!(key_of(inline_link(i - 1)) < key_of(inline_link(i))))
+            {
+                return false;
+            }
+		}
+		return true;
+	}
+
+	//entries left in the array since it spilled are part of the tree
+	if (inline_count() > size + deadCount || (treeRoot != 0 && links(treeRoot).parent != 0))
+    {
+        return false;
+    }
+
+	//node plus the closest ancestors it must sort after and before
+	struct Bounds
+	{
+		LinkPtr node;
+		LinkPtr low;
+		LinkPtr high;
+	};
+	std::vector<Bounds> pending;
+	if (treeRoot != 0)
+    {
+		Bounds root = { treeRoot, 0, 0 };
+		pending.push_back(root);
+	}
+
+	//dead nodes are linked like live ones, only without lazy erase there
+	//can be none
+	const std::size_t total = size + deadCount;
+	std::size_t count = 0, dead = 0;
+	while (!pending.empty())
+    {
+		Bounds b = pending.back();
+		pending.pop_back();
+		LinkPtr node = b.node;
+		LinkPtr left = links(node).left;
+		LinkPtr right = links(node).right;
+		++count;
+		dead += links(node).dead;
+		if (Hashed::value && !links(node).dead
+			&& Index::index_find(key_of(node), [node](LinkPtr found) { return found == node; }) != node)
+        {
+            return false;
+        }
+
+		if (count > total || (links(node).dead && !LazyErase::value))
+        {
+            return false;
+        }
+		if (b.low != 0 && !(key_of(b.low) < key_of(node)))
+        {
+            return false;
+        }
+		if (b.high != 0 && !(key_of(node) < key_of(b.high)))
+        {
+            return false;
+        }
+		if (!Balance::check(*this, node))
+        {
+            return false;
+        }
+
+		if (left != 0)
+        {
+			if (links(left).parent != node)
+            {
+                return false;
+            }
+			Bounds child = { left, b.low, node };
+			pending.push_back(child);
+		}
+		if (right != 0)
+        {
+			if (links(right).parent != node)
+            {
+                return false;
+            }
+			Bounds child = { right, node, b.high };
+			pending.push_back(child);
+		}
+	}
+	if (count != total || dead != deadCount || (Hashed::value && Index::index_size() != size))
+    {
+        return false;
+    }
+
+	//the iteration order has to visit every node once, in key order, and
+	//step back the same way
+	count = 0;
+	LinkPtr previous = header_link();
+	for (LinkPtr node = next_link(previous); node != header_link(); node = next_link(node))
+    {
+		if (++count > total || previous_link(node) != previous)
+        {
+            return false;
+        }
+		if (previous != header_link() && !(key_of(previous) < key_of(node)))
+        {
+            return false;
+        }
+		previous = node;
+	}
+	return count == total && previous_link(header_link()) == previous;
+}
+
+//COMPACT: lay every node out again in traversal order
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::compact(CompactOrder order)
+{
+	stop_compaction();
+	if (inline_mode())
+    {
+        return;
+    }
+	if (deadCount != 0)
+    {
+		purge_dead();
+		if (inline_mode())
+        {
+            return;
+        }
+	}
+
+	//the storage moves heap nodes only
+	evict_inline();
+
+	std::vector<LinkPtr> layout;
+	layout.reserve(size);
+	if (order == CompactOrder::van_emde_boas)
+    {
+		//only AVL keeps the height in the root, the others are measured
+		if (treeRoot != 0)
+        {
+            van_emde_boas_order(treeRoot, std::is_same<typename Policy::balance, AvlBalance>::value
+                ? links(treeRoot).height + 1 : int(shape().height), layout);
+        }
+	}
+	else
+    {
+        breadth_first_order(layout);
+    }
+
+	Cache::cache_forget_all();
+	nodes.relayout(layout, treeRoot);
+	index_rebuild();
+}
+
+//COMPACT: move a bounded number of nodes, continuing the last pass
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+bool Tree<Key_T, Mapped_T, Policy, Alloc>::compact_step(std::size_t budget)
+{
+	if (compactQueue.empty())
+    {
+		if (treeRoot == 0)
+        {
+            return true;
+        }
+		compactQueue.push_back(treeRoot);
+	}
+
+	for (; budget > 0 && compactNext < compactQueue.size(); --budget)
+    {
+		LinkPtr moved = relocate_node(compactQueue[compactNext++]);
+		if (links(moved).left != 0)
+        {
+            compactQueue.push_back(links(moved).left);
+        }
+		if (links(moved).right != 0)
+        {
+            compactQueue.push_back(links(moved).right);
+        }
+	}
+
+	if (compactNext < compactQueue.size())
+    {
+        return false;
+    }
+	stop_compaction();
+	return true;
+}
+
+//HELPER FUNCTION: move one node, then fix every link that pointed at it
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr Tree<Key_T, Mapped_T, Policy, Alloc>::relocate_node(LinkPtr node)
+{
+	Cache::cache_forget(key_of(node), node);
+	Index::index_remove(key_of(node), node);
+	LinkPtr moved = move_node(node);
+	if (!links(moved).dead)
+    {
+        Index::index_add(key_of(moved), moved);
+    }
+	LinkPtr parent = links(moved).parent;
+
+	if (parent == 0)
+    {
+        treeRoot = moved;
+    }
+	else if (links(parent).left == node)
+    {
+        links(parent).left = moved;
+    }
+	else
+    {
+        links(parent).right = moved;
+    }
+
+	if (links(moved).left != 0)
+    {
+        links(links(moved).left).parent = moved;
+    }
+	if (links(moved).right != 0)
+    {
+        links(links(moved).right).parent = moved;
+    }
+
+	relink_order(node, moved, Threaded());
+	return moved;
+}
+
+//HELPER FUNCTION: neighbours in the thread point at the moved node
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::relink_order(LinkPtr, LinkPtr to, std::true_type)
+{
+	links(links(to).listPrevious).listNext = to;
+	links(links(to).listNext).listPrevious = to;
+}
+
+//HELPER FUNCTION: the cached ends follow the moved node
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::relink_order(LinkPtr from, LinkPtr to, std::false_type)
+{
+	NodeBase<Policy> & header = links(header_link());
+	if (header.left == from)
+    {
+        header.left = to;
+    }
+	if (header.right == from)
+    {
+        header.right = to;
+    }
+}
+
+//HELPER FUNCTION: nodes level by level from the root
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::breadth_first_order(std::vector<LinkPtr> & order) const
+{
+	if (treeRoot == 0)
+    {
+        return;
+    }
+	order.push_back(treeRoot);
+	for (std::size_t i = 0; i < order.size(); ++i)
+    {
+		if (links(order[i]).left != 0)
+        {
+            order.push_back(links(order[i]).left);
+        }
+		if (links(order[i]).right != 0)
+        {
+            order.push_back(links(order[i]).right);
+        }
+	}
+}
+
+//HELPER FUNCTION: the top half of the levels first, then every sub tree
+//hanging below it, each laid out the same way
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::van_emde_boas_order(LinkPtr root, int levels, std::vector<LinkPtr> & order) const
+{
+	if (root == 0 || levels <= 0)
+    {
+        return;
+    }
+	if (levels == 1)
+    {
+		order.push_back(root);
+		return;
+	}
+
+	int top = levels / 2;
+	van_emde_boas_order(root, top, order);
+
+	std::vector<LinkPtr> bottom;
+	collect_level(root, top, bottom);
+	for (std::size_t i = 0; i < bottom.size(); ++i)
+    {
+        van_emde_boas_order(bottom[i], levels - top, order);
+    }
+}
+
+//HELPER FUNCTION: nodes exactly depth levels below the given one
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::collect_level(LinkPtr node, int depth, std::vector<LinkPtr> & level) const
+{
+	if (node == 0)
+    {
+        return;
+    }
+	if (depth == 0)
+    {
+		level.push_back(node);
+		return;
+	}
+	collect_level(links(node).left, depth - 1, level);
+	collect_level(links(node).right, depth - 1, level);
+}
+
+//**** IMPLEMENTATION FOR ITERATORS STARTS HERE *****//
 
-	return current;
+//Iterator: begin
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::Iterator Tree<Key_T, Mapped_T, Policy, Alloc>::begin()
+{
+	return Iterator(next_live(header_link()), this);
 }
 
-//HELPER FUNCTION: get the maximum value
-template<class Key_T, class Mapped_T>
-NodePtr<Key_T, Mapped_T> Tree<Key_T, Mapped_T>::max_val(const NodePtr<Key_T, Mapped_T> & subTreeRoot) const
+//Iterator: end
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::Iterator Tree<Key_T, Mapped_T, Policy, Alloc>::end()
 {
-	if (subTreeRoot == NULL)
-    {
-        return NULL;
-    }
+	return Iterator(header_link(), this);
+}
 
-	NodePtr<Key_T, Mapped_T> current = subTreeRoot;
-	while (current->right != NULL)
-    {
-		current = current->right;
-	}
+//Iterator: increment
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::Iterator::increment()
+{
+    inode = ptr->next_live(inode);
+}
 
-	return current;
+//Iterator: decrement, from end() this lands on the rightmost node
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::Iterator::decrement()
+{
+    inode = ptr->previous_live(inode);
 }
 
-//HELPER FUNCTION: in-order Successor
-template<class Key_T, class Mapped_T>
-NodePtr<Key_T, Mapped_T> Tree<Key_T, Mapped_T>::get_successor(NodePtr<Key_T, Mapped_T> node)
+//Const Iterator: begin
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+const typename Tree<Key_T, Mapped_T, Policy, Alloc>::ConstIterator Tree<Key_T, Mapped_T, Policy, Alloc>::begin() const
 {
-    //if it has a right child
-    if (node->right != NULL)
-    {
-        return min_val(node->right);
-    }
+	return ConstIterator(next_live(header_link()), this);
+}
 
-	NodePtr<Key_T, Mapped_T> p = node->parent;
-	while (p != NULL && node == p->right)
-    {
-		node = p;
-		p = node->parent;
-	}
+//Const Iterator: end
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+const typename Tree<Key_T, Mapped_T, Policy, Alloc>::ConstIterator Tree<Key_T, Mapped_T, Policy, Alloc>::end() const
+{
+	return ConstIterator(header_link(), this);
+}
 
-	return p;
+//Const Iterator: increment
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::ConstIterator::increment()
+{
+    inode = ptr->next_live(inode);
 }
 
-//HELPER FUNCTION: in-order predecessor
-template<class Key_T, class Mapped_T>
-NodePtr<Key_T, Mapped_T> Tree<Key_T, Mapped_T>::get_predecessor(NodePtr<Key_T, Mapped_T> node)
+//Const Iterator: decrement
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::ConstIterator::decrement()
 {
-    //if it has a left child
-	if (node->left != NULL)
-    {
-        return max_val(node->left);
-    }
+    inode = ptr->previous_live(inode);
+}
 
+//Reverse Iterator: begin
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::ReverseIterator Tree<Key_T, Mapped_T, Policy, Alloc>::rbegin()
+{
+	return ReverseIterator(previous_live(header_link()), this);
+}
 
-	NodePtr<Key_T, Mapped_T> p = node->parent;
-	while (p != NULL && node == p->left)
-    {
-		node = p;
-		p = node->parent;
-	}
+//Reverse Iterator: end
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+typename Tree<Key_T, Mapped_T, Policy, Alloc>::ReverseIterator Tree<Key_T, Mapped_T, Policy, Alloc>::rend()
+{
+	return ReverseIterator(header_link(), this);
+}
 
-	return p;
+//Reverse Iterator: increment operator
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::ReverseIterator::increment()
+{
+    inode = ptr->previous_live(inode);
 }
 
-//HELPER FUNCTION: search function
-template<class Key_T, class Mapped_T>
-NodePtr<Key_T, Mapped_T> Tree<Key_T, Mapped_T>::hSearch(const Key_T & key)
+//Reverse Iterator: decrement operator, from rend() this lands on the leftmost node
+template<class Key_T, class Mapped_T, class Policy, class Alloc>
+void Tree<Key_T, Mapped_T, Policy, Alloc>::ReverseIterator::decrement()
 {
-	NodePtr<Key_T, Mapped_T> nodePtr = treeRoot;
-	bool found = false;
+    inode = ptr->next_live(inode);
+}
 
-	while (!found && nodePtr != 0)
-    {
-		if (key < nodePtr->key)
-		{
-		    nodePtr = nodePtr->left;
-		}
-		else if (nodePtr->key < key)
-        {
-            nodePtr = nodePtr->right;
-        }
-		else
-        {
-            found = true;
-        }
+//Operator overloaded: equality
+template <class Key_T, class Mapped_T, class Policy, class Alloc>
+bool operator==(const Tree<Key_T, Mapped_T, Policy, Alloc> & x, const Tree<Key_T, Mapped_T, Policy, Alloc> & y)
+{
+	typename Tree<Key_T, Mapped_T, Policy, Alloc>::ConstIterator first = x.begin();
+	typename Tree<Key_T, Mapped_T, Policy, Alloc>::ConstIterator second = y.begin();
+	if (x.sizeR() != y.sizeR())
+		return false;
+	for (; first != x.end() || second != y.end(); ++first, ++second) {
+		if (!(first->first == second->first) || !(first->second == second->second))
+			return false;
 	}
-	if (found)
-    {
-        return nodePtr;
-    }
-	return NULL;
+	return true;
 }
 
-//HELPER FUNCTION: search function doesn't modify the tree
-template<class Key_T, class Mapped_T>
-NodePtr<Key_T, Mapped_T> Tree<Key_T, Mapped_T>::hSearch(const Key_T & key) const
+//Operator overloaded: inequality
+template <class Key_T, class Mapped_T, class Policy, class Alloc>
+bool operator!=(const Tree<Key_T, Mapped_T, Policy, Alloc> & x, const Tree<Key_T, Mapped_T, Policy, Alloc> & y)
 {
-	NodePtr<Key_T, Mapped_T> nodePtr = treeRoot;
-	bool found = false;
-
-	while (!found && nodePtr != 0)
-    {
-        //search left
-		if (key < nodePtr->key)
-		{
-		    nodePtr = nodePtr->left;
-		}
-		else if (nodePtr->key < key)
-        {
-            nodePtr = nodePtr->right;
-        }
-		else
-        {
-            found = true;
-        }
-	}
-	if (found)
-    {
-        return nodePtr;
-    }
-	return NULL;
+	return !(x == y);
 }
 
-//REMOVE: the node with the given key
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::remove_node(const Key_T & key)
+//Operator overloaded: less-than
+template <class Key_T, class Mapped_T, class Policy, class Alloc>
+bool operator<(const Tree<Key_T, Mapped_T, Policy, Alloc> & x, const Tree<Key_T, Mapped_T, Policy, Alloc> & y)
 {
-	NodePtr<Key_T, Mapped_T> sub_tree_node = NULL;
+	return x.sizeR()<y.sizeR();
+}
 
-	//node to be deleted
-	NodePtr<Key_T, Mapped_T> to_delete = NULL;
+//*** END OF ITERATOR IMPLEMENTATION ***//
 
-	if (NodePtr<Key_T, Mapped_T> node = hSearch(key))
-    {
-		to_delete = node;
-		if (node->left != NULL && node->right != NULL)
-        {
-            //in order successor
-			NodePtr<Key_T, Mapped_T> nodeSucc = get_successor(node);
-
-			//create a new node with the successor value
-			NodePtr<Key_T, Mapped_T> newNode = new Node<Key_T, Mapped_T>(nodeSucc->pair);
-
-			//Copy everything for the old node into the new node
-			newNode->height = node->height;
-			newNode->balanceFactor = node->balanceFactor;
-			newNode->parent = node->parent;
-			newNode->right = node->right;
-			newNode->left = node->left;
-			newNode->listPrevious = node->listPrevious;
-			newNode->listNext = node->listNext;
-
-			//point to the newly created node
-			node->listPrevious->listNext = newNode;
-			node->listNext->listPrevious = newNode;
-
-			//Set children's parent
-			node->right->parent = newNode;
-			node->left->parent = newNode;
-
-			//it is the root of the tree
-			if (node->parent == NULL)
-            {
-                treeRoot = newNode;
-            }
+//+++++++++++++++++++++++++++++ END AVL TREE +++++++++++++++++++++++++++++++++++++++++//
+
+//****** SNAPSHOTS ******//
+
+//A snapshot file is a 64 byte SnapshotHeader, the entries in key order and
+//an 8 byte FNV-1a checksum of everything before it. Raw snapshots hold an
+//array of MappedEntry that can be used in place, see cs540::MappedMap,
+//other snapshots hold each key and value as written by their Serializer.
+//Numbers are in the byte order of the machine that wrote the file.
+struct SnapshotHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrder;
+    std::uint32_t flags;
+    std::uint32_t entrySize;
+    std::uint64_t count;
+    std::uint64_t keySize;
+    std::uint64_t mappedSize;
+    unsigned char reserved[16];
+
+    static constexpr std::uint32_t currentVersion = 1;
+    static constexpr std::uint32_t byteOrderMark = 0x01020304;
+
+    //entries are an array of MappedEntry
+    static constexpr std::uint32_t rawEntries = 1;
+};
+
+static_assert(sizeof(SnapshotHeader) == 64, "snapshot header has to stay 64 bytes");
+
+//entry of a raw snapshot, first and second like the pairs of a Map
+template <class Key_T, class Mapped_T>
+struct MappedEntry
+{
+    Key_T first;
+    Mapped_T second;
+};
+
+//running FNV-1a checksum of the bytes of a snapshot
+class SnapshotChecksum
+{
+    public:
+        SnapshotChecksum()
+            : hash(14695981039346656037ULL)
+        {
+            //Empty
+        }
+
+        void update(const void * data, std::size_t length)
+        {
+            const unsigned char * bytes = static_cast<const unsigned char *>(data);
+            for (std::size_t i = 0; i < length; ++i)
+            {
+                hash = (hash ^ bytes[i]) * 1099511628211ULL;
+            }
+        }
+
+        std::uint64_t value() const
+        {
+            return hash;
+        }
+
+    private:
+        std::uint64_t hash;
+};
+
+//Writes a snapshot to a temporary file next to the target, finish()
+//appends the checksum and renames it over the target, so a failed save
+//leaves the old snapshot alone
+class SnapshotWriter
+{
+    public:
+        explicit SnapshotWriter(const std::string & path)
+            : target(path), temporary(path + ".tmp"), out(temporary.c_str(), std::ios::binary | std::ios::trunc)
+        {
+            if (!out)
+            {
+                throw std::runtime_error("cannot create snapshot " + temporary);
+            }
+        }
+
+        ~SnapshotWriter()
+        {
+            if (out.is_open())
+            {
+                out.close();
+                std::remove(temporary.c_str());
+            }
+        }
+
+        SnapshotWriter(const SnapshotWriter &) = delete;
+        SnapshotWriter & operator=(const SnapshotWriter &) = delete;
+
+        void write(const void * data, std::size_t length)
+        {
+            checksum.update(data, length);
+            out.write(static_cast<const char *>(data), length);
+        }
+
+        void finish()
+        {
+            std::uint64_t sum = checksum.value();
+            out.write(reinterpret_cast<const char *>(&sum), sizeof(sum));
+            out.close();
+            if (!out || std::rename(temporary.c_str(), target.c_str()) != 0)
+            {
+                std::remove(temporary.c_str());
+                throw std::runtime_error("cannot write snapshot " + target);
+            }
+        }
+
+    private:
+        std::string target;
+        std::string temporary;
+        std::ofstream out;
+        SnapshotChecksum checksum;
+};
+
+//Reads a snapshot, every read is checked against the end of the file and
+//finish() checks the checksum
+class SnapshotReader
+{
+    public:
+        explicit SnapshotReader(const std::string & path)
+            : name(path), in(path.c_str(), std::ios::binary), remaining(0)
+        {
+            if (!in)
+            {
+                throw std::runtime_error("cannot open snapshot " + name);
+            }
+            in.seekg(0, std::ios::end);
+            std::uint64_t length = static_cast<std::uint64_t>(in.tellg());
+            in.seekg(0, std::ios::beg);
+            if (length < sizeof(SnapshotHeader) + sizeof(std::uint64_t))
+            {
+                fail("is too short");
+            }
+            remaining = length - sizeof(std::uint64_t);
+        }
+
+        SnapshotReader(const SnapshotReader &) = delete;
+        SnapshotReader & operator=(const SnapshotReader &) = delete;
+
+        void read(void * data, std::size_t length)
+        {
+            if (length > remaining || !in.read(static_cast<char *>(data), length))
+            {
+                fail("is truncated");
+            }
+            remaining -= length;
+            checksum.update(data, length);
+        }
+
+        //bytes left before the checksum
+        std::uint64_t bytes_left() const
+        {
+            return remaining;
+        }
+
+        void finish()
+        {
+            std::uint64_t sum = 0;
+            if (remaining != 0)
+            {
+                fail("has data past its entries");
+            }
+            if (!in.read(reinterpret_cast<char *>(&sum), sizeof(sum)) || sum != checksum.value())
+            {
+                fail("fails its checksum");
+            }
+        }
+
+        void fail(const char * what) const
+        {
+            throw std::runtime_error("snapshot " + name + " " + what);
+        }
+
+    private:
+        std::string name;
+        std::ifstream in;
+        std::uint64_t remaining;
+        SnapshotChecksum checksum;
+};
+
+//How a type is written to a snapshot. Trivially copyable types are
+//written as their bytes, which also lets raw snapshots be mapped. Other
+//types need a specialization with raw = false, write() and read().
+//Both take the stream as a template, a SnapshotWriter or SnapshotReader
+//or the record buffers of the DurableMap journal.
+template <class T>
+struct Serializer
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+        "specialize Serializer to save this type");
+
+    static constexpr bool raw = true;
+
+    template <class Out>
+    static void write(Out & out, const T & value)
+    {
+        out.write(&value, sizeof(T));
+    }
+
+    template <class In>
+    static T read(In & in)
+    {
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type bytes;
+        in.read(&bytes, sizeof(T));
+        return *reinterpret_cast<const T *>(&bytes);
+    }
+};
+
+//length followed by the characters
+template <>
+struct Serializer<std::string>
+{
+    static constexpr bool raw = false;
+
+    template <class Out>
+    static void write(Out & out, const std::string & value)
+    {
+        std::uint64_t length = value.size();
+        out.write(&length, sizeof(length));
+        out.write(value.data(), value.size());
+    }
+
+    template <class In>
+    static std::string read(In & in)
+    {
+        std::uint64_t length;
+        in.read(&length, sizeof(length));
+        if (length > in.bytes_left())
+        {
+            in.fail("has a string past its end");
+        }
+        std::string value(static_cast<std::size_t>(length), '\0');
+        if (length != 0)
+        {
+            in.read(&value[0], value.size());
+        }
+        return value;
+    }
+};
+
+//Snapshot layout of one key and value type
+template <class Key_T, class Mapped_T>
+struct SnapshotFormat
+{
+    typedef MappedEntry<Key_T, Mapped_T> Entry;
+
+    //both types are written as their bytes
+    typedef std::integral_constant<bool, Serializer<Key_T>::raw && Serializer<Mapped_T>::raw> Raw;
+
+    static_assert(!Raw::value || alignof(Entry) <= sizeof(SnapshotHeader),
+        "raw entries have to be aligned by the header size");
+
+    //header describing count entries of this format
+    static SnapshotHeader header(std::uint64_t count)
+    {
+        SnapshotHeader result;
+        std::memset(&result, 0, sizeof(result));
+        std::memcpy(result.magic, "CS540MAP", sizeof(result.magic));
+        result.version = SnapshotHeader::currentVersion;
+        result.byteOrder = SnapshotHeader::byteOrderMark;
+        result.flags = Raw::value ? SnapshotHeader::rawEntries : 0;
+        result.entrySize = Raw::value ? sizeof(Entry) : 0;
+        result.count = count;
+        result.keySize = sizeof(Key_T);
+        result.mappedSize = sizeof(Mapped_T);
+        return result;
+    }
+
+    //does a header describe a snapshot of this format, payloadBytes is
+    //what follows the header up to the checksum
+    static bool matches(const SnapshotHeader & found, std::uint64_t payloadBytes)
+    {
+        SnapshotHeader expected = header(found.count);
+        if (std::memcmp(&found, &expected, sizeof(SnapshotHeader)) != 0)
+        {
+            return false;
+        }
+        //a raw snapshot is exactly its entries, any other entry takes at
+        //least a byte
+        if (Raw::value)
+        {
+            return found.count <= payloadBytes / sizeof(Entry) && found.count * sizeof(Entry) == payloadBytes;
+        }
+        return found.count <= payloadBytes;
+    }
+
+    static void write_entry(SnapshotWriter & out, const Key_T & key, const Mapped_T & value)
+    {
+        write_entry(out, key, value, Raw());
+    }
+    static void write_entry(SnapshotWriter & out, const Key_T & key, const Mapped_T & value, std::true_type)
+    {
+        //padding is zeroed so equal maps give equal files
+        typename std::aligned_storage<sizeof(Entry), alignof(Entry)>::type bytes;
+        std::memset(&bytes, 0, sizeof(bytes));
+        Entry * entry = reinterpret_cast<Entry *>(&bytes);
+        std::memcpy(&entry->first, &key, sizeof(Key_T));
+        std::memcpy(&entry->second, &value, sizeof(Mapped_T));
+        out.write(&bytes, sizeof(bytes));
+    }
+    static void write_entry(SnapshotWriter & out, const Key_T & key, const Mapped_T & value, std::false_type)
+    {
+        Serializer<Key_T>::write(out, key);
+        Serializer<Mapped_T>::write(out, value);
+    }
+
+    static ValueType<Key_T, Mapped_T> read_entry(SnapshotReader & in)
+    {
+        return read_entry(in, Raw());
+    }
+    static ValueType<Key_T, Mapped_T> read_entry(SnapshotReader & in, std::true_type)
+    {
+        typename std::aligned_storage<sizeof(Entry), alignof(Entry)>::type bytes;
+        in.read(&bytes, sizeof(bytes));
+        const Entry & entry = *reinterpret_cast<const Entry *>(&bytes);
+        return ValueType<Key_T, Mapped_T>(entry.first, entry.second);
+    }
+    static ValueType<Key_T, Mapped_T> read_entry(SnapshotReader & in, std::false_type)
+    {
+        Key_T key = Serializer<Key_T>::read(in);
+        Mapped_T value = Serializer<Mapped_T>::read(in);
+        return ValueType<Key_T, Mapped_T>(std::move(key), std::move(value));
+    }
+
+    //read and check the header, returns the number of entries
+    static std::uint64_t read_header(SnapshotReader & in)
+    {
+        SnapshotHeader found;
+        in.read(&found, sizeof(found));
+        if (!matches(found, in.bytes_left()))
+        {
+            in.fail("does not hold entries of this key and value type");
+        }
+        return found.count;
+    }
+};
+
+
+namespace cs540
+{
+    //class declaration
+	template<class Key_T, class Mapped_T, class Policy = DefaultTreePolicy,
+	    class Alloc = std::allocator<ValueType<Key_T, Mapped_T>>>
+	class Map;
 
-			//it is not the root of the tree
-			if (node->parent != NULL)
-            {
-				if (node == node->parent->right)
-				{
-					node->parent->right = newNode;
-				}
-				if (node == node->parent->left)
-				{
-					node->parent->left = newNode;
-				}
-			}
-
-			//discard the old node
-			delete node;
-
-			//set the successor
-			to_delete = nodeSucc;
-		}
-
-		//reassign children based on whether or not it has 1 or 0 children
-		sub_tree_node = to_delete->left;
-		if (sub_tree_node == NULL)
-        {
-			sub_tree_node = to_delete->right;
-		}
+	//equality operator
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	bool operator==(const Map<Key_T, Mapped_T, Policy, Alloc> &, const Map<Key_T, Mapped_T, Policy, Alloc> &);
 
-		//is the node to be deleted is root?
-		if (to_delete->parent == NULL)
-        {
-			treeRoot = sub_tree_node;
-		}
+	//less-than operator
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	bool operator<(const Map<Key_T, Mapped_T, Policy, Alloc> &, const Map<Key_T, Mapped_T, Policy, Alloc> &);
 
-		//The node to be deleted, which child is it?
-		else if (to_delete->parent->left == to_delete)
-        {
-			to_delete->parent->left = sub_tree_node;
-		}
-		else
-		{
-			to_delete->parent->right = sub_tree_node;
-		}
-
-		//Set the parent to the node's parent pointer
-		if (sub_tree_node != NULL)
-        {
-			sub_tree_node->parent = to_delete->parent;
-		}
-
-		//re-adjust the height after a node is removed
-		adjust_height_remove(to_delete->parent);
-		{
-			if (to_delete->listPrevious != NULL)
-				(to_delete->listPrevious)->listNext = (to_delete->listNext);
-			if (to_delete->listNext != NULL)
-				(to_delete->listNext)->listPrevious = (to_delete->listPrevious);
-		}
-		--size;
-		delete to_delete;
-	}
-}
+	//inequality operator
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	bool operator!=(const Map<Key_T, Mapped_T, Policy, Alloc> &, const Map<Key_T, Mapped_T, Policy, Alloc> &);
 
-//**** IMPLEMENTATION FOR ITERATORS STARTS HERE *****//
+	//equality operator
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	bool operator==(const Map<Key_T, Mapped_T, Policy, Alloc> &, const Map<Key_T, Mapped_T, Policy, Alloc> &);
 
-//Iterator: begin
-template<class Key_T, class Mapped_T>
-typename Tree<Key_T, Mapped_T>::Iterator Tree<Key_T, Mapped_T>::begin()
-{
-	return Iterator(min_val(treeRoot), this);
-}
+	//*** Start of the Map Class ***//
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	class Map
+	{
+	    private:
+            Tree<Key_T, Mapped_T, Policy, Alloc> tree;
+            using LinkPtr = typename Tree<Key_T, Mapped_T, Policy, Alloc>::LinkPtr;
+            friend bool operator== <>(const Map<Key_T, Mapped_T, Policy, Alloc> &, const Map<Key_T, Mapped_T, Policy, Alloc> &);
+            friend bool operator< <>(const Map<Key_T, Mapped_T, Policy, Alloc> &, const Map<Key_T, Mapped_T, Policy, Alloc> &);
+            friend bool operator!= <>(const Map<Key_T, Mapped_T, Policy, Alloc> &, const Map<Key_T, Mapped_T, Policy, Alloc> &);
+
+        public:
 
-//Iterator: end
-template<class Key_T, class Mapped_T>
-typename Tree<Key_T, Mapped_T>::Iterator Tree<Key_T, Mapped_T>::end()
-{
-	return Iterator(NULL, this);
-}
+            //declarations for the iterators
+            using Iterator = typename Tree<Key_T, Mapped_T, Policy, Alloc>::Iterator;
+            using ConstIterator = typename Tree<Key_T, Mapped_T, Policy, Alloc>::ConstIterator;
+            using ReverseIterator = typename Tree<Key_T, Mapped_T, Policy, Alloc>::ReverseIterator;
+
+            //standard container names, so generic code can take a Map
+            using key_type = Key_T;
+            using mapped_type = Mapped_T;
+            using value_type = ValueType<Key_T, Mapped_T>;
+            using size_type = std::size_t;
+            using iterator = Iterator;
+            using const_iterator = ConstIterator;
+            using reverse_iterator = ReverseIterator;
+
+            using allocator_type = Alloc;
+
+            //node handles, see extract()
+            using node_type = typename Tree<Key_T, Mapped_T, Policy, Alloc>::NodeHandle;
+            struct insert_return_type
+            {
+                Iterator position;
+                bool inserted;
+                node_type node;
+            };
+
+            //empty constructor
+            Map()
+            {
+                //empty
+            }
 
-//Iterator: increment
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::Iterator::increment() {
-	if (inode != NULL)
-    {
-        inode = inode->listNext;
-	}
-}
+            //empty map whose nodes come from the given allocator
+            explicit Map(const Alloc & alloc)
+                : tree(alloc)
+            {
+                //empty
+            }
+
+            //copy constructor, the allocator is selected for copying
+            Map(const Map<Key_T, Mapped_T, Policy, Alloc> &original)
+                : tree(original.tree)
+            {
+                //empty
+            }
+
+            //move constructor, takes the nodes without touching them
+            Map(Map<Key_T, Mapped_T, Policy, Alloc> &&original)
+                : tree(std::move(original.tree))
+            {
+                //empty
+            }
 
-//Iterator: decrement
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::Iterator::decrement()
-{
-	if (inode != NULL)
-    {
-		inode = inode->listPrevious;
-	}
+            //assignment operator
+            Map<Key_T, Mapped_T, Policy, Alloc> & operator=(const Map & original)
+            {
+                tree = original.tree;
+                return *this;
+            }
 
-	if (inode == NULL)
-	{
-		inode = ptr->max_val(ptr->treeRoot);
-	}
-}
+            //move assignment, copies when the allocators differ and do
+            //not propagate
+            Map<Key_T, Mapped_T, Policy, Alloc> & operator=(Map && original)
+            {
+                tree = std::move(original.tree);
+                return *this;
+            }
+
+            //exchange contents with another map
+            void swap(Map & other)
+            {
+                tree.swap(other.tree);
+            }
+
+            allocator_type get_allocator() const
+            {
+                return tree.get_allocator();
+            }
+
+            //constructor when a list of initializer is given
+            Map(std::initializer_list<std::pair<const Key_T, Mapped_T>> list,
+                const Alloc & alloc = Alloc())
+                : tree(alloc)
+            {
+                for (auto x : list)
+                {
+                    insert(x);
+                }
+            }
 
-//Const Iterator: begin
-template<class Key_T, class Mapped_T>
-const typename Tree<Key_T, Mapped_T>::ConstIterator Tree<Key_T, Mapped_T>::begin() const
-{
-	return ConstIterator(min_val(treeRoot), this);
-}
+            //get the size of the tree
+            size_t size() const
+            {
+                return tree.sizeR();
+            }
 
-//Const Iterator: end
-template<class Key_T, class Mapped_T>
-const typename Tree<Key_T, Mapped_T>::ConstIterator Tree<Key_T, Mapped_T>::end() const
-{
-	return ConstIterator(NULL, this);
-}
+            //check if the tree is empty
+            bool empty() const
+            {
+                return tree.empty();
+            }
+
+            //erased entries whose nodes are still linked, only policies
+            //with a lazy_erase_ratio leave them. compact() drops them.
+            size_t dead_count() const
+            {
+                return tree.dead_count();
+            }
+
+            //*** DEFINITON OF ITERATOR FUNCTIONS *****
+            Iterator begin();
+            Iterator end();
+            ConstIterator begin() const;
+            ConstIterator end() const;
+            ReverseIterator rbegin();
+            ReverseIterator rend();
 
-//Const Iterator: increment
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::ConstIterator::increment() {
-	if (inode != NULL) {
-		inode = inode->listNext;
-	}
-}
+            //*** function declarations ****//
+            Iterator find(const Key_T &);
+            ConstIterator find(const Key_T &) const;
+            //first entry not less than the key, first entry greater than it
+            Iterator lower_bound(const Key_T &);
+            ConstIterator lower_bound(const Key_T &) const;
+            Iterator upper_bound(const Key_T &);
+            ConstIterator upper_bound(const Key_T &) const;
+            Mapped_T &at(const Key_T &);
+            template <typename IT_T>
+            void insert(IT_T range_beg, IT_T range_end);
+            Iterator erase(Iterator pos);
+            void erase(const Key_T &);
+            void clear();
+            std::thread clear_background();
+            void compact(CompactOrder order = CompactOrder::breadth_first);
+            bool compact_step(std::size_t budget);
+            TreeStats stats() const;
+            void reset_stats();
+
+            //hits and misses of the lookup cache, see lookup_cache_sets.
+            //reset_stats() clears them too.
+            LookupCacheStats lookup_cache_stats() const
+            {
+                return tree.lookup_cache_stats();
+            }
+
+            MemoryUsage memory_usage() const;
+            TreeShape shape() const;
+            bool validate() const;
+            const Mapped_T &at(const Key_T &) const;
+            Mapped_T & operator[] (const Key_T &);
+            std::pair<typename Map <Key_T, Mapped_T, Policy, Alloc>::Iterator, bool> insert(const ValueType<const Key_T, Mapped_T> & pair);
+
+            //unlink an element without freeing it, the handle owns it and
+            //its key can be changed. Needs PointerStorage.
+            node_type extract(Iterator pos);
+            node_type extract(const Key_T &);
+
+            //write the entries to a snapshot file, see SnapshotHeader. Keys
+            //and values go through their Serializer.
+            void save(const std::string & path) const;
+
+            //replace the contents with a snapshot written by save(), built
+            //in O(n). Throws and keeps the old contents when the file does
+            //not check out.
+            void load(const std::string & path);
+
+            //apply changes sorted by key, one per key, in a single merge
+            //when the batch is large. Values are moved out of the batch.
+            void merge_sorted(std::vector<MergeEntry<Key_T, Mapped_T>> & batch);
+
+            //link the node of a handle from a map with an equal allocator,
+            //without allocating or copying. When the key is already there
+            //the node is handed back in the result.
+            insert_return_type insert(node_type && node);
+            //end of function declarations
+
+
+	};
 
-//Const Iterator: decrement
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::ConstIterator::decrement()
-{
-	if (inode != NULL)
-    {
-		inode = inode->listPrevious;
-	}
-	if (inode == NULL)
-    {
-		inode = ptr->max_val(ptr->treeRoot);
-	}
-}
+	//*** end of map class ***//
 
-//Reverse Iterator: begin
-template<class Key_T, class Mapped_T>
-typename Tree<Key_T, Mapped_T>::ReverseIterator Tree<Key_T, Mapped_T>::rbegin()
-{
-	return ReverseIterator(max_val(treeRoot), this);
-}
+	//**** IMPLEMENATION OF FUNCTIONS STARTS HERE *****//
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	std::pair<typename Map <Key_T, Mapped_T, Policy, Alloc>::Iterator, bool> Map<Key_T, Mapped_T, Policy, Alloc>::insert(const ValueType<const Key_T, Mapped_T> & pair)
+	{
+		bool inserted;
+		LinkPtr tmp = tree.insert_unique(pair.first, pair.second, inserted);
+		return std::pair<Iterator, bool>(Iterator(tmp, &tree), inserted);
+	}
+
+	//save a snapshot, entries are written in key order
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void Map<Key_T, Mapped_T, Policy, Alloc>::save(const std::string & path) const
+	{
+		typedef SnapshotFormat<Key_T, Mapped_T> Format;
+		SnapshotWriter out(path);
+		SnapshotHeader header = Format::header(size());
+		out.write(&header, sizeof(header));
+		for (ConstIterator x = begin(); x != end(); ++x)
+        {
+            Format::write_entry(out, x->first, x->second);
+        }
+		out.finish();
+	}
+
+	//load a snapshot into a fresh tree, which replaces this one once the
+	//whole file checks out
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void Map<Key_T, Mapped_T, Policy, Alloc>::load(const std::string & path)
+	{
+		typedef SnapshotFormat<Key_T, Mapped_T> Format;
+		SnapshotReader in(path);
+		std::uint64_t count = Format::read_header(in);
+
+		Tree<Key_T, Mapped_T, Policy, Alloc> fresh(get_allocator());
+		fresh.assign_sorted(static_cast<std::size_t>(count), [&in]() { return Format::read_entry(in); });
+		in.finish();
+		tree.swap(fresh);
+	}
+
+	//apply a sorted batch of changes
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void Map<Key_T, Mapped_T, Policy, Alloc>::merge_sorted(std::vector<MergeEntry<Key_T, Mapped_T>> & batch)
+	{
+		tree.merge_sorted(batch);
+	}
+
+	//insert the node of a handle
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename Map<Key_T, Mapped_T, Policy, Alloc>::insert_return_type Map<Key_T, Mapped_T, Policy, Alloc>::insert(node_type && node)
+	{
+		insert_return_type result;
+		result.inserted = false;
+		if (node.empty())
+        {
+			result.position = end();
+			return result;
+		}
+		result.position = Iterator(tree.insert(std::move(node), result.inserted), &tree);
+		if (!result.inserted)
+        {
+            result.node = std::move(node);
+        }
+		return result;
+	}
+
+	//extract the element at the given position
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename Map<Key_T, Mapped_T, Policy, Alloc>::node_type Map<Key_T, Mapped_T, Policy, Alloc>::extract(Iterator pos)
+	{
+		return tree.extract(pos.inode);
+	}
+
+	//extract the element with the given key, an empty handle without one
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename Map<Key_T, Mapped_T, Policy, Alloc>::node_type Map<Key_T, Mapped_T, Policy, Alloc>::extract(const Key_T & key)
+	{
+		LinkPtr node = tree.helper_search(key);
+		return node ? tree.extract(node) : node_type();
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	template<typename IT_T>
+	void Map<Key_T, Mapped_T, Policy, Alloc>::insert(IT_T range_beg, IT_T range_end)
+	{
+		for (; range_beg != range_end; ++range_beg)
+        {
+			tree.insert(range_beg->first, range_beg->second);
+		}
+	}
 
-//Reverse Iterator: end
-template<class Key_T, class Mapped_T>
-typename Tree<Key_T, Mapped_T>::ReverseIterator Tree<Key_T, Mapped_T>::rend()
-{
-	return ReverseIterator(NULL, this);
-}
+	//erase the given key
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void Map<Key_T, Mapped_T, Policy, Alloc>::erase(const Key_T & key)
+    {
+		tree.remove(key);
+	}
+
+	//erase the element at the given position, returns the one after it
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename Map<Key_T, Mapped_T, Policy, Alloc>::Iterator Map<Key_T, Mapped_T, Policy, Alloc>::erase(const Iterator pos)
+	{
+		return tree.remove(pos);
+	}
 
-//Reverse Iterator: increment operator
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::ReverseIterator::increment()
-{
-	if (inode != NULL)
-        {
-		inode = inode->listPrevious;
-	}
-}
+	//delete the entire tree
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void Map<Key_T, Mapped_T, Policy, Alloc>::clear()
+	{
+		tree.clear();
+	}
+
+	//empty the map now, the old elements are destroyed on the returned
+	//thread. Join or detach it, the allocator has to outlive it.
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	std::thread Map<Key_T, Mapped_T, Policy, Alloc>::clear_background()
+	{
+		return tree.clear_background();
+	}
+
+	//lay the nodes out again in traversal order, invalidates iterators
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void Map<Key_T, Mapped_T, Policy, Alloc>::compact(CompactOrder order)
+	{
+		tree.compact(order);
+	}
+
+	//compact at most budget nodes, true once a whole pass is done
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	bool Map<Key_T, Mapped_T, Policy, Alloc>::compact_step(std::size_t budget)
+	{
+		return tree.compact_step(budget);
+	}
+
+	//snapshot of the instrumentation counters, all zero unless the
+	//policy uses CountingStats
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	TreeStats Map<Key_T, Mapped_T, Policy, Alloc>::stats() const
+	{
+		return tree.stats();
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void Map<Key_T, Mapped_T, Policy, Alloc>::reset_stats()
+	{
+		tree.reset_stats();
+	}
+
+	//memory held by the map
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	MemoryUsage Map<Key_T, Mapped_T, Policy, Alloc>::memory_usage() const
+	{
+		return tree.memory_usage();
+	}
+
+	//depth histogram, height against the AVL bound, average search path
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	TreeShape Map<Key_T, Mapped_T, Policy, Alloc>::shape() const
+	{
+		return tree.shape();
+	}
+
+	//false if any link, height, balance factor or key order is off
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	bool Map<Key_T, Mapped_T, Policy, Alloc>::validate() const
+	{
+		return tree.validate();
+	}
+
+	//at function
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	Mapped_T & Map<Key_T, Mapped_T, Policy, Alloc>::at(const Key_T & key)
+	{
+		return tree.at(key);
+	}
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	const Mapped_T & Map<Key_T, Mapped_T, Policy, Alloc>::at(const Key_T & key) const
+	{
+		return tree.at(key);
+	}
 
-//Reverse Iterator: decrement operator
-template<class Key_T, class Mapped_T>
-void Tree<Key_T, Mapped_T>::ReverseIterator::decrement()
-{
-	if (inode != NULL)
-    {
-		inode = inode->listNext;
-	}
-	if (inode == NULL)
-	{
-		inode = ptr->min_val(ptr->treeRoot);
-	}
-}
+	//find function
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename Map<Key_T, Mapped_T, Policy, Alloc>::Iterator Map<Key_T, Mapped_T, Policy, Alloc>::find(const Key_T & key)
+	{
+		LinkPtr node = tree.helper_search(key);
+		return node ? Iterator(node, &tree) : tree.end();
+	}
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename Map<Key_T, Mapped_T, Policy, Alloc>::ConstIterator Map<Key_T, Mapped_T, Policy, Alloc>::find(const Key_T & key) const
+	{
+		LinkPtr node = tree.helper_search(key);
+		return node ? ConstIterator(node, &tree) : tree.end();
+	}
+
+	//bound functions, iteration from them is in key order
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename Map<Key_T, Mapped_T, Policy, Alloc>::Iterator Map<Key_T, Mapped_T, Policy, Alloc>::lower_bound(const Key_T & key)
+	{
+		return Iterator(tree.bound(key, false), &tree);
+	}
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename Map<Key_T, Mapped_T, Policy, Alloc>::ConstIterator Map<Key_T, Mapped_T, Policy, Alloc>::lower_bound(const Key_T & key) const
+	{
+		return ConstIterator(tree.bound(key, false), &tree);
+	}
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename Map<Key_T, Mapped_T, Policy, Alloc>::Iterator Map<Key_T, Mapped_T, Policy, Alloc>::upper_bound(const Key_T & key)
+	{
+		return Iterator(tree.bound(key, true), &tree);
+	}
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename Map<Key_T, Mapped_T, Policy, Alloc>::ConstIterator Map<Key_T, Mapped_T, Policy, Alloc>::upper_bound(const Key_T & key) const
+	{
+		return ConstIterator(tree.bound(key, true), &tree);
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	Mapped_T & Map<Key_T, Mapped_T, Policy, Alloc>::operator[](const Key_T & key)
+	{
+		LinkPtr temp;
+		if ((temp = tree.helper_search(key)))
+        {
+			return tree.pair_of(temp).second;
+		}
+		temp = tree.insert(key, Mapped_T());
+		return tree.pair_of(temp).second;
+	}
 
-//Operator overloaded: equality
-template <class Key_T, class Mapped_T>
-bool operator==(const Tree<Key_T, Mapped_T> & x, const Tree<Key_T, Mapped_T> & y)
-{
-	typename Tree<Key_T, Mapped_T>::ConstIterator first = x.begin();
-	typename Tree<Key_T, Mapped_T>::ConstIterator second = y.begin();
-	if (x.sizeR() != y.sizeR())
-		return false;
-	for (; first != x.end() || second != y.end(); ++first, ++second) {
-		if (!(first->first == second->first) || !(first->second == second->second))
-			return false;
+    //iterator implementation
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename Map<Key_T, Mapped_T, Policy, Alloc>::Iterator Map<Key_T, Mapped_T, Policy, Alloc>::begin()
+	{
+		return tree.begin();
+	}
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename Map<Key_T, Mapped_T, Policy, Alloc>::Iterator Map<Key_T, Mapped_T, Policy, Alloc>::end()
+	{
+		return tree.end();
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename Map<Key_T, Mapped_T, Policy, Alloc>::ConstIterator Map<Key_T, Mapped_T, Policy, Alloc>::begin() const {
+		return tree.begin();
+	}
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename Map<Key_T, Mapped_T, Policy, Alloc>::ConstIterator Map<Key_T, Mapped_T, Policy, Alloc>::end() const
+	{
+		return tree.end();
+	}
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename Map<Key_T, Mapped_T, Policy, Alloc>::ReverseIterator Map<Key_T, Mapped_T, Policy, Alloc>::rbegin()
+	{
+		return tree.rbegin();
+	}
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename Map<Key_T, Mapped_T, Policy, Alloc>::ReverseIterator Map<Key_T, Mapped_T, Policy, Alloc>::rend()
+	{
+		return tree.rend();
+	}
+
+	//*** GLOBAL COMPARSION FUNCTIONS *****//
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	bool operator==(const Map<Key_T, Mapped_T, Policy, Alloc> & x, const Map<Key_T, Mapped_T, Policy, Alloc> & y)
+	{
+		return x.tree == y.tree;
+	}
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	bool operator!=(const Map<Key_T, Mapped_T, Policy, Alloc> & x, const Map<Key_T, Mapped_T, Policy, Alloc> & y)
+	{
+		return x.tree != y.tree;
 	}
-	return true;
-}
-
-//Operator overloaded: inequality
-template <class Key_T, class Mapped_T>
-bool operator!=(const Tree<Key_T, Mapped_T> & x, const Tree<Key_T, Mapped_T> & y)
-{
-	return !(x == y);
-}
-
-//Operator overloaded: less-than
-template <class Key_T, class Mapped_T>
-bool operator<(const Tree<Key_T, Mapped_T> & x, const Tree<Key_T, Mapped_T> & y)
-{
-	return x.sizeR()<y.sizeR();
+	template <class Key_T, class Mapped_T, class Policy, class Alloc>
+	bool operator<(const Map<Key_T, Mapped_T, Policy, Alloc> & x, const Map<Key_T, Mapped_T, Policy, Alloc> & y)
+	{
+		return x.tree<y.tree;
+	}
+
+	//exchange two maps
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void swap(Map<Key_T, Mapped_T, Policy, Alloc> & x, Map<Key_T, Mapped_T, Policy, Alloc> & y)
+	{
+		x.swap(y);
+	}
+
+	//+++++++++++++++++++++++++++ BUFFERED MAP +++++++++++++++++++++++++++++//
+
+	//Map for write heavy loads. insert, assign and erase only append to a
+	//buffer. When it is full, or before anything is read, the buffer is
+	//sorted, reduced to one change per key and merged into the map in key
+	//order, see Map::merge_sorted. Reads see every change made before them.
+	//The buffer holds bufferCapacity changes or an eighth of the map,
+	//whichever is more, so a large map takes each batch in one relinking
+	//pass instead of a descent per change.
+	//Writes do not report whether the key was there, the map only knows
+	//once they are merged.
+	template<class Key_T, class Mapped_T, class Policy = DefaultTreePolicy,
+	    class Alloc = std::allocator<ValueType<Key_T, Mapped_T>>>
+	class BufferedMap
+	{
+	    public:
+	        typedef Map<Key_T, Mapped_T, Policy, Alloc> MapType;
+
+	        using Iterator = typename MapType::Iterator;
+	        using ConstIterator = typename MapType::ConstIterator;
+	        using key_type = Key_T;
+	        using mapped_type = Mapped_T;
+	        using value_type = ValueType<Key_T, Mapped_T>;
+	        using size_type = std::size_t;
+	        using iterator = Iterator;
+	        using const_iterator = ConstIterator;
+
+	        static constexpr std::size_t defaultBufferCapacity = 16384;
+
+	        //16K changes of a few words each fit in the L2 cache
+	        explicit BufferedMap(std::size_t bufferCapacity = defaultBufferCapacity)
+	            : capacity(std::max<std::size_t>(bufferCapacity, 1))
+	        {
+	            buffer.reserve(capacity);
+	        }
+
+	        //only adds a missing key, like Map::insert
+	        void insert(const ValueType<Key_T, Mapped_T> & pair)
+	        {
+	            append(pair.first, pair.second, MergeOp::insert);
+	        }
+
+	        //insert or overwrite
+	        void assign(const Key_T & key, const Mapped_T & value)
+	        {
+	            append(key, value, MergeOp::put);
+	        }
+
+	        void erase(const Key_T & key)
+	        {
+	            append(key, Mapped_T(), MergeOp::erase);
+	        }
+
+	        //merge the buffer into the map now
+	        void flush() const;
+
+	        //drop the map and the buffer
+	        void clear()
+	        {
+	            buffer.clear();
+	            entries.clear();
+	        }
+
+	        //changes waiting in the buffer
+	        size_t buffered() const
+	        {
+	            return buffer.size();
+	        }
+
+	        //the merged map, changes through it are not buffered
+	        MapType & map()
+	        {
+	            flush();
+	            return entries;
+	        }
+	        const MapType & map() const
+	        {
+	            flush();
+	            return entries;
+	        }
+
+	        size_t size() const
+	        {
+	            return map().size();
+	        }
+	        bool empty() const
+	        {
+	            return map().empty();
+	        }
+	        Iterator begin()
+	        {
+	            return map().begin();
+	        }
+	        Iterator end()
+	        {
+	            return map().end();
+	        }
+	        ConstIterator begin() const
+	        {
+	            return map().begin();
+	        }
+	        ConstIterator end() const
+	        {
+	            return map().end();
+	        }
+	        Iterator find(const Key_T & key)
+	        {
+	            return map().find(key);
+	        }
+	        ConstIterator find(const Key_T & key) const
+	        {
+	            return map().find(key);
+	        }
+	        Mapped_T & at(const Key_T & key)
+	        {
+	            return map().at(key);
+	        }
+	        const Mapped_T & at(const Key_T & key) const
+	        {
+	            return map().at(key);
+	        }
+	        Mapped_T & operator[](const Key_T & key)
+	        {
+	            return map()[key];
+	        }
+
+	    private:
+	        typedef MergeEntry<Key_T, Mapped_T> Entry;
+
+	        //reads merge the buffer first, so both change under const
+	        mutable MapType entries;
+	        mutable std::vector<Entry> buffer;
+	        std::size_t capacity;
+
+	        void append(const Key_T & key, const Mapped_T & value, MergeOp op)
+	        {
+	            Entry entry = { key, value, op };
+	            buffer.push_back(std::move(entry));
+	            if (buffer.size() >= std::max(capacity, entries.size() / 8))
+	            {
+	                flush();
+	            }
+	        }
+	};
+
+	//sort stably so the changes to a key stay in the order they were made,
+	//then fold each run of one key into a single change. After an erase the
+	//key is known to be missing, so a later insert becomes a put.
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void BufferedMap<Key_T, Mapped_T, Policy, Alloc>::flush() const
+	{
+		if (buffer.empty())
+		{
+			return;
+		}
+		std::stable_sort(buffer.begin(), buffer.end(), [](const Entry & a, const Entry & b) {
+			return KeyCompare<Key_T>::compare(a.first, b.first) < 0;
+		});
+
+		std::size_t kept = 0;
+		for (std::size_t i = 0; i < buffer.size(); ++kept)
+		{
+			if (kept != i)
+			{
+				buffer[kept] = std::move(buffer[i]);
+			}
+			Entry & folded = buffer[kept];
+			for (++i; i < buffer.size() && KeyCompare<Key_T>::compare(buffer[i].first, folded.first) == 0; ++i)
+			{
+				if (buffer[i].op == MergeOp::put)
+				{
+					folded.second = std::move(buffer[i].second);
+					folded.op = MergeOp::put;
+				}
+				else if (buffer[i].op == MergeOp::erase)
+				{
+					folded.op = MergeOp::erase;
+				}
+				else if (folded.op == MergeOp::erase)
+				{
+					folded.second = std::move(buffer[i].second);
+					folded.op = MergeOp::put;
+				}
+			}
+		}
+		buffer.erase(buffer.begin() + kept, buffer.end());
+
+		//folded changes can be applied twice, after a failed merge the
+		//buffer is simply merged again
+		entries.merge_sorted(buffer);
+		buffer.clear();
+	}
+
+	//+++++++++++++++++++++++++++ LRU MAP +++++++++++++++++++++++++++++//
+
+	//lookups of an LruMap and the entries it dropped to stay in capacity
+	struct LruStats
+	{
+	    std::uint64_t hits;
+	    std::uint64_t misses;
+	    std::uint64_t evictions;
+	};
+
+	//bytes an LruMap charges an entry on top of its node, none by default.
+	//A weigher must give the same bytes for the same entry every time.
+	struct LruNodeBytes
+	{
+	    template<class Key_T, class Mapped_T>
+	    std::size_t operator()(const Key_T &, const Mapped_T &) const
+	    {
+	        return 0;
+	    }
+	};
+
+	template<class Key_T, class Mapped_T, class Policy, class Weigh, class Alloc> class LruMap;
+
+	//what an LruMap node maps a key to: the value and its place in the
+	//recency list, kept in the node so a hit moves no memory
+	template<class Key_T, class Mapped_T>
+	class LruEntry
+	{
+	    public:
+	        Mapped_T value;
+
+	        LruEntry()
+	            : value(), newer(0), older(0)
+	        {
+	        }
+	        explicit LruEntry(const Mapped_T & v)
+	            : value(v), newer(0), older(0)
+	        {
+	        }
+
+	    private:
+	        template<class K, class M, class P, class W, class A> friend class LruMap;
+
+	        ValueType<Key_T, LruEntry> * newer;
+	        ValueType<Key_T, LruEntry> * older;
+	};
+
+	//Map used as a cache in front of a slower store. Past maxEntries
+	//entries or maxBytes bytes the least recently used entry is evicted in
+	//O(log n). A hit moves its entry to the front of the recency list in
+	//O(1), the list runs through the nodes. Iteration and the bounds are in
+	//key order and leave recency alone. Bytes are the size of a node plus
+	//what Weigh charges for the entry.
+	//The list points into the nodes, so they must never move: the policy
+	//needs PointerStorage without inline entries and the map is not copied.
+	template<class Key_T, class Mapped_T, class Policy = DefaultTreePolicy, class Weigh = LruNodeBytes,
+	    class Alloc = std::allocator<ValueType<Key_T, LruEntry<Key_T, Mapped_T>>>>
+	class LruMap
+	{
+	        static_assert(std::is_same<typename Policy::storage, PointerStorage>::value,
+	            "LruMap keeps pointers to its nodes, use PointerStorage");
+	        static_assert(Policy::inline_capacity == 0, "LruMap keeps pointers to its nodes, inline entries move");
+
+	    public:
+	        typedef LruEntry<Key_T, Mapped_T> Entry;
+	        typedef Map<Key_T, Entry, Policy, Alloc> MapType;
+
+	        using ConstIterator = typename MapType::ConstIterator;
+	        using key_type = Key_T;
+	        using mapped_type = Mapped_T;
+	        using value_type = ValueType<Key_T, Entry>;
+	        using size_type = std::size_t;
+	        using const_iterator = ConstIterator;
+
+	        //a limit of 0 is no limit
+	        explicit LruMap(std::size_t maxEntries, std::size_t maxBytes = 0, const Weigh & weigh = Weigh())
+	            : newestEntry(0), oldestEntry(0), entryLimit(maxEntries), byteLimit(maxBytes), usedBytes(0), weigh(weigh)
+	        {
+	            reset_stats();
+	        }
+	        LruMap(const LruMap &) = delete;
+	        LruMap & operator=(const LruMap &) = delete;
+
+	        //the value of the key, which becomes the most recently used, or
+	        //null on a miss. Counted as a hit or a miss.
+	        Mapped_T * find(const Key_T & key);
+
+	        //the value of the key without counting or touching recency
+	        const Mapped_T * peek(const Key_T & key) const
+	        {
+	            ConstIterator it = entries.find(key);
+	            return it != entries.end() ? &it->second.value : 0;
+	        }
+
+	        //insert or overwrite, the entry becomes the most recently used and
+	        //the least recently used ones are evicted past the capacity. The
+	        //newest entry stays even when it alone is over maxBytes.
+	        //Returns whether the key was new.
+	        bool assign(const Key_T & key, const Mapped_T & value);
+
+	        bool erase(const Key_T & key);
+	        void clear();
+
+	        //drop the least recently used entry, false when there is none
+	        bool evict();
+
+	        //change the limits and evict down to them
+	        void set_capacity(std::size_t maxEntries, std::size_t maxBytes = 0)
+	        {
+	            entryLimit = maxEntries;
+	            byteLimit = maxBytes;
+	            trim();
+	        }
+
+	        std::size_t size() const
+	        {
+	            return entries.size();
+	        }
+	        bool empty() const
+	        {
+	            return entries.size() == 0;
+	        }
+	        std::size_t bytes() const
+	        {
+	            return usedBytes;
+	        }
+	        std::size_t max_entries() const
+	        {
+	            return entryLimit;
+	        }
+	        std::size_t max_bytes() const
+	        {
+	            return byteLimit;
+	        }
+
+	        //the next entry to be evicted and the last one used, null when empty
+	        const value_type * oldest() const
+	        {
+	            return oldestEntry;
+	        }
+	        const value_type * newest() const
+	        {
+	            return newestEntry;
+	        }
+
+	        ConstIterator begin() const
+	        {
+	            return entries.begin();
+	        }
+	        ConstIterator end() const
+	        {
+	            return entries.end();
+	        }
+	        ConstIterator lower_bound(const Key_T & key) const
+	        {
+	            return entries.lower_bound(key);
+	        }
+	        ConstIterator upper_bound(const Key_T & key) const
+	        {
+	            return entries.upper_bound(key);
+	        }
+
+	        //read only, changes have to go through the recency list
+	        const MapType & map() const
+	        {
+	            return entries;
+	        }
+
+	        LruStats stats() const
+	        {
+	            return counters;
+	        }
+	        void reset_stats()
+	        {
+	            counters.hits = 0;
+	            counters.misses = 0;
+	            counters.evictions = 0;
+	        }
+
+	    private:
+	        MapType entries;
+	        value_type * newestEntry;
+	        value_type * oldestEntry;
+	        std::size_t entryLimit;
+	        std::size_t byteLimit;
+	        std::size_t usedBytes;
+	        Weigh weigh;
+	        LruStats counters;
+
+	        std::size_t charge(const Key_T & key, const Mapped_T & value) const
+	        {
+	            return sizeof(Node<Key_T, Entry, Policy>) + weigh(key, value);
+	        }
+
+	        //HELPER FUNCTION: recency list
+	        void unlink(value_type & entry);
+	        void push_newest(value_type & entry);
+
+	        //HELPER FUNCTION: evict until within both limits
+	        void trim();
+	};
+
+	template<class Key_T, class Mapped_T, class Policy, class Weigh, class Alloc>
+	Mapped_T * LruMap<Key_T, Mapped_T, Policy, Weigh, Alloc>::find(const Key_T & key)
+	{
+		typename MapType::Iterator it = entries.find(key);
+		if (it == entries.end())
+	    {
+			++counters.misses;
+			return 0;
+		}
+		++counters.hits;
+		value_type & entry = *it.operator->();
+		if (&entry != newestEntry)
+	    {
+			unlink(entry);
+			push_newest(entry);
+		}
+		return &entry.second.value;
+	}
+
+	//one descent either way, insert hands back the entry that is there
+	template<class Key_T, class Mapped_T, class Policy, class Weigh, class Alloc>
+	bool LruMap<Key_T, Mapped_T, Policy, Weigh, Alloc>::assign(const Key_T & key, const Mapped_T & value)
+	{
+		std::size_t added = charge(key, value);
+		std::pair<typename MapType::Iterator, bool> result = entries.insert(value_type(key, Entry(value)));
+		value_type & entry = *result.first.operator->();
+		if (result.second)
+	    {
+			usedBytes += added;
+			push_newest(entry);
+		}
+		else
+	    {
+			std::size_t dropped = charge(key, entry.second.value);
+			entry.second.value = value;
+			usedBytes = usedBytes - dropped + added;
+			if (&entry != newestEntry)
+	        {
+				unlink(entry);
+				push_newest(entry);
+			}
+		}
+		trim();
+		return result.second;
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Weigh, class Alloc>
+	bool LruMap<Key_T, Mapped_T, Policy, Weigh, Alloc>::erase(const Key_T & key)
+	{
+		typename MapType::Iterator it = entries.find(key);
+		if (it == entries.end())
+	    {
+	        return false;
+	    }
+		value_type & entry = *it.operator->();
+		usedBytes -= charge(entry.first, entry.second.value);
+		unlink(entry);
+		entries.erase(it);
+		return true;
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Weigh, class Alloc>
+	void LruMap<Key_T, Mapped_T, Policy, Weigh, Alloc>::clear()
+	{
+		entries.clear();
+		newestEntry = 0;
+		oldestEntry = 0;
+		usedBytes = 0;
+	}
+
+	//the key lives in the node that goes, erase does not look at it once
+	//the node is found
+	template<class Key_T, class Mapped_T, class Policy, class Weigh, class Alloc>
+	bool LruMap<Key_T, Mapped_T, Policy, Weigh, Alloc>::evict()
+	{
+		if (oldestEntry == 0)
+	    {
+	        return false;
+	    }
+		value_type & victim = *oldestEntry;
+		usedBytes -= charge(victim.first, victim.second.value);
+		unlink(victim);
+		entries.erase(victim.first);
+		++counters.evictions;
+		return true;
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Weigh, class Alloc>
+	void LruMap<Key_T, Mapped_T, Policy, Weigh, Alloc>::trim()
+	{
+		while (entries.size() > 1
+			&& ((entryLimit != 0 && entries.size() > entryLimit) || (byteLimit != 0 && usedBytes > byteLimit)))
+	    {
+			evict();
+		}
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Weigh, class Alloc>
+	void LruMap<Key_T, Mapped_T, Policy, Weigh, Alloc>::unlink(value_type & entry)
+	{
+		Entry & links = entry.second;
+		(links.newer ? links.newer->second.older : newestEntry) = links.older;
+		(links.older ? links.older->second.newer : oldestEntry) = links.newer;
+		links.newer = 0;
+		links.older = 0;
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Weigh, class Alloc>
+	void LruMap<Key_T, Mapped_T, Policy, Weigh, Alloc>::push_newest(value_type & entry)
+	{
+		entry.second.newer = 0;
+		entry.second.older = newestEntry;
+		(newestEntry ? newestEntry->second.newer : oldestEntry) = &entry;
+		newestEntry = &entry;
+	}
+
+	//+++++++++++++++++++++++++++ INTRUSIVE AVL TREE +++++++++++++++++++++++++++++//
+
+	//links an object needs for each IntrusiveTree it sits in
+	struct IntrusiveHookPolicy : DefaultTreePolicy
+	{
+	    static constexpr bool threaded = false;
+	};
+	using AvlHook = NodeBase<IntrusiveHookPolicy>;
+
+	//AVL tree over objects the caller owns. Each object embeds one AvlHook
+	//per tree it can be in, the tree links the hooks and never allocates,
+	//copies or destroys an object. An object must stay put while linked.
+	template<class T, AvlHook T::*Hook, class Compare = std::less<T>>
+	class IntrusiveTree
+	{
+	    private:
+            using LinkPtr = AvlHook *;
+            typedef AvlAlgorithms<IntrusiveTree> Avl;
+            friend struct AvlAlgorithms<IntrusiveTree>;
+            friend struct BinaryTreeAlgorithms<IntrusiveTree>;
+
+	    public:
+            struct Iterator
+            {
+                using iterator_category = std::bidirectional_iterator_tag;
+                using value_type = T;
+                using difference_type = std::ptrdiff_t;
+                using pointer = T *;
+                using reference = T &;
+
+                Iterator()
+                    : inode(0), ptr(0)
+                {
+                    //empty
+                }
+                Iterator(LinkPtr node, const IntrusiveTree * tree)
+                    : inode(node), ptr(tree)
+                {
+                    //empty
+                }
+
+                T & operator*() const
+                {
+                    return object_of(inode);
+                }
+                T * operator->() const
+                {
+                    return &object_of(inode);
+                }
+                Iterator & operator++()
+                {
+                    inode = Avl::get_successor(*ptr, inode);
+                    return *this;
+                }
+                Iterator operator++(int)
+                {
+                    Iterator copy = *this;
+                    ++*this;
+                    return copy;
+                }
+
+                //from end() this lands on the largest object
+                Iterator & operator--()
+                {
+                    inode = inode == 0 ? Avl::max_val(*ptr, ptr->treeRoot) : Avl::get_predecessor(*ptr, inode);
+                    return *this;
+                }
+                Iterator operator--(int)
+                {
+                    Iterator copy = *this;
+                    --*this;
+                    return copy;
+                }
+                bool operator==(const Iterator & itTwo) const
+                {
+                    return inode == itTwo.inode;
+                }
+                bool operator!=(const Iterator & itTwo) const
+                {
+                    return inode != itTwo.inode;
+                }
+
+                LinkPtr inode;
+                const IntrusiveTree * ptr;
+            };
+
+            explicit IntrusiveTree(const Compare & comp = Compare())
+                : treeRoot(0), count(0), compare(comp)
+            {
+                //empty
+            }
+
+            //objects can only be linked into one place through a hook
+            IntrusiveTree(const IntrusiveTree &) = delete;
+            IntrusiveTree & operator=(const IntrusiveTree &) = delete;
+
+            size_t size() const
+            {
+                return count;
+            }
+            bool empty() const
+            {
+                return treeRoot == 0;
+            }
+
+            Iterator begin() const
+            {
+                return Iterator(Avl::min_val(*this, treeRoot), this);
+            }
+            Iterator end() const
+            {
+                return Iterator(0, this);
+            }
+
+            //link the object in, an equal object already in the tree is
+            //returned instead and the new one stays unlinked
+            std::pair<Iterator, bool> insert(T & object);
+
+            //unlink an object of this tree, returns the next position
+            Iterator erase(Iterator pos);
+            void erase(T & object)
+            {
+                erase(iterator_to(object));
+            }
+
+            //objects equal to the key, Compare has to take the key on
+            //either side
+            template<class K>
+            Iterator find(const K & key) const;
+
+            //position of an object that is in this tree
+            Iterator iterator_to(T & object) const
+            {
+                return Iterator(&(object.*Hook), this);
+            }
+
+            //forget every object, their hooks are reset when inserted again
+            void clear()
+            {
+                treeRoot = 0;
+                count = 0;
+            }
+
+	    private:
+            LinkPtr treeRoot;
+            size_t count;
+            Compare compare;
+
+            AvlHook & links(LinkPtr node) const
+            {
+                return *node;
+            }
+
+            //intrusive trees keep no counters
+            NoStats counters() const
+            {
+                return NoStats();
+            }
+
+            //the object a hook is embedded in
+            static T & object_of(LinkPtr hook)
+            {
+                return *reinterpret_cast<T *>(reinterpret_cast<char *>(hook) - hook_offset());
+            }
+            static std::size_t hook_offset()
+            {
+                typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+                const T * object = reinterpret_cast<const T *>(&storage);
+                return reinterpret_cast<const char *>(&(object->*Hook)) - reinterpret_cast<const char *>(object);
+            }
+	};
+
+	//insert: descend like Tree::insert, then link the hook as a new leaf
+	template<class T, AvlHook T::*Hook, class Compare>
+	std::pair<typename IntrusiveTree<T, Hook, Compare>::Iterator, bool> IntrusiveTree<T, Hook, Compare>::insert(T & object)
+	{
+		LinkPtr locationPtr = treeRoot, parent = 0;
+		bool left = false;
+		while (locationPtr != 0)
+		{
+			parent = locationPtr;
+			if (compare(object, object_of(locationPtr)))
+			{
+				left = true;
+				locationPtr = links(locationPtr).left;
+			}
+			else if (compare(object_of(locationPtr), object))
+			{
+				left = false;
+				locationPtr = links(locationPtr).right;
+			}
+			else
+			{
+				return std::make_pair(Iterator(locationPtr, this), false);
+			}
+		}
+
+		LinkPtr hook = &(object.*Hook);
+		*hook = AvlHook();
+		Avl::attach(*this, parent, hook, left);
+		Avl::adjust_height_insert(*this, hook);
+		++count;
+		return std::make_pair(Iterator(hook, this), true);
+	}
+
+	//erase: the successor takes the place of a node with two children
+	template<class T, AvlHook T::*Hook, class Compare>
+	typename IntrusiveTree<T, Hook, Compare>::Iterator IntrusiveTree<T, Hook, Compare>::erase(Iterator pos)
+	{
+		LinkPtr next = Avl::get_successor(*this, pos.inode);
+		Avl::detach(*this, pos.inode, next);
+		--count;
+		return Iterator(next, this);
+	}
+
+	//find: plain descent, no allocation of a probe object
+	template<class T, AvlHook T::*Hook, class Compare>
+	template<class K>
+	typename IntrusiveTree<T, Hook, Compare>::Iterator IntrusiveTree<T, Hook, Compare>::find(const K & key) const
+	{
+		LinkPtr nodePtr = treeRoot;
+		while (nodePtr != 0)
+		{
+			if (compare(key, object_of(nodePtr)))
+			{
+				nodePtr = links(nodePtr).left;
+			}
+			else if (compare(object_of(nodePtr), key))
+			{
+				nodePtr = links(nodePtr).right;
+			}
+			else
+			{
+				break;
+			}
+		}
+		return Iterator(nodePtr, this);
+	}
+
+	//+++++++++++++++++++++++++++ EXPIRING MAP +++++++++++++++++++++++++++++//
+
+	template<class Key_T, class Mapped_T, class Policy, class Clock, class Alloc> class ExpiringMap;
+
+	//what an ExpiringMap node maps a key to: the value, when it expires
+	//and the hook of the deadline tree, kept in the node so the second
+	//index allocates nothing
+	template<class Key_T, class Mapped_T, class Clock>
+	class ExpiringEntry
+	{
+	    public:
+	        typedef typename Clock::time_point TimePoint;
+
+	        Mapped_T value;
+
+	        ExpiringEntry(const Mapped_T & v, TimePoint when)
+	            : value(v), expiry(when), key(0)
+	        {
+	        }
+
+	        TimePoint deadline() const
+	        {
+	            return expiry;
+	        }
+
+	        //expired at its deadline, not after it
+	        bool expired(TimePoint now) const
+	        {
+	            return !(now < expiry);
+	        }
+
+	    private:
+	        template<class K, class M, class P, class C, class A> friend class ExpiringMap;
+
+	        TimePoint expiry;
+	        AvlHook hook;
+	        //the key of the node, the deadline tree erases through it
+	        const Key_T * key;
+	};
+
+	//Map whose entries expire a given time after they are assigned. A
+	//second tree, threaded through the nodes, orders them by deadline.
+	//find treats an expired entry as missing right away, expire() removes
+	//them oldest first: O(log n) to reach the first, then each one costs
+	//an erase from both trees, O(log n), so a call is O(k log n) for k
+	//removed and not O(k + log n). Expired keys are spread over the key
+	//tree and each is unlinked and retraced on its own. The budget bounds
+	//k so a large batch of deadlines can be spread over several calls.
+	//Until then expired entries are still counted by size() and seen by
+	//iteration, which is in key order; check them with expired().
+	//The deadline tree points into the nodes: the policy needs
+	//PointerStorage without inline entries and the map is not copied.
+	template<class Key_T, class Mapped_T, class Policy = DefaultTreePolicy, class Clock = std::chrono::steady_clock,
+	    class Alloc = std::allocator<ValueType<Key_T, ExpiringEntry<Key_T, Mapped_T, Clock>>>>
+	class ExpiringMap
+	{
+	        static_assert(std::is_same<typename Policy::storage, PointerStorage>::value,
+	            "ExpiringMap keeps pointers to its nodes, use PointerStorage");
+	        static_assert(Policy::inline_capacity == 0, "ExpiringMap keeps pointers to its nodes, inline entries move");
+
+	    public:
+	        typedef ExpiringEntry<Key_T, Mapped_T, Clock> Entry;
+	        typedef Map<Key_T, Entry, Policy, Alloc> MapType;
+	        typedef typename Clock::time_point TimePoint;
+	        typedef typename Clock::duration Duration;
+
+	        using ConstIterator = typename MapType::ConstIterator;
+	        using key_type = Key_T;
+	        using mapped_type = Mapped_T;
+	        using value_type = ValueType<Key_T, Entry>;
+	        using size_type = std::size_t;
+	        using const_iterator = ConstIterator;
+
+	        ExpiringMap()
+	        {
+	        }
+	        ExpiringMap(const ExpiringMap &) = delete;
+	        ExpiringMap & operator=(const ExpiringMap &) = delete;
+
+	        //insert or overwrite, the entry expires ttl after now. Returns
+	        //whether the key was new, an expired entry counts as missing.
+	        bool assign(const Key_T & key, const Mapped_T & value, Duration ttl, TimePoint now = Clock::now());
+
+	        //the value of the key, null when it is missing or expired
+	        Mapped_T * find(const Key_T & key, TimePoint now = Clock::now());
+	        const Mapped_T * find(const Key_T & key, TimePoint now = Clock::now()) const;
+
+	        //give a live entry another ttl from now, false when there is none
+	        bool refresh(const Key_T & key, Duration ttl, TimePoint now = Clock::now());
+
+	        bool erase(const Key_T & key);
+	        void clear()
+	        {
+	            byDeadline.clear();
+	            entries.clear();
+	        }
+
+	        //remove at most budget entries expired by now, oldest first.
+	        //Returns how many went, fewer than budget when none are left.
+	        std::size_t expire(TimePoint now = Clock::now(), std::size_t budget = std::size_t(-1));
+
+	        //the earliest deadline, TimePoint::max() when empty
+	        TimePoint next_deadline() const
+	        {
+	            return byDeadline.empty() ? TimePoint::max() : byDeadline.begin()->expiry;
+	        }
+
+	        //entries not removed yet, expired ones included
+	        std::size_t size() const
+	        {
+	            return entries.size();
+	        }
+	        bool empty() const
+	        {
+	            return entries.size() == 0;
+	        }
+
+	        ConstIterator begin() const
+	        {
+	            return entries.begin();
+	        }
+	        ConstIterator end() const
+	        {
+	            return entries.end();
+	        }
+	        ConstIterator lower_bound(const Key_T & key) const
+	        {
+	            return entries.lower_bound(key);
+	        }
+	        ConstIterator upper_bound(const Key_T & key) const
+	        {
+	            return entries.upper_bound(key);
+	        }
+
+	        //read only, changes have to go through the deadline tree
+	        const MapType & map() const
+	        {
+	            return entries;
+	        }
+
+	    private:
+	        //deadline first, equal deadlines by address so none compare equal
+	        struct ByDeadline
+	        {
+	            bool operator()(const Entry & a, const Entry & b) const
+	            {
+	                if (a.expiry != b.expiry)
+	                {
+	                    return a.expiry < b.expiry;
+	                }
+	                return std::less<const Entry *>()(&a, &b);
+	            }
+	        };
+
+	        MapType entries;
+	        IntrusiveTree<Entry, &Entry::hook, ByDeadline> byDeadline;
+	};
+
+	template<class Key_T, class Mapped_T, class Policy, class Clock, class Alloc>
+	bool ExpiringMap<Key_T, Mapped_T, Policy, Clock, Alloc>::assign(const Key_T & key, const Mapped_T & value, Duration ttl, TimePoint now)
+	{
+		TimePoint when = now + ttl;
+		std::pair<typename MapType::Iterator, bool> result = entries.insert(value_type(key, Entry(value, when)));
+		value_type & node = *result.first.operator->();
+		if (result.second)
+	    {
+			node.second.key = &node.first;
+			byDeadline.insert(node.second);
+			return true;
+		}
+
+		bool expired = node.second.expired(now);
+		byDeadline.erase(node.second);
+		node.second.value = value;
+		node.second.expiry = when;
+		byDeadline.insert(node.second);
+		return expired;
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Clock, class Alloc>
+	Mapped_T * ExpiringMap<Key_T, Mapped_T, Policy, Clock, Alloc>::find(const Key_T & key, TimePoint now)
+	{
+		typename MapType::Iterator it = entries.find(key);
+		if (it == entries.end() || it->second.expired(now))
+	    {
+	        return 0;
+	    }
+		return &it->second.value;
+	}
+	template<class Key_T, class Mapped_T, class Policy, class Clock, class Alloc>
+	const Mapped_T * ExpiringMap<Key_T, Mapped_T, Policy, Clock, Alloc>::find(const Key_T & key, TimePoint now) const
+	{
+		ConstIterator it = entries.find(key);
+		if (it == entries.end() || it->second.expired(now))
+	    {
+	        return 0;
+	    }
+		return &it->second.value;
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Clock, class Alloc>
+	bool ExpiringMap<Key_T, Mapped_T, Policy, Clock, Alloc>::refresh(const Key_T & key, Duration ttl, TimePoint now)
+	{
+		typename MapType::Iterator it = entries.find(key);
+		if (it == entries.end() || it->second.expired(now))
+	    {
+	        return false;
+	    }
+		Entry & entry = it->second;
+		byDeadline.erase(entry);
+		entry.expiry = now + ttl;
+		byDeadline.insert(entry);
+		return true;
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Clock, class Alloc>
+	bool ExpiringMap<Key_T, Mapped_T, Policy, Clock, Alloc>::erase(const Key_T & key)
+	{
+		typename MapType::Iterator it = entries.find(key);
+		if (it == entries.end())
+	    {
+	        return false;
+	    }
+		byDeadline.erase(it->second);
+		entries.erase(it);
+		return true;
+	}
+
+	//the key lives in the node that goes, erase does not look at it once
+	//the node is found. The walk goes on from the successor erase returns
+	//instead of descending to the oldest again.
+	template<class Key_T, class Mapped_T, class Policy, class Clock, class Alloc>
+	std::size_t ExpiringMap<Key_T, Mapped_T, Policy, Clock, Alloc>::expire(TimePoint now, std::size_t budget)
+	{
+		std::size_t removed = 0;
+		typename IntrusiveTree<Entry, &Entry::hook, ByDeadline>::Iterator it = byDeadline.begin();
+		while (removed < budget && it != byDeadline.end())
+	    {
+			Entry & oldest = *it;
+			if (!oldest.expired(now))
+	        {
+	            break;
+	        }
+			it = byDeadline.erase(it);
+			entries.erase(*oldest.key);
+			++removed;
+		}
+		return removed;
+	}
 }
-
-//*** END OF ITERATOR IMPLEMENTATION ***//
-
-//+++++++++++++++++++++++++++++ END AVL TREE +++++++++++++++++++++++++++++++++++++++++//
 
-namespace cs540
-{
-    //class declaration
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cs540
+{
+	//Read-only view of a raw snapshot written by Map::save(). The file is
+	//mapped and searched in place, opening it reads nothing but the header.
+	//The entries are a sorted array, iterators are plain pointers.
+	template<class Key_T, class Mapped_T>
+	class MappedMap
+	{
+	    private:
+	        typedef SnapshotFormat<Key_T, Mapped_T> Format;
+	        static_assert(Format::Raw::value,
+	            "MappedMap needs key and value types that are saved raw");
+
+	    public:
+	        using key_type = Key_T;
+	        using mapped_type = Mapped_T;
+	        using value_type = MappedEntry<Key_T, Mapped_T>;
+	        using size_type = std::size_t;
+	        using const_iterator = const value_type *;
+	        using iterator = const_iterator;
+
+	        //map the snapshot, verify also reads the whole file once to
+	        //check the checksum
+	        explicit MappedMap(const std::string & path, bool verify = false);
+
+	        MappedMap(MappedMap && other)
+	            : data(other.data), length(other.length), entries(other.entries), count(other.count)
+	        {
+	            other.data = 0;
+	            other.length = 0;
+	            other.count = 0;
+	        }
+
+	        MappedMap & operator=(MappedMap && other)
+	        {
+	            if (this != &other)
+	            {
+	                unmap();
+	                data = other.data;
+	                length = other.length;
+	                entries = other.entries;
+	                count = other.count;
+	                other.data = 0;
+	                other.length = 0;
+	                other.count = 0;
+	            }
+	            return *this;
+	        }
+
+	        MappedMap(const MappedMap &) = delete;
+	        MappedMap & operator=(const MappedMap &) = delete;
+
+	        ~MappedMap()
+	        {
+	            unmap();
+	        }
+
+	        size_type size() const
+	        {
+	            return count;
+	        }
+	        bool empty() const
+	        {
+	            return count == 0;
+	        }
+
+	        const_iterator begin() const
+	        {
+	            return entries;
+	        }
+	        const_iterator end() const
+	        {
+	            return entries + count;
+	        }
+
+	        //binary search, end() when the key is not there
+	        const_iterator find(const Key_T & key) const;
+
+	        const Mapped_T & at(const Key_T & key) const
+	        {
+	            const_iterator found = find(key);
+	            if (found == end())
+	            {
+	                throw std::out_of_range("not in range");
+	            }
+	            return found->second;
+	        }
+
+	    private:
+	        void * data;
+	        std::size_t length;
+	        const value_type * entries;
+	        std::size_t count;
+
+	        void unmap()
+	        {
+	            if (data != 0)
+	            {
+	                munmap(data, length);
+	                data = 0;
+	            }
+	        }
+	};
+
+	//map the file and check the header against the key and value types
+	template<class Key_T, class Mapped_T>
+	MappedMap<Key_T, Mapped_T>::MappedMap(const std::string & path, bool verify)
+	    : data(0), length(0), entries(0), count(0)
+	{
+		int file = open(path.c_str(), O_RDONLY);
+		if (file < 0)
+		{
+			throw std::runtime_error("cannot open snapshot " + path);
+		}
+		struct stat info;
+		if (fstat(file, &info) != 0 || std::size_t(info.st_size) < sizeof(SnapshotHeader) + sizeof(std::uint64_t))
+		{
+			close(file);
+			throw std::runtime_error("snapshot " + path + " is too short");
+		}
+		length = info.st_size;
+		data = mmap(0, length, PROT_READ, MAP_SHARED, file, 0);
+		close(file);
+		if (data == MAP_FAILED)
+		{
+			data = 0;
+			throw std::runtime_error("cannot map snapshot " + path);
+		}
+
+		const unsigned char * bytes = static_cast<const unsigned char *>(data);
+		std::size_t payload = length - sizeof(SnapshotHeader) - sizeof(std::uint64_t);
+		SnapshotHeader header;
+		std::memcpy(&header, bytes, sizeof(header));
+		if (!Format::matches(header, payload))
+		{
+			unmap();
+			throw std::runtime_error("snapshot " + path + " does not hold entries of this key and value type");
+		}
+		if (verify)
+		{
+			SnapshotChecksum checksum;
+			checksum.update(bytes, length - sizeof(std::uint64_t));
+			std::uint64_t stored;
+			std::memcpy(&stored, bytes + length - sizeof(stored), sizeof(stored));
+			if (stored != checksum.value())
+			{
+				unmap();
+				throw std::runtime_error("snapshot " + path + " fails its checksum");
+			}
+		}
+		entries = reinterpret_cast<const value_type *>(bytes + sizeof(SnapshotHeader));
+		count = header.count;
+	}
+
+	template<class Key_T, class Mapped_T>
+	typename MappedMap<Key_T, Mapped_T>::const_iterator MappedMap<Key_T, Mapped_T>::find(const Key_T & key) const
+	{
+		std::size_t first = 0, last = count;
+		while (first < last)
+		{
+			std::size_t middle = first + (last - first) / 2;
+			int cmp = KeyCompare<Key_T>::compare(key, entries[middle].first);
+			if (cmp == 0)
+			{
+				return entries + middle;
+			}
+			if (cmp < 0)
+			{
+				last = middle;
+			}
+			else
+			{
+				first = middle + 1;
+			}
+		}
+		return end();
+	}
+
+	//+++++++++++++++++++++++++++ DISK RESIDENT MAP +++++++++++++++++++++++++++++//
+
+	//Nodes of a DiskMap live in a mapped file and link to each other with
+	//byte offsets into it. Offset 0 is the file header, so it doubles as
+	//the null link.
+	struct FileStorage
+	{
+	    template <class Base>
+	    using link = std::uint64_t;
+	};
+
+	//node layout of a DiskMap, iteration follows parent links
+	struct DiskMapPolicy : DefaultTreePolicy
+	{
+	    using storage = FileStorage;
+	    static constexpr bool threaded = false;
+	};
+
+	//first bytes of a DiskMap file. The tree fields are written back by
+	//flush(), clean is cleared before the first change after it. nodeLimit
+	//is written whenever it moves, a crash does not make it stale.
+	struct DiskMapHeader
+	{
+	    char magic[8];
+	    std::uint32_t version;
+	    std::uint32_t byteOrder;
+	    std::uint32_t nodeSize;
+	    std::uint32_t clean;
+	    std::uint64_t keySize;
+	    std::uint64_t mappedSize;
+	    std::uint64_t root;
+	    std::uint64_t count;
+
+	    //end of the nodes handed out so far and the first freed one
+	    std::uint64_t nodeEnd;
+	    std::uint64_t freeList;
+
+	    //every node slot below it holds an entry or is marked free
+	    std::uint64_t nodeLimit;
+
+	    static constexpr std::uint32_t currentVersion = 2;
+	};
+
+	//work of the window cache of a DiskMap. A miss is an access to a
+	//window the cache did not hold, the kernel may still have it in memory.
+	struct DiskCacheStats
+	{
+	    std::uint64_t hits;
+	    std::uint64_t misses;
+
+	    //windows unmapped to stay within the budget
+	    std::uint64_t evictions;
+
+	    //bytes of the file mapped into the process, not the page cache
+	    std::size_t residentBytes;
+	    std::size_t budgetBytes;
+	};
+
+	//Ordered map whose nodes live in a file, for data that does not fit in
+	//memory. The file is mapped into one reserved address range that never
+	//moves, so references and iterators stay valid like those of a Map.
+	//The file can grow up to the address space reserved for it, see the
+	//constructor. The cache tracks which windows of the file were touched
+	//and, at the end of every operation, unmaps the least recently used
+	//ones until at most the budget is mapped. So the budget caps the part
+	//of the file in the resident set of this process. An unmapped window
+	//stays in the kernel page cache until the kernel reclaims it, so the
+	//budget does not cap the memory the file takes on the machine.
+	//A crash between a change and the next flush() leaves the file marked
+	//as not clean. Opening it again rebuilds the tree from the node slots,
+	//so every entry is back as its page last reached the disk: changes
+	//since the last flush() may be missing and an erase that was under way
+	//may come back.
+	//Keys and values are stored as raw bytes. Not safe to share between
+	//threads, lookups update the cache.
 	template<class Key_T, class Mapped_T>
-	class Map;
-
-	//equality operator
+	class DiskMap
+	{
+	    private:
+	        using LinkPtr = std::uint64_t;
+	        using Base = NodeBase<DiskMapPolicy>;
+	        using NodeType = Node<Key_T, Mapped_T, DiskMapPolicy>;
+	        typedef AvlAlgorithms<DiskMap> Avl;
+	        friend struct AvlAlgorithms<DiskMap>;
+	        friend struct BinaryTreeAlgorithms<DiskMap>;
+
+	        static_assert(std::is_trivially_copyable<Key_T>::value && std::is_trivially_copyable<Mapped_T>::value,
+	            "DiskMap stores keys and values as raw bytes");
+
+	        //a reverse iterator walks the same links the other way, its end
+	        //is the null link too
+	        template <bool Const, bool Reverse = false>
+	        struct BasicIterator
+	        {
+	            using iterator_category = std::bidirectional_iterator_tag;
+	            using value_type = ValueType<Key_T, Mapped_T>;
+	            using difference_type = std::ptrdiff_t;
+	            using pointer = typename std::conditional<Const, const value_type *, value_type *>::type;
+	            using reference = typename std::conditional<Const, const value_type &, value_type &>::type;
+
+	            BasicIterator()
+	                : inode(0), ptr(0)
+	            {
+	                //empty
+	            }
+	            BasicIterator(LinkPtr node, const DiskMap * map)
+	                : inode(node), ptr(map)
+	            {
+	                //empty
+	            }
+
+	            //an Iterator converts to a ConstIterator
+	            template <bool C = Const, class = typename std::enable_if<C>::type>
+	            BasicIterator(const BasicIterator<false, Reverse> & other)
+	                : inode(other.inode), ptr(other.ptr)
+	            {
+	                //empty
+	            }
+
+	            reference operator*() const
+	            {
+	                return ptr->entry(inode).pair;
+	            }
+	            pointer operator->() const
+	            {
+	                return &ptr->entry(inode).pair;
+	            }
+	            BasicIterator & operator++()
+	            {
+	                inode = Reverse ? ptr->previous(inode) : ptr->next(inode);
+	                ptr->trim();
+	                return *this;
+	            }
+	            BasicIterator operator++(int)
+	            {
+	                BasicIterator copy = *this;
+	                ++*this;
+	                return copy;
+	            }
+
+	            //from end() this lands on the largest key, from rend() on the
+	            //smallest
+	            BasicIterator & operator--()
+	            {
+	                inode = Reverse ? ptr->next(inode) : ptr->previous(inode);
+	                ptr->trim();
+	                return *this;
+	            }
+	            BasicIterator operator--(int)
+	            {
+	                BasicIterator copy = *this;
+	                --*this;
+	                return copy;
+	            }
+	            template <bool Other>
+	            bool operator==(const BasicIterator<Other, Reverse> & itTwo) const
+	            {
+	                return inode == itTwo.inode;
+	            }
+	            template <bool Other>
+	            bool operator!=(const BasicIterator<Other, Reverse> & itTwo) const
+	            {
+	                return inode != itTwo.inode;
+	            }
+
+	            LinkPtr inode;
+	            const DiskMap * ptr;
+	        };
+
+	    public:
+	        using Iterator = BasicIterator<false>;
+	        using ConstIterator = BasicIterator<true>;
+	        using ReverseIterator = BasicIterator<false, true>;
+	        using ConstReverseIterator = BasicIterator<true, true>;
+
+	        using key_type = Key_T;
+	        using mapped_type = Mapped_T;
+	        using value_type = ValueType<Key_T, Mapped_T>;
+	        using size_type = std::size_t;
+	        using iterator = Iterator;
+	        using const_iterator = ConstIterator;
+	        using reverse_iterator = ReverseIterator;
+	        using const_reverse_iterator = ConstReverseIterator;
+
+	        //unit the cache tracks and evicts, and the file grows by
+	        static constexpr std::size_t windowBytes = 64 * 1024;
+	        static constexpr std::size_t defaultCacheBytes = std::size_t(256) << 20;
+
+	        //address space reserved for the file by default, it cannot grow
+	        //past what was reserved
+	        static constexpr std::uint64_t maxFileBytes = std::uint64_t(1) << 40;
+
+	        //open the file, or create it when it does not exist. Throws when
+	        //the file holds other types. A file that was not closed cleanly
+	        //is recovered first, see recover(). maxBytes of address space
+	        //are reserved for the file, or the file size if that is more.
+	        //When the system refuses, with ulimit -v say, the reservation is
+	        //halved until it fits, but not below the file size.
+	        explicit DiskMap(const std::string & path, std::size_t cacheBytes = defaultCacheBytes,
+	            std::uint64_t maxBytes = maxFileBytes);
+
+	        //the file holds the nodes, there is nothing to copy them into
+	        DiskMap(const DiskMap &) = delete;
+	        DiskMap & operator=(const DiskMap &) = delete;
+
+	        //flush a map that was not closed. Errors cannot be reported from
+	        //a destructor, call close() to see them. A file left not clean
+	        //is recovered when it is opened again.
+	        ~DiskMap();
+
+	        size_t size() const
+	        {
+	            return count;
+	        }
+	        bool empty() const
+	        {
+	            return count == 0;
+	        }
+
+	        Iterator begin()
+	        {
+	            return Iterator(first(), this);
+	        }
+	        Iterator end()
+	        {
+	            return Iterator(0, this);
+	        }
+	        ConstIterator begin() const
+	        {
+	            return ConstIterator(first(), this);
+	        }
+	        ConstIterator end() const
+	        {
+	            return ConstIterator(0, this);
+	        }
+	        ReverseIterator rbegin()
+	        {
+	            return ReverseIterator(last(), this);
+	        }
+	        ReverseIterator rend()
+	        {
+	            return ReverseIterator(0, this);
+	        }
+	        ConstReverseIterator rbegin() const
+	        {
+	            return ConstReverseIterator(last(), this);
+	        }
+	        ConstReverseIterator rend() const
+	        {
+	            return ConstReverseIterator(0, this);
+	        }
+
+	        Iterator find(const Key_T & key)
+	        {
+	            return Iterator(search(key), this);
+	        }
+	        ConstIterator find(const Key_T & key) const
+	        {
+	            return ConstIterator(search(key), this);
+	        }
+
+	        //first entry whose key is not less than the key, or greater than it
+	        Iterator lower_bound(const Key_T & key)
+	        {
+	            return Iterator(bound(key, false), this);
+	        }
+	        ConstIterator lower_bound(const Key_T & key) const
+	        {
+	            return ConstIterator(bound(key, false), this);
+	        }
+	        Iterator upper_bound(const Key_T & key)
+	        {
+	            return Iterator(bound(key, true), this);
+	        }
+	        ConstIterator upper_bound(const Key_T & key) const
+	        {
+	            return ConstIterator(bound(key, true), this);
+	        }
+	        Mapped_T & at(const Key_T & key);
+	        const Mapped_T & at(const Key_T & key) const;
+	        Mapped_T & operator[](const Key_T & key);
+	        std::pair<Iterator, bool> insert(const ValueType<Key_T, Mapped_T> & pair);
+	        Iterator erase(Iterator pos);
+	        void erase(const Key_T & key);
+
+	        //drop every entry, the file keeps its size for new ones
+	        void clear();
+
+	        //write every change and the tree fields to the file and mark
+	        //it clean. Values changed through references are written too.
+	        void flush();
+
+	        //flush and close the file, throws when either fails. A map whose
+	        //flush failed stays open. Once closed it can only be destroyed.
+	        void close();
+
+	        DiskCacheStats cache_stats() const;
+
+	        //change the cache budget, unmaps windows at once when it shrank
+	        void set_cache_budget(std::size_t cacheBytes);
+
+	    private:
+	        //nodes start after the header page and never straddle a page
+	        static constexpr std::size_t pageBytes = 4096;
+
+	        //the file grows by at most this much at a time
+	        static constexpr std::size_t growthLimit = std::size_t(1) << 30;
+
+	        //node slots are marked free ahead of the ones in use, a quarter
+	        //of the slots so far and at least this much at a time
+	        static constexpr std::size_t limitStep = 16 * windowBytes;
+
+	        //state of a window in the cache, referenced since the clock
+	        //hand passed it last or not
+	        enum WindowState : unsigned char
+	        {
+	            absent,
+	            idle,
+	            referenced
+	        };
+
+	        int file;
+	        char * base;
+	        std::size_t reserved;
+	        std::size_t mapped;
+
+	        //tree fields, written to the header by flush()
+	        LinkPtr treeRoot;
+	        std::size_t count;
+	        LinkPtr nodeEnd;
+	        LinkPtr freeList;
+	        LinkPtr nodeLimit;
+	        bool dirty;
+
+	        //clock over the windows the cache holds
+	        std::size_t windowBudget;
+	        mutable std::vector<unsigned char> windowState;
+	        mutable std::vector<std::size_t> resident;
+	        mutable std::size_t hand;
+	        mutable DiskCacheStats cache;
+
+	        DiskMapHeader & header() const
+	        {
+	            return *reinterpret_cast<DiskMapHeader *>(base);
+	        }
+
+	        Base & links(LinkPtr node) const
+	        {
+	            touch(node);
+	            return *reinterpret_cast<Base *>(base + node);
+	        }
+	        NodeType & node(LinkPtr node) const
+	        {
+	            touch(node);
+	            return *reinterpret_cast<NodeType *>(base + node);
+	        }
+
+	        //a node handed to the caller, the last access of an operation,
+	        //so the cache is trimmed after it
+	        NodeType & entry(LinkPtr node) const
+	        {
+	            NodeType & result = this->node(node);
+	            trim();
+	            return result;
+	        }
+
+	        //disk maps keep no tree counters
+	        NoStats counters() const
+	        {
+	            return NoStats();
+	        }
+
+	        //note an access to the window of a node
+	        void touch(LinkPtr node) const
+	        {
+	            std::size_t window = static_cast<std::size_t>(node / windowBytes);
+	            unsigned char & state = windowState[window];
+	            if (state == absent)
+	            {
+	                ++cache.misses;
+	                resident.push_back(window);
+	            }
+	            else
+	            {
+	                ++cache.hits;
+	            }
+	            state = referenced;
+	        }
+
+	        //evict windows the clock hand finds unreferenced until the cache
+	        //is within its budget. Evicted pages are refetched on access, so
+	        //references into them stay good.
+	        void trim() const;
+
+	        LinkPtr first() const
+	        {
+	            LinkPtr node = Avl::min_val(*this, treeRoot);
+	            trim();
+	            return node;
+	        }
+	        LinkPtr last() const
+	        {
+	            LinkPtr node = Avl::max_val(*this, treeRoot);
+	            trim();
+	            return node;
+	        }
+
+	        //neighbours in key order, the null link is before the smallest
+	        //and after the largest key
+	        LinkPtr next(LinkPtr node) const
+	        {
+	            return node == 0 ? Avl::min_val(*this, treeRoot) : Avl::get_successor(*this, node);
+	        }
+	        LinkPtr previous(LinkPtr node) const
+	        {
+	            return node == 0 ? Avl::max_val(*this, treeRoot) : Avl::get_predecessor(*this, node);
+	        }
+
+	        LinkPtr search(const Key_T & key) const;
+	        LinkPtr bound(const Key_T & key, bool upper) const;
+
+	        //clear the clean mark on disk before the first change reaches it
+	        void mark_dirty();
+
+	        //a free node, growing the file when there is none. A free node
+	        //is marked dead, so recover() tells it from an entry.
+	        LinkPtr allocate_node();
+	        void release_node(LinkPtr node);
+
+	        //where a node at or after the offset goes, nodes never straddle
+	        //a page
+	        static LinkPtr place_node(LinkPtr at)
+	        {
+	            if (sizeof(NodeType) <= pageBytes && at / pageBytes != (at + sizeof(NodeType) - 1) / pageBytes)
+	            {
+	                at = (at / pageBytes + 1) * pageBytes;
+	            }
+	            return at;
+	        }
+
+	        //mark the slots up to a new limit free, then store the limit
+	        void extend_limit(LinkPtr need);
+
+	        //rebuild the tree and the free list from the node slots of a
+	        //file that was not closed cleanly
+	        void recover();
+	        LinkPtr link_sorted(const std::vector<LinkPtr> & order, std::size_t first, std::size_t last, LinkPtr parent);
+
+	        void grow(std::size_t need);
+	        void map_range(std::size_t from, std::size_t to);
+	        void open_existing(const std::string & path, std::size_t fileBytes);
+	        void close_file();
+	};
+
+	//reserve the address range, then map the file at its start
 	template<class Key_T, class Mapped_T>
-	bool operator==(const Map<Key_T, Mapped_T> &, const Map<Key_T, Mapped_T> &);
-
-	//less-than operator
-	template<class Key_T, class Mapped_T>
-	bool operator<(const Map<Key_T, Mapped_T> &, const Map<Key_T, Mapped_T> &);
-
-	//inequality operator
+	DiskMap<Key_T, Mapped_T>::DiskMap(const std::string & path, std::size_t cacheBytes, std::uint64_t maxBytes)
+	    : file(-1), base(0), reserved(0), mapped(0), treeRoot(0), count(0), nodeEnd(pageBytes), freeList(0),
+	      nodeLimit(pageBytes), dirty(false), windowBudget(std::max<std::size_t>(cacheBytes / windowBytes, 1)), hand(0), cache()
+	{
+		file = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+		if (file < 0)
+		{
+			throw std::runtime_error("cannot open disk map " + path);
+		}
+		struct stat info;
+		if (fstat(file, &info) != 0)
+		{
+			close_file();
+			throw std::runtime_error("cannot read disk map " + path);
+		}
+
+		std::uint64_t least = std::max(std::uint64_t(info.st_size), std::uint64_t(windowBytes));
+		reserved = static_cast<std::size_t>(std::min(std::max(maxBytes, least), std::uint64_t(std::numeric_limits<std::size_t>::max() / 4)));
+		void * range = mmap(0, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		while (range == MAP_FAILED && reserved > least)
+		{
+			reserved = static_cast<std::size_t>(std::max(std::uint64_t(reserved / 2), least));
+			range = mmap(0, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		}
+		if (range == MAP_FAILED)
+		{
+			close_file();
+			throw std::runtime_error("cannot reserve address space for disk map " + path);
+		}
+		base = static_cast<char *>(range);
+
+		try
+		{
+			if (info.st_size == 0)
+			{
+				grow(windowBytes);
+				DiskMapHeader & fresh = header();
+				std::memcpy(fresh.magic, "CS540DSK", sizeof(fresh.magic));
+				fresh.version = DiskMapHeader::currentVersion;
+				fresh.byteOrder = SnapshotHeader::byteOrderMark;
+				fresh.nodeSize = sizeof(NodeType);
+				fresh.keySize = sizeof(Key_T);
+				fresh.mappedSize = sizeof(Mapped_T);
+				fresh.nodeLimit = nodeLimit;
+				dirty = true;
+				flush();
+			}
+			else
+			{
+				open_existing(path, static_cast<std::size_t>(info.st_size));
+			}
+		}
+		catch (...)
+		{
+			close_file();
+			throw;
+		}
+	}
+
+	//check the header and take the tree fields from it, or rebuild them
 	template<class Key_T, class Mapped_T>
-	bool operator!=(const Map<Key_T, Mapped_T> &, const Map<Key_T, Mapped_T> &);
-
-	//equality operator
+	void DiskMap<Key_T, Mapped_T>::open_existing(const std::string & path, std::size_t fileBytes)
+	{
+		if (fileBytes % windowBytes != 0 || fileBytes > reserved)
+		{
+			throw std::runtime_error("disk map " + path + " has a bad size");
+		}
+		map_range(0, fileBytes);
+		mapped = fileBytes;
+		windowState.assign(mapped / windowBytes, absent);
+
+		const DiskMapHeader & stored = header();
+		if (std::memcmp(stored.magic, "CS540DSK", sizeof(stored.magic)) != 0
+		    || stored.version != DiskMapHeader::currentVersion
+		    || stored.byteOrder != SnapshotHeader::byteOrderMark
+		    || stored.nodeSize != sizeof(NodeType)
+		    || stored.keySize != sizeof(Key_T)
+		    || stored.mappedSize != sizeof(Mapped_T))
+		{
+			throw std::runtime_error("disk map " + path + " does not hold entries of this key and value type");
+		}
+		if (stored.nodeLimit < pageBytes || stored.nodeLimit > mapped)
+		{
+			throw std::runtime_error("disk map " + path + " has a bad header");
+		}
+		nodeLimit = stored.nodeLimit;
+		if (stored.clean != 1)
+		{
+			recover();
+			return;
+		}
+		if (stored.nodeEnd < pageBytes || stored.nodeEnd > nodeLimit || stored.root >= stored.nodeEnd
+		    || stored.freeList >= stored.nodeEnd)
+		{
+			throw std::runtime_error("disk map " + path + " has a bad header");
+		}
+		treeRoot = stored.root;
+		count = static_cast<std::size_t>(stored.count);
+		nodeEnd = stored.nodeEnd;
+		freeList = stored.freeList;
+	}
+
 	template<class Key_T, class Mapped_T>
-	bool operator==(const Map<Key_T, Mapped_T> &, const Map<Key_T, Mapped_T> &);
-
-	//*** Start of the Map Class ***//
+	DiskMap<Key_T, Mapped_T>::~DiskMap()
+	{
+		if (base == 0)
+		{
+			return;
+		}
+		try
+		{
+			flush();
+		}
+		catch (...)
+		{
+			//the file stays marked as not clean
+		}
+		close_file();
+	}
+
 	template<class Key_T, class Mapped_T>
-	class Map
-	{
-	    private:
-            Tree<Key_T, Mapped_T> tree;
-            friend bool operator== <>(const Map<Key_T, Mapped_T> &, const Map<Key_T, Mapped_T> &);
-            friend bool operator< <>(const Map<Key_T, Mapped_T> &, const Map<Key_T, Mapped_T> &);
-            friend bool operator!= <>(const Map<Key_T, Mapped_T> &, const Map<Key_T, Mapped_T> &);
+	void DiskMap<Key_T, Mapped_T>::close()
+	{
+		if (base == 0)
+		{
+			return;
+		}
+		flush();
+		int closing = file;
+		file = -1;
+		close_file();
+		if (::close(closing) != 0)
+		{
+			throw std::runtime_error("cannot close disk map file");
+		}
+	}
 
-        public:
-
-            //declarations for the iterators
-            using Iterator = typename Tree<Key_T, Mapped_T>::Iterator;
-            using ConstIterator = typename Tree<Key_T, Mapped_T>::ConstIterator;
-            using ReverseIterator = typename Tree<Key_T, Mapped_T>::ReverseIterator;
-
-            //empty constructor
-            Map <Key_T, Mapped_T>()
-            {
-                //empty
-            }
-
-            //copy constructor
-            Map <Key_T, Mapped_T>(const Map<Key_T, Mapped_T> &original)
-            {
-                tree = original.tree;
-            }
-
-            //assignment operator
-            Map<Key_T, Mapped_T> & operator=(const Map & original)
-            {
-                clear();
-                tree = original.tree;
-                return *this;
-            }
-
-            //constructor when a list of initializer is given
-            Map <Key_T, Mapped_T>(std::initializer_list<std::pair<const Key_T, Mapped_T>> list)
-            {
-                for (auto x : list)
-                {
-                    insert(x);
-                }
-            }
-
-            //get the size of the tree
-            size_t size() const
-            {
-                return tree.sizeR();
-            }
-
-            //check if the tree is empty
-            bool empty() const
-            {
-                return tree.empty();
-            }
+	template<class Key_T, class Mapped_T>
+	void DiskMap<Key_T, Mapped_T>::close_file()
+	{
+		if (base != 0)
+		{
+			munmap(base, reserved);
+			base = 0;
+		}
+		if (file >= 0)
+		{
+			::close(file);
+			file = -1;
+		}
+	}
 
-            //*** DEFINITON OF ITERATOR FUNCTIONS *****
-            Iterator begin();
-            Iterator end();
-            ConstIterator begin() const;
-            ConstIterator end() const;
-            ReverseIterator rbegin();
-            ReverseIterator rend();
-
-            //*** function declarations ****//
-            Iterator find(const Key_T &);
-            ConstIterator find(const Key_T &) const;
-            Mapped_T &at(const Key_T &);
-            template <typename IT_T>
-            void insert(IT_T range_beg, IT_T range_end);
-            void erase(Iterator pos);
-            void erase(const Key_T &);
-            void clear();
-            const Mapped_T &at(const Key_T &) const;
-            Mapped_T & operator[] (const Key_T &);
-            std::pair<typename Map <Key_T, Mapped_T>::Iterator, bool> insert(const ValueType<const Key_T, Mapped_T> & pair);
-            //end of function declarations
+	//replace part of the reservation with the file, shared so changes
+	//reach it
+	template<class Key_T, class Mapped_T>
+	void DiskMap<Key_T, Mapped_T>::map_range(std::size_t from, std::size_t to)
+	{
+		void * range = mmap(base + from, to - from, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, file, static_cast<off_t>(from));
+		if (range == MAP_FAILED)
+		{
+			throw std::runtime_error("cannot map disk map file");
+		}
 
+		//tree nodes are read at random, read ahead only wastes the cache
+		madvise(range, to - from, MADV_RANDOM);
+	}
 
-	};
-
-	//*** end of map class ***//
-
-	//**** IMPLEMENATION OF FUNCTIONS STARTS HERE *****//
+	//double the file, at most by growthLimit and up to the reservation,
+	//and map the new part
+	template<class Key_T, class Mapped_T>
+	void DiskMap<Key_T, Mapped_T>::grow(std::size_t need)
+	{
+		std::size_t most = reserved / windowBytes * windowBytes;
+		need = (need + windowBytes - 1) / windowBytes * windowBytes;
+		if (need > most)
+		{
+			throw std::length_error("disk map reached its maximum file size");
+		}
+		std::size_t size = mapped + std::min(std::max(mapped, std::size_t(windowBytes)), std::size_t(growthLimit));
+		size = std::max(std::min(size, most), need);
+		if (ftruncate(file, static_cast<off_t>(size)) != 0)
+		{
+			throw std::runtime_error("cannot grow disk map file");
+		}
+		map_range(mapped, size);
+		mapped = size;
+		windowState.resize(mapped / windowBytes, absent);
+	}
+
+	template<class Key_T, class Mapped_T>
+	void DiskMap<Key_T, Mapped_T>::mark_dirty()
+	{
+		if (!dirty)
+		{
+			header().clean = 0;
+			if (msync(base, pageBytes, MS_SYNC) != 0)
+			{
+				throw std::runtime_error("cannot write disk map header");
+			}
+			dirty = true;
+		}
+	}
+
+	//the data goes first, the header only says clean once it is there
+	template<class Key_T, class Mapped_T>
+	void DiskMap<Key_T, Mapped_T>::flush()
+	{
+		if (msync(base, mapped, MS_SYNC) != 0)
+		{
+			throw std::runtime_error("cannot write disk map file");
+		}
+		if (dirty)
+		{
+			DiskMapHeader & stored = header();
+			stored.root = treeRoot;
+			stored.count = count;
+			stored.nodeEnd = nodeEnd;
+			stored.freeList = freeList;
+			stored.clean = 1;
+			if (msync(base, pageBytes, MS_SYNC) != 0)
+			{
+				throw std::runtime_error("cannot write disk map header");
+			}
+			dirty = false;
+		}
+	}
+
+	template<class Key_T, class Mapped_T>
+	void DiskMap<Key_T, Mapped_T>::trim() const
+	{
+		while (resident.size() > windowBudget)
+		{
+			if (hand >= resident.size())
+			{
+				hand = 0;
+			}
+			std::size_t window = resident[hand];
+			if (windowState[window] == referenced)
+			{
+				windowState[window] = idle;
+				++hand;
+				continue;
+			}
+			madvise(base + window * windowBytes, windowBytes, MADV_DONTNEED);
+			windowState[window] = absent;
+			resident[hand] = resident.back();
+			resident.pop_back();
+			++cache.evictions;
+		}
+	}
+
+	template<class Key_T, class Mapped_T>
+	DiskCacheStats DiskMap<Key_T, Mapped_T>::cache_stats() const
+	{
+		DiskCacheStats result = cache;
+		result.residentBytes = resident.size() * windowBytes;
+		result.budgetBytes = windowBudget * windowBytes;
+		return result;
+	}
+
+	template<class Key_T, class Mapped_T>
+	void DiskMap<Key_T, Mapped_T>::set_cache_budget(std::size_t cacheBytes)
+	{
+		windowBudget = std::max<std::size_t>(cacheBytes / windowBytes, 1);
+		trim();
+	}
+
+	//free nodes are chained through their parent link
+	template<class Key_T, class Mapped_T>
+	typename DiskMap<Key_T, Mapped_T>::LinkPtr DiskMap<Key_T, Mapped_T>::allocate_node()
+	{
+		if (freeList != 0)
+		{
+			LinkPtr node = freeList;
+			freeList = links(node).parent;
+			return node;
+		}
+		LinkPtr node = place_node(nodeEnd);
+		if (node + sizeof(NodeType) > nodeLimit)
+		{
+			extend_limit(node + sizeof(NodeType));
+		}
+		nodeEnd = node + sizeof(NodeType);
+		return node;
+	}
+
+	template<class Key_T, class Mapped_T>
+	void DiskMap<Key_T, Mapped_T>::release_node(LinkPtr node)
+	{
+		new (base + node) Base();
+		links(node).dead = true;
+		links(node).parent = freeList;
+		freeList = node;
+	}
+
+	//the marks reach the disk before the limit does, a crash leaves no
+	//slot below the stored limit with neither an entry nor the mark
+	template<class Key_T, class Mapped_T>
+	void DiskMap<Key_T, Mapped_T>::extend_limit(LinkPtr need)
+	{
+		LinkPtr step = std::min(std::max(LinkPtr(limitStep), nodeLimit / 4), LinkPtr(growthLimit));
+		LinkPtr limit = std::max<LinkPtr>(nodeLimit + step, need);
+		limit = (limit + windowBytes - 1) / windowBytes * windowBytes;
+
+		//the last slots before the end of the reservation
+		limit = std::max<LinkPtr>(std::min<LinkPtr>(limit, reserved / windowBytes * windowBytes), need);
+		if (limit > mapped)
+		{
+			grow(static_cast<std::size_t>(limit));
+		}
+		for (LinkPtr slot = place_node(nodeEnd); slot + sizeof(NodeType) <= limit; slot = place_node(slot + sizeof(NodeType)))
+		{
+			new (base + slot) Base();
+			links(slot).dead = true;
+		}
+
+		std::size_t from = static_cast<std::size_t>(nodeEnd / pageBytes * pageBytes);
+		if (msync(base + from, static_cast<std::size_t>(limit) - from, MS_SYNC) != 0)
+		{
+			throw std::runtime_error("cannot write disk map file");
+		}
+		header().nodeLimit = limit;
+		if (msync(base, pageBytes, MS_SYNC) != 0)
+		{
+			throw std::runtime_error("cannot write disk map header");
+		}
+		nodeLimit = limit;
+	}
+
+	//a key found twice, an erase and an insert of which only one page
+	//reached the disk, is kept once. The new tree is written at once.
+	template<class Key_T, class Mapped_T>
+	void DiskMap<Key_T, Mapped_T>::recover()
+	{
+		std::vector<std::pair<Key_T, LinkPtr>> live;
+		freeList = 0;
+		for (LinkPtr slot = place_node(pageBytes); slot + sizeof(NodeType) <= nodeLimit; slot = place_node(slot + sizeof(NodeType)))
+		{
+			if (links(slot).dead)
+			{
+				release_node(slot);
+			}
+			else
+			{
+				live.push_back(std::make_pair(node(slot).pair.first, slot));
+			}
+			trim();
+		}
+
+		std::sort(live.begin(), live.end(), [](const std::pair<Key_T, LinkPtr> & a, const std::pair<Key_T, LinkPtr> & b)
+		{
+			return KeyCompare<Key_T>::compare(a.first, b.first) < 0;
+		});
+		std::vector<LinkPtr> order;
+		order.reserve(live.size());
+		for (std::size_t i = 0; i < live.size(); ++i)
+		{
+			if (i > 0 && KeyCompare<Key_T>::compare(live[i - 1].first, live[i].first) == 0)
+			{
+				release_node(live[i].second);
+			}
+			else
+			{
+				order.push_back(live[i].second);
+			}
+		}
+
+		treeRoot = link_sorted(order, 0, order.size(), 0);
+		count = order.size();
+		nodeEnd = nodeLimit;
+		dirty = true;
+		flush();
+	}
+
+	//HELPER FUNCTION: the middle entry of a range becomes the root of its
+	//subtree, the children are linked first so its height can be set
+	template<class Key_T, class Mapped_T>
+	typename DiskMap<Key_T, Mapped_T>::LinkPtr DiskMap<Key_T, Mapped_T>::link_sorted(const std::vector<LinkPtr> & order,
+	    std::size_t first, std::size_t last, LinkPtr parent)
+	{
+		if (first == last)
+		{
+			return 0;
+		}
+		std::size_t middle = first + (last - first) / 2;
+		LinkPtr node = order[middle];
+		LinkPtr left = link_sorted(order, first, middle, node);
+		LinkPtr right = link_sorted(order, middle + 1, last, node);
+		links(node).parent = parent;
+		links(node).left = left;
+		links(node).right = right;
+		Avl::built(*this, node, 0, 0);
+		trim();
+		return node;
+	}
+
+	template<class Key_T, class Mapped_T>
+	typename DiskMap<Key_T, Mapped_T>::LinkPtr DiskMap<Key_T, Mapped_T>::search(const Key_T & key) const
+	{
+		LinkPtr nodePtr = treeRoot;
+		while (nodePtr != 0)
+		{
+			int cmp = KeyCompare<Key_T>::compare(key, node(nodePtr).pair.first);
+			if (cmp == 0)
+			{
+				break;
+			}
+			nodePtr = cmp < 0 ? links(nodePtr).left : links(nodePtr).right;
+		}
+		trim();
+		return nodePtr;
+	}
+
+	//the same descent, remembering the last node it went left from
 	template<class Key_T, class Mapped_T>
-	std::pair<typename Map <Key_T, Mapped_T>::Iterator, bool> Map<Key_T, Mapped_T>::insert(const ValueType<const Key_T, Mapped_T> & pair)
+	typename DiskMap<Key_T, Mapped_T>::LinkPtr DiskMap<Key_T, Mapped_T>::bound(const Key_T & key, bool upper) const
 	{
-		NodePtr <Key_T, Mapped_T> tmp = tree.helper_search(pair.first);
-		if (tmp)
-        {
-            return std::pair<Iterator, bool>(Iterator(tmp, &tree), false);
-        }
-		tmp = tree.insert(pair.first, pair.second);
-		return std::pair<Iterator, bool>(Iterator(tmp, &tree), true);
+		LinkPtr bound = 0;
+		LinkPtr nodePtr = treeRoot;
+		while (nodePtr != 0)
+		{
+			int cmp = KeyCompare<Key_T>::compare(key, node(nodePtr).pair.first);
+			if (cmp < 0 || (cmp == 0 && !upper))
+			{
+				bound = nodePtr;
+				nodePtr = links(nodePtr).left;
+			}
+			else
+			{
+				nodePtr = links(nodePtr).right;
+			}
+		}
+		trim();
+		return bound;
 	}
 
+	//insert: one three-way comparison per level, then link a new leaf
 	template<class Key_T, class Mapped_T>
-	template<typename IT_T>
-	void Map<Key_T, Mapped_T>::insert(IT_T range_beg, IT_T range_end)
+	std::pair<typename DiskMap<Key_T, Mapped_T>::Iterator, bool> DiskMap<Key_T, Mapped_T>::insert(const ValueType<Key_T, Mapped_T> & pair)
 	{
-		for (; range_beg != range_end; ++range_beg)
-        {
-			tree.insert(range_beg->first, range_beg->second);
+		LinkPtr locationPtr = treeRoot, parent = 0;
+		int cmp = 0;
+		while (locationPtr != 0)
+		{
+			cmp = KeyCompare<Key_T>::compare(pair.first, node(locationPtr).pair.first);
+			if (cmp == 0)
+			{
+				trim();
+				return std::make_pair(Iterator(locationPtr, this), false);
+			}
+			parent = locationPtr;
+			locationPtr = cmp < 0 ? links(locationPtr).left : links(locationPtr).right;
 		}
+
+		mark_dirty();
+		LinkPtr fresh = allocate_node();
+		new (base + fresh) NodeType(pair);
+		Avl::attach(*this, parent, fresh, cmp < 0);
+		Avl::adjust_height_insert(*this, fresh);
+		++count;
+		trim();
+		return std::make_pair(Iterator(fresh, this), true);
 	}
-
-	//erase the given key
+
+	//erase: the successor takes the place of a node with two children
 	template<class Key_T, class Mapped_T>
-	void Map<Key_T, Mapped_T>::erase(const Key_T & key)
-    {
-		tree.remove(key);
+	typename DiskMap<Key_T, Mapped_T>::Iterator DiskMap<Key_T, Mapped_T>::erase(Iterator pos)
+	{
+		mark_dirty();
+		LinkPtr next = Avl::get_successor(*this, pos.inode);
+		Avl::detach(*this, pos.inode, next);
+		release_node(pos.inode);
+		--count;
+		trim();
+		return Iterator(next, this);
 	}
+
 	template<class Key_T, class Mapped_T>
-	void Map<Key_T, Mapped_T>::erase(const Iterator pos)
+	void DiskMap<Key_T, Mapped_T>::erase(const Key_T & key)
 	{
-		Key_T temp = pos.inode->pair.first;
-		tree.remove(temp);
+		if (LinkPtr node = search(key))
+		{
+			erase(Iterator(node, this));
+		}
 	}
-
-	//delete the entire tree
+
+	//hand every page back, the file keeps its size
 	template<class Key_T, class Mapped_T>
-	void Map<Key_T, Mapped_T>::clear()
+	void DiskMap<Key_T, Mapped_T>::clear()
 	{
-		tree.clear();
+		mark_dirty();
+		treeRoot = 0;
+		count = 0;
+		nodeEnd = pageBytes;
+		freeList = 0;
+
+		//the old entries are still in their slots, a crash must not bring
+		//them back
+		nodeLimit = pageBytes;
+		header().nodeLimit = nodeLimit;
+		if (msync(base, pageBytes, MS_SYNC) != 0)
+		{
+			throw std::runtime_error("cannot write disk map header");
+		}
+		madvise(base, mapped, MADV_DONTNEED);
+		for (std::size_t i = 0; i < resident.size(); ++i)
+		{
+			windowState[resident[i]] = absent;
+		}
+		resident.clear();
+		hand = 0;
 	}
 
-	//at function
 	template<class Key_T, class Mapped_T>
-	Mapped_T & Map<Key_T, Mapped_T>::at(const Key_T & key)
+	Mapped_T & DiskMap<Key_T, Mapped_T>::at(const Key_T & key)
 	{
-		return tree.at(key);
+		LinkPtr found = search(key);
+		if (found == 0)
+		{
+			throw std::out_of_range("not in range");
+		}
+		return entry(found).pair.second;
 	}
 	template<class Key_T, class Mapped_T>
-	const Mapped_T & Map<Key_T, Mapped_T>::at(const Key_T & key) const
+	const Mapped_T & DiskMap<Key_T, Mapped_T>::at(const Key_T & key) const
 	{
-		return tree.at(key);
+		LinkPtr found = search(key);
+		if (found == 0)
+		{
+			throw std::out_of_range("not in range");
+		}
+		return entry(found).pair.second;
 	}
-
-	//find function
+
 	template<class Key_T, class Mapped_T>
-	typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::find(const Key_T & key)
+	Mapped_T & DiskMap<Key_T, Mapped_T>::operator[](const Key_T & key)
 	{
-		return Map<Key_T, Mapped_T>::Iterator(tree.helper_search(key), &tree);
+		return insert(ValueType<Key_T, Mapped_T>(key, Mapped_T())).first->second;
 	}
-	template<class Key_T, class Mapped_T>
-	typename Map<Key_T, Mapped_T>::ConstIterator Map<Key_T, Mapped_T>::find(const Key_T & key) const
+
+	//+++++++++++++++++++++++++++ DURABLE MAP +++++++++++++++++++++++++++++//
+
+	//first bytes of a DurableMap journal
+	struct JournalHeader
+	{
+	    char magic[8];
+	    std::uint32_t version;
+	    std::uint32_t byteOrder;
+	    std::uint64_t keySize;
+	    std::uint64_t mappedSize;
+
+	    static constexpr std::uint32_t currentVersion = 1;
+	};
+
+	//a record is this header, the key and for a put the value, then a
+	//checksum of all of it. A torn record at the end is cut off.
+	struct JournalRecordHeader
+	{
+	    std::uint32_t length;
+	    std::uint32_t op;
+
+	    static constexpr std::uint32_t put = 1;
+	    static constexpr std::uint32_t erase = 2;
+	};
+
+	//records being built, a Serializer sink
+	class JournalBuffer
+	{
+	    public:
+	        void write(const void * data, std::size_t length)
+	        {
+	            const char * first = static_cast<const char *>(data);
+	            bytes.insert(bytes.end(), first, first + length);
+	        }
+
+	        std::vector<char> bytes;
+	};
+
+	//payload of one record, a Serializer source
+	class JournalCursor
+	{
+	    public:
+	        JournalCursor(const char * data, std::size_t length)
+	            : next(data), remaining(length)
+	        {
+	            //empty
+	        }
+
+	        void read(void * data, std::size_t length)
+	        {
+	            if (length > remaining)
+	            {
+	                fail("has a record past its end");
+	            }
+	            std::memcpy(data, next, length);
+	            next += length;
+	            remaining -= length;
+	        }
+
+	        std::uint64_t bytes_left() const
+	        {
+	            return remaining;
+	        }
+
+	        void fail(const char * what) const
+	        {
+	            throw std::runtime_error(std::string("journal ") + what);
+	        }
+
+	    private:
+	        const char * next;
+	        std::size_t remaining;
+	};
+
+	//work of a DurableMap since it was opened
+	struct DurableStats
+	{
+	    //records written and the syncs they shared
+	    std::uint64_t records;
+	    std::uint64_t commits;
+	    std::uint64_t checkpoints;
+
+	    //bytes of the journal, pending records included
+	    std::uint64_t journalBytes;
+	};
+
+	//Map whose changes survive a crash. Every insert, erase and write
+	//through operator[] is appended to a journal and returns once it is on
+	//disk. A commit thread syncs the journal, writers that arrive while a
+	//sync runs, or within the commit window, share the next one.
+	//Opening loads path.snap and replays path.log onto it. A checkpoint
+	//saves the map to path.snap and drops the journal records it holds,
+	//in the background once the journal reaches checkpointBytes.
+	//Records are idempotent, so replaying records a snapshot already has
+	//is harmless and a crash at any step recovers.
+	//Changes are thread safe and visible to readers before they are
+	//durable. When a sync fails, every change that is not durable is
+	//rolled back and throws, and so does every change after it.
+	//map() gives the entries, it must not be used while other threads
+	//change them.
+	template<class Key_T, class Mapped_T, class Policy = DefaultTreePolicy,
+	    class Alloc = std::allocator<ValueType<Key_T, Mapped_T>>>
+	class DurableMap
+	{
+	    public:
+	        typedef Map<Key_T, Mapped_T, Policy, Alloc> MapType;
+
+	        using key_type = Key_T;
+	        using mapped_type = Mapped_T;
+	        using value_type = ValueType<Key_T, Mapped_T>;
+	        using size_type = std::size_t;
+
+	        //result of operator[], assigning to it is a logged write and
+	        //reading a missing key inserts the default value like Map does
+	        class Reference
+	        {
+	            public:
+	                Reference & operator=(const Mapped_T & value)
+	                {
+	                    owner->assign(key, value);
+	                    return *this;
+	                }
+	                Reference & operator=(const Reference & other)
+	                {
+	                    return *this = Mapped_T(other);
+	                }
+	                operator Mapped_T() const
+	                {
+	                    return owner->value_or_insert(key);
+	                }
+
+	            private:
+	                friend class DurableMap;
+
+	                Reference(DurableMap * map, const Key_T & k)
+	                    : owner(map), key(k)
+	                {
+	                    //empty
+	                }
+
+	                DurableMap * owner;
+	                Key_T key;
+	        };
+
+	        static constexpr std::uint64_t defaultCheckpointBytes = std::uint64_t(64) << 20;
+
+	        //recover from path.snap and path.log, then start the commit and
+	        //checkpoint threads. A commit waits commitWindow for more
+	        //records before it syncs, checkpointBytes 0 only checkpoints on
+	        //request.
+	        explicit DurableMap(const std::string & path,
+	            std::chrono::microseconds commitWindow = std::chrono::microseconds(0),
+	            std::uint64_t checkpointBytes = defaultCheckpointBytes);
+
+	        DurableMap(const DurableMap &) = delete;
+	        DurableMap & operator=(const DurableMap &) = delete;
+
+	        //commits what is pending and stops the threads
+	        ~DurableMap();
+
+	        //false, and nothing logged, when the key is already there
+	        bool insert(const ValueType<Key_T, Mapped_T> & pair);
+
+	        //insert or overwrite
+	        void assign(const Key_T & key, const Mapped_T & value);
+
+	        void erase(const Key_T & key);
+
+	        Reference operator[](const Key_T & key)
+	        {
+	            return Reference(this, key);
+	        }
+
+	        //copy of the value, throws out_of_range without one
+	        Mapped_T at(const Key_T & key) const;
+
+	        size_t size() const;
+	        bool empty() const
+	        {
+	            return size() == 0;
+	        }
+
+	        //waits for a checkpoint that runs, the changes made during it
+	        //are in the entries once it is done
+	        const MapType & map() const
+	        {
+	            std::lock_guard<std::mutex> serial(checkpointMutex);
+	            return entries;
+	        }
+
+	        //save a snapshot and cut the journal now. Writers go on while
+	        //it is saved, their changes are merged in afterwards.
+	        void checkpoint();
+
+	        DurableStats stats() const;
+
+	    private:
+	        std::string snapshotPath;
+	        std::string journalPath;
+	        MapType entries;
+
+	        //value a key got while a checkpoint saves entries, or its erase
+	        struct Change
+	        {
+	            Mapped_T value;
+	            bool erased;
+	        };
+
+	        //while a checkpoint saves entries nothing changes them, changes
+	        //go here until thaw() merges them in. frozenSize is the size
+	        //with them.
+	        Map<Key_T, Change> changes;
+	        bool frozen;
+	        std::size_t frozenSize;
+
+	        //what a change replaced, the old value or none for a new key
+	        struct Undo
+	        {
+	            Key_T key;
+	            std::unique_ptr<Mapped_T> old;
+	        };
+
+	        //one per change that is not durable yet, oldest first
+	        std::vector<Undo> undo;
+
+	        //guards entries, changes, undo, pending and the counters below
+	        mutable std::mutex mutex;
+	        std::condition_variable workReady;
+	        std::condition_variable committed;
+	        std::condition_variable checkpointDue;
+
+	        //records not written yet, the last sequence number handed out
+	        //and the last one on disk
+	        JournalBuffer pending;
+	        std::uint64_t lastLsn;
+	        std::uint64_t durableLsn;
+
+	        //journal size with the pending records, and the size that
+	        //starts a background checkpoint
+	        std::uint64_t journalEnd;
+	        std::uint64_t checkpointAt;
+
+	        //set when the journal cannot be written, changes fail after it
+	        std::string failure;
+	        bool stopping;
+	        DurableStats counters;
+
+	        const std::chrono::microseconds window;
+	        const std::uint64_t checkpointBytes;
+
+	        //guards the journal file, taken before mutex when both are held
+	        std::mutex ioMutex;
+	        int journal;
+	        std::uint64_t written;
+
+	        //one checkpoint at a time
+	        mutable std::mutex checkpointMutex;
+
+	        std::thread committer;
+	        std::thread checkpointer;
+
+	        //append the record of a change made, wake the commit thread and
+	        //wait for the sync
+	        void log(const JournalBuffer & record, Undo && change, std::unique_lock<std::mutex> & lock);
+	        static void encode(JournalBuffer & out, std::uint32_t op, const Key_T & key, const Mapped_T * value);
+
+	        Mapped_T value_or_insert(const Key_T & key);
+
+	        //the value readers see, null without one
+	        const Mapped_T * visible(const Key_T & key) const;
+
+	        //change entries, or changes during a checkpoint, and return how
+	        //to undo it. remove() needs a visible key.
+	        Undo put(const Key_T & key, const Mapped_T & value);
+	        Undo remove(const Key_T & key);
+
+	        //undo every change that is not durable, newest first
+	        void roll_back();
+
+	        //merge the changes made during a checkpoint into entries
+	        void thaw();
+
+	        void check_failure() const
+	        {
+	            if (!failure.empty())
+	            {
+	                throw std::runtime_error(failure);
+	            }
+	        }
+
+	        void recover();
+	        void replay(const char * record, std::size_t length, std::uint32_t op);
+	        void commit_loop();
+	        void checkpoint_loop();
+
+	        //write a batch at the end of the journal and sync it, an
+	        //error message on failure
+	        std::string write_batch(const std::vector<char> & batch);
+
+	        //journal of only the records from cut on
+	        void rewrite_journal(std::uint64_t cut);
+
+	        static JournalHeader journal_header();
+	        static void write_all(int file, const char * data, std::size_t length, std::uint64_t offset);
+	        static void sync_file(int file);
+	        static void sync_path(const std::string & path);
+	        static void sync_directory(const std::string & path);
+	};
+
+	//recover first, the threads only start on a consistent map
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	DurableMap<Key_T, Mapped_T, Policy, Alloc>::DurableMap(const std::string & path,
+	    std::chrono::microseconds commitWindow, std::uint64_t checkpointBytes)
+	    : snapshotPath(path + ".snap"), journalPath(path + ".log"), frozen(false), frozenSize(0), lastLsn(0), durableLsn(0),
+	      journalEnd(0), checkpointAt(checkpointBytes), stopping(false), counters(),
+	      window(commitWindow), checkpointBytes(checkpointBytes), journal(-1), written(0)
 	{
-		return Map<Key_T, Mapped_T>::ConstIterator(tree.helper_search(key), &tree);
+		recover();
+		try
+		{
+			committer = std::thread(&DurableMap::commit_loop, this);
+			checkpointer = std::thread(&DurableMap::checkpoint_loop, this);
+		}
+		catch (...)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			workReady.notify_all();
+			if (committer.joinable())
+			{
+				committer.join();
+			}
+			close(journal);
+			throw;
+		}
 	}
 
-	template<class Key_T, class Mapped_T>
-	Mapped_T & Map<Key_T, Mapped_T>::operator[](const Key_T & key)
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	DurableMap<Key_T, Mapped_T, Policy, Alloc>::~DurableMap()
 	{
-		NodePtr<Key_T, Mapped_T> temp;
-		if ((temp = tree.helper_search(key)))
-        {
-			return temp->data;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
 		}
-		temp = tree.insert(key, Mapped_T());
-		return temp->data;
+		workReady.notify_all();
+		checkpointDue.notify_all();
+		committer.join();
+		checkpointer.join();
+		close(journal);
 	}
-
-    //iterator implementation
-	template<class Key_T, class Mapped_T>
-	typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::begin()
+
+	//load the snapshot, replay every whole record of the journal and cut
+	//off a torn one at its end
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void DurableMap<Key_T, Mapped_T, Policy, Alloc>::recover()
 	{
-		return tree.begin();
+		struct stat info;
+		if (stat(snapshotPath.c_str(), &info) == 0)
+		{
+			entries.load(snapshotPath);
+		}
+
+		journal = open(journalPath.c_str(), O_RDWR | O_CREAT, 0644);
+		if (journal < 0 || fstat(journal, &info) != 0)
+		{
+			if (journal >= 0)
+			{
+				close(journal);
+			}
+			throw std::runtime_error("cannot open journal " + journalPath);
+		}
+
+		try
+		{
+			JournalHeader header = journal_header();
+			std::size_t length = static_cast<std::size_t>(info.st_size);
+			std::vector<char> bytes(length);
+			if (length != 0 && pread(journal, &bytes[0], length, 0) != static_cast<ssize_t>(length))
+			{
+				throw std::runtime_error("cannot read journal " + journalPath);
+			}
+
+			//a crash while the journal was created leaves no header or part
+			//of one, and no records
+			if (length < sizeof(header) || (length == sizeof(header) && std::memcmp(&bytes[0], header.magic, sizeof(header.magic)) != 0))
+			{
+				write_all(journal, reinterpret_cast<const char *>(&header), sizeof(header), 0);
+				if (ftruncate(journal, static_cast<off_t>(sizeof(header))) != 0)
+				{
+					throw std::runtime_error("cannot write journal " + journalPath);
+				}
+				sync_file(journal);
+				sync_directory(journalPath);
+				written = journalEnd = sizeof(header);
+				return;
+			}
+			if (std::memcmp(&bytes[0], &header, sizeof(header)) != 0)
+			{
+				throw std::runtime_error("journal " + journalPath + " does not hold entries of this key and value type");
+			}
+
+			std::size_t position = sizeof(header);
+			while (length - position >= sizeof(JournalRecordHeader) + sizeof(std::uint64_t))
+			{
+				JournalRecordHeader record;
+				std::memcpy(&record, &bytes[position], sizeof(record));
+				std::size_t room = length - position - sizeof(record) - sizeof(std::uint64_t);
+				if (record.length > room)
+				{
+					break;
+				}
+				SnapshotChecksum checksum;
+				checksum.update(&bytes[position], sizeof(record) + record.length);
+				std::uint64_t stored;
+				std::memcpy(&stored, &bytes[position + sizeof(record) + record.length], sizeof(stored));
+				if (stored != checksum.value())
+				{
+					break;
+				}
+				replay(&bytes[position + sizeof(record)], record.length, record.op);
+				position += sizeof(record) + record.length + sizeof(stored);
+			}
+
+			if (position != length)
+			{
+				if (ftruncate(journal, static_cast<off_t>(position)) != 0)
+				{
+					throw std::runtime_error("cannot cut the torn end off journal " + journalPath);
+				}
+				sync_file(journal);
+			}
+			written = journalEnd = position;
+		}
+		catch (...)
+		{
+			close(journal);
+			throw;
+		}
 	}
-	template<class Key_T, class Mapped_T>
-	typename Map<Key_T, Mapped_T>::Iterator Map<Key_T, Mapped_T>::end()
+
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void DurableMap<Key_T, Mapped_T, Policy, Alloc>::replay(const char * record, std::size_t length, std::uint32_t op)
 	{
-		return tree.end();
+		JournalCursor in(record, length);
+		Key_T key = Serializer<Key_T>::read(in);
+		if (op == JournalRecordHeader::put)
+		{
+			Mapped_T value = Serializer<Mapped_T>::read(in);
+			typename MapType::Iterator found = entries.find(key);
+			if (found != entries.end())
+			{
+				found->second = std::move(value);
+			}
+			else
+			{
+				entries.insert(ValueType<Key_T, Mapped_T>(key, value));
+			}
+		}
+		else if (op == JournalRecordHeader::erase)
+		{
+			entries.erase(key);
+		}
+		else
+		{
+			in.fail("has a record of an unknown kind");
+		}
+		if (in.bytes_left() != 0)
+		{
+			in.fail("has a record longer than its entry");
+		}
 	}
 
-	template<class Key_T, class Mapped_T>
-	typename Map<Key_T, Mapped_T>::ConstIterator Map<Key_T, Mapped_T>::begin() const {
-		return tree.begin();
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	JournalHeader DurableMap<Key_T, Mapped_T, Policy, Alloc>::journal_header()
+	{
+		JournalHeader header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, "CS540LOG", sizeof(header.magic));
+		header.version = JournalHeader::currentVersion;
+		header.byteOrder = SnapshotHeader::byteOrderMark;
+		header.keySize = sizeof(Key_T);
+		header.mappedSize = sizeof(Mapped_T);
+		return header;
 	}
-	template<class Key_T, class Mapped_T>
-	typename Map<Key_T, Mapped_T>::ConstIterator Map<Key_T, Mapped_T>::end() const
+
+	//header, payload and checksum of one record
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void DurableMap<Key_T, Mapped_T, Policy, Alloc>::encode(JournalBuffer & out, std::uint32_t op, const Key_T & key, const Mapped_T * value)
 	{
-		return tree.end();
+		std::size_t start = out.bytes.size();
+		JournalRecordHeader header = { 0, op };
+		out.write(&header, sizeof(header));
+		Serializer<Key_T>::write(out, key);
+		if (value != 0)
+		{
+			Serializer<Mapped_T>::write(out, *value);
+		}
+
+		std::size_t length = out.bytes.size() - start - sizeof(header);
+		if (length > std::numeric_limits<std::uint32_t>::max())
+		{
+			throw std::length_error("entry is too large for the journal");
+		}
+		header.length = static_cast<std::uint32_t>(length);
+		std::memcpy(&out.bytes[start], &header, sizeof(header));
+
+		SnapshotChecksum checksum;
+		checksum.update(&out.bytes[start], sizeof(header) + length);
+		std::uint64_t sum = checksum.value();
+		out.write(&sum, sizeof(sum));
 	}
-	template<class Key_T, class Mapped_T>
-	typename Map<Key_T, Mapped_T>::ReverseIterator Map<Key_T, Mapped_T>::rbegin()
+
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void DurableMap<Key_T, Mapped_T, Policy, Alloc>::log(const JournalBuffer & record, Undo && change, std::unique_lock<std::mutex> & lock)
 	{
-		return tree.rbegin();
+		undo.push_back(std::move(change));
+		pending.write(record.bytes.data(), record.bytes.size());
+		journalEnd += record.bytes.size();
+		std::uint64_t lsn = ++lastLsn;
+		++counters.records;
+		workReady.notify_one();
+		committed.wait(lock, [this, lsn] { return durableLsn >= lsn || !failure.empty(); });
+		if (durableLsn < lsn)
+		{
+			check_failure();
+		}
 	}
-	template<class Key_T, class Mapped_T>
-	typename Map<Key_T, Mapped_T>::ReverseIterator Map<Key_T, Mapped_T>::rend()
+
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	bool DurableMap<Key_T, Mapped_T, Policy, Alloc>::insert(const ValueType<Key_T, Mapped_T> & pair)
 	{
-		return tree.rend();
+		JournalBuffer record;
+		encode(record, JournalRecordHeader::put, pair.first, &pair.second);
+		std::unique_lock<std::mutex> lock(mutex);
+		check_failure();
+		if (visible(pair.first) != 0)
+		{
+			return false;
+		}
+		log(record, put(pair.first, pair.second), lock);
+		return true;
 	}
 
-	//*** GLOBAL COMPARSION FUNCTIONS *****//
-	template<class Key_T, class Mapped_T>
-	bool operator==(const Map<Key_T, Mapped_T> & x, const Map<Key_T, Mapped_T> & y)
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void DurableMap<Key_T, Mapped_T, Policy, Alloc>::assign(const Key_T & key, const Mapped_T & value)
 	{
-		return x.tree == y.tree;
+		JournalBuffer record;
+		encode(record, JournalRecordHeader::put, key, &value);
+		std::unique_lock<std::mutex> lock(mutex);
+		check_failure();
+		log(record, put(key, value), lock);
 	}
-	template<class Key_T, class Mapped_T>
-	bool operator!=(const Map<Key_T, Mapped_T> & x, const Map<Key_T, Mapped_T> & y)
-	{
-		return x.tree != y.tree;
-	}
-	template <class Key_T, class Mapped_T>
-	bool operator<(const Map<Key_T, Mapped_T> & x, const Map<Key_T, Mapped_T> & y)
+
+	//nothing is logged for a key that is not there
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void DurableMap<Key_T, Mapped_T, Policy, Alloc>::erase(const Key_T & key)
 	{
-		return x.tree<y.tree;
+		JournalBuffer record;
+		encode(record, JournalRecordHeader::erase, key, 0);
+		std::unique_lock<std::mutex> lock(mutex);
+		check_failure();
+		if (visible(key) == 0)
+		{
+			return;
+		}
+		log(record, remove(key), lock);
 	}
-}
+
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	Mapped_T DurableMap<Key_T, Mapped_T, Policy, Alloc>::value_or_insert(const Key_T & key)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (const Mapped_T * found = visible(key))
+		{
+			return *found;
+		}
+		check_failure();
+		Mapped_T value = Mapped_T();
+		JournalBuffer record;
+		encode(record, JournalRecordHeader::put, key, &value);
+		log(record, put(key, value), lock);
+		return value;
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	Mapped_T DurableMap<Key_T, Mapped_T, Policy, Alloc>::at(const Key_T & key) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		const Mapped_T * found = visible(key);
+		if (found == 0)
+		{
+			throw std::out_of_range("not in range");
+		}
+		return *found;
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	size_t DurableMap<Key_T, Mapped_T, Policy, Alloc>::size() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return frozen ? frozenSize : entries.size();
+	}
+
+	//a change during a checkpoint wins over the saved entry
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	const Mapped_T * DurableMap<Key_T, Mapped_T, Policy, Alloc>::visible(const Key_T & key) const
+	{
+		if (frozen)
+		{
+			typename Map<Key_T, Change>::ConstIterator change = changes.find(key);
+			if (change != changes.end())
+			{
+				return change->second.erased ? 0 : &change->second.value;
+			}
+		}
+		typename MapType::ConstIterator found = entries.find(key);
+		return found == entries.end() ? 0 : &found->second;
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename DurableMap<Key_T, Mapped_T, Policy, Alloc>::Undo DurableMap<Key_T, Mapped_T, Policy, Alloc>::put(const Key_T & key, const Mapped_T & value)
+	{
+		Undo result = { key, std::unique_ptr<Mapped_T>() };
+		if (!frozen)
+		{
+			typename MapType::Iterator found = entries.find(key);
+			if (found != entries.end())
+			{
+				result.old.reset(new Mapped_T(found->second));
+				found->second = value;
+			}
+			else
+			{
+				entries.insert(ValueType<Key_T, Mapped_T>(key, value));
+			}
+			return result;
+		}
+
+		if (const Mapped_T * current = visible(key))
+		{
+			result.old.reset(new Mapped_T(*current));
+		}
+		else
+		{
+			++frozenSize;
+		}
+		Change change = { value, false };
+		typename Map<Key_T, Change>::Iterator found = changes.find(key);
+		if (found != changes.end())
+		{
+			found->second = change;
+		}
+		else
+		{
+			changes.insert(ValueType<Key_T, Change>(key, change));
+		}
+		return result;
+	}
+
+	//during a checkpoint a saved entry needs an erase among the changes,
+	//a key only among the changes goes
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	typename DurableMap<Key_T, Mapped_T, Policy, Alloc>::Undo DurableMap<Key_T, Mapped_T, Policy, Alloc>::remove(const Key_T & key)
+	{
+		Undo result = { key, std::unique_ptr<Mapped_T>() };
+		if (!frozen)
+		{
+			typename MapType::Iterator found = entries.find(key);
+			result.old.reset(new Mapped_T(std::move(found->second)));
+			entries.erase(found);
+			return result;
+		}
+
+		const Mapped_T * current = visible(key);
+		result.old.reset(new Mapped_T(*current));
+		--frozenSize;
+		typename Map<Key_T, Change>::Iterator found = changes.find(key);
+		if (static_cast<const MapType &>(entries).find(key) == entries.end())
+		{
+			changes.erase(found);
+		}
+		else if (found != changes.end())
+		{
+			found->second.erased = true;
+		}
+		else
+		{
+			Change change = { *current, true };
+			changes.insert(ValueType<Key_T, Change>(key, change));
+		}
+		return result;
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void DurableMap<Key_T, Mapped_T, Policy, Alloc>::roll_back()
+	{
+		for (std::size_t i = undo.size(); i > 0; --i)
+		{
+			Undo & change = undo[i - 1];
+			if (change.old)
+			{
+				put(change.key, *change.old);
+			}
+			else
+			{
+				remove(change.key);
+			}
+		}
+		undo.clear();
+	}
+
+	//one merge, the changes are sorted and there is one per key
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void DurableMap<Key_T, Mapped_T, Policy, Alloc>::thaw()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<MergeEntry<Key_T, Mapped_T>> batch;
+		batch.reserve(changes.size());
+		for (typename Map<Key_T, Change>::Iterator change = changes.begin(); change != changes.end(); ++change)
+		{
+			MergeEntry<Key_T, Mapped_T> entry = { change->first, std::move(change->second.value),
+			    change->second.erased ? MergeOp::erase : MergeOp::put };
+			batch.push_back(std::move(entry));
+		}
+		entries.merge_sorted(batch);
+		changes.clear();
+		frozen = false;
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	DurableStats DurableMap<Key_T, Mapped_T, Policy, Alloc>::stats() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		DurableStats result = counters;
+		result.journalBytes = journalEnd;
+		return result;
+	}
+
+	//take what is pending, after the commit window when there is one, and
+	//sync it with a single call. Pending records are drained before a stop.
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void DurableMap<Key_T, Mapped_T, Policy, Alloc>::commit_loop()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;)
+		{
+			workReady.wait(lock, [this] { return stopping || !pending.bytes.empty(); });
+			if (pending.bytes.empty())
+			{
+				return;
+			}
+			if (window.count() > 0 && !stopping)
+			{
+				workReady.wait_for(lock, window, [this] { return stopping; });
+			}
+
+			std::vector<char> batch;
+			batch.swap(pending.bytes);
+			std::uint64_t batchLsn = lastLsn;
+			lock.unlock();
+			std::string error = write_batch(batch);
+			lock.lock();
+
+			if (!error.empty())
+			{
+				//nothing after the failed batch is written either
+				failure = error;
+				roll_back();
+				pending.bytes.clear();
+			}
+			else
+			{
+				undo.erase(undo.begin(), undo.begin() + static_cast<std::ptrdiff_t>(batchLsn - durableLsn));
+				durableLsn = batchLsn;
+				++counters.commits;
+			}
+			committed.notify_all();
+			if (checkpointBytes != 0 && journalEnd >= checkpointAt)
+			{
+				checkpointDue.notify_one();
+			}
+		}
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	std::string DurableMap<Key_T, Mapped_T, Policy, Alloc>::write_batch(const std::vector<char> & batch)
+	{
+		std::lock_guard<std::mutex> io(ioMutex);
+		try
+		{
+			write_all(journal, batch.data(), batch.size(), written);
+			written += batch.size();
+			sync_file(journal);
+		}
+		catch (const std::exception & error)
+		{
+			return std::string(error.what()) + ", journal " + journalPath + " stopped";
+		}
+		return std::string();
+	}
+
+	//a failed checkpoint is tried again once the journal grew as much again
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void DurableMap<Key_T, Mapped_T, Policy, Alloc>::checkpoint_loop()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;)
+		{
+			checkpointDue.wait(lock, [this] {
+				return stopping || (checkpointBytes != 0 && journalEnd >= checkpointAt && failure.empty());
+			});
+			if (stopping)
+			{
+				return;
+			}
+			lock.unlock();
+			bool done = true;
+			try
+			{
+				checkpoint();
+			}
+			catch (...)
+			{
+				done = false;
+			}
+			lock.lock();
+			checkpointAt = done ? checkpointBytes : journalEnd + checkpointBytes;
+		}
+	}
+
+	//entries are frozen at the journal position of their last record and
+	//saved without the lock. The snapshot replaces the old one once those
+	//records are durable, and before the journal drops them.
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void DurableMap<Key_T, Mapped_T, Policy, Alloc>::checkpoint()
+	{
+		std::lock_guard<std::mutex> serial(checkpointMutex);
+		std::uint64_t cut, cutLsn;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			check_failure();
+			frozenSize = entries.size();
+			frozen = true;
+			cut = journalEnd;
+			cutLsn = lastLsn;
+		}
+
+		std::string fresh = snapshotPath + ".new";
+		try
+		{
+			entries.save(fresh);
+		}
+		catch (...)
+		{
+			thaw();
+			throw;
+		}
+		thaw();
+		sync_path(fresh);
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			committed.wait(lock, [this, cutLsn] { return durableLsn >= cutLsn || !failure.empty(); });
+			if (!failure.empty())
+			{
+				std::remove(fresh.c_str());
+			}
+			check_failure();
+		}
+		if (std::rename(fresh.c_str(), snapshotPath.c_str()) != 0)
+		{
+			std::remove(fresh.c_str());
+			throw std::runtime_error("cannot replace snapshot " + snapshotPath);
+		}
+		sync_directory(snapshotPath);
+		rewrite_journal(cut);
+	}
+
+	//copy the records after cut into a new journal and rename it over the
+	//old one. Offsets of records not written yet move with the rest.
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void DurableMap<Key_T, Mapped_T, Policy, Alloc>::rewrite_journal(std::uint64_t cut)
+	{
+		std::lock_guard<std::mutex> io(ioMutex);
+		JournalHeader header = journal_header();
+		std::vector<char> bytes(sizeof(header) + (written - cut));
+		std::memcpy(&bytes[0], &header, sizeof(header));
+		if (written > cut && pread(journal, &bytes[sizeof(header)], written - cut, static_cast<off_t>(cut))
+		    != static_cast<ssize_t>(written - cut))
+		{
+			throw std::runtime_error("cannot read journal " + journalPath);
+		}
+
+		std::string temporary = journalPath + ".tmp";
+		int file = open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (file < 0)
+		{
+			throw std::runtime_error("cannot create journal " + temporary);
+		}
+		try
+		{
+			write_all(file, bytes.data(), bytes.size(), 0);
+			sync_file(file);
+			if (std::rename(temporary.c_str(), journalPath.c_str()) != 0)
+			{
+				throw std::runtime_error("cannot replace journal " + journalPath);
+			}
+		}
+		catch (...)
+		{
+			close(file);
+			std::remove(temporary.c_str());
+			throw;
+		}
+		close(journal);
+		journal = file;
+		sync_directory(journalPath);
+
+		std::uint64_t dropped = cut - sizeof(header);
+		written -= dropped;
+		std::lock_guard<std::mutex> lock(mutex);
+		journalEnd -= dropped;
+		++counters.checkpoints;
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void DurableMap<Key_T, Mapped_T, Policy, Alloc>::write_all(int file, const char * data, std::size_t length, std::uint64_t offset)
+	{
+		while (length > 0)
+		{
+			ssize_t done = pwrite(file, data, length, static_cast<off_t>(offset));
+			if (done < 0)
+			{
+				throw std::runtime_error("cannot write journal");
+			}
+			data += done;
+			length -= static_cast<std::size_t>(done);
+			offset += static_cast<std::uint64_t>(done);
+		}
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void DurableMap<Key_T, Mapped_T, Policy, Alloc>::sync_file(int file)
+	{
+#if defined(__APPLE__)
+		int result = fsync(file);
+#else
+		int result = fdatasync(file);
+#endif
+		if (result != 0)
+		{
+			throw std::runtime_error("cannot sync journal");
+		}
+	}
+
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void DurableMap<Key_T, Mapped_T, Policy, Alloc>::sync_path(const std::string & path)
+	{
+		int file = open(path.c_str(), O_RDONLY);
+		if (file < 0 || fsync(file) != 0)
+		{
+			if (file >= 0)
+			{
+				close(file);
+			}
+			throw std::runtime_error("cannot sync " + path);
+		}
+		close(file);
+	}
+
+	//a rename is only durable once the directory is
+	template<class Key_T, class Mapped_T, class Policy, class Alloc>
+	void DurableMap<Key_T, Mapped_T, Policy, Alloc>::sync_directory(const std::string & path)
+	{
+		std::string::size_type slash = path.rfind('/');
+		sync_path(slash == std::string::npos ? std::string(".") : slash == 0 ? std::string("/") : path.substr(0, slash));
+	}
+}
+#endif
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+
+namespace cs540
+{
+    namespace pmr
+    {
+        //Map whose nodes come from a std::pmr::memory_resource, e.g. a
+        //monotonic arena that is released in one go
+        template<class Key_T, class Mapped_T, class Policy = DefaultTreePolicy>
+        using Map = cs540::Map<Key_T, Mapped_T, Policy,
+            std::pmr::polymorphic_allocator<ValueType<Key_T, Mapped_T>>>;
+    }
+}
+#endif
+#endif
 
 #endif
@@ -0,0 +1,266 @@
+//runs the balancing policies through mixes of finds, inserts and erases
+//and prints one JSON line per (balance, size, mix) to stdout.
+//
+//  balance_bench [--balances avl,rb,wavl,treap] [--sizes 10K,1M]
+//                [--mixes 90/5/5,50/25/25,10/45/45,0/20/80] [--ops N] [--seed N]
+//
+//A mix is the percentage of finds, inserts and erases. The map is filled
+//with size random keys, then every policy replays the same trace of
+//--ops operations, as many as the size unless given: finds hit a present
+//key, inserts add a new one and erases remove a present one.
+//The trace is replayed a second time with CountingStats for the rotations
+//and retrace steps per insert or erase. Height and average search path
+//are those of the map after the trace.
+
+#include "Map.hpp"
+#include "bench_common.hpp"
+
+#include <random>
+
+namespace
+{
+    struct Options
+    {
+        std::vector<std::string> balances;
+        std::vector<std::size_t> sizes;
+        std::vector<std::string> mixes;
+        std::size_t ops;
+        unsigned long long seed;
+    };
+
+    enum class Op { find, insert, erase };
+
+    struct Step
+    {
+        Op op;
+        std::uint64_t key;
+    };
+
+    //keys to fill the map with and the operations that follow
+    struct Trace
+    {
+        std::vector<std::uint64_t> fill;
+        std::vector<Step> steps;
+        std::size_t updates;
+    };
+
+    Trace make_trace(std::size_t n, std::size_t ops, const unsigned percent[3], std::mt19937_64 & rng)
+    {
+        Trace trace;
+        trace.fill.resize(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            trace.fill[i] = rng();
+        }
+
+        //present keys in no particular order, erase swaps the last one in
+        std::vector<std::uint64_t> present(trace.fill);
+        std::uniform_int_distribution<unsigned> roll(0, 99);
+        trace.steps.reserve(ops);
+        trace.updates = 0;
+        for (std::size_t i = 0; i < ops; ++i)
+        {
+            unsigned r = roll(rng);
+            Op op = r < percent[0] ? Op::find : (r < percent[0] + percent[1] ? Op::insert : Op::erase);
+            if (op != Op::insert && present.empty())
+            {
+                op = Op::insert;
+            }
+
+            Step step = { op, 0 };
+            if (op == Op::insert)
+            {
+                step.key = rng();
+                present.push_back(step.key);
+            }
+            else
+            {
+                std::size_t at = std::uniform_int_distribution<std::size_t>(0, present.size() - 1)(rng);
+                step.key = present[at];
+                if (op == Op::erase)
+                {
+                    present[at] = present.back();
+                    present.pop_back();
+                }
+            }
+            trace.updates += op != Op::find;
+            trace.steps.push_back(step);
+        }
+        return trace;
+    }
+
+    template<class Balance, class Stats>
+    struct BenchPolicy : DefaultTreePolicy
+    {
+        using balance = Balance;
+        using stats = Stats;
+    };
+
+    template<class MapT>
+    double replay(MapT & m, const Trace & trace)
+    {
+        for (std::size_t i = 0; i < trace.fill.size(); ++i)
+        {
+            m.insert(std::make_pair(trace.fill[i], std::uint64_t(i)));
+        }
+        m.reset_stats();
+
+        std::size_t found = 0;
+        bench::Clock::time_point start = bench::Clock::now();
+        for (std::size_t i = 0; i < trace.steps.size(); ++i)
+        {
+            const Step & step = trace.steps[i];
+            if (step.op == Op::find)
+            {
+                found += m.find(step.key) != m.end();
+            }
+            else if (step.op == Op::insert)
+            {
+                m.insert(std::make_pair(step.key, std::uint64_t(i)));
+            }
+            else
+            {
+                m.erase(step.key);
+            }
+        }
+        double ns = bench::elapsed_ns(start, bench::Clock::now());
+        bench::consume(found);
+        return ns;
+    }
+
+    template<class Balance>
+    void run(const std::string & name, std::size_t n, const std::string & mix, const Trace & trace)
+    {
+        double ns;
+        {
+            cs540::Map<std::uint64_t, std::uint64_t, BenchPolicy<Balance, NoStats> > m;
+            ns = replay(m, trace);
+        }
+
+        cs540::Map<std::uint64_t, std::uint64_t, BenchPolicy<Balance, CountingStats> > counted;
+        replay(counted, trace);
+        TreeStats stats = counted.stats();
+        TreeShape shape = counted.shape();
+        double updates = std::max<std::size_t>(trace.updates, 1);
+
+        bench::JsonLine()
+            .field("balance", name)
+            .field("size", n)
+            .field("mix", mix)
+            .field("ns_per_op", ns / std::max<std::size_t>(trace.steps.size(), 1))
+            .field("comparisons_per_op", double(stats.comparisons) / std::max<std::size_t>(trace.steps.size(), 1))
+            .field("rotations_per_update", (stats.singleRotations + stats.doubleRotations) / updates)
+            .field("retrace_steps_per_update", stats.retraceSteps / updates)
+            .field("height", shape.height)
+            .field("avl_bound", shape.avlBound)
+            .field("average_path", shape.averagePathLength)
+            .print();
+    }
+
+    bool parse_mix(const std::string & text, unsigned percent[3])
+    {
+        return std::sscanf(text.c_str(), "%u/%u/%u", &percent[0], &percent[1], &percent[2]) == 3
+            && percent[0] + percent[1] + percent[2] == 100;
+    }
+
+    void usage()
+    {
+        std::fprintf(stderr,
+            "usage: balance_bench [--balances avl,rb,wavl,treap] [--sizes 10K,1M]\n"
+            "                     [--mixes 90/5/5,50/25/25,10/45/45,0/20/80] [--ops N] [--seed N]\n");
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    Options options;
+    options.balances = bench::split_list("avl,rb,wavl,treap");
+    options.sizes.push_back(10000);
+    options.sizes.push_back(1000000);
+    options.mixes = bench::split_list("90/5/5,50/25/25,10/45/45,0/20/80");
+    options.ops = 0;
+    options.seed = 540;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || i + 1 >= argc)
+        {
+            usage();
+            return arg == "--help" ? 0 : 2;
+        }
+        std::string value = argv[++i];
+        if (arg == "--balances")
+        {
+            options.balances = bench::split_list(value);
+        }
+        else if (arg == "--sizes")
+        {
+            options.sizes.clear();
+            std::vector<std::string> items = bench::split_list(value);
+            for (std::size_t s = 0; s < items.size(); ++s)
+            {
+                options.sizes.push_back(bench::parse_size(items[s]));
+            }
+        }
+        else if (arg == "--mixes")
+        {
+            options.mixes = bench::split_list(value);
+        }
+        else if (arg == "--ops")
+        {
+            options.ops = bench::parse_size(value);
+        }
+        else if (arg == "--seed")
+        {
+            options.seed = std::strtoull(value.c_str(), 0, 10);
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    std::mt19937_64 rng(options.seed);
+    for (std::size_t s = 0; s < options.sizes.size(); ++s)
+    {
+        for (std::size_t x = 0; x < options.mixes.size(); ++x)
+        {
+            unsigned percent[3];
+            if (!parse_mix(options.mixes[x], percent))
+            {
+                std::fprintf(stderr, "a mix is finds/inserts/erases adding up to 100, not %s\n", options.mixes[x].c_str());
+                return 2;
+            }
+            std::size_t ops = options.ops != 0 ? options.ops : options.sizes[s];
+            Trace trace = make_trace(options.sizes[s], ops, percent, rng);
+            for (std::size_t b = 0; b < options.balances.size(); ++b)
+            {
+                const std::string & balance = options.balances[b];
+                if (balance == "avl")
+                {
+                    run<AvlBalance>(balance, options.sizes[s], options.mixes[x], trace);
+                }
+                else if (balance == "rb")
+                {
+                    run<RedBlackBalance>(balance, options.sizes[s], options.mixes[x], trace);
+                }
+                else if (balance == "wavl")
+                {
+                    run<WavlBalance>(balance, options.sizes[s], options.mixes[x], trace);
+                }
+                else if (balance == "treap")
+                {
+                    run<TreapBalance>(balance, options.sizes[s], options.mixes[x], trace);
+                }
+                else
+                {
+                    std::fprintf(stderr, "unknown balance %s\n", balance.c_str());
+                    return 2;
+                }
+            }
+        }
+    }
+    return 0;
+}
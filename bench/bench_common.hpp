@@ -0,0 +1,262 @@
+#ifndef BENCH_COMMON_HPP
+#define BENCH_COMMON_HPP
+
+//shared pieces of the benchmark executables: allocation counting, timing,
+//latency percentiles, peak RSS and JSON lines output.
+//Include from exactly one translation unit per executable, it replaces the
+//global operator new and delete.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+namespace bench
+{
+    //allocation counters, live bytes are tracked through a size header.
+    //Atomic because benches with threads allocate from all of them, relaxed
+    //because they are only read once the threads are done.
+    struct AllocCounters
+    {
+        std::atomic<std::uint64_t> allocations;
+        std::atomic<std::uint64_t> frees;
+        std::atomic<std::size_t> liveBytes;
+        std::atomic<std::size_t> peakBytes;
+    };
+
+    inline AllocCounters & alloc_counters()
+    {
+        //zero initialized before anything can allocate
+        static AllocCounters counters;
+        return counters;
+    }
+
+    //the peak is measured from what is live now
+    inline void reset_peak(AllocCounters & c)
+    {
+        c.peakBytes.store(c.liveBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    //start counting from zero
+    inline void reset_alloc_counters()
+    {
+        AllocCounters & c = alloc_counters();
+        c.allocations.store(0, std::memory_order_relaxed);
+        c.frees.store(0, std::memory_order_relaxed);
+        reset_peak(c);
+    }
+
+    //peak resident set size of the whole process in kilobytes
+    inline long peak_rss_kb()
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    typedef std::chrono::steady_clock Clock;
+
+    inline double elapsed_ns(Clock::time_point from, Clock::time_point to)
+    {
+        return std::chrono::duration<double, std::nano>(to - from).count();
+    }
+
+    //latency samples of a single run
+    class Latencies
+    {
+        public:
+            explicit Latencies(std::size_t expected)
+            {
+                samples.reserve(expected);
+            }
+            void add(double ns)
+            {
+                samples.push_back(ns);
+            }
+
+            //nearest rank percentile, p in [0, 1]
+            double percentile(double p)
+            {
+                if (samples.empty())
+                {
+                    return 0;
+                }
+                if (!sorted)
+                {
+                    std::sort(samples.begin(), samples.end());
+                    sorted = true;
+                }
+                std::size_t rank = static_cast<std::size_t>(p * (samples.size() - 1) + 0.5);
+                return samples[rank];
+            }
+        private:
+            std::vector<double> samples;
+            bool sorted = false;
+    };
+
+    //one JSON object per line, fields in the order they were added
+    class JsonLine
+    {
+        public:
+            JsonLine & field(const char * name, const std::string & value)
+            {
+                separator();
+                out << '"' << name << "\":\"" << value << '"';
+                return *this;
+            }
+            JsonLine & field(const char * name, const char * value)
+            {
+                return field(name, std::string(value));
+            }
+            template<class Number>
+            JsonLine & field(const char * name, Number value)
+            {
+                separator();
+                out << '"' << name << "\":" << value;
+                return *this;
+            }
+            void print()
+            {
+                std::printf("{%s}\n", out.str().c_str());
+                std::fflush(stdout);
+            }
+        private:
+            std::ostringstream out;
+            bool first = true;
+
+            void separator()
+            {
+                if (!first)
+                {
+                    out << ',';
+                }
+                first = false;
+            }
+    };
+
+    //split a comma separated command line value
+    inline std::vector<std::string> split_list(const std::string & list)
+    {
+        std::vector<std::string> items;
+        std::string::size_type start = 0;
+        while (start <= list.size())
+        {
+            std::string::size_type comma = list.find(',', start);
+            if (comma == std::string::npos)
+            {
+                comma = list.size();
+            }
+            if (comma > start)
+            {
+                items.push_back(list.substr(start, comma - start));
+            }
+            start = comma + 1;
+        }
+        return items;
+    }
+
+    //sizes accept a K/M suffix, 100M is 100000000
+    inline std::size_t parse_size(const std::string & text)
+    {
+        char * end = 0;
+        double value = std::strtod(text.c_str(), &end);
+        if (*end == 'K' || *end == 'k')
+        {
+            value *= 1e3;
+        }
+        else if (*end == 'M' || *end == 'm')
+        {
+            value *= 1e6;
+        }
+        return static_cast<std::size_t>(value);
+    }
+
+    //keeps results alive so the optimizer cannot drop the work
+    inline void consume(std::size_t value)
+    {
+        static volatile std::size_t sink;
+        sink = sink + value;
+    }
+}
+
+//HELPER FUNCTION: counting replacements of the global allocation functions
+namespace bench
+{
+    namespace detail
+    {
+        //keeps the returned memory aligned for any fundamental type
+        static const std::size_t headerSize = 16;
+
+        inline void * counted_alloc(std::size_t n)
+        {
+            void * raw = std::malloc(n + headerSize);
+            if (raw == 0)
+            {
+                throw std::bad_alloc();
+            }
+            *static_cast<std::size_t *>(raw) = n;
+            AllocCounters & c = alloc_counters();
+            c.allocations.fetch_add(1, std::memory_order_relaxed);
+            std::size_t live = c.liveBytes.fetch_add(n, std::memory_order_relaxed) + n;
+            std::size_t peak = c.peakBytes.load(std::memory_order_relaxed);
+            while (peak < live && !c.peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+            {
+            }
+            return static_cast<char *>(raw) + headerSize;
+        }
+
+        //kept out of line: once inlined into a caller GCC sees free() on a
+        //pointer from operator new and warns about the mismatch
+#if defined(__GNUC__)
+        __attribute__((noinline))
+#endif
+        inline void counted_free(void * p)
+        {
+            if (p == 0)
+            {
+                return;
+            }
+            void * raw = static_cast<char *>(p) - headerSize;
+            AllocCounters & c = alloc_counters();
+            c.frees.fetch_add(1, std::memory_order_relaxed);
+            c.liveBytes.fetch_sub(*static_cast<std::size_t *>(raw), std::memory_order_relaxed);
+            std::free(raw);
+        }
+    }
+}
+
+void * operator new(std::size_t n)
+{
+    return bench::detail::counted_alloc(n);
+}
+void * operator new[](std::size_t n)
+{
+    return bench::detail::counted_alloc(n);
+}
+void operator delete(void * p) noexcept
+{
+    bench::detail::counted_free(p);
+}
+void operator delete[](void * p) noexcept
+{
+    bench::detail::counted_free(p);
+}
+void operator delete(void * p, std::size_t) noexcept
+{
+    bench::detail::counted_free(p);
+}
+void operator delete[](void * p, std::size_t) noexcept
+{
+    bench::detail::counted_free(p);
+}
+
+#endif
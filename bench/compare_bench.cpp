@@ -0,0 +1,208 @@
+//counts key comparisons of cs540::Map and std::map on long string keys and
+//prints one JSON line per (map, key, size, workload) to stdout.
+//
+//  compare_bench [--sizes 1K,10K,100K,1M] [--prefix N] [--repeat N] [--seed N]
+//
+//Keys share a prefix of --prefix characters, so every comparison has to walk
+//past it. The less_only key only has operator<, the descent falls back to
+//two calls per level. The three_way key also has compare(), which the
+//descent uses once per level. Every call of either counts as a comparison.
+
+#include "Map.hpp"
+#include "bench_common.hpp"
+
+#include <map>
+#include <random>
+
+namespace
+{
+    std::uint64_t comparisons = 0;
+
+    //string key that only orders with operator<
+    struct LessOnlyKey
+    {
+        std::string text;
+
+        bool operator<(const LessOnlyKey & other) const
+        {
+            ++comparisons;
+            return text < other.text;
+        }
+    };
+
+    //string key that also has a three-way compare()
+    struct ThreeWayKey
+    {
+        std::string text;
+
+        bool operator<(const ThreeWayKey & other) const
+        {
+            ++comparisons;
+            return text < other.text;
+        }
+        int compare(const ThreeWayKey & other) const
+        {
+            ++comparisons;
+            return text.compare(other.text);
+        }
+    };
+
+    struct Options
+    {
+        std::vector<std::size_t> sizes;
+        std::size_t prefix;
+        std::size_t repeat;
+        unsigned long long seed;
+    };
+
+    //present keys are the even numbers, missing keys the odd ones
+    template<class K>
+    K make_key(std::size_t i, std::size_t prefix)
+    {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%012llu", static_cast<unsigned long long>(i));
+        K key;
+        key.text = std::string(prefix, 'k') + buffer;
+        return key;
+    }
+
+    //comparisons and time of one workload, averaged over the repetitions
+    struct Result
+    {
+        std::uint64_t comparisons;
+        std::size_t ops;
+        double ns;
+    };
+
+    template<class MapT, class K>
+    Result run_workload(const std::string & workload, const std::vector<K> & keys, const std::vector<K> & lookups, const Options & options)
+    {
+        Result result = { 0, 0, 0 };
+        for (std::size_t r = 0; r < options.repeat; ++r)
+        {
+            MapT map;
+            const std::vector<K> & timed = workload == "insert" ? keys : lookups;
+            if (workload != "insert")
+            {
+                for (std::size_t i = 0; i < keys.size(); ++i)
+                {
+                    map.insert(std::make_pair(keys[i], 0));
+                }
+            }
+
+            std::size_t found = 0;
+            comparisons = 0;
+            bench::Clock::time_point start = bench::Clock::now();
+            for (std::size_t i = 0; i < timed.size(); ++i)
+            {
+                if (workload == "insert")
+                {
+                    map.insert(std::make_pair(timed[i], 0));
+                }
+                else
+                {
+                    found += map.find(timed[i]) != map.end();
+                }
+            }
+            result.ns += bench::elapsed_ns(start, bench::Clock::now());
+            result.comparisons += comparisons;
+            result.ops += timed.size();
+            bench::consume(found + map.size());
+        }
+        return result;
+    }
+
+    template<class MapT, class K>
+    void run_map(const std::string & mapName, const std::string & keyName, std::size_t n, const Options & options, std::mt19937_64 & rng)
+    {
+        std::vector<K> keys, hits, misses;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            keys.push_back(make_key<K>(2 * i, options.prefix));
+            misses.push_back(make_key<K>(2 * i + 1, options.prefix));
+        }
+        std::shuffle(keys.begin(), keys.end(), rng);
+        hits = keys;
+        std::shuffle(hits.begin(), hits.end(), rng);
+        std::shuffle(misses.begin(), misses.end(), rng);
+
+        const char * workloads[] = { "insert", "find_hit", "find_miss" };
+        for (std::size_t w = 0; w < 3; ++w)
+        {
+            std::string workload = workloads[w];
+            Result result = run_workload<MapT>(workload, keys, workload == "find_miss" ? misses : hits, options);
+            bench::JsonLine()
+                .field("map", mapName)
+                .field("key", keyName)
+                .field("workload", workload)
+                .field("size", n)
+                .field("ops", result.ops)
+                .field("comparisons_per_op", result.ops > 0 ? double(result.comparisons) / result.ops : 0)
+                .field("ns_per_op", result.ops > 0 ? result.ns / result.ops : 0)
+                .print();
+        }
+    }
+
+    void usage()
+    {
+        std::fprintf(stderr, "usage: compare_bench [--sizes 1K,10K,100K,1M] [--prefix N] [--repeat N] [--seed N]\n");
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    Options options;
+    options.sizes.push_back(1000);
+    options.sizes.push_back(10000);
+    options.sizes.push_back(100000);
+    options.prefix = 32;
+    options.repeat = 3;
+    options.seed = 540;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || i + 1 >= argc)
+        {
+            usage();
+            return arg == "--help" ? 0 : 2;
+        }
+        std::string value = argv[++i];
+        if (arg == "--sizes")
+        {
+            options.sizes.clear();
+            std::vector<std::string> sizes = bench::split_list(value);
+            for (std::size_t s = 0; s < sizes.size(); ++s)
+            {
+                options.sizes.push_back(bench::parse_size(sizes[s]));
+            }
+        }
+        else if (arg == "--prefix")
+        {
+            options.prefix = bench::parse_size(value);
+        }
+        else if (arg == "--repeat")
+        {
+            options.repeat = bench::parse_size(value);
+        }
+        else if (arg == "--seed")
+        {
+            options.seed = std::strtoull(value.c_str(), 0, 10);
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    std::mt19937_64 rng(options.seed);
+    for (std::size_t s = 0; s < options.sizes.size(); ++s)
+    {
+        std::size_t n = options.sizes[s];
+        run_map<cs540::Map<LessOnlyKey, int>, LessOnlyKey>("cs540", "less_only", n, options, rng);
+        run_map<cs540::Map<ThreeWayKey, int>, ThreeWayKey>("cs540", "three_way", n, options, rng);
+        run_map<std::map<LessOnlyKey, int>, LessOnlyKey>("std", "less_only", n, options, rng);
+    }
+    return 0;
+}
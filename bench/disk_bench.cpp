@@ -0,0 +1,148 @@
+//random lookups in a cs540::DiskMap under shrinking cache budgets, prints
+//one JSON line per (size, cache, workload) to stdout.
+//
+//  disk_bench [--sizes 1M,4M] [--caches 1M,16M,256M] [--lookups N] [--file PATH] [--seed N]
+//
+//The map is built once per size in --file, which is removed afterwards.
+//Each cache budget then runs uniform lookups over every key and lookups
+//over a hot tenth of them, so the working set is first larger and then
+//smaller than the budget. Misses count windows the cache did not hold.
+
+#include "Map.hpp"
+#include "bench_common.hpp"
+
+#include <random>
+
+namespace
+{
+    struct Options
+    {
+        std::vector<std::size_t> sizes;
+        std::vector<std::size_t> caches;
+        std::size_t lookups;
+        std::string file;
+        unsigned long long seed;
+    };
+
+    typedef cs540::DiskMap<std::uint64_t, std::uint64_t> Disk;
+
+    void run_size(std::size_t n, const Options & options, std::mt19937_64 & rng)
+    {
+        std::remove(options.file.c_str());
+        std::vector<std::uint64_t> keys(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            keys[i] = rng();
+        }
+
+        {
+            Disk map(options.file);
+            bench::Clock::time_point start = bench::Clock::now();
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                map.insert(std::make_pair(keys[i], std::uint64_t(i)));
+            }
+            map.flush();
+            double ns = bench::elapsed_ns(start, bench::Clock::now());
+            bench::JsonLine()
+                .field("size", n)
+                .field("cache_bytes", map.cache_stats().budgetBytes)
+                .field("workload", "build")
+                .field("ns_per_op", ns / n)
+                .print();
+        }
+
+        for (std::size_t c = 0; c < options.caches.size(); ++c)
+        {
+            Disk map(options.file, options.caches[c]);
+            const char * workloads[] = { "uniform", "hot_tenth" };
+            for (std::size_t w = 0; w < 2; ++w)
+            {
+                std::size_t range = w == 0 ? n : std::max<std::size_t>(n / 10, 1);
+                std::uniform_int_distribution<std::size_t> pick(0, range - 1);
+                cs540::DiskCacheStats before = map.cache_stats();
+                std::size_t found = 0;
+                bench::Clock::time_point start = bench::Clock::now();
+                for (std::size_t i = 0; i < options.lookups; ++i)
+                {
+                    found += map.find(keys[pick(rng)]) != map.end();
+                }
+                double ns = bench::elapsed_ns(start, bench::Clock::now());
+                cs540::DiskCacheStats after = map.cache_stats();
+                bench::consume(found);
+                bench::JsonLine()
+                    .field("size", n)
+                    .field("cache_bytes", after.budgetBytes)
+                    .field("workload", workloads[w])
+                    .field("ns_per_op", ns / options.lookups)
+                    .field("misses_per_op", double(after.misses - before.misses) / options.lookups)
+                    .field("evictions", after.evictions - before.evictions)
+                    .field("peak_rss_kb", bench::peak_rss_kb())
+                    .print();
+            }
+        }
+        std::remove(options.file.c_str());
+    }
+
+    void usage()
+    {
+        std::fprintf(stderr, "usage: disk_bench [--sizes 1M,4M] [--caches 1M,16M,256M] [--lookups N] [--file PATH] [--seed N]\n");
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    Options options;
+    options.sizes.push_back(1000000);
+    options.caches.push_back(1000000);
+    options.caches.push_back(16000000);
+    options.caches.push_back(256000000);
+    options.lookups = 1000000;
+    options.file = "disk_bench.map";
+    options.seed = 540;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || i + 1 >= argc)
+        {
+            usage();
+            return arg == "--help" ? 0 : 2;
+        }
+        std::string value = argv[++i];
+        if (arg == "--sizes" || arg == "--caches")
+        {
+            std::vector<std::size_t> & list = arg == "--sizes" ? options.sizes : options.caches;
+            list.clear();
+            std::vector<std::string> items = bench::split_list(value);
+            for (std::size_t s = 0; s < items.size(); ++s)
+            {
+                list.push_back(bench::parse_size(items[s]));
+            }
+        }
+        else if (arg == "--lookups")
+        {
+            options.lookups = bench::parse_size(value);
+        }
+        else if (arg == "--file")
+        {
+            options.file = value;
+        }
+        else if (arg == "--seed")
+        {
+            options.seed = std::strtoull(value.c_str(), 0, 10);
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    std::mt19937_64 rng(options.seed);
+    for (std::size_t s = 0; s < options.sizes.size(); ++s)
+    {
+        run_size(options.sizes[s], options, rng);
+    }
+    return 0;
+}
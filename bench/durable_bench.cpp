@@ -0,0 +1,130 @@
+//durable write throughput of cs540::DurableMap for several group commit
+//windows and writer counts, prints one JSON line per (threads, window).
+//
+//  durable_bench [--threads 1,4,16] [--windows 0,100,1000] [--writes N] [--path PATH]
+//
+//Windows are in microseconds. Every writer assigns its own keys and waits
+//for each write to be on disk, so throughput is bounded by the syncs and
+//records_per_commit shows how many writes shared one. The journal and
+//snapshot at --path are removed before and after each run.
+
+#include "Map.hpp"
+#include "bench_common.hpp"
+
+#include <thread>
+
+namespace
+{
+    struct Options
+    {
+        std::vector<std::size_t> threads;
+        std::vector<std::size_t> windows;
+        std::size_t writes;
+        std::string path;
+    };
+
+    typedef cs540::DurableMap<std::uint64_t, std::uint64_t> Durable;
+
+    void remove_files(const std::string & path)
+    {
+        std::remove((path + ".snap").c_str());
+        std::remove((path + ".log").c_str());
+    }
+
+    void run(std::size_t threads, std::size_t window, const Options & options)
+    {
+        remove_files(options.path);
+        {
+            Durable map(options.path, std::chrono::microseconds(window), 0);
+            std::size_t perThread = std::max<std::size_t>(options.writes / threads, 1);
+            std::vector<std::thread> writers;
+            bench::Clock::time_point start = bench::Clock::now();
+            for (std::size_t t = 0; t < threads; ++t)
+            {
+                writers.push_back(std::thread([&map, t, perThread] {
+                    for (std::size_t i = 0; i < perThread; ++i)
+                    {
+                        map.assign(t * perThread + i, i);
+                    }
+                }));
+            }
+            for (std::size_t t = 0; t < writers.size(); ++t)
+            {
+                writers[t].join();
+            }
+            double ns = bench::elapsed_ns(start, bench::Clock::now());
+
+            cs540::DurableStats stats = map.stats();
+            bench::JsonLine()
+                .field("threads", threads)
+                .field("window_us", window)
+                .field("writes", stats.records)
+                .field("commits", stats.commits)
+                .field("records_per_commit", stats.commits > 0 ? double(stats.records) / stats.commits : 0)
+                .field("writes_per_sec", stats.records / (ns / 1e9))
+                .print();
+        }
+        remove_files(options.path);
+    }
+
+    void usage()
+    {
+        std::fprintf(stderr, "usage: durable_bench [--threads 1,4,16] [--windows 0,100,1000] [--writes N] [--path PATH]\n");
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    Options options;
+    options.threads.push_back(1);
+    options.threads.push_back(4);
+    options.threads.push_back(16);
+    options.windows.push_back(0);
+    options.windows.push_back(100);
+    options.windows.push_back(1000);
+    options.writes = 4000;
+    options.path = "durable_bench";
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || i + 1 >= argc)
+        {
+            usage();
+            return arg == "--help" ? 0 : 2;
+        }
+        std::string value = argv[++i];
+        if (arg == "--threads" || arg == "--windows")
+        {
+            std::vector<std::size_t> & list = arg == "--threads" ? options.threads : options.windows;
+            list.clear();
+            std::vector<std::string> items = bench::split_list(value);
+            for (std::size_t s = 0; s < items.size(); ++s)
+            {
+                list.push_back(bench::parse_size(items[s]));
+            }
+        }
+        else if (arg == "--writes")
+        {
+            options.writes = bench::parse_size(value);
+        }
+        else if (arg == "--path")
+        {
+            options.path = value;
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    for (std::size_t t = 0; t < options.threads.size(); ++t)
+    {
+        for (std::size_t w = 0; w < options.windows.size(); ++w)
+        {
+            run(options.threads[t], options.windows[w], options);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,180 @@
+//hit rate and speed of cs540::LruMap as a cache on a Zipfian trace next to
+//an unbounded cs540::Map, prints one JSON line per (skew, map, capacity).
+//
+//  lru_bench [--keys 1M] [--skews 0.8,0.99,1.2] [--capacities 1K,10K,100K]
+//            [--ops 2M] [--seed N]
+//
+//Key ranks are drawn with probability proportional to 1 / rank^skew and
+//spread over the key space. Every lookup that misses stands for a fetch
+//from the backend and puts the key in the cache. The unbounded map keeps
+//everything, its misses are the first use of each key and its memory is
+//what a cache without eviction grows to.
+
+#include "Map.hpp"
+#include "bench_common.hpp"
+
+#include <cmath>
+#include <random>
+
+namespace
+{
+    struct Options
+    {
+        std::size_t keys;
+        std::vector<std::string> skews;
+        std::vector<std::size_t> capacities;
+        std::size_t ops;
+        unsigned long long seed;
+    };
+
+    //rank to key, hot keys should not all sit in one corner of the tree
+    std::uint64_t spread(std::uint64_t rank)
+    {
+        std::uint64_t z = rank + 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    std::vector<std::uint64_t> make_trace(std::size_t keys, double skew, std::size_t ops, std::mt19937_64 & rng)
+    {
+        std::vector<double> cdf(keys);
+        double sum = 0;
+        for (std::size_t r = 0; r < keys; ++r)
+        {
+            sum += 1 / std::pow(double(r + 1), skew);
+            cdf[r] = sum;
+        }
+
+        std::uniform_real_distribution<double> uniform(0, sum);
+        std::vector<std::uint64_t> trace(ops);
+        for (std::size_t i = 0; i < ops; ++i)
+        {
+            std::size_t rank = std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+            trace[i] = spread(std::min(rank, keys - 1));
+        }
+        return trace;
+    }
+
+    void print(const std::string & skew, const char * map, std::size_t capacity, std::size_t hits,
+        std::size_t ops, double ns, std::size_t entries, std::size_t bytes)
+    {
+        bench::JsonLine()
+            .field("skew", skew)
+            .field("map", map)
+            .field("capacity", capacity)
+            .field("hit_rate", double(hits) / std::max<std::size_t>(ops, 1))
+            .field("ns_per_op", ns / std::max<std::size_t>(ops, 1))
+            .field("entries", entries)
+            .field("memory_bytes", bytes)
+            .print();
+    }
+
+    void run_lru(const std::string & skew, std::size_t capacity, const std::vector<std::uint64_t> & trace)
+    {
+        cs540::LruMap<std::uint64_t, std::uint64_t> cache(capacity);
+        bench::Clock::time_point start = bench::Clock::now();
+        for (std::size_t i = 0; i < trace.size(); ++i)
+        {
+            if (cache.find(trace[i]) == 0)
+            {
+                cache.assign(trace[i], i);
+            }
+        }
+        double ns = bench::elapsed_ns(start, bench::Clock::now());
+        print(skew, "lru", capacity, cache.stats().hits, trace.size(), ns, cache.size(),
+            cache.map().memory_usage().totalBytes);
+    }
+
+    void run_unbounded(const std::string & skew, const std::vector<std::uint64_t> & trace)
+    {
+        cs540::Map<std::uint64_t, std::uint64_t> cache;
+        std::size_t hits = 0;
+        bench::Clock::time_point start = bench::Clock::now();
+        for (std::size_t i = 0; i < trace.size(); ++i)
+        {
+            if (cache.find(trace[i]) != cache.end())
+            {
+                ++hits;
+            }
+            else
+            {
+                cache.insert(std::make_pair(trace[i], std::uint64_t(i)));
+            }
+        }
+        double ns = bench::elapsed_ns(start, bench::Clock::now());
+        print(skew, "unbounded", 0, hits, trace.size(), ns, cache.size(), cache.memory_usage().totalBytes);
+    }
+
+    void usage()
+    {
+        std::fprintf(stderr,
+            "usage: lru_bench [--keys 1M] [--skews 0.8,0.99,1.2] [--capacities 1K,10K,100K]\n"
+            "                 [--ops 2M] [--seed N]\n");
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    Options options;
+    options.keys = 1000000;
+    options.skews = bench::split_list("0.8,0.99,1.2");
+    options.capacities.push_back(1000);
+    options.capacities.push_back(10000);
+    options.capacities.push_back(100000);
+    options.ops = 2000000;
+    options.seed = 540;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || i + 1 >= argc)
+        {
+            usage();
+            return arg == "--help" ? 0 : 2;
+        }
+        std::string value = argv[++i];
+        if (arg == "--keys")
+        {
+            options.keys = std::max<std::size_t>(bench::parse_size(value), 1);
+        }
+        else if (arg == "--skews")
+        {
+            options.skews = bench::split_list(value);
+        }
+        else if (arg == "--capacities")
+        {
+            options.capacities.clear();
+            std::vector<std::string> items = bench::split_list(value);
+            for (std::size_t s = 0; s < items.size(); ++s)
+            {
+                options.capacities.push_back(bench::parse_size(items[s]));
+            }
+        }
+        else if (arg == "--ops")
+        {
+            options.ops = bench::parse_size(value);
+        }
+        else if (arg == "--seed")
+        {
+            options.seed = std::strtoull(value.c_str(), 0, 10);
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    std::mt19937_64 rng(options.seed);
+    for (std::size_t s = 0; s < options.skews.size(); ++s)
+    {
+        std::vector<std::uint64_t> trace = make_trace(options.keys, std::atof(options.skews[s].c_str()), options.ops, rng);
+        run_unbounded(options.skews[s], trace);
+        for (std::size_t c = 0; c < options.capacities.size(); ++c)
+        {
+            run_lru(options.skews[s], options.capacities[c], trace);
+        }
+    }
+    return 0;
+}
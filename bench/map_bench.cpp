@@ -0,0 +1,527 @@
+//runs cs540::Map and std::map through the same workloads and prints one
+//JSON line per (map, type, size, workload) to stdout.
+//
+//  map_bench [--maps cs540,cs540_index,cs540_unthreaded,cs540_buffered,cs540_lazy,
+//                     cs540_cached,cs540_hashed,std]
+//            [--types int,string,large] [--sizes 1K,10K,100K,1M]
+//            [--workloads insert_random,...] [--repeat N] [--seed N]
+//            [--max-samples N]
+//
+//Per operation latencies are sampled (at most --max-samples per run) so the
+//clock does not dominate small operations. Iterate, copy and clear are bulk
+//workloads, their latency is the time of one repetition divided by the size.
+//peak_heap_bytes is the heap growth during the timed part, peak_rss_kb is the
+//process wide peak so far.
+
+#include "Map.hpp"
+#include "bench_common.hpp"
+
+#include <map>
+#include <random>
+
+namespace
+{
+    //value types
+    struct LargeValue
+    {
+        std::uint64_t words[32];
+    };
+
+    template<class T> struct ValueTraits;
+
+    template<> struct ValueTraits<int>
+    {
+        static int make(std::size_t i) { return static_cast<int>(i); }
+        static void touch(int & value) { ++value; }
+        static std::size_t digest(const int & value) { return static_cast<std::size_t>(value); }
+    };
+
+    template<> struct ValueTraits<LargeValue>
+    {
+        static LargeValue make(std::size_t i)
+        {
+            LargeValue value;
+            for (std::size_t w = 0; w < 32; ++w)
+            {
+                value.words[w] = i + w;
+            }
+            return value;
+        }
+        static void touch(LargeValue & value) { ++value.words[0]; }
+        static std::size_t digest(const LargeValue & value) { return value.words[0]; }
+    };
+
+    //keys, increasing in i so sorted input is just i = 0, 1, 2, ...
+    template<class K> struct KeyTraits;
+
+    template<> struct KeyTraits<int>
+    {
+        static int make(std::size_t i) { return static_cast<int>(i); }
+        static std::size_t digest(int key) { return static_cast<std::size_t>(key); }
+    };
+
+    //long enough to live on the heap instead of in the small string buffer
+    template<> struct KeyTraits<std::string>
+    {
+        static std::string make(std::size_t i)
+        {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "user:%012llu", static_cast<unsigned long long>(i));
+            return buffer;
+        }
+        static std::size_t digest(const std::string & key) { return key.size(); }
+    };
+
+    //inputs shared by every map of a (type, size) pair. Present keys are the
+    //even numbers, missing keys the odd ones.
+    template<class K>
+    struct Dataset
+    {
+        std::vector<K> sorted;
+        std::vector<K> random;
+        std::vector<K> lookups;
+        std::vector<K> misses;
+
+        Dataset(std::size_t n, std::mt19937_64 & rng)
+        {
+            sorted.reserve(n);
+            misses.reserve(n);
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                sorted.push_back(KeyTraits<K>::make(2 * i));
+                misses.push_back(KeyTraits<K>::make(2 * i + 1));
+            }
+            random = sorted;
+            std::shuffle(random.begin(), random.end(), rng);
+            lookups = sorted;
+            std::shuffle(lookups.begin(), lookups.end(), rng);
+            std::shuffle(misses.begin(), misses.end(), rng);
+        }
+    };
+
+    struct Options
+    {
+        std::vector<std::string> maps;
+        std::vector<std::string> types;
+        std::vector<std::string> workloads;
+        std::vector<std::size_t> sizes;
+        std::size_t repeat;
+        std::size_t maxSamples;
+        unsigned long long seed;
+    };
+
+    //measurement of one run
+    struct Result
+    {
+        std::size_t ops;
+        double ns;
+        bench::Latencies latencies;
+        std::uint64_t allocations;
+        std::uint64_t frees;
+        std::size_t peakHeap;
+
+        explicit Result(std::size_t expected)
+            : ops(0), ns(0), latencies(expected), allocations(0), frees(0), peakHeap(0)
+        {
+        }
+    };
+
+    //times a section and the allocations it makes
+    class Section
+    {
+        public:
+            explicit Section(Result & r)
+                : result(r)
+            {
+                bench::AllocCounters & c = bench::alloc_counters();
+                allocations = c.allocations.load(std::memory_order_relaxed);
+                frees = c.frees.load(std::memory_order_relaxed);
+                baseBytes = c.liveBytes.load(std::memory_order_relaxed);
+                bench::reset_peak(c);
+                start = bench::Clock::now();
+            }
+            ~Section()
+            {
+                bench::Clock::time_point stop = bench::Clock::now();
+                bench::AllocCounters & c = bench::alloc_counters();
+                result.ns += bench::elapsed_ns(start, stop);
+                result.allocations += c.allocations.load(std::memory_order_relaxed) - allocations;
+                result.frees += c.frees.load(std::memory_order_relaxed) - frees;
+                result.peakHeap = std::max(result.peakHeap, c.peakBytes.load(std::memory_order_relaxed) - baseBytes);
+            }
+        private:
+            Result & result;
+            bench::Clock::time_point start;
+            std::uint64_t allocations;
+            std::uint64_t frees;
+            std::size_t baseBytes;
+    };
+
+    //runs op(i) for every i, timing every stride-th call on its own
+    template<class Op>
+    void per_op(Result & result, std::size_t n, std::size_t maxSamples, Op op)
+    {
+        std::size_t stride = std::max<std::size_t>(1, n / std::max<std::size_t>(1, maxSamples));
+        Section section(result);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            if (i % stride == 0)
+            {
+                bench::Clock::time_point before = bench::Clock::now();
+                op(i);
+                result.latencies.add(bench::elapsed_ns(before, bench::Clock::now()));
+            }
+            else
+            {
+                op(i);
+            }
+        }
+        result.ops += n;
+    }
+
+    //times one whole pass over n elements and records it per element
+    template<class Op>
+    void bulk_op(Result & result, std::size_t n, Op op)
+    {
+        double before = result.ns;
+        {
+            Section section(result);
+            op();
+        }
+        result.latencies.add((result.ns - before) / std::max<std::size_t>(1, n));
+        result.ops += n;
+    }
+
+    //writes a map still holds back are part of the timed work
+    template<class MapT>
+    void settle(Result &, MapT &)
+    {
+        //Empty
+    }
+    template<class K, class V>
+    void settle(Result & result, cs540::BufferedMap<K, V> & m)
+    {
+        Section section(result);
+        m.flush();
+    }
+
+    template<class MapT, class K>
+    void fill(MapT & m, const std::vector<K> & keys)
+    {
+        typedef typename MapT::mapped_type V;
+        for (std::size_t i = 0; i < keys.size(); ++i)
+        {
+            m.insert(typename MapT::value_type(keys[i], ValueTraits<V>::make(i)));
+        }
+    }
+
+    template<class MapT, class K>
+    bool run_workload(const std::string & workload, const Dataset<K> & data, const Options & options, Result & result)
+    {
+        typedef typename MapT::mapped_type V;
+        typedef typename MapT::value_type Pair;
+        const std::size_t n = data.sorted.size();
+
+        if (workload == "insert_random" || workload == "insert_sequential")
+        {
+            const std::vector<K> & keys = workload == "insert_random" ? data.random : data.sorted;
+            MapT m;
+            per_op(result, n, options.maxSamples, [&](std::size_t i)
+            {
+                m.insert(Pair(keys[i], ValueTraits<V>::make(i)));
+            });
+            settle(result, m);
+            bench::consume(m.size());
+        }
+        else if (workload == "find_hit" || workload == "find_miss")
+        {
+            const std::vector<K> & keys = workload == "find_hit" ? data.lookups : data.misses;
+            MapT m;
+            fill(m, data.random);
+            std::size_t found = 0;
+            per_op(result, n, options.maxSamples, [&](std::size_t i)
+            {
+                found += m.find(keys[i]) != m.end();
+            });
+            bench::consume(found);
+        }
+        else if (workload == "subscript")
+        {
+            //half of the keys exist, the other half get inserted
+            MapT m;
+            fill(m, data.random);
+            per_op(result, n, options.maxSamples, [&](std::size_t i)
+            {
+                ValueTraits<V>::touch(m[i % 2 == 0 ? data.lookups[i] : data.misses[i]]);
+            });
+            bench::consume(m.size());
+        }
+        else if (workload == "erase")
+        {
+            MapT m;
+            fill(m, data.random);
+            per_op(result, n, options.maxSamples, [&](std::size_t i)
+            {
+                m.erase(data.lookups[i]);
+            });
+            settle(result, m);
+            bench::consume(m.size());
+        }
+        else if (workload == "iterate")
+        {
+            MapT m;
+            fill(m, data.random);
+            for (std::size_t r = 0; r < options.repeat; ++r)
+            {
+                std::size_t sum = 0;
+                bulk_op(result, n, [&]()
+                {
+                    for (typename MapT::const_iterator it = m.begin(); it != m.end(); ++it)
+                    {
+                        sum += KeyTraits<K>::digest(it->first) + ValueTraits<V>::digest(it->second);
+                    }
+                });
+                bench::consume(sum);
+            }
+        }
+        else if (workload == "copy")
+        {
+            MapT m;
+            fill(m, data.random);
+            for (std::size_t r = 0; r < options.repeat; ++r)
+            {
+                MapT * copy = 0;
+                bulk_op(result, n, [&]()
+                {
+                    copy = new MapT(m);
+                });
+                bench::consume(copy->size());
+                delete copy;
+            }
+        }
+        else if (workload == "clear")
+        {
+            for (std::size_t r = 0; r < options.repeat; ++r)
+            {
+                MapT m;
+                fill(m, data.random);
+                bulk_op(result, n, [&]()
+                {
+                    m.clear();
+                });
+                bench::consume(m.size());
+            }
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    template<class MapT, class K>
+    void run_map(const std::string & mapName, const std::string & typeName, const Dataset<K> & data, const Options & options)
+    {
+        for (std::size_t w = 0; w < options.workloads.size(); ++w)
+        {
+            Result result(options.maxSamples);
+            if (!run_workload<MapT>(options.workloads[w], data, options, result))
+            {
+                std::fprintf(stderr, "unknown workload %s\n", options.workloads[w].c_str());
+                std::exit(2);
+            }
+
+            double seconds = result.ns / 1e9;
+            bench::JsonLine()
+                .field("map", mapName)
+                .field("type", typeName)
+                .field("workload", options.workloads[w])
+                .field("size", data.sorted.size())
+                .field("ops", result.ops)
+                .field("seconds", seconds)
+                .field("ops_per_sec", seconds > 0 ? result.ops / seconds : 0)
+                .field("p50_ns", result.latencies.percentile(0.50))
+                .field("p99_ns", result.latencies.percentile(0.99))
+                .field("p999_ns", result.latencies.percentile(0.999))
+                .field("allocations", result.allocations)
+                .field("frees", result.frees)
+                .field("peak_heap_bytes", result.peakHeap)
+                .field("peak_rss_kb", bench::peak_rss_kb())
+                .print();
+        }
+    }
+
+    struct IndexPolicy : DefaultTreePolicy
+    {
+        using storage = IndexStorage;
+    };
+
+    struct UnthreadedPolicy : DefaultTreePolicy
+    {
+        static constexpr bool threaded = false;
+    };
+
+    struct LazyPolicy : DefaultTreePolicy
+    {
+        static constexpr double lazy_erase_ratio = 0.25;
+    };
+
+    struct CachedPolicy : DefaultTreePolicy
+    {
+        static constexpr std::size_t lookup_cache_sets = 4096;
+    };
+
+    struct HashedPolicy : DefaultTreePolicy
+    {
+        static constexpr bool hash_index = true;
+    };
+
+    template<class K, class V>
+    void run_type(const std::string & typeName, std::size_t n, const Options & options, std::mt19937_64 & rng)
+    {
+        Dataset<K> data(n, rng);
+        for (std::size_t m = 0; m < options.maps.size(); ++m)
+        {
+            const std::string & map = options.maps[m];
+            if (map == "cs540")
+            {
+                run_map<cs540::Map<K, V> >(map, typeName, data, options);
+            }
+            else if (map == "cs540_index")
+            {
+                run_map<cs540::Map<K, V, IndexPolicy> >(map, typeName, data, options);
+            }
+            else if (map == "cs540_unthreaded")
+            {
+                run_map<cs540::Map<K, V, UnthreadedPolicy> >(map, typeName, data, options);
+            }
+            else if (map == "cs540_buffered")
+            {
+                run_map<cs540::BufferedMap<K, V> >(map, typeName, data, options);
+            }
+            else if (map == "cs540_lazy")
+            {
+                run_map<cs540::Map<K, V, LazyPolicy> >(map, typeName, data, options);
+            }
+            else if (map == "cs540_cached")
+            {
+                run_map<cs540::Map<K, V, CachedPolicy> >(map, typeName, data, options);
+            }
+            else if (map == "cs540_hashed")
+            {
+                run_map<cs540::Map<K, V, HashedPolicy> >(map, typeName, data, options);
+            }
+            else if (map == "std")
+            {
+                run_map<std::map<K, V> >(map, typeName, data, options);
+            }
+            else
+            {
+                std::fprintf(stderr, "unknown map %s\n", map.c_str());
+                std::exit(2);
+            }
+        }
+    }
+
+    void usage()
+    {
+        std::fprintf(stderr,
+            "usage: map_bench [--maps cs540,cs540_index,cs540_unthreaded,cs540_buffered,\n"
+            "                         cs540_lazy,cs540_cached,cs540_hashed,std]\n"
+            "                 [--types int,string,large] [--sizes 1K,10K,100K,1M]\n"
+            "                 [--workloads insert_random,insert_sequential,find_hit,\n"
+            "                              find_miss,subscript,erase,iterate,copy,clear]\n"
+            "                 [--repeat N] [--seed N] [--max-samples N]\n");
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    Options options;
+    options.maps = bench::split_list("cs540,std");
+    options.types = bench::split_list("int,string,large");
+    options.workloads = bench::split_list("insert_random,insert_sequential,find_hit,find_miss,subscript,erase,iterate,copy,clear");
+    options.sizes.push_back(1000);
+    options.sizes.push_back(10000);
+    options.sizes.push_back(100000);
+    options.sizes.push_back(1000000);
+    options.repeat = 5;
+    options.maxSamples = 100000;
+    options.seed = 540;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || i + 1 >= argc)
+        {
+            usage();
+            return arg == "--help" ? 0 : 2;
+        }
+        std::string value = argv[++i];
+        if (arg == "--maps")
+        {
+            options.maps = bench::split_list(value);
+        }
+        else if (arg == "--types")
+        {
+            options.types = bench::split_list(value);
+        }
+        else if (arg == "--workloads")
+        {
+            options.workloads = bench::split_list(value);
+        }
+        else if (arg == "--sizes")
+        {
+            std::vector<std::string> sizes = bench::split_list(value);
+            options.sizes.clear();
+            for (std::size_t s = 0; s < sizes.size(); ++s)
+            {
+                options.sizes.push_back(bench::parse_size(sizes[s]));
+            }
+        }
+        else if (arg == "--repeat")
+        {
+            options.repeat = std::max<std::size_t>(1, bench::parse_size(value));
+        }
+        else if (arg == "--max-samples")
+        {
+            options.maxSamples = std::max<std::size_t>(1, bench::parse_size(value));
+        }
+        else if (arg == "--seed")
+        {
+            options.seed = std::strtoull(value.c_str(), 0, 10);
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    std::mt19937_64 rng(options.seed);
+    for (std::size_t t = 0; t < options.types.size(); ++t)
+    {
+        for (std::size_t s = 0; s < options.sizes.size(); ++s)
+        {
+            const std::string & type = options.types[t];
+            if (type == "int")
+            {
+                run_type<int, int>(type, options.sizes[s], options, rng);
+            }
+            else if (type == "string")
+            {
+                run_type<std::string, int>(type, options.sizes[s], options, rng);
+            }
+            else if (type == "large")
+            {
+                run_type<int, LargeValue>(type, options.sizes[s], options, rng);
+            }
+            else
+            {
+                std::fprintf(stderr, "unknown type %s\n", type.c_str());
+                return 2;
+            }
+        }
+    }
+    return 0;
+}
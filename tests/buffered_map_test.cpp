@@ -0,0 +1,243 @@
+//applies sorted batches with Map::merge_sorted, small ones entry by entry
+//and large ones in one relinking pass, and random changes through a
+//cs540::BufferedMap of several buffer sizes, checking both against
+//std::map under several policies.
+//
+//  buffered_map_test
+
+#include "Map.hpp"
+
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool ok, const std::string & what)
+    {
+        if (!ok)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            ++failures;
+        }
+    }
+
+    struct IndexPolicy : DefaultTreePolicy
+    {
+        using storage = IndexStorage;
+    };
+
+    struct LazyPolicy : DefaultTreePolicy
+    {
+        static constexpr double lazy_erase_ratio = 0.25;
+    };
+
+    struct InlinePolicy : DefaultTreePolicy
+    {
+        static constexpr std::size_t inline_capacity = 8;
+    };
+
+    struct WavlPolicy : DefaultTreePolicy
+    {
+        using balance = WavlBalance;
+    };
+
+    typedef std::map<int, int> Model;
+
+    //same entries forwards and backwards, and a valid tree
+    template<class M>
+    bool holds(const M & map, const Model & model)
+    {
+        if (map.size() != model.size() || !map.validate())
+        {
+            return false;
+        }
+        Model::const_iterator expected = model.begin();
+        for (typename M::ConstIterator it = map.begin(); it != map.end(); ++it, ++expected)
+        {
+            if (it->first != expected->first || it->second != expected->second)
+            {
+                return false;
+            }
+        }
+        Model::const_reverse_iterator back = model.rbegin();
+        typename M::ConstIterator it = map.end();
+        while (it != map.begin())
+        {
+            --it;
+            if (it->first != back->first)
+            {
+                return false;
+            }
+            ++back;
+        }
+        return true;
+    }
+
+    //one change per key in key order, a mix of the three operations on
+    //keys that are there and keys that are not
+    std::vector<MergeEntry<int, int>> sorted_batch(std::mt19937 & rng, std::size_t n, int range, Model & model)
+    {
+        std::vector<MergeEntry<int, int>> batch;
+        for (int key = 0; key < range && batch.size() < n; ++key)
+        {
+            if (rng() % std::size_t(range / int(n) + 1) != 0)
+            {
+                continue;
+            }
+            MergeEntry<int, int> entry = { key, int(rng() % 1000), MergeOp::put };
+            switch (rng() % 3)
+            {
+                case 0:
+                    model[key] = entry.second;
+                    break;
+                case 1:
+                    entry.op = MergeOp::insert;
+                    model.insert(std::make_pair(key, entry.second));
+                    break;
+                default:
+                    entry.op = MergeOp::erase;
+                    model.erase(key);
+                    break;
+            }
+            batch.push_back(entry);
+        }
+        return batch;
+    }
+
+    template<class Policy>
+    void merge(const std::string & name)
+    {
+        const int range = 40000;
+        std::mt19937 rng(11);
+        cs540::Map<int, int, Policy> map;
+        Model model;
+
+        //from empty, then batches from a few entries to more than the tree
+        const std::size_t sizes[] = { 5, 20000, 3, 100, 15000, 1, 40000, 50 };
+        for (std::size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+        {
+            std::vector<MergeEntry<int, int>> batch = sorted_batch(rng, sizes[s], range, model);
+            map.merge_sorted(batch);
+            check(holds(map, model), name + ": merge of " + std::to_string(batch.size()) + " changes");
+
+            //plain changes in between, under lazy erase they leave dead nodes
+            for (int i = 0; i < 300; ++i)
+            {
+                int key = int(rng() % range);
+                if (i % 2 == 0)
+                {
+                    map.erase(key);
+                    model.erase(key);
+                }
+                else
+                {
+                    map[key] = i;
+                    model[key] = i;
+                }
+            }
+        }
+        check(holds(map, model), name + ": merges and changes");
+
+        std::vector<MergeEntry<int, int>> none;
+        map.merge_sorted(none);
+        check(holds(map, model), name + ": empty batch");
+
+        //everything erased in one batch
+        std::vector<MergeEntry<int, int>> all;
+        for (Model::const_iterator it = model.begin(); it != model.end(); ++it)
+        {
+            MergeEntry<int, int> entry = { it->first, 0, MergeOp::erase };
+            all.push_back(entry);
+        }
+        model.clear();
+        map.merge_sorted(all);
+        check(holds(map, model), name + ": batch that erases everything");
+    }
+
+    template<class Policy>
+    void buffered(const std::string & name, std::size_t capacity)
+    {
+        std::string what = name + ", buffer of " + std::to_string(capacity);
+        cs540::BufferedMap<int, int, Policy> map(capacity);
+        Model model;
+        std::mt19937 rng(static_cast<unsigned>(capacity));
+        for (int step = 0; step < 60000; ++step)
+        {
+            int key = int(rng() % 5000);
+            switch (rng() % 8)
+            {
+                case 0:
+                case 1:
+                case 2:
+                    map.assign(key, step);
+                    model[key] = step;
+                    break;
+                case 3:
+                case 4:
+                    map.insert(ValueType<int, int>(key, step));
+                    model.insert(std::make_pair(key, step));
+                    break;
+                case 5:
+                case 6:
+                    map.erase(key);
+                    model.erase(key);
+                    break;
+                default:
+                    //a read sees every change made before it
+                    {
+                        typename cs540::BufferedMap<int, int, Policy>::ConstIterator found =
+                            static_cast<const cs540::BufferedMap<int, int, Policy> &>(map).find(key);
+                        Model::const_iterator expected = model.find(key);
+                        bool right = expected == model.end() ? found == map.end() : found != map.end() && found->second == expected->second;
+                        check(right && map.buffered() == 0, what + ": read at step " + std::to_string(step));
+                    }
+                    break;
+            }
+        }
+        check(holds(map.map(), model), what + ": entries");
+
+        //the same key changed many times within one buffer
+        for (int i = 0; i < 10; ++i)
+        {
+            map.erase(7);
+            map.insert(ValueType<int, int>(7, i));
+            map.insert(ValueType<int, int>(7, -i));
+            map.assign(8, i);
+            map.erase(8);
+        }
+        model[7] = 9;
+        model.erase(8);
+        check(map.at(7) == 9 && map.find(8) == map.end() && holds(map.map(), model), what + ": folded changes to one key");
+
+        map.clear();
+        check(map.empty() && map.buffered() == 0, what + ": clear");
+    }
+}
+
+int main()
+{
+    merge<DefaultTreePolicy>("default");
+    merge<IndexPolicy>("index storage");
+    merge<LazyPolicy>("lazy erase");
+    merge<InlinePolicy>("inline");
+    merge<WavlPolicy>("wavl");
+
+    const std::size_t capacities[] = { 1, 7, 256, cs540::BufferedMap<int, int>::defaultBufferCapacity };
+    for (std::size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); ++c)
+    {
+        buffered<DefaultTreePolicy>("default", capacities[c]);
+        buffered<LazyPolicy>("lazy erase", capacities[c]);
+    }
+    buffered<IndexPolicy>("index storage", 64);
+    buffered<InlinePolicy>("inline", 64);
+    if (failures == 0)
+    {
+        std::printf("buffered_map_test: ok\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
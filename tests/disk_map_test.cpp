@@ -0,0 +1,293 @@
+//opens a cs540::DiskMap again after it was closed, after the process
+//died between flushes and after it was killed while writing, and checks
+//that the entries are the ones the map held.
+//
+//  disk_map_test [PATH]
+//
+//The file at PATH is removed before and after each case.
+
+#include "Map.hpp"
+
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+    typedef cs540::DiskMap<std::uint64_t, std::uint64_t> Disk;
+    typedef std::map<std::uint64_t, std::uint64_t> Model;
+
+    int failures = 0;
+
+    void check(bool ok, const std::string & what)
+    {
+        if (!ok)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            ++failures;
+        }
+    }
+
+    //same entries in the same order, forwards and backwards
+    bool holds(const Disk & map, const Model & model)
+    {
+        if (map.size() != model.size())
+        {
+            return false;
+        }
+        Model::const_iterator expected = model.begin();
+        for (Disk::ConstIterator it = map.begin(); it != map.end(); ++it, ++expected)
+        {
+            if (it->first != expected->first || it->second != expected->second)
+            {
+                return false;
+            }
+        }
+        Model::const_reverse_iterator back = model.rbegin();
+        for (Disk::ConstReverseIterator it = map.rbegin(); it != map.rend(); ++it, ++back)
+        {
+            if (it->first != back->first)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    struct Op
+    {
+        std::uint64_t key;
+        std::uint64_t value;
+        bool erase;
+    };
+
+    //random inserts, overwrites and erases
+    std::vector<Op> random_ops(std::mt19937_64 & rng, std::size_t n)
+    {
+        std::vector<Op> ops(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            ops[i].key = rng() % (4 * n);
+            ops[i].value = i;
+            ops[i].erase = rng() % 4 == 0;
+        }
+        return ops;
+    }
+
+    //the same changes to a DiskMap and to the model
+    template<class M>
+    void apply_ops(M & map, const std::vector<Op> & ops)
+    {
+        for (std::size_t i = 0; i < ops.size(); ++i)
+        {
+            if (ops[i].erase)
+            {
+                map.erase(ops[i].key);
+            }
+            else
+            {
+                map[ops[i].key] = ops[i].value;
+            }
+        }
+    }
+
+    void reopen_after_close(const std::string & path)
+    {
+        std::remove(path.c_str());
+        std::mt19937_64 rng(1);
+        Model model;
+        std::vector<Op> ops = random_ops(rng, 20000);
+        apply_ops(model, ops);
+        {
+            Disk map(path);
+            apply_ops(map, ops);
+            map.close();
+            map.close();
+        }
+        {
+            Disk map(path, 64 * 1024);
+            check(holds(map, model), "reopen after close");
+            ops = random_ops(rng, 20000);
+            apply_ops(map, ops);
+            apply_ops(model, ops);
+        }
+        {
+            Disk map(path);
+            check(holds(map, model), "reopen after the destructor flushed");
+        }
+
+        //a reservation smaller than the file takes the file size, the
+        //file cannot grow past it
+        Disk map(path, Disk::defaultCacheBytes, 4096);
+        check(holds(map, model), "reopen with a small reservation");
+        try
+        {
+            for (std::uint64_t key = 1000000; key < 2000000; ++key)
+            {
+                map[key] = key;
+                model[key] = key;
+            }
+            check(false, "the file grew past its reservation");
+        }
+        catch (const std::length_error &)
+        {
+            check(holds(map, model), "entries after running out of reservation");
+        }
+
+        //a file of other types is refused
+        try
+        {
+            cs540::DiskMap<std::uint32_t, std::uint64_t> other(path);
+            check(false, "a file of other types opened");
+        }
+        catch (const std::runtime_error &)
+        {
+            //expected
+        }
+    }
+
+    //the child changes the map after its last flush and dies without
+    //closing it, the page cache keeps every change that returned
+    void reopen_after_exit(const std::string & path, bool clear)
+    {
+        std::string what = clear ? "reopen after clear and exit" : "reopen after exit";
+        std::remove(path.c_str());
+        std::mt19937_64 rng(2);
+        Model model;
+        std::vector<Op> ops = random_ops(rng, 20000);
+        apply_ops(model, ops);
+        {
+            Disk map(path);
+            apply_ops(map, ops);
+        }
+
+        ops = random_ops(rng, 5000);
+        pid_t child = fork();
+        if (child == 0)
+        {
+            Disk map(path);
+            if (clear)
+            {
+                map.clear();
+            }
+            apply_ops(map, ops);
+            _exit(0);
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        check(WIFEXITED(status) && WEXITSTATUS(status) == 0, what + ": the child failed");
+
+        if (clear)
+        {
+            model.clear();
+        }
+        apply_ops(model, ops);
+        try
+        {
+            Disk map(path);
+            check(holds(map, model), what + ": entries");
+
+            //the recovered file is clean and takes changes again
+            ops = random_ops(rng, 5000);
+            apply_ops(map, ops);
+            apply_ops(model, ops);
+            check(holds(map, model), what + ": changes after recovery");
+        }
+        catch (const std::exception & error)
+        {
+            check(false, what + ": reopening threw " + error.what());
+        }
+    }
+
+    //killed at a random point, every entry is one the writer put there
+    //and every key written before the last flush is there
+    void reopen_after_kill(const std::string & path)
+    {
+        std::remove(path.c_str());
+        for (int round = 0; round < 4; ++round)
+        {
+            int fds[2];
+            if (pipe(fds) != 0)
+            {
+                check(false, "pipe");
+                return;
+            }
+            pid_t child = fork();
+            if (child == 0)
+            {
+                close(fds[0]);
+                alarm(60);
+                Disk map(path);
+                for (std::uint64_t i = 0;; ++i)
+                {
+                    std::uint64_t key = std::uint64_t(round) << 32 | i;
+                    map[key] = key * 3 + 1;
+                    if (i % 1000 == 999)
+                    {
+                        map.flush();
+                        if (write(fds[1], &key, sizeof(key)) != sizeof(key))
+                        {
+                            _exit(2);
+                        }
+                    }
+                }
+            }
+            close(fds[1]);
+            std::uint64_t flushed = 0, key;
+            std::size_t acks = 0;
+            while (read(fds[0], &key, sizeof(key)) == sizeof(key))
+            {
+                flushed = key;
+                if (++acks == std::size_t(5 + round * 3))
+                {
+                    kill(child, SIGKILL);
+                }
+            }
+            close(fds[0]);
+            int status = 0;
+            waitpid(child, &status, 0);
+
+            std::string what = "reopen after kill, round " + std::to_string(round);
+            try
+            {
+                Disk map(path);
+                std::size_t wrong = 0, missing = 0;
+                for (Disk::ConstIterator it = map.begin(); it != map.end(); ++it)
+                {
+                    wrong += it->second != it->first * 3 + 1;
+                }
+                for (std::uint64_t k = std::uint64_t(round) << 32; k <= flushed; ++k)
+                {
+                    missing += map.find(k) == map.end();
+                }
+                check(wrong == 0, what + ": " + std::to_string(wrong) + " wrong entries");
+                check(missing == 0, what + ": " + std::to_string(missing) + " flushed entries lost");
+            }
+            catch (const std::exception & error)
+            {
+                check(false, what + ": reopening threw " + error.what());
+            }
+        }
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    std::string path = argc > 1 ? argv[1] : "disk_map_test.db";
+    reopen_after_close(path);
+    reopen_after_exit(path, false);
+    reopen_after_exit(path, true);
+    reopen_after_kill(path);
+    std::remove(path.c_str());
+    if (failures == 0)
+    {
+        std::printf("disk_map_test: ok\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
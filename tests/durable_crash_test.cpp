@@ -0,0 +1,265 @@
+//kills a process writing to a cs540::DurableMap with SIGKILL while its
+//commits and checkpoints run, then reopens the files and checks that
+//every write the process saw return is there. Runs several crashes in a
+//row on the same files for each commit window and checkpoint size.
+//
+//  durable_crash_test [PATH]
+//
+//The journal and snapshot at PATH are removed before and after each run.
+
+#include "Map.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+    typedef cs540::DurableMap<std::uint64_t, std::uint64_t> Durable;
+
+    //what a writer reports once a change returned, one write() each so
+    //the records of several threads do not interleave in the pipe
+    struct Ack
+    {
+        std::uint64_t key;
+        std::uint64_t op;
+    };
+
+    const std::uint64_t put = 1;
+    const std::uint64_t erased = 2;
+
+    //an erase that was sent but not acknowledged may or may not be there
+    const std::uint64_t either = 3;
+
+    const std::size_t writers = 4;
+
+    //the keys are unique to a round and a writer, so the last change that
+    //returned decides what the reopened map holds
+    std::uint64_t key_of(std::uint64_t round, std::uint64_t writer, std::uint64_t i)
+    {
+        return round << 40 | writer << 32 | i;
+    }
+    std::uint64_t value_of(std::uint64_t key)
+    {
+        return key * 3 + 1;
+    }
+
+    //a writer erases an older key of its own after every fifth write
+    bool erases_after(std::uint64_t i)
+    {
+        return i % 5 == 4;
+    }
+
+    int failures = 0;
+
+    void check(bool ok, const std::string & what)
+    {
+        if (!ok)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            ++failures;
+        }
+    }
+
+    void remove_files(const std::string & path)
+    {
+        std::remove((path + ".snap").c_str());
+        std::remove((path + ".log").c_str());
+    }
+
+    //the child: recover, then write from every thread until killed
+    void write_until_killed(const std::string & path, std::chrono::microseconds window,
+        std::uint64_t checkpointBytes, std::uint64_t round, int ackPipe)
+    {
+        //a parent that died leaves nobody to kill us
+        alarm(60);
+        try
+        {
+            Durable map(path, window, checkpointBytes);
+            std::vector<std::thread> threads;
+            for (std::uint64_t w = 0; w < writers; ++w)
+            {
+                threads.emplace_back([&map, w, round, ackPipe]()
+                {
+                    for (std::uint64_t i = 0; i < (std::uint64_t(1) << 20); ++i)
+                    {
+                        Ack ack = { key_of(round, w, i), put };
+                        map.assign(ack.key, value_of(ack.key));
+                        if (write(ackPipe, &ack, sizeof(ack)) != sizeof(ack))
+                        {
+                            _exit(2);
+                        }
+
+                        //now and then erase one of the own keys again
+                        if (erases_after(i))
+                        {
+                            ack.key = key_of(round, w, i - 3);
+                            ack.op = erased;
+                            map.erase(ack.key);
+                            if (write(ackPipe, &ack, sizeof(ack)) != sizeof(ack))
+                            {
+                                _exit(2);
+                            }
+                        }
+                    }
+                });
+            }
+            for (std::size_t t = 0; t < threads.size(); ++t)
+            {
+                threads[t].join();
+            }
+        }
+        catch (const std::exception & error)
+        {
+            std::fprintf(stderr, "writer: %s\n", error.what());
+            _exit(1);
+        }
+        _exit(3);
+    }
+
+    //one crash: returns the acknowledged changes in the order they came
+    bool crash_once(const std::string & path, std::chrono::microseconds window, std::uint64_t checkpointBytes,
+        std::uint64_t round, std::size_t killAfter, std::vector<Ack> & acks)
+    {
+        int fds[2];
+        if (pipe(fds) != 0)
+        {
+            return false;
+        }
+        pid_t child = fork();
+        if (child < 0)
+        {
+            return false;
+        }
+        if (child == 0)
+        {
+            close(fds[0]);
+            write_until_killed(path, window, checkpointBytes, round, fds[1]);
+        }
+        close(fds[1]);
+
+        bool killed = false;
+        Ack ack;
+        std::size_t got = 0;
+        for (;;)
+        {
+            ssize_t n = read(fds[0], reinterpret_cast<char *>(&ack) + got, sizeof(ack) - got);
+            if (n <= 0)
+            {
+                break;
+            }
+            got += static_cast<std::size_t>(n);
+            if (got < sizeof(ack))
+            {
+                continue;
+            }
+            got = 0;
+            acks.push_back(ack);
+            if (!killed && acks.size() >= killAfter)
+            {
+                kill(child, SIGKILL);
+                killed = true;
+            }
+        }
+        close(fds[0]);
+
+        int status = 0;
+        waitpid(child, &status, 0);
+        return killed && WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL;
+    }
+
+    void run(const std::string & path, std::chrono::microseconds window, std::uint64_t checkpointBytes)
+    {
+        std::string config = "window " + std::to_string(window.count()) + "us, checkpoint "
+            + std::to_string(checkpointBytes) + " bytes";
+        remove_files(path);
+        std::mt19937 rng(static_cast<unsigned>(window.count() * 7 + checkpointBytes));
+
+        //last acknowledged change of every key, over all rounds
+        std::map<std::uint64_t, std::uint64_t> expected;
+        for (std::uint64_t round = 0; round < 4; ++round)
+        {
+            std::vector<Ack> acks;
+            std::size_t killAfter = 100 + rng() % 3000;
+            if (!crash_once(path, window, checkpointBytes, round, killAfter, acks))
+            {
+                check(false, config + ": the writer did not run until it was killed");
+                return;
+            }
+            for (std::size_t i = 0; i < acks.size(); ++i)
+            {
+                expected[acks[i].key] = acks[i].op;
+                std::uint64_t index = acks[i].key & 0xffffffffu;
+                if (acks[i].op == put && erases_after(index))
+                {
+                    //overwritten by the erase acknowledgement if it came
+                    expected[acks[i].key - 3] = either;
+                }
+            }
+
+            std::string what = config + ", round " + std::to_string(round);
+            try
+            {
+                Durable map(path, window, checkpointBytes);
+                std::size_t missing = 0, resurrected = 0, wrong = 0;
+                for (std::map<std::uint64_t, std::uint64_t>::const_iterator it = expected.begin(); it != expected.end(); ++it)
+                {
+                    cs540::Map<std::uint64_t, std::uint64_t>::ConstIterator found = map.map().find(it->first);
+                    if (it->second == put && found == map.map().end())
+                    {
+                        ++missing;
+                    }
+                    else if (it->second == erased && found != map.map().end())
+                    {
+                        ++resurrected;
+                    }
+                }
+                //whatever is there, acknowledged or not, was written whole
+                for (cs540::Map<std::uint64_t, std::uint64_t>::ConstIterator it = map.map().begin(); it != map.map().end(); ++it)
+                {
+                    if (it->second != value_of(it->first))
+                    {
+                        ++wrong;
+                    }
+                }
+                check(missing == 0, what + ": " + std::to_string(missing) + " acknowledged writes lost");
+                check(resurrected == 0, what + ": " + std::to_string(resurrected) + " acknowledged erases undone");
+                check(wrong == 0, what + ": " + std::to_string(wrong) + " entries with a wrong value");
+            }
+            catch (const std::exception & error)
+            {
+                check(false, what + ": reopening threw " + error.what());
+                return;
+            }
+        }
+        remove_files(path);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    std::string path = argc > 1 ? argv[1] : "durable_crash_test.db";
+    const long windows[] = { 0, 200, 2000 };
+    const std::uint64_t checkpoints[] = { 0, 4096, 64 * 1024 };
+    for (std::size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); ++w)
+    {
+        for (std::size_t c = 0; c < sizeof(checkpoints) / sizeof(checkpoints[0]); ++c)
+        {
+            run(path, std::chrono::microseconds(windows[w]), checkpoints[c]);
+        }
+    }
+    if (failures == 0)
+    {
+        std::printf("durable_crash_test: ok\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,223 @@
+//a cs540::DurableMap that checkpoints while writers run, that opens a
+//journal whose header was cut short, and whose journal stops taking
+//writes: the changes that did not reach it are rolled back.
+//
+//  durable_map_test [PATH]
+//
+//The journal and snapshot at PATH are removed before and after each case.
+
+#include "Map.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+    typedef cs540::DurableMap<std::uint64_t, std::uint64_t> Durable;
+
+    int failures = 0;
+
+    void check(bool ok, const std::string & what)
+    {
+        if (!ok)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            ++failures;
+        }
+    }
+
+    void remove_files(const std::string & path)
+    {
+        std::remove((path + ".snap").c_str());
+        std::remove((path + ".log").c_str());
+    }
+
+    //every writer owns a range of keys, puts them and erases every third,
+    //while another thread checkpoints over and over
+    void checkpoint_while_writing(const std::string & path)
+    {
+        remove_files(path);
+        const std::uint64_t writers = 4, perWriter = 600;
+        {
+            Durable map(path, std::chrono::microseconds(100), 0);
+            std::atomic<bool> done(false);
+            std::vector<std::thread> threads;
+            for (std::uint64_t w = 0; w < writers; ++w)
+            {
+                threads.emplace_back([&map, w]()
+                {
+                    for (std::uint64_t i = 0; i < perWriter; ++i)
+                    {
+                        std::uint64_t key = w * perWriter + i;
+                        map.assign(key, key + 1);
+                        if (i % 3 == 2)
+                        {
+                            map.erase(key - 1);
+                        }
+                        if (map.at(key) != key + 1)
+                        {
+                            std::fprintf(stderr, "FAILED: read back a change during checkpoints\n");
+                            std::abort();
+                        }
+                    }
+                });
+            }
+            std::size_t checkpoints = 0;
+            std::thread checkpointer([&map, &done, &checkpoints]()
+            {
+                while (!done)
+                {
+                    map.checkpoint();
+                    ++checkpoints;
+
+                    //let the writers reach the journal between checkpoints
+                    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                }
+            });
+            for (std::size_t t = 0; t < threads.size(); ++t)
+            {
+                threads[t].join();
+            }
+            done = true;
+            checkpointer.join();
+            check(checkpoints > 1, "checkpoints ran while writing");
+            check(map.size() == writers * perWriter * 2 / 3, "size after checkpoints");
+        }
+
+        Durable map(path);
+        std::size_t wrong = 0;
+        for (std::uint64_t key = 0; key < writers * perWriter; ++key)
+        {
+            bool erased = key % 3 == 1;
+            cs540::Map<std::uint64_t, std::uint64_t>::ConstIterator found = map.map().find(key);
+            wrong += erased ? found != map.map().end() : (found == map.map().end() || found->second != key + 1);
+        }
+        check(wrong == 0, "reopened after checkpoints, " + std::to_string(wrong) + " keys wrong");
+        check(map.size() == writers * perWriter * 2 / 3, "reopened size");
+        remove_files(path);
+    }
+
+    //a crash while the journal was created leaves part of a header
+    void torn_header(const std::string & path)
+    {
+        const std::size_t lengths[] = { 1, 7, sizeof(cs540::JournalHeader) - 1, sizeof(cs540::JournalHeader) };
+        for (std::size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i)
+        {
+            std::string what = "journal cut to " + std::to_string(lengths[i]) + " bytes";
+            remove_files(path);
+            std::FILE * file = std::fopen((path + ".log").c_str(), "wb");
+            std::vector<char> zeros(lengths[i], 0);
+            std::fwrite(zeros.data(), 1, zeros.size(), file);
+            std::fclose(file);
+            try
+            {
+                {
+                    Durable map(path);
+                    check(map.empty(), what + ": empty");
+                    map.assign(1, 2);
+                }
+                Durable map(path);
+                check(map.size() == 1 && map.at(1) == 2, what + ": takes changes");
+            }
+            catch (const std::exception & error)
+            {
+                check(false, what + ": threw " + error.what());
+            }
+        }
+        remove_files(path);
+    }
+
+    //the child's journal may not grow past a limit, the change that
+    //crosses it fails and is rolled back, and so is every change after it
+    void roll_back(const std::string & path)
+    {
+        remove_files(path);
+        pid_t child = fork();
+        if (child == 0)
+        {
+            signal(SIGXFSZ, SIG_IGN);
+            struct rlimit limit = { 4096, 4096 };
+            setrlimit(RLIMIT_FSIZE, &limit);
+            int result = 0;
+            {
+                Durable map(path, std::chrono::microseconds(0), 0);
+                std::uint64_t key = 0;
+                bool overwriting = false;
+                try
+                {
+                    for (; key < 100000; ++key)
+                    {
+                        overwriting = false;
+                        map.assign(key, key);
+                        overwriting = true;
+                        map.assign(0, key);
+                    }
+                    result = 1;
+                }
+                catch (const std::runtime_error &)
+                {
+                    //expected once the journal is full
+                }
+
+                //either the new key or the new value of key 0 is gone
+                std::size_t size = overwriting ? key + 1 : key;
+                if (result == 0 && (key == 0 || map.size() != size || map.at(0) != key - 1))
+                {
+                    result = 2;
+                }
+                try
+                {
+                    map.assign(key + 1, 0);
+                    result = 3;
+                }
+                catch (const std::runtime_error &)
+                {
+                    //every change after a failure fails
+                }
+                if (result == 0 && map.size() != size)
+                {
+                    result = 4;
+                }
+            }
+            _exit(result);
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        check(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+            "roll back, the child reported " + std::to_string(WIFEXITED(status) ? WEXITSTATUS(status) : -1));
+
+        //what the journal holds opens again
+        try
+        {
+            Durable map(path);
+            check(map.size() > 0, "reopened after a full journal");
+        }
+        catch (const std::exception & error)
+        {
+            check(false, std::string("reopened after a full journal: threw ") + error.what());
+        }
+        remove_files(path);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    std::string path = argc > 1 ? argv[1] : "durable_map_test.db";
+    checkpoint_while_writing(path);
+    torn_header(path);
+    roll_back(path);
+    if (failures == 0)
+    {
+        std::printf("durable_map_test: ok\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+//drives a cs540::ExpiringMap with a simulated clock: expired entries are
+//missing for find() at once, expire() removes exactly the expired ones,
+//oldest first and within its budget, and refresh() and assign() move
+//deadlines. Checked against a model of every key's deadline.
+//
+//  expiring_map_test
+
+#include "Map.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool ok, const std::string & what)
+    {
+        if (!ok)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            ++failures;
+        }
+    }
+
+    typedef std::chrono::steady_clock Clock;
+    typedef cs540::ExpiringMap<int, int> Expiring;
+    typedef std::chrono::milliseconds Ms;
+
+    struct Expected
+    {
+        int value;
+        Clock::time_point deadline;
+    };
+    typedef std::map<int, Expected> Model;
+
+    bool holds(const Expiring & map, const Model & model, Clock::time_point now)
+    {
+        if (map.size() != model.size() || map.empty() != model.empty() || !map.map().validate())
+        {
+            return false;
+        }
+        Clock::time_point earliest = Clock::time_point::max();
+        Model::const_iterator expected = model.begin();
+        for (Expiring::ConstIterator it = map.begin(); it != map.end(); ++it, ++expected)
+        {
+            if (it->first != expected->first || it->second.value != expected->second.value
+                || it->second.deadline() != expected->second.deadline
+                || it->second.expired(now) != !(now < expected->second.deadline))
+            {
+                return false;
+            }
+            earliest = std::min(earliest, expected->second.deadline);
+        }
+        return map.next_deadline() == earliest;
+    }
+}
+
+int main()
+{
+    const Clock::time_point start = Clock::now();
+    Clock::time_point now = start;
+    Expiring map;
+    Model model;
+    check(map.next_deadline() == Clock::time_point::max() && map.expire(now) == 0, "empty map");
+
+    std::mt19937 rng(9);
+    for (int step = 0; step < 50000; ++step)
+    {
+        int key = int(rng() % 2000);
+        Model::iterator there = model.find(key);
+        bool live = there != model.end() && now < there->second.deadline;
+        switch (rng() % 8)
+        {
+            case 0:
+            case 1:
+            case 2:
+                {
+                    Ms ttl(rng() % 500);
+                    check(map.assign(key, step, ttl, now) == !live, "assign returns whether the key was missing");
+                    Expected entry = { step, now + ttl };
+                    model[key] = entry;
+                }
+                break;
+            case 3:
+            case 4:
+                {
+                    const Expiring & reader = map;
+                    const int * found = reader.find(key, now);
+                    check((found != 0) == live && (!live || *found == there->second.value), "find hides expired entries");
+                    check(map.find(key, now) == found, "find through a non-const map");
+                }
+                break;
+            case 5:
+                {
+                    Ms ttl(rng() % 500);
+                    check(map.refresh(key, ttl, now) == live, "refresh of a live entry only");
+                    if (live)
+                    {
+                        there->second.deadline = now + ttl;
+                    }
+                }
+                break;
+            case 6:
+                check(map.erase(key) == (there != model.end()), "erase, expired or not");
+                model.erase(key);
+                break;
+            default:
+                {
+                    //the budget caps a call, what is left goes on the next
+                    std::size_t budget = rng() % 2 == 0 ? std::size_t(rng() % 20) : std::size_t(-1);
+                    std::size_t due = 0;
+                    for (Model::const_iterator it = model.begin(); it != model.end(); ++it)
+                    {
+                        due += !(now < it->second.deadline);
+                    }
+                    std::size_t removed = map.expire(now, budget);
+                    check(removed == std::min(due, budget), "expire removes min(expired, budget)");
+
+                    //no entry that stays is older than one that went
+                    Model kept;
+                    Clock::time_point newestRemoved = Clock::time_point::min(), oldestKept = Clock::time_point::max();
+                    for (Model::const_iterator it = model.begin(); it != model.end(); ++it)
+                    {
+                        if (map.map().find(it->first) != map.map().end())
+                        {
+                            kept[it->first] = it->second;
+                            oldestKept = std::min(oldestKept, it->second.deadline);
+                        }
+                        else
+                        {
+                            newestRemoved = std::max(newestRemoved, it->second.deadline);
+                            check(!(now < it->second.deadline), "expire removed a live entry");
+                        }
+                    }
+                    check(newestRemoved <= oldestKept, "expire removes the oldest first");
+                    check(kept.size() + removed == model.size(), "entries after expire");
+                    if (removed < budget)
+                    {
+                        check(oldestKept > now, "expired entry after a full expire");
+                    }
+                    model.swap(kept);
+                }
+                break;
+        }
+        now += Ms(rng() % 3);
+        if (step % 1000 == 0)
+        {
+            check(holds(map, model, now), "entries at step " + std::to_string(step));
+        }
+    }
+    check(holds(map, model, now), "entries after the changes");
+
+    //many entries with one deadline go over several calls
+    map.clear();
+    model.clear();
+    check(map.empty() && map.next_deadline() == Clock::time_point::max(), "clear");
+    for (int key = 0; key < 1000; ++key)
+    {
+        map.assign(key, key, Ms(10), now);
+    }
+    map.assign(5000, 5000, Ms(20), now);
+    now += Ms(10);
+    check(map.find(999, now) == 0 && map.find(5000, now) != 0, "a deadline is the first expired instant");
+    std::size_t calls = 0, removed = 0, batch;
+    while ((batch = map.expire(now, 64)) > 0)
+    {
+        removed += batch;
+        ++calls;
+    }
+    check(removed == 1000 && calls == 16 && map.size() == 1, "equal deadlines over several calls");
+    check(map.next_deadline() == now + Ms(10), "next deadline after the batch");
+
+    if (failures == 0)
+    {
+        std::printf("expiring_map_test: ok\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
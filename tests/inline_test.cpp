@@ -0,0 +1,147 @@
+//a map with inline_capacity keeps its first entries in an array inside
+//the map. Filling the array past its capacity has to leave references
+//and iterators to those entries valid, and erasing, extracting, swapping,
+//compacting and clearing have to cope with entries still in the array.
+//
+//  inline_test
+
+#include "Map.hpp"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool ok, const std::string & what)
+    {
+        if (!ok)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            ++failures;
+        }
+    }
+
+    template<bool Threaded, bool Lazy>
+    struct InlinePolicy : DefaultTreePolicy
+    {
+        static constexpr std::size_t inline_capacity = 8;
+        static constexpr bool threaded = Threaded;
+        static constexpr double lazy_erase_ratio = Lazy ? 0.25 : 0.0;
+    };
+
+    //long enough that the strings live on the heap, so a lost or twice
+    //destroyed entry shows up under a sanitizer
+    std::string value_of(int key)
+    {
+        return "value of key number " + std::to_string(key) + " in the inline test";
+    }
+
+    template<class Policy>
+    void run(const std::string & name)
+    {
+        typedef cs540::Map<int, std::string, Policy> Inline;
+        const int capacity = int(Policy::inline_capacity);
+
+        //fill the array, keep a reference and an iterator to every entry
+        Inline m;
+        std::vector<const std::string *> refs;
+        std::vector<typename Inline::Iterator> its;
+        for (int i = 0; i < capacity; ++i)
+        {
+            its.push_back(m.insert(std::make_pair(2 * i, value_of(2 * i))).first);
+            refs.push_back(&its.back()->second);
+        }
+
+        //the next entry spills the array into the tree
+        m.insert(std::make_pair(1, value_of(1)));
+        check(m.validate(), name + ": validate after the spill");
+        for (int i = 0; i < capacity; ++i)
+        {
+            typename Inline::Iterator found = m.find(2 * i);
+            check(&found->second == refs[i], name + ": entry " + std::to_string(2 * i) + " moved");
+            check(*refs[i] == value_of(2 * i), name + ": reference to " + std::to_string(2 * i));
+            check(its[i] == found && its[i]->first == 2 * i, name + ": iterator to " + std::to_string(2 * i));
+        }
+        typename Inline::Iterator next = its[0];
+        ++next;
+        check(next->first == 1, name + ": iterating from an old entry");
+
+        //grow, then erase entries from the array and from the heap
+        for (int i = 0; i < 64; ++i)
+        {
+            m.insert(std::make_pair(2 * capacity + i, value_of(2 * capacity + i)));
+        }
+        m.erase(2);
+        m.erase(1);
+        m.erase(2 * capacity + 5);
+        check(m.validate(), name + ": validate after erasing");
+        check(*refs[3] == value_of(6), name + ": reference after erasing");
+
+        //an extracted entry from the array comes back whole
+        typename Inline::node_type handle = m.extract(4);
+        check(!handle.empty() && handle.key() == 4 && handle.mapped() == value_of(4), name + ": extracted entry");
+        check(m.find(4) == m.end() && m.validate(), name + ": tree after the extract");
+        m.insert(std::move(handle));
+        check(m.find(4) != m.end() && m.find(4)->second == value_of(4), name + ": entry inserted back");
+
+        //swap and compact move what is left of the array onto the heap
+        Inline other;
+        other.insert(std::make_pair(-1, value_of(-1)));
+        m.swap(other);
+        check(other.validate() && m.validate(), name + ": validate after the swap");
+        check(m.size() == 1 && m.find(-1)->second == value_of(-1), name + ": swapped small map");
+        check(other.find(6)->second == value_of(6) && other.find(2 * capacity + 7)->second == value_of(2 * capacity + 7),
+            name + ": swapped large map");
+
+        other.compact();
+        check(other.validate(), name + ": validate after compact");
+        std::size_t count = 0;
+        for (typename Inline::ConstIterator it = other.begin(); it != other.end(); ++it, ++count)
+        {
+            check(it->second == value_of(it->first), name + ": value after compact");
+        }
+        check(count == other.size(), name + ": entries after compact");
+
+        //erase everything, the map starts over in the array
+        std::vector<int> keys;
+        for (typename Inline::ConstIterator it = other.begin(); it != other.end(); ++it)
+        {
+            keys.push_back(it->first);
+        }
+        for (std::size_t i = 0; i < keys.size(); ++i)
+        {
+            other.erase(keys[i]);
+        }
+        check(other.size() == 0 && other.validate(), name + ": empty after erasing all");
+
+        //spill again, then clear and destroy with entries still in the array
+        for (int i = 0; i < 3 * capacity; ++i)
+        {
+            other.insert(std::make_pair(i, value_of(i)));
+        }
+        other.clear();
+        check(other.size() == 0 && other.validate(), name + ": clear");
+        for (int i = 0; i < 2 * capacity; ++i)
+        {
+            other.insert(std::make_pair(i, value_of(i)));
+            m.insert(std::make_pair(i, value_of(i)));
+        }
+        Inline moved(std::move(m));
+        check(moved.validate() && moved.size() == std::size_t(2 * capacity + 1), name + ": moved map");
+    }
+}
+
+int main()
+{
+    run<InlinePolicy<true, false>>("threaded");
+    run<InlinePolicy<false, false>>("unthreaded");
+    run<InlinePolicy<true, true>>("lazy erase");
+    if (failures == 0)
+    {
+        std::printf("inline_test: ok\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+//links caller-owned objects into two cs540::IntrusiveTree at once, one by
+//id and one by score, and checks both orders against std::set while
+//objects are inserted, erased and moved between positions.
+//
+//  intrusive_tree_test
+
+#include "Map.hpp"
+
+#include <cstdio>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool ok, const std::string & what)
+    {
+        if (!ok)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            ++failures;
+        }
+    }
+
+    struct Item
+    {
+        int id;
+        int score;
+        cs540::AvlHook byIdHook;
+        cs540::AvlHook byScoreHook;
+        bool linked;
+    };
+
+    struct ById
+    {
+        bool operator()(const Item & a, const Item & b) const
+        {
+            return a.id < b.id;
+        }
+        bool operator()(int id, const Item & b) const
+        {
+            return id < b.id;
+        }
+        bool operator()(const Item & a, int id) const
+        {
+            return a.id < id;
+        }
+    };
+
+    //equal scores by id, so no two items compare equal
+    struct ByScore
+    {
+        bool operator()(const Item & a, const Item & b) const
+        {
+            return a.score != b.score ? a.score < b.score : a.id < b.id;
+        }
+    };
+
+    typedef cs540::IntrusiveTree<Item, &Item::byIdHook, ById> IdTree;
+    typedef cs540::IntrusiveTree<Item, &Item::byScoreHook, ByScore> ScoreTree;
+    typedef std::set<std::pair<int, int>> Model;
+
+    //both trees hold the model in order, forwards and backwards
+    bool holds(const IdTree & ids, const ScoreTree & scores, const Model & byId, const Model & byScore)
+    {
+        if (ids.size() != byId.size() || scores.size() != byScore.size() || ids.empty() != byId.empty())
+        {
+            return false;
+        }
+        Model::const_iterator expected = byId.begin();
+        for (IdTree::Iterator it = ids.begin(); it != ids.end(); ++it, ++expected)
+        {
+            if (it->id != expected->first || it->score != expected->second)
+            {
+                return false;
+            }
+        }
+        expected = byScore.begin();
+        for (ScoreTree::Iterator it = scores.begin(); it != scores.end(); ++it, ++expected)
+        {
+            if (it->score != expected->first || it->id != expected->second)
+            {
+                return false;
+            }
+        }
+        Model::const_reverse_iterator back = byId.rbegin();
+        IdTree::Iterator it = ids.end();
+        while (it != ids.begin())
+        {
+            --it;
+            if (it->id != back->first)
+            {
+                return false;
+            }
+            ++back;
+        }
+        return true;
+    }
+}
+
+int main()
+{
+    const int count = 4000;
+    std::vector<Item> items(count);
+    for (int i = 0; i < count; ++i)
+    {
+        items[i].id = i;
+        items[i].score = 0;
+        items[i].linked = false;
+    }
+
+    IdTree ids;
+    ScoreTree scores;
+    Model byId, byScore;
+    std::mt19937 rng(7);
+    for (int step = 0; step < 40000; ++step)
+    {
+        Item & item = items[rng() % count];
+        if (!item.linked)
+        {
+            item.score = int(rng() % 500);
+            bool inserted = ids.insert(item).second && scores.insert(item).second;
+            check(inserted, "insert of an unlinked item");
+            byId.insert(std::make_pair(item.id, item.score));
+            byScore.insert(std::make_pair(item.score, item.id));
+            item.linked = true;
+        }
+        else if (rng() % 2 == 0)
+        {
+            //the position after it comes back
+            IdTree::Iterator next = ids.iterator_to(item);
+            ++next;
+            check(ids.erase(ids.iterator_to(item)) == next, "erase returns the next position");
+            scores.erase(item);
+            byId.erase(std::make_pair(item.id, item.score));
+            byScore.erase(std::make_pair(item.score, item.id));
+            item.linked = false;
+        }
+        else
+        {
+            //a new score moves it in one tree only
+            scores.erase(item);
+            byScore.erase(std::make_pair(item.score, item.id));
+            byId.erase(std::make_pair(item.id, item.score));
+            item.score = int(rng() % 500);
+            scores.insert(item);
+            byScore.insert(std::make_pair(item.score, item.id));
+            byId.insert(std::make_pair(item.id, item.score));
+        }
+        if (step % 5000 == 0)
+        {
+            check(holds(ids, scores, byId, byScore), "order at step " + std::to_string(step));
+        }
+    }
+    check(holds(ids, scores, byId, byScore), "order after the changes");
+
+    //find by key, a linked equal object is handed back on insert
+    std::size_t wrong = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        IdTree::Iterator found = ids.find(i);
+        wrong += items[i].linked ? found == ids.end() || &*found != &items[i] : found != ids.end();
+    }
+    check(wrong == 0, "find, " + std::to_string(wrong) + " wrong");
+    Item twin = items[byId.begin()->first];
+    std::pair<IdTree::Iterator, bool> again = ids.insert(twin);
+    check(!again.second && &*again.first == &items[byId.begin()->first], "insert of an equal item");
+
+    //clear forgets the objects, they can be linked again
+    ids.clear();
+    scores.clear();
+    check(ids.empty() && ids.size() == 0 && ids.begin() == ids.end(), "clear");
+    for (int i = count - 1; i >= 0; --i)
+    {
+        ids.insert(items[i]);
+    }
+    IdTree::Iterator it = ids.begin();
+    bool ordered = ids.size() == std::size_t(count);
+    for (int i = 0; i < count && ordered; ++i, ++it)
+    {
+        ordered = it->id == i;
+    }
+    check(ordered && it == ids.end(), "linked again after clear");
+
+    if (failures == 0)
+    {
+        std::printf("intrusive_tree_test: ok\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,236 @@
+//runs random assigns, lookups, erases and limit changes on a cs540::LruMap
+//next to a model of its recency list, and checks the entries, the order of
+//eviction, the byte count and the hit, miss and eviction counters.
+//
+//  lru_map_test
+
+#include "Map.hpp"
+
+#include <cstdio>
+#include <list>
+#include <map>
+#include <random>
+#include <string>
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool ok, const std::string & what)
+    {
+        if (!ok)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            ++failures;
+        }
+    }
+
+    //a string costs its characters on top of the node
+    struct StringBytes
+    {
+        std::size_t operator()(int, const std::string & value) const
+        {
+            return value.size();
+        }
+    };
+
+    typedef cs540::LruMap<int, std::string, DefaultTreePolicy, StringBytes> Lru;
+
+    //the recency list, newest first, and what the map should charge
+    class Model
+    {
+        public:
+            explicit Model(std::size_t nodeBytes)
+                : nodeBytes(nodeBytes), bytes(0), hits(0), misses(0), evictions(0)
+            {
+            }
+
+            std::list<int> order;
+            std::map<int, std::string> values;
+            std::size_t nodeBytes;
+            std::size_t bytes;
+            std::uint64_t hits;
+            std::uint64_t misses;
+            std::uint64_t evictions;
+
+            void touch(int key)
+            {
+                order.remove(key);
+                order.push_front(key);
+            }
+            void assign(int key, const std::string & value)
+            {
+                if (values.count(key) != 0)
+                {
+                    bytes -= values[key].size();
+                }
+                else
+                {
+                    bytes += nodeBytes;
+                }
+                bytes += value.size();
+                values[key] = value;
+                touch(key);
+            }
+            void erase(int key)
+            {
+                bytes -= nodeBytes + values[key].size();
+                values.erase(key);
+                order.remove(key);
+            }
+            void trim(std::size_t maxEntries, std::size_t maxBytes)
+            {
+                while (values.size() > 1 && ((maxEntries != 0 && values.size() > maxEntries) || (maxBytes != 0 && bytes > maxBytes)))
+                {
+                    erase(order.back());
+                    ++evictions;
+                }
+            }
+    };
+
+    bool holds(const Lru & lru, const Model & model)
+    {
+        if (lru.size() != model.values.size() || lru.bytes() != model.bytes || lru.empty() != model.values.empty())
+        {
+            return false;
+        }
+        if (!model.order.empty()
+            && (lru.newest() == 0 || lru.newest()->first != model.order.front()
+                || lru.oldest() == 0 || lru.oldest()->first != model.order.back()))
+        {
+            return false;
+        }
+        std::map<int, std::string>::const_iterator expected = model.values.begin();
+        for (Lru::ConstIterator it = lru.begin(); it != lru.end(); ++it, ++expected)
+        {
+            if (it->first != expected->first || it->second.value != expected->second)
+            {
+                return false;
+            }
+        }
+        cs540::LruStats stats = lru.stats();
+        return stats.hits == model.hits && stats.misses == model.misses && stats.evictions == model.evictions
+            && lru.map().validate();
+    }
+
+    //bytes charged for a node with an empty value
+    std::size_t node_bytes()
+    {
+        Lru probe(0);
+        probe.assign(0, std::string());
+        return probe.bytes();
+    }
+}
+
+int main()
+{
+    std::size_t maxEntries = 300, maxBytes = 0;
+    Lru lru(maxEntries);
+    Model model(node_bytes());
+    check(lru.oldest() == 0 && lru.newest() == 0 && !lru.evict(), "empty map");
+
+    std::mt19937 rng(5);
+    for (int step = 0; step < 100000; ++step)
+    {
+        int key = int(rng() % 1000);
+        switch (rng() % 10)
+        {
+            case 0:
+            case 1:
+            case 2:
+            case 3:
+                {
+                    std::string value(rng() % 64, char('a' + step % 26));
+                    bool added = model.values.count(key) == 0;
+                    check(lru.assign(key, value) == added, "assign returns whether the key was new");
+                    model.assign(key, value);
+                    model.trim(maxEntries, maxBytes);
+                }
+                break;
+            case 4:
+            case 5:
+            case 6:
+                {
+                    std::string * found = lru.find(key);
+                    bool there = model.values.count(key) != 0;
+                    check((found != 0) == there && (!there || *found == model.values[key]), "find");
+                    if (there)
+                    {
+                        ++model.hits;
+                        model.touch(key);
+                    }
+                    else
+                    {
+                        ++model.misses;
+                    }
+                }
+                break;
+            case 7:
+                {
+                    //peek neither counts nor moves the entry
+                    const std::string * found = lru.peek(key);
+                    check((found != 0) == (model.values.count(key) != 0), "peek");
+                }
+                break;
+            case 8:
+                {
+                    bool there = model.values.count(key) != 0;
+                    check(lru.erase(key) == there, "erase returns whether the key was there");
+                    if (there)
+                    {
+                        model.erase(key);
+                    }
+                }
+                break;
+            default:
+                if (step % 20 == 9)
+                {
+                    //switch between an entry limit, a byte limit and both
+                    maxEntries = rng() % 3 == 0 ? 0 : 50 + rng() % 400;
+                    maxBytes = rng() % 3 == 0 ? 0 : model.nodeBytes * (20 + rng() % 300);
+                    lru.set_capacity(maxEntries, maxBytes);
+                    model.trim(maxEntries, maxBytes);
+                    check(lru.max_entries() == maxEntries && lru.max_bytes() == maxBytes, "limits");
+                }
+                else if (!model.order.empty())
+                {
+                    int oldest = model.order.back();
+                    check(lru.evict() && lru.peek(oldest) == 0, "evict drops the oldest");
+                    model.erase(oldest);
+                    ++model.evictions;
+                }
+                break;
+        }
+        if (step % 1000 == 0)
+        {
+            check(holds(lru, model), "entries at step " + std::to_string(step));
+        }
+    }
+    check(holds(lru, model), "entries after the changes");
+
+    //a single entry over the byte limit stays, the next one replaces it
+    lru.set_capacity(0, model.nodeBytes + 10);
+    model.trim(0, model.nodeBytes + 10);
+    lru.assign(-1, std::string(100, 'x'));
+    model.assign(-1, std::string(100, 'x'));
+    model.trim(0, model.nodeBytes + 10);
+    check(lru.size() == 1 && lru.peek(-1) != 0 && holds(lru, model), "oversized newest entry stays");
+    lru.assign(-2, "y");
+    model.assign(-2, "y");
+    model.trim(0, model.nodeBytes + 10);
+    check(lru.size() == 1 && lru.peek(-2) != 0 && holds(lru, model), "oversized entry evicted by the next");
+
+    lru.reset_stats();
+    lru.clear();
+    cs540::LruStats stats = lru.stats();
+    check(lru.empty() && lru.bytes() == 0 && lru.oldest() == 0 && lru.newest() == 0
+        && stats.hits == 0 && stats.misses == 0 && stats.evictions == 0, "clear");
+    lru.assign(1, "one");
+    check(lru.find(1) != 0 && lru.oldest() == lru.newest(), "entries after clear");
+
+    if (failures == 0)
+    {
+        std::printf("lru_map_test: ok\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,164 @@
+//moves entries between cs540::Map instances with extract() and
+//insert(node_type &&): the node itself moves, its key can be changed on
+//the way, a key that is already there hands the node back, and a handle
+//that is dropped frees its node.
+//
+//  node_handle_test
+
+#include "Map.hpp"
+
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool ok, const std::string & what)
+    {
+        if (!ok)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            ++failures;
+        }
+    }
+
+    template<class Balance, bool Lazy>
+    struct TestPolicy : DefaultTreePolicy
+    {
+        using balance = Balance;
+        static constexpr double lazy_erase_ratio = Lazy ? 0.25 : 0.0;
+    };
+
+    //long enough to live on the heap, a node freed twice or leaked shows
+    //up under a sanitizer
+    std::string value_of(int key)
+    {
+        return "the value stored under key " + std::to_string(key);
+    }
+
+    template<class M>
+    bool holds(const M & map, const std::map<int, std::string> & model)
+    {
+        if (map.size() != model.size() || !map.validate())
+        {
+            return false;
+        }
+        std::map<int, std::string>::const_iterator expected = model.begin();
+        for (typename M::ConstIterator it = map.begin(); it != map.end(); ++it, ++expected)
+        {
+            if (it->first != expected->first || it->second != expected->second)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template<class Policy>
+    void run(const std::string & name)
+    {
+        typedef cs540::Map<int, std::string, Policy> M;
+        typedef typename M::node_type Handle;
+        M from, to;
+        std::map<int, std::string> fromModel, toModel;
+        for (int i = 0; i < 2000; ++i)
+        {
+            from.insert(std::make_pair(i, value_of(i)));
+            fromModel[i] = value_of(i);
+        }
+
+        //the node keeps its address from one map to the other
+        typename M::Iterator source = from.find(10);
+        const std::string * address = &source->second;
+        Handle handle = from.extract(source);
+        check(!handle.empty() && handle && handle.key() == 10 && handle.mapped() == value_of(10), name + ": extract by position");
+        typename M::insert_return_type result = to.insert(std::move(handle));
+        check(result.inserted && result.node.empty() && handle.empty(), name + ": insert of a handle");
+        check(result.position->first == 10 && &result.position->second == address, name + ": the node moved, not a copy");
+        fromModel.erase(10);
+        toModel[10] = value_of(10);
+
+        //random moves both ways, some with a new key
+        std::mt19937 rng(3);
+        for (int step = 0; step < 6000; ++step)
+        {
+            bool forward = rng() % 2 == 0;
+            M & a = forward ? from : to;
+            M & b = forward ? to : from;
+            std::map<int, std::string> & aModel = forward ? fromModel : toModel;
+            std::map<int, std::string> & bModel = forward ? toModel : fromModel;
+            int key = int(rng() % 2500);
+            Handle taken = a.extract(key);
+            check(taken.empty() == (aModel.count(key) == 0), name + ": extract by key");
+            if (taken.empty())
+            {
+                continue;
+            }
+            std::string value = aModel[key];
+            aModel.erase(key);
+            if (rng() % 4 == 0)
+            {
+                taken.key() = int(rng() % 2500);
+            }
+            int newKey = taken.key();
+            typename M::insert_return_type put = b.insert(std::move(taken));
+            if (bModel.count(newKey) != 0)
+            {
+                //the handle comes back and frees the node when it goes
+                check(!put.inserted && !put.node.empty() && put.node.key() == newKey && put.node.mapped() == value,
+                    name + ": a key already there hands the node back");
+                check(put.position->first == newKey && put.position->second == bModel[newKey], name + ": position of the old entry");
+            }
+            else
+            {
+                check(put.inserted && put.node.empty() && put.position->first == newKey, name + ": insert of a moved node");
+                bModel[newKey] = value;
+            }
+        }
+        check(holds(from, fromModel), name + ": source map after the moves");
+        check(holds(to, toModel), name + ": target map after the moves");
+
+        //empty handles
+        Handle none = from.extract(-1);
+        check(none.empty(), name + ": extract of a missing key");
+        typename M::insert_return_type nothing = from.insert(std::move(none));
+        check(!nothing.inserted && nothing.position == from.end(), name + ": insert of an empty handle");
+
+        //an erased key, dead under lazy erase, takes the node's value
+        int reused = fromModel.begin()->first;
+        from.erase(reused);
+        Handle back = to.extract(toModel.begin()->first);
+        std::string value = back.mapped();
+        toModel.erase(back.key());
+        back.key() = reused;
+        check(from.insert(std::move(back)).inserted && from.find(reused)->second == value, name + ": insert over an erased key");
+        fromModel[reused] = value;
+        check(holds(from, fromModel) && holds(to, toModel), name + ": maps at the end");
+
+        //swapped and moved handles own one node each
+        Handle first = from.extract(from.begin());
+        Handle second = to.extract(to.begin());
+        int firstKey = first.key();
+        first.swap(second);
+        check(second.key() == firstKey, name + ": swapped handles");
+        Handle third = std::move(first);
+        check(first.empty() && !third.empty(), name + ": moved handle");
+    }
+}
+
+int main()
+{
+    run<TestPolicy<AvlBalance, false>>("avl");
+    run<TestPolicy<RedBlackBalance, false>>("red-black");
+    run<TestPolicy<TreapBalance, false>>("treap");
+    run<TestPolicy<AvlBalance, true>>("avl lazy erase");
+    if (failures == 0)
+    {
+        std::printf("node_handle_test: ok\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
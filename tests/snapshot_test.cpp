@@ -0,0 +1,332 @@
+//saves cs540::Map snapshots and loads them back under several policies,
+//refuses files that are cut short, damaged, out of key order or of other
+//types without losing the old contents, and searches raw snapshots in
+//place with cs540::MappedMap.
+//
+//  snapshot_test [PATH]
+//
+//The file at PATH is removed before and after each case.
+
+#include "Map.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool ok, const std::string & what)
+    {
+        if (!ok)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            ++failures;
+        }
+    }
+
+    struct IndexPolicy : DefaultTreePolicy
+    {
+        using storage = IndexStorage;
+    };
+
+    struct InlinePolicy : DefaultTreePolicy
+    {
+        static constexpr std::size_t inline_capacity = 8;
+    };
+
+    struct LazyPolicy : DefaultTreePolicy
+    {
+        static constexpr double lazy_erase_ratio = 0.25;
+    };
+
+    struct RedBlackPolicy : DefaultTreePolicy
+    {
+        using balance = RedBlackBalance;
+    };
+
+    std::vector<char> read_file(const std::string & path)
+    {
+        std::vector<char> bytes;
+        if (std::FILE * file = std::fopen(path.c_str(), "rb"))
+        {
+            char buffer[4096];
+            std::size_t n;
+            while ((n = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+            {
+                bytes.insert(bytes.end(), buffer, buffer + n);
+            }
+            std::fclose(file);
+        }
+        return bytes;
+    }
+
+    void write_file(const std::string & path, const std::vector<char> & bytes)
+    {
+        std::FILE * file = std::fopen(path.c_str(), "wb");
+        std::fwrite(bytes.data(), 1, bytes.size(), file);
+        std::fclose(file);
+    }
+
+    template<class M, class Model>
+    bool holds(const M & map, const Model & model)
+    {
+        if (map.size() != model.size() || !map.validate())
+        {
+            return false;
+        }
+        typename Model::const_iterator expected = model.begin();
+        for (typename M::ConstIterator it = map.begin(); it != map.end(); ++it, ++expected)
+        {
+            if (it->first != expected->first || it->second != expected->second)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //the load has to throw and leave the map as it was
+    template<class M, class Model>
+    void refused(const std::string & path, M & map, const Model & model, const std::string & what)
+    {
+        try
+        {
+            map.load(path);
+            check(false, what + ": loaded");
+        }
+        catch (const std::exception &)
+        {
+            check(holds(map, model), what + ": old contents kept");
+        }
+    }
+
+    //load builds the tree bottom up, it has to come out balanced and
+    //threaded whatever the size, with dead nodes in the saved map or not
+    template<class Policy>
+    void round_trip(const std::string & path, const std::string & name)
+    {
+        const std::size_t sizes[] = { 0, 1, 5, 8, 9, 1000, 100000 };
+        for (std::size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+        {
+            std::string what = name + ", " + std::to_string(sizes[s]) + " entries";
+            std::mt19937 rng(unsigned(sizes[s]));
+            cs540::Map<int, int, Policy> saved;
+            std::map<int, int> model;
+            for (std::size_t i = 0; i < sizes[s]; ++i)
+            {
+                int key = int(rng() % (4 * sizes[s] + 1));
+                saved[key] = int(i);
+                model[key] = int(i);
+            }
+            for (std::size_t i = 0; i < sizes[s] / 10; ++i)
+            {
+                int key = int(rng() % (4 * sizes[s] + 1));
+                saved.erase(key);
+                model.erase(key);
+            }
+
+            std::remove(path.c_str());
+            saved.save(path);
+            cs540::Map<int, int, Policy> loaded;
+            loaded[-1] = -1;
+            loaded.load(path);
+            check(holds(loaded, model), what + ": loaded entries");
+            check(loaded.shape().height <= std::size_t(2 * std::log2(double(model.size()) + 1)) + 2, what + ": height");
+
+            //the loaded tree takes changes like any other
+            for (int i = 0; i < 200; ++i)
+            {
+                loaded[i * 7] = i;
+                model[i * 7] = i;
+                loaded.erase(i * 11);
+                model.erase(i * 11);
+            }
+            check(holds(loaded, model), what + ": changes after the load");
+            typename cs540::Map<int, int, Policy>::ConstIterator last = loaded.end();
+            check(model.empty() || (--last)->first == model.rbegin()->first, what + ": backwards from end()");
+        }
+    }
+
+    //keys and values written by a Serializer instead of as bytes
+    void strings(const std::string & path)
+    {
+        std::remove(path.c_str());
+        cs540::Map<std::string, std::string> saved;
+        std::map<std::string, std::string> model;
+        for (int i = 0; i < 3000; ++i)
+        {
+            std::string key = "key " + std::to_string(i * 37 % 3001);
+            std::string value = std::string(std::size_t(i % 50), 'v') + std::to_string(i);
+            saved[key] = value;
+            model[key] = value;
+        }
+        saved[""] = "";
+        model[""] = "";
+        saved.save(path);
+
+        cs540::Map<std::string, std::string> loaded;
+        loaded.load(path);
+        check(holds(loaded, model), "strings: loaded entries");
+
+        //a string length past the end of the file
+        std::vector<char> bytes = read_file(path);
+        std::vector<char> cut(bytes.begin(), bytes.begin() + bytes.size() / 2);
+        write_file(path, cut);
+        refused(path, loaded, model, "strings cut in half");
+    }
+
+    void damaged(const std::string & path)
+    {
+        std::remove(path.c_str());
+        cs540::Map<int, int> saved, kept;
+        std::map<int, int> model;
+        for (int i = 0; i < 1000; ++i)
+        {
+            saved[i] = i * i;
+            kept[i] = i;
+            model[i] = i;
+        }
+        saved.save(path);
+        std::vector<char> good = read_file(path);
+
+        refused(path + ".missing", kept, model, "missing file");
+
+        std::vector<char> bytes(good.begin(), good.end() - 1);
+        write_file(path, bytes);
+        refused(path, kept, model, "file one byte short");
+
+        bytes = good;
+        bytes[sizeof(SnapshotHeader) + 100] ^= 1;
+        write_file(path, bytes);
+        refused(path, kept, model, "flipped bit in an entry");
+
+        bytes = good;
+        bytes[0] ^= 1;
+        write_file(path, bytes);
+        refused(path, kept, model, "flipped bit in the magic");
+
+        //two entries swapped, the checksum is not what stops it
+        bytes = good;
+        typedef MappedEntry<int, int> Entry;
+        Entry * entries = reinterpret_cast<Entry *>(&bytes[sizeof(SnapshotHeader)]);
+        std::swap(entries[10], entries[20]);
+        write_file(path, bytes);
+        refused(path, kept, model, "entries out of key order");
+
+        write_file(path, good);
+        cs540::Map<int, double> other;
+        std::map<int, double> none;
+        refused(path, other, none, "snapshot of other types");
+        std::remove(path.c_str());
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    void mapped(const std::string & path)
+    {
+        std::remove(path.c_str());
+        typedef cs540::MappedMap<std::uint64_t, double> Mapped;
+        cs540::Map<std::uint64_t, double> saved;
+        std::map<std::uint64_t, double> model;
+        for (std::uint64_t i = 0; i < 50000; ++i)
+        {
+            std::uint64_t key = i * 2654435761u % 1000003;
+            saved[key] = double(i) / 4;
+            model[key] = double(i) / 4;
+        }
+        saved.save(path);
+
+        Mapped view(path, true);
+        check(view.size() == model.size() && !view.empty(), "mapped: size");
+        bool same = true;
+        std::map<std::uint64_t, double>::const_iterator expected = model.begin();
+        for (Mapped::const_iterator it = view.begin(); it != view.end(); ++it, ++expected)
+        {
+            same = same && it->first == expected->first && it->second == expected->second;
+        }
+        check(same, "mapped: entries in key order");
+
+        std::size_t wrong = 0;
+        for (std::uint64_t key = 0; key < 20000; ++key)
+        {
+            Mapped::const_iterator found = view.find(key);
+            std::map<std::uint64_t, double>::const_iterator there = model.find(key);
+            wrong += there == model.end() ? found != view.end() : found == view.end() || found->second != there->second;
+        }
+        check(wrong == 0, "mapped: find, " + std::to_string(wrong) + " wrong");
+        check(view.at(model.begin()->first) == model.begin()->second, "mapped: at");
+        try
+        {
+            view.at(1000004);
+            check(false, "mapped: at of a missing key");
+        }
+        catch (const std::out_of_range &)
+        {
+            //expected
+        }
+
+        //the view keeps working when it is moved
+        Mapped moved(std::move(view));
+        check(view.size() == 0 && moved.size() == model.size(), "mapped: moved");
+        Mapped assigned(path);
+        assigned = std::move(moved);
+        check(assigned.find(model.rbegin()->first) != assigned.end(), "mapped: move assigned");
+
+        //an empty map is a valid snapshot
+        cs540::Map<std::uint64_t, double>().save(path + ".empty");
+        Mapped empty(path + ".empty", true);
+        check(empty.empty() && empty.begin() == empty.end() && empty.find(1) == empty.end(), "mapped: empty snapshot");
+        std::remove((path + ".empty").c_str());
+
+        //damage is found by verify, other types always
+        std::vector<char> bytes = read_file(path);
+        bytes[sizeof(SnapshotHeader) + 3] ^= 1;
+        write_file(path, bytes);
+        try
+        {
+            Mapped checked(path, true);
+            check(false, "mapped: damaged file verified");
+        }
+        catch (const std::runtime_error &)
+        {
+            //expected
+        }
+        try
+        {
+            cs540::MappedMap<std::uint32_t, double> other(path);
+            check(false, "mapped: snapshot of other types opened");
+        }
+        catch (const std::runtime_error &)
+        {
+            //expected
+        }
+        std::remove(path.c_str());
+    }
+#endif
+}
+
+int main(int argc, char ** argv)
+{
+    std::string path = argc > 1 ? argv[1] : "snapshot_test.snap";
+    round_trip<DefaultTreePolicy>(path, "default");
+    round_trip<IndexPolicy>(path, "index storage");
+    round_trip<InlinePolicy>(path, "inline");
+    round_trip<LazyPolicy>(path, "lazy erase");
+    round_trip<RedBlackPolicy>(path, "red-black");
+    strings(path);
+    damaged(path);
+#if defined(__unix__) || defined(__APPLE__)
+    mapped(path);
+#endif
+    std::remove(path.c_str());
+    if (failures == 0)
+    {
+        std::printf("snapshot_test: ok\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+//every balancing policy, with both storages, fed a large run of sorted
+//keys in either direction: the tree has to stay valid and logarithmic,
+//and purging dead nodes and destroying the tree must cope with its height.
+//
+//  sorted_input_test [N]
+
+#include "Map.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace
+{
+    int failures = 0;
+
+    void check(bool ok, const std::string & what)
+    {
+        if (!ok)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            ++failures;
+        }
+    }
+
+    template<class Balance, class Storage>
+    struct TestPolicy : DefaultTreePolicy
+    {
+        using balance = Balance;
+        using storage = Storage;
+    };
+
+    template<class Balance, class Storage>
+    struct LazyPolicy : TestPolicy<Balance, Storage>
+    {
+        static constexpr double lazy_erase_ratio = 0.25;
+    };
+
+    //red-black is at most 2 log n deep, a treap a small multiple of it
+    //with overwhelming probability
+    std::size_t height_bound(std::size_t n)
+    {
+        return std::size_t(4 * std::log2(double(n) + 1)) + 8;
+    }
+
+    template<class Policy>
+    void run(const std::string & name, std::size_t n, bool descending)
+    {
+        std::string what = name + (descending ? " descending" : " ascending");
+        {
+            cs540::Map<int, int, Policy> m;
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                int key = int(descending ? n - 1 - i : i);
+                m.insert(std::make_pair(key, key));
+            }
+            check(m.size() == n, what + ": size");
+            check(m.validate(), what + ": validate");
+            check(m.shape().height <= height_bound(n), what + ": height " + std::to_string(m.shape().height));
+            //the destructor walks the whole tree
+        }
+
+        //erase three keys in four, lazily, so the tree is rebuilt
+        //without its dead nodes along the way
+        cs540::Map<int, int, LazyPolicy<typename Policy::balance, typename Policy::storage> > lazy;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            int key = int(descending ? n - 1 - i : i);
+            lazy.insert(std::make_pair(key, key));
+        }
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            if (i % 4 != 0)
+            {
+                lazy.erase(int(i));
+            }
+        }
+        check(lazy.size() == (n + 3) / 4, what + ": lazy size");
+        check(lazy.validate(), what + ": lazy validate");
+        lazy.clear();
+        check(lazy.size() == 0 && lazy.validate(), what + ": clear");
+    }
+
+    template<class Balance>
+    void run_storages(const std::string & name, std::size_t n)
+    {
+        for (int descending = 0; descending < 2; ++descending)
+        {
+            run<TestPolicy<Balance, PointerStorage> >(name + " pointer", n, descending != 0);
+            run<TestPolicy<Balance, IndexStorage> >(name + " index", n, descending != 0);
+        }
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    std::size_t n = argc > 1 ? std::strtoul(argv[1], 0, 10) : 1000000;
+    run_storages<AvlBalance>("avl", n);
+    run_storages<RedBlackBalance>("rb", n);
+    run_storages<WavlBalance>("wavl", n);
+    run_storages<TreapBalance>("treap", n);
+    if (failures == 0)
+    {
+        std::printf("sorted_input_test: ok\n");
+    }
+    return failures == 0 ? 0 : 1;
+}